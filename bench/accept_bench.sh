@@ -0,0 +1,31 @@
+#!/bin/sh
+# Bão kết nối lại: 1000 client cùng đăng nhập, với backlog cũ (5) và backlog mặc định.
+# Usage: bench/accept_bench.sh [build_dir]
+BINDIR=$(cd "${1:-build}" && pwd)
+RUNDIR=$(mktemp -d)
+PORT=18280
+CLIENTS=1000
+
+mkdir -p "$RUNDIR/data" "$RUNDIR/conversation" "$RUNDIR/node"
+: > "$RUNDIR/data/user.txt"
+i=0
+while [ $i -lt $CLIENTS ]; do
+    echo "storm$i:1234" >> "$RUNDIR/data/user.txt"
+    i=$((i + 1))
+done
+echo "stormgroup:Storm:storm0" > "$RUNDIR/data/group.txt"
+
+for BACKLOG in 5 4096; do
+    echo "--- backlog $BACKLOG ---"
+    (cd "$RUNDIR/node" && exec "$BINDIR/socket_server_storm" -p "$PORT" -b "$BACKLOG" > /dev/null 2>&1) &
+    PID=$!
+    sleep 1
+
+    "$BINDIR/bench_accept" -p "$PORT" -n "$CLIENTS" -r 3
+
+    kill $PID 2>/dev/null
+    wait $PID 2>/dev/null
+    sleep 1
+done
+
+rm -rf "$RUNDIR"
@@ -0,0 +1,164 @@
+// Bão kết nối lại: N client cùng connect + đăng nhập một lúc (như sau khi server restart).
+// Client bị từ chối/reset thì kết nối lại ngay. Đo thời gian tới khi từng client nhận được
+// "Login successful" và thời gian hồi phục (tới client cuối cùng), qua nhiều vòng.
+// SYN bị drop khi hàng đợi listen đầy thể hiện thành độ trễ ~1s, 3s... do retransmit.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define ROUND_TIMEOUT_SEC 30
+
+typedef enum { ST_CONNECTING, ST_LOGIN, ST_DONE } StormState;
+
+typedef struct {
+    int sock;
+    StormState state;
+} StormClient;
+
+static int port = 8080;
+static int client_count = 1000;
+static int rounds = 3;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int start_connect(StormClient *c) {
+    c->sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->sock < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (connect(c->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(c->sock);
+        c->sock = -1;
+        return -1;
+    }
+    c->state = ST_CONNECTING;
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_round(int round, StormClient *clients, struct pollfd *pfds, double *latency) {
+    int retries = 0, done = 0;
+    double start = now_sec();
+    for (int i = 0; i < client_count; i++) {
+        while (start_connect(&clients[i]) < 0) {
+            retries++;
+        }
+    }
+
+    while (done < client_count && now_sec() - start < ROUND_TIMEOUT_SEC) {
+        int n = 0;
+        for (int i = 0; i < client_count; i++) {
+            if (clients[i].state == ST_DONE) continue;
+            pfds[n].fd = clients[i].sock;
+            pfds[n].events = clients[i].state == ST_CONNECTING ? POLLOUT : POLLIN;
+            pfds[n].revents = 0;
+            n++;
+        }
+        if (poll(pfds, n, 100) <= 0) continue;
+
+        // pfds được dựng theo đúng thứ tự các client chưa xong
+        int k = 0;
+        for (int i = 0; i < client_count; i++) {
+            StormClient *c = &clients[i];
+            if (c->state == ST_DONE) continue;
+            short revents = pfds[k++].revents;
+            if (!revents) continue;
+
+            int failed = 0;
+            if (c->state == ST_CONNECTING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->sock, SOL_SOCKET, SO_ERROR, &err, &len);
+                char creds[64];
+                int creds_len = snprintf(creds, sizeof(creds), "storm%d:1234", i);
+                if (err != 0 || send(c->sock, creds, creds_len, MSG_NOSIGNAL) != creds_len) {
+                    failed = 1;
+                } else {
+                    c->state = ST_LOGIN;
+                }
+            } else {
+                char reply[4096];
+                int len = recv(c->sock, reply, sizeof(reply) - 1, 0);
+                if (len <= 0) {
+                    failed = 1;
+                } else {
+                    reply[len] = '\0';
+                    if (strstr(reply, "Login successful")) {
+                        latency[done++] = now_sec() - start;
+                        c->state = ST_DONE;
+                    } else {
+                        failed = 1;
+                    }
+                }
+            }
+            if (failed) {
+                // Kết nối lại ngay như một client thật
+                close(c->sock);
+                retries++;
+                while (start_connect(c) < 0) {
+                    retries++;
+                }
+            }
+        }
+    }
+
+    qsort(latency, done, sizeof(double), compare_double);
+    printf("round %d: logged_in=%d/%d retries=%d p50=%.3fs p99=%.3fs recovery=%.3fs\n", round, done,
+           client_count, retries, done ? latency[done / 2] : 0, done ? latency[(int)(done * 0.99)] : 0,
+           done ? latency[done - 1] : 0);
+    fflush(stdout);
+
+    for (int i = 0; i < client_count; i++) {
+        close(clients[i].sock);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:r:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'n': client_count = atoi(optarg); break;
+        case 'r': rounds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-n clients] [-r rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    StormClient *clients = calloc(client_count, sizeof(StormClient));
+    struct pollfd *pfds = calloc(client_count, sizeof(struct pollfd));
+    double *latency = calloc(client_count, sizeof(double));
+    if (!clients || !pfds || !latency) {
+        perror("calloc");
+        return 1;
+    }
+    for (int r = 1; r <= rounds; r++) {
+        run_round(r, clients, pfds, latency);
+        sleep(1);  // Để server dọn các phiên vừa đóng
+    }
+    free(clients);
+    free(pfds);
+    free(latency);
+    return 0;
+}
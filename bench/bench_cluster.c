@@ -0,0 +1,147 @@
+// Load generator cho cụm nhiều node
+// Mỗi client đăng nhập vào một node (xoay vòng theo danh sách port) và gửi PM
+// cho client kế tiếp, nằm ở node khác khi cụm có nhiều hơn một node.
+// Kết quả là tổng throughput (tin nhắn được giao/giây) của toàn cụm.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#define MAX_BENCH_CLIENTS 90
+#define MAX_BENCH_PORTS 16
+
+typedef struct {
+    int sock;
+    int index;
+    long received;
+} BenchClient;
+
+static BenchClient bench_clients[MAX_BENCH_CLIENTS];
+static int client_count = 32;
+static int msgs_per_client = 2000;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int connect_and_login(int port, int index) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    char creds[64], reply[2048];
+    snprintf(creds, sizeof(creds), "bench%d:1234", index);
+    send(sock, creds, strlen(creds), 0);
+    int len = recv(sock, reply, sizeof(reply) - 1, 0);
+    if (len <= 0) {
+        fprintf(stderr, "login failed for bench%d\n", index);
+        exit(1);
+    }
+    reply[len] = '\0';
+    if (!strstr(reply, "Login successful")) {
+        fprintf(stderr, "login failed for bench%d: %s\n", index, reply);
+        exit(1);
+    }
+    return sock;
+}
+
+// Đếm số PM nhận được (mỗi PM kết thúc bằng '\n')
+static void *reader_thread(void *arg) {
+    BenchClient *c = (BenchClient *)arg;
+    char buffer[65536];
+    int in_pm = 0;
+    while (1) {
+        int len = recv(c->sock, buffer, sizeof(buffer), 0);
+        if (len <= 0) break;
+        for (int i = 0; i < len; i++) {
+            if (!in_pm && buffer[i] == '[') {
+                in_pm = 1;
+            } else if (buffer[i] == '\n') {
+                if (in_pm) __atomic_add_fetch(&c->received, 1, __ATOMIC_RELAXED);
+                in_pm = 0;
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int ports[MAX_BENCH_PORTS];
+    int port_count = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:m:P:")) != -1) {
+        switch (opt) {
+        case 'c': client_count = atoi(optarg); break;
+        case 'm': msgs_per_client = atoi(optarg); break;
+        case 'P': {
+            char *saveptr = NULL;
+            for (char *tok = strtok_r(optarg, ",", &saveptr); tok && port_count < MAX_BENCH_PORTS;
+                 tok = strtok_r(NULL, ",", &saveptr)) {
+                ports[port_count++] = atoi(tok);
+            }
+            break;
+        }
+        default:
+            fprintf(stderr, "Usage: %s [-c clients] [-m msgs_per_client] -P port1,port2,...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (port_count == 0) {
+        ports[port_count++] = 8080;
+    }
+    if (client_count < 2 || client_count > MAX_BENCH_CLIENTS) {
+        fprintf(stderr, "clients must be in [2, %d]\n", MAX_BENCH_CLIENTS);
+        return 1;
+    }
+
+    pthread_t readers[MAX_BENCH_CLIENTS];
+    for (int i = 0; i < client_count; i++) {
+        bench_clients[i].index = i;
+        bench_clients[i].sock = connect_and_login(ports[i % port_count], i);
+    }
+    // Chờ presence lan ra toàn cụm
+    sleep(1);
+    for (int i = 0; i < client_count; i++) {
+        pthread_create(&readers[i], NULL, reader_thread, &bench_clients[i]);
+    }
+
+    double start = now_sec();
+    char line[128];
+    for (int m = 0; m < msgs_per_client; m++) {
+        for (int i = 0; i < client_count; i++) {
+            int len = snprintf(line, sizeof(line), "/bench%d msg %d\n", (i + 1) % client_count, m);
+            send(bench_clients[i].sock, line, len, 0);
+        }
+    }
+
+    long expected = (long)client_count * msgs_per_client;
+    long total = 0;
+    double deadline = now_sec() + 60;
+    while (now_sec() < deadline) {
+        total = 0;
+        for (int i = 0; i < client_count; i++) {
+            total += __atomic_load_n(&bench_clients[i].received, __ATOMIC_RELAXED);
+        }
+        if (total >= expected) break;
+        usleep(1000);
+    }
+    double elapsed = now_sec() - start;
+
+    printf("nodes=%d clients=%d delivered=%ld/%ld elapsed=%.3fs throughput=%.0f msg/s\n",
+           port_count, client_count, total, expected, elapsed, total / elapsed);
+    for (int i = 0; i < client_count; i++) {
+        close(bench_clients[i].sock);
+    }
+    return total >= expected ? 0 : 1;
+}
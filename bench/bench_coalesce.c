@@ -0,0 +1,263 @@
+// Thông lượng và độ trễ của tin nhắn group khi bật/tắt cửa sổ gom (socket_server -W).
+// Một group có N thành viên cùng đăng nhập; S người nói gửi tin mang thời điểm gửi
+// với tổng tốc độ cố định, mỗi pha một tốc độ. Thread đọc poll tất cả thành viên và
+// ghi độ trễ của từng bản sao nhận được. Mỗi pha in: số bản sao giao được mỗi giây,
+// p50/p99 độ trễ và số tin trung bình mỗi lần ghi của server (từ /stats).
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define MAX_MEMBERS 64
+#define MAX_SAMPLES 2000000
+#define MAX_RATES 8
+
+typedef struct {
+    int sock;
+    char line[2048];
+    size_t line_len;
+} Member;
+
+static int port = 8080;
+static int member_count = 50;
+static int speaker_count = 4;
+static int phase_ms = 2000;
+static int window_us = 0;             // Chỉ để ghi vào CSV
+static const char *csv_path = NULL;
+static int rates[MAX_RATES] = {200, 2000, 10000};
+static int rate_count = 3;
+
+static Member members[MAX_MEMBERS];
+static double *samples;
+static int sample_count = 0;
+static volatile int reading = 1;
+static pthread_mutex_t sample_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_and_login(const char *user) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char creds[64], reply[4096];
+    snprintf(creds, sizeof(creds), "%s:1234", user);
+    send(sock, creds, strlen(creds), 0);
+    int len = recv(sock, reply, sizeof(reply) - 1, 0);
+    if (len <= 0 || (reply[len] = '\0', !strstr(reply, "Login successful"))) {
+        fprintf(stderr, "login failed for %s\n", user);
+        exit(1);
+    }
+    return sock;
+}
+
+// Tách dòng và ghi độ trễ của mỗi tin "[cN@cgroup]: <t_us>"
+static void consume(Member *m, const char *data, int len) {
+    for (int i = 0; i < len; i++) {
+        if (data[i] != '\n') {
+            if (m->line_len < sizeof(m->line) - 1) m->line[m->line_len++] = data[i];
+            continue;
+        }
+        m->line[m->line_len] = '\0';
+        m->line_len = 0;
+        const char *colon = strstr(m->line, "@cgroup]: ");
+        if (colon) {
+            double latency = now_us() - atof(colon + 10);
+            pthread_mutex_lock(&sample_mutex);
+            if (sample_count < MAX_SAMPLES) samples[sample_count++] = latency;
+            pthread_mutex_unlock(&sample_mutex);
+        }
+    }
+}
+
+static void *reader_thread(void *arg) {
+    (void)arg;
+    struct pollfd pfds[MAX_MEMBERS];
+    for (int i = 0; i < member_count; i++) {
+        pfds[i].fd = members[i].sock;
+        pfds[i].events = POLLIN;
+    }
+    char buffer[65536];
+    while (reading) {
+        if (poll(pfds, member_count, 100) <= 0) continue;
+        for (int i = 0; i < member_count; i++) {
+            if (!(pfds[i].revents & POLLIN)) continue;
+            int len = recv(pfds[i].fd, buffer, sizeof(buffer), 0);
+            if (len > 0) consume(&members[i], buffer, len);
+        }
+    }
+    return NULL;
+}
+
+// Đọc các bộ đếm gom của server qua /stats
+static void read_coalesce_stats(int sock, long *writes, long *items) {
+    char reply[8192];
+    size_t total = 0;
+    *writes = *items = 0;
+    if (send(sock, "/stats\n", 7, MSG_NOSIGNAL) != 7) {
+        perror("send /stats");
+        return;
+    }
+    while (total < sizeof(reply) - 1) {
+        int len = recv(sock, reply + total, sizeof(reply) - 1 - total, 0);
+        if (len <= 0) break;
+        total += len;
+        reply[total] = '\0';
+        const char *w = strstr(reply, "coalesce_writes ");
+        const char *it = strstr(reply, "coalesce_items ");
+        if (w && it && strchr(it, '\n')) {
+            *writes = atol(w + 16);
+            *items = atol(it + 15);
+            break;
+        }
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_phase(int rate, int stat_sock, FILE *csv) {
+    pthread_mutex_lock(&sample_mutex);
+    sample_count = 0;
+    pthread_mutex_unlock(&sample_mutex);
+    long writes_before, items_before;
+    read_coalesce_stats(stat_sock, &writes_before, &items_before);
+
+    // Người nói lần lượt gửi theo lịch cố định (open loop), không chờ phản hồi
+    double start = now_us();
+    double interval = 1e6 / rate;
+    long sent = 0;
+    char msg[64];
+    while (now_us() - start < phase_ms * 1000.0) {
+        double due = start + sent * interval;
+        double wait = due - now_us();
+        if (wait > 0) usleep((useconds_t)wait);
+        int len = snprintf(msg, sizeof(msg), "/cgroup %.0f\n", now_us());
+        if (send(members[sent % speaker_count].sock, msg, len, MSG_NOSIGNAL) != len) {
+            perror("send");
+            break;
+        }
+        sent++;
+    }
+    double elapsed = (now_us() - start) / 1e6;
+    usleep(500000);  // Chờ các tin cuối
+
+    long writes_after, items_after;
+    read_coalesce_stats(stat_sock, &writes_after, &items_after);
+    long writes = writes_after - writes_before;
+    long items = items_after - items_before;
+
+    pthread_mutex_lock(&sample_mutex);
+    int n = sample_count;
+    qsort(samples, n, sizeof(double), compare_double);
+    double p50 = n ? samples[n / 2] / 1000 : 0;
+    double p99 = n ? samples[(int)(n * 0.99)] / 1000 : 0;
+    pthread_mutex_unlock(&sample_mutex);
+
+    double delivered = n / elapsed;
+    double per_write = writes > 0 ? (double)items / writes : 0;
+    printf("window=%-5dus rate=%-6d delivered=%.0f/s p50=%.2fms p99=%.2fms items_per_write=%.2f\n",
+           window_us, rate, delivered, p50, p99, per_write);
+    fflush(stdout);
+    if (csv) {
+        fprintf(csv, "%d,%d,%.0f,%.3f,%.3f,%.2f\n", window_us, rate, delivered, p50, p99, per_write);
+    }
+}
+
+static int parse_rates(const char *list) {
+    rate_count = 0;
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", list);
+    for (char *tok = strtok(copy, ","); tok && rate_count < MAX_RATES; tok = strtok(NULL, ",")) {
+        if ((rates[rate_count] = atoi(tok)) <= 0) return -1;
+        rate_count++;
+    }
+    return rate_count > 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:s:t:R:w:o:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'n': member_count = atoi(optarg); break;
+        case 's': speaker_count = atoi(optarg); break;
+        case 't': phase_ms = atoi(optarg); break;
+        case 'R':
+            if (parse_rates(optarg) < 0) {
+                fprintf(stderr, "Invalid rate list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'w': window_us = atoi(optarg); break;
+        case 'o': csv_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-n members] [-s speakers] [-t phase_ms]\n"
+                            "          [-R rate1,rate2,...] [-w window_us_label] [-o out.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (member_count < 1 || member_count > MAX_MEMBERS || speaker_count < 1 || speaker_count > member_count) {
+        fprintf(stderr, "Invalid member/speaker count\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    samples = malloc(sizeof(double) * MAX_SAMPLES);
+    if (!samples) {
+        perror("malloc");
+        return 1;
+    }
+
+    char user[32];
+    for (int i = 0; i < member_count; i++) {
+        snprintf(user, sizeof(user), "c%d", i);
+        members[i].sock = connect_and_login(user);
+    }
+    int stat_sock = connect_and_login("cstat");
+    usleep(200000);
+
+    FILE *csv = NULL;
+    if (csv_path) {
+        csv = fopen(csv_path, "a");
+        if (!csv) {
+            perror("fopen");
+            return 1;
+        }
+    }
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, reader_thread, NULL);
+    for (int r = 0; r < rate_count; r++) {
+        run_phase(rates[r], stat_sock, csv);
+    }
+    reading = 0;
+    pthread_join(tid, NULL);
+
+    if (csv) fclose(csv);
+    for (int i = 0; i < member_count; i++) {
+        close(members[i].sock);
+    }
+    close(stat_sock);
+    free(samples);
+    return 0;
+}
@@ -0,0 +1,207 @@
+// Độ trễ giao tin broadcast tới từng người nhận theo số người nhận và số worker fan-out.
+// Mỗi client giả là một đầu của socketpair (đầu kia do thread đọc theo dõi bằng epoll),
+// nên đo được thời điểm từng người nhận có dữ liệu kể từ lúc gọi deliver_broadcast_local.
+// Mỗi cấu hình chạy nhiều vòng; in median qua các vòng của p50/p99/người nhận cuối cùng:
+//   recipients,workers,p50_us,p99_us,last_us
+// Build với -DMAX_CLIENTS đủ lớn (xem target bench-fanout). Mỗi người nhận dùng 2 fd và có
+// hàng đợi gửi (thread writer) riêng như client đã đăng nhập thật.
+#include "../include/server_utils.h"
+#include "../include/conversation_store.h"
+#include "../include/fanout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#define MAX_CONFIGS 8
+#define EPOLL_BATCH 1024
+
+static int recipient_counts[MAX_CONFIGS] = {1000, 4000, 8000};
+static int recipient_config_count = 3;
+static int worker_counts[MAX_CONFIGS] = {0, 1, 2, 4, 8};
+static int worker_config_count = 5;
+static int rounds = 20;
+
+static int *peer_fds;                 // Đầu đọc của từng client giả
+static double *arrival;               // Thời điểm người nhận i có dữ liệu trong vòng hiện tại
+static int epoll_fd;
+static int arrived = 0;
+static volatile int reading = 1;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *reader_thread(void *arg) {
+    (void)arg;
+    struct epoll_event events[EPOLL_BATCH];
+    char buffer[4096];
+    while (reading) {
+        int n = epoll_wait(epoll_fd, events, EPOLL_BATCH, 100);
+        double now = now_us();
+        for (int e = 0; e < n; e++) {
+            int i = events[e].data.u32;
+            while (read(peer_fds[i], buffer, sizeof(buffer)) > 0) {
+            }
+            arrival[i] = now;
+            __atomic_add_fetch(&arrived, 1, __ATOMIC_RELEASE);
+        }
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int setup_recipients(int n) {
+    peer_fds = malloc(sizeof(int) * n);
+    arrival = malloc(sizeof(double) * n);
+    epoll_fd = epoll_create1(0);
+    if (!peer_fds || !arrival || epoll_fd < 0) {
+        perror("setup");
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+            perror("socketpair (raise ulimit -n?)");
+            return -1;
+        }
+        fcntl(pair[1], F_SETFL, O_NONBLOCK);
+        struct epoll_event ev = {.events = EPOLLIN, .data.u32 = i};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pair[1], &ev);
+        peer_fds[i] = pair[1];
+        snprintf(clients[i].username, sizeof(clients[i].username), "user%d", i);
+        clients[i].socket = pair[0];
+        clients[i].caps = 0;
+        if (outbox_create(pair[0]) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void run_config(int n, int workers, FILE *csv) {
+    if (fanout_start(workers, 0) < 0) {
+        fprintf(stderr, "fanout_start(%d) failed\n", workers);
+        return;
+    }
+    clientCount = n;
+    double *p50 = malloc(sizeof(double) * rounds);
+    double *p99 = malloc(sizeof(double) * rounds);
+    double *last = malloc(sizeof(double) * rounds);
+    double *sorted = malloc(sizeof(double) * n);
+
+    for (int r = 0; r < rounds; r++) {
+        __atomic_store_n(&arrived, 0, __ATOMIC_RELEASE);
+        double start = now_us();
+        deliver_broadcast_local("bench", "fanout latency probe");
+        while (__atomic_load_n(&arrived, __ATOMIC_ACQUIRE) < n) {
+            usleep(100);
+        }
+        for (int i = 0; i < n; i++) {
+            sorted[i] = arrival[i] - start;
+        }
+        qsort(sorted, n, sizeof(double), compare_double);
+        p50[r] = sorted[n / 2];
+        p99[r] = sorted[(int)(n * 0.99)];
+        last[r] = sorted[n - 1];
+    }
+    fanout_stop();
+
+    qsort(p50, rounds, sizeof(double), compare_double);
+    qsort(p99, rounds, sizeof(double), compare_double);
+    qsort(last, rounds, sizeof(double), compare_double);
+    printf("recipients=%-6d workers=%-2d p50=%9.0fus p99=%9.0fus last=%9.0fus\n", n, workers,
+           p50[rounds / 2], p99[rounds / 2], last[rounds / 2]);
+    fflush(stdout);
+    fprintf(csv, "%d,%d,%.0f,%.0f,%.0f\n", n, workers, p50[rounds / 2], p99[rounds / 2], last[rounds / 2]);
+    free(p50);
+    free(p99);
+    free(last);
+    free(sorted);
+}
+
+static int parse_list(char *list, int *out, int min) {
+    int count = 0;
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(list, ",", &saveptr); tok && count < MAX_CONFIGS; tok = strtok_r(NULL, ",", &saveptr)) {
+        int v = atoi(tok);
+        if (v < min) return -1;
+        out[count++] = v;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = "fanout.csv";
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:r:o:")) != -1) {
+        switch (opt) {
+        case 'n': recipient_config_count = parse_list(optarg, recipient_counts, 1); break;
+        case 'w': worker_config_count = parse_list(optarg, worker_counts, 0); break;
+        case 'r': rounds = atoi(optarg); break;
+        case 'o': out_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-n 1000,4000,...] [-w 0,1,2,4,...] [-r rounds] [-o out.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (recipient_config_count <= 0 || worker_config_count <= 0 || rounds < 1) {
+        fprintf(stderr, "Invalid recipient/worker list or rounds\n");
+        return 1;
+    }
+    int max_recipients = 0;
+    for (int i = 0; i < recipient_config_count; i++) {
+        if (recipient_counts[i] > MAX_CLIENTS) {
+            fprintf(stderr, "Recipient count %d exceeds build limit MAX_CLIENTS=%d\n", recipient_counts[i], MAX_CLIENTS);
+            return 1;
+        }
+        if (recipient_counts[i] > max_recipients) max_recipients = recipient_counts[i];
+    }
+
+    // Môi trường tạm cho log và thư mục hội thoại
+    char workdir[] = "/tmp/bench_fanout.XXXXXX";
+    if (!mkdtemp(workdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/server.log", workdir);
+    logFile = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/conversation", workdir);
+    set_conversation_dir(path);
+    if (!logFile || conversation_store_init() < 0 || setup_recipients(max_recipients) < 0) {
+        return 1;
+    }
+    FILE *csv = fopen(out_path, "w");
+    if (!csv) {
+        perror(out_path);
+        return 1;
+    }
+    fprintf(csv, "recipients,workers,p50_us,p99_us,last_us\n");
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, reader_thread, NULL);
+    for (int i = 0; i < recipient_config_count; i++) {
+        for (int w = 0; w < worker_config_count; w++) {
+            run_config(recipient_counts[i], worker_counts[w], csv);
+        }
+    }
+    reading = 0;
+    pthread_join(tid, NULL);
+    fclose(csv);
+    fclose(logFile);
+    printf("CSV: %s\n", out_path);
+    return 0;
+}
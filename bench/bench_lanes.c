@@ -0,0 +1,175 @@
+// Đo độ trễ tin nhắn real-time khi cùng kết nối đang tải lịch sử lớn.
+// bench1 gửi PM mang thời điểm gửi cho bench0 mỗi vài ms; bench0 đọc với tốc độ
+// giới hạn (giả lập đường truyền chậm). Pha 1 chỉ có PM, pha 2 thì bench0 đồng thời
+// liên tục tải lại lịch sử của benchgroup. Kết quả là p50/p99 của từng pha.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define MAX_SAMPLES 100000
+
+static int port = 8080;
+static int history_lines = 20000;
+static int read_rate_kb = 2048;        // Tốc độ đọc của bench0 (KB/s)
+static int phase_ms = 2000;
+static int pm_interval_us = 5000;
+
+static double samples[MAX_SAMPLES];
+static int sample_count = 0;
+static int history_requests = 0;
+static pthread_mutex_t sample_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_and_login(const char *user, int rcvbuf) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char creds[64], reply[4096];
+    snprintf(creds, sizeof(creds), "%s:1234", user);
+    send(sock, creds, strlen(creds), 0);
+    int len = recv(sock, reply, sizeof(reply) - 1, 0);
+    if (len <= 0 || (reply[len] = '\0', !strstr(reply, "Login successful"))) {
+        fprintf(stderr, "login failed for %s\n", user);
+        exit(1);
+    }
+    return sock;
+}
+
+// Đọc có giới hạn tốc độ; ghi độ trễ của mỗi PM "[PM bench1 → bench0]: <t_us>"
+static void *slow_reader(void *arg) {
+    int sock = *(int *)arg;
+    char buffer[4096];
+    char line[2048];
+    size_t line_len = 0;
+    double start = now_us();
+    long total = 0;
+    while (1) {
+        int len = recv(sock, buffer, sizeof(buffer), 0);
+        if (len <= 0) break;
+        total += len;
+        for (int i = 0; i < len; i++) {
+            if (buffer[i] != '\n') {
+                if (line_len < sizeof(line) - 1) line[line_len++] = buffer[i];
+                continue;
+            }
+            line[line_len] = '\0';
+            line_len = 0;
+            const char *pm = strstr(line, "[PM bench1");
+            const char *colon = pm ? strstr(pm, "]: ") : NULL;
+            if (colon) {
+                double sent = atof(colon + 3);
+                pthread_mutex_lock(&sample_mutex);
+                if (sample_count < MAX_SAMPLES) samples[sample_count++] = now_us() - sent;
+                pthread_mutex_unlock(&sample_mutex);
+            }
+        }
+        // Giới hạn tốc độ đọc
+        double due = start + total * 1e6 / (read_rate_kb * 1024.0);
+        double wait = due - now_us();
+        if (wait > 0) usleep((useconds_t)wait);
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_phase(const char *label, int sender, int reader, int with_history) {
+    pthread_mutex_lock(&sample_mutex);
+    sample_count = 0;
+    pthread_mutex_unlock(&sample_mutex);
+    history_requests = 0;
+
+    double end = now_us() + phase_ms * 1000.0;
+    double next_history = 0;
+    char msg[128];
+    while (now_us() < end) {
+        if (with_history && now_us() >= next_history) {
+            // Đủ để luôn có lịch sử đang tải mà không chất đống vô hạn
+            send(reader, "|benchgroup\n", 12, 0);
+            history_requests++;
+            next_history = now_us() + (double)history_lines * 60 / (read_rate_kb * 1024.0) * 1e6;
+        }
+        int len = snprintf(msg, sizeof(msg), "/bench0 %.0f\n", now_us());
+        send(sender, msg, len, 0);
+        usleep(pm_interval_us);
+    }
+    usleep(500000);  // Chờ các PM cuối
+
+    pthread_mutex_lock(&sample_mutex);
+    int n = sample_count;
+    qsort(samples, n, sizeof(double), compare_double);
+    printf("%-16s pm_samples=%d history_requests=%d p50=%.2fms p99=%.2fms max=%.2fms\n", label, n,
+           history_requests, n ? samples[n / 2] / 1000 : 0, n ? samples[(int)(n * 0.99)] / 1000 : 0,
+           n ? samples[n - 1] / 1000 : 0);
+    pthread_mutex_unlock(&sample_mutex);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:r:t:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'l': history_lines = atoi(optarg); break;
+        case 'r': read_rate_kb = atoi(optarg); break;
+        case 't': phase_ms = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-l history_lines] [-r read_kb_per_sec] [-t phase_ms]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int sender = connect_and_login("bench1", 0);
+    int reader = connect_and_login("bench0", 64 * 1024);
+
+    // Tạo lịch sử cho benchgroup
+    char msg[128];
+    for (int i = 0; i < history_lines; i++) {
+        int len = snprintf(msg, sizeof(msg), "/benchgroup history line %d with some padding text\n", i);
+        send(sender, msg, len, 0);
+    }
+    // Bỏ qua các tin nhắn group vừa tạo ở phía bench0 trước khi đo
+    sleep(2);
+    char drain[65536];
+    struct timeval tv = {0, 200000};
+    setsockopt(reader, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while (recv(reader, drain, sizeof(drain), 0) > 0) {
+    }
+    tv.tv_usec = 0;
+    setsockopt(reader, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, slow_reader, &reader);
+    run_phase("realtime_only", sender, reader, 0);
+    run_phase("with_history", sender, reader, 1);
+
+    close(sender);
+    shutdown(reader, SHUT_RDWR);
+    pthread_join(tid, NULL);
+    close(reader);
+    return 0;
+}
@@ -0,0 +1,105 @@
+// Microbenchmark cho bộ phân tích lệnh của server
+// So sánh parse_next_command() (một lần duyệt, không copy) với cách cũ
+// (chuỗi strncmp + strcpy target/msg + 4 lần strcmp từ khóa dành riêng).
+#include "../include/command_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BUFFER_SIZE 1024
+#define ITERATIONS 2000000
+
+static const char *command_mix[] = {
+    "/bob hello there, are you coming to the meeting?",
+    "/group1 deploy finished, please verify staging",
+    "|group2",
+    "/users",
+    "/menu",
+    "just a broadcast message to everyone",
+    "/alice ok",
+    "/groups",
+};
+#define MIX_COUNT (sizeof(command_mix) / sizeof(command_mix[0]))
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Mô phỏng đường xử lý cũ trong client_handler()/handle_send_command()
+static int legacy_parse(const char *buffer) {
+    if (strncmp(buffer, "/exit", 5) == 0) return 1;
+    if (strncmp(buffer, "/menu", 5) == 0) return 2;
+    if (strncmp(buffer, "/users", 6) == 0) return 3;
+    if (strncmp(buffer, "/groups", 7) == 0) return 4;
+    if (buffer[0] == '/') {
+        char target[32] = {0}, msg[BUFFER_SIZE] = {0};
+        const char *space = strchr(buffer + 1, ' ');
+        if (space) {
+            strncpy(target, buffer + 1, space - (buffer + 1));
+            target[space - (buffer + 1)] = '\0';
+            strcpy(msg, space + 1);
+        } else {
+            strcpy(target, buffer + 1);
+        }
+        if (strcmp(target, "menu") == 0 || strcmp(target, "users") == 0 ||
+            strcmp(target, "groups") == 0 || strcmp(target, "exit") == 0) {
+            return 0;
+        }
+        return (int)(strlen(msg) + target[0]);
+    }
+    if (buffer[0] == '|') {
+        char target[32] = {0};
+        size_t n = strnlen(buffer + 1, sizeof(target) - 1);
+        memcpy(target, buffer + 1, n);
+        return target[0];
+    }
+    return 6;
+}
+
+int main(void) {
+    static char templates[MIX_COUNT][BUFFER_SIZE];
+    size_t lengths[MIX_COUNT];
+    for (size_t i = 0; i < MIX_COUNT; i++) {
+        lengths[i] = strlen(command_mix[i]);
+        memcpy(templates[i], command_mix[i], lengths[i] + 1);
+    }
+
+    char work[BUFFER_SIZE];
+    volatile unsigned long sink = 0;
+
+    // Chi phí copy template vào buffer làm việc, để trừ ra khỏi kết quả
+    double t0 = now_ns();
+    for (long i = 0; i < ITERATIONS; i++) {
+        size_t k = i % MIX_COUNT;
+        memcpy(work, templates[k], lengths[k] + 1);
+        sink += (unsigned char)work[0];
+    }
+    double copy_ns = (now_ns() - t0) / ITERATIONS;
+
+    t0 = now_ns();
+    for (long i = 0; i < ITERATIONS; i++) {
+        size_t k = i % MIX_COUNT;
+        memcpy(work, templates[k], lengths[k] + 1);
+        ParsedCommand cmd;
+        parse_next_command(work, work + lengths[k], &cmd);
+        sink += cmd.type + cmd.body.len;
+    }
+    double parser_ns = (now_ns() - t0) / ITERATIONS - copy_ns;
+
+    t0 = now_ns();
+    for (long i = 0; i < ITERATIONS; i++) {
+        size_t k = i % MIX_COUNT;
+        memcpy(work, templates[k], lengths[k] + 1);
+        sink += legacy_parse(work);
+    }
+    double legacy_ns = (now_ns() - t0) / ITERATIONS - copy_ns;
+
+    printf("=== Command parser benchmark (%d commands, %zu-command mix) ===\n", ITERATIONS, MIX_COUNT);
+    printf("parse_next_command : %8.2f ns/command\n", parser_ns);
+    printf("legacy strncmp/strcpy: %6.2f ns/command\n", legacy_ns);
+    printf("speedup            : %8.2fx\n", parser_ns > 0 ? legacy_ns / parser_ns : 0.0);
+    return sink == 42 ? 1 : 0;
+}
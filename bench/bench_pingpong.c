@@ -0,0 +1,154 @@
+// Round trip của PM giữa hai phiên trên localhost: bench0 gửi "/bench1 <i>", bench1 nhận
+// rồi trả "/bench0 <i>", bench0 nhận lại. Mỗi lượt đi qua server hai lần, chỉ có một tin
+// đang bay nên đo đúng độ trễ đánh thức + xử lý chứ không phải thông lượng.
+// In p50/p99/max (micro giây) và nối một dòng CSV: mode,samples,p50_us,p99_us,max_us
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+static int port = 8080;
+static int iterations = 5000;
+static int warmup = 200;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int connect_and_login(const char *user) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char creds[64], reply[4096];
+    snprintf(creds, sizeof(creds), "%s:1234", user);
+    send(sock, creds, strlen(creds), 0);
+    int len = recv(sock, reply, sizeof(reply) - 1, 0);
+    if (len <= 0 || (reply[len] = '\0', !strstr(reply, "Login successful"))) {
+        fprintf(stderr, "login failed for %s\n", user);
+        exit(1);
+    }
+    // Bỏ menu gửi sau khi đăng nhập
+    usleep(200000);
+    struct timeval tv = {0, 100000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    while (recv(sock, reply, sizeof(reply), 0) > 0) {
+    }
+    tv.tv_usec = 0;
+    tv.tv_sec = 5;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return sock;
+}
+
+typedef struct {
+    int sock;
+    char buf[4096];
+    size_t fill;
+} Peer;
+
+// Đọc tới khi gặp dòng PM có số thứ tự seq ("[PM from → to]: <seq>")
+static int wait_pm(Peer *p, int seq) {
+    while (1) {
+        char *nl;
+        while ((nl = memchr(p->buf, '\n', p->fill)) != NULL) {
+            *nl = '\0';
+            const char *colon = strstr(p->buf, "]: ");
+            int got = colon ? atoi(colon + 3) : -1;
+            size_t used = nl + 1 - p->buf;
+            memmove(p->buf, nl + 1, p->fill - used);
+            p->fill -= used;
+            if (got == seq) {
+                return 0;
+            }
+        }
+        if (p->fill == sizeof(p->buf)) {
+            p->fill = 0;  // Dòng quá dài, không phải PM của bench
+        }
+        ssize_t n = recv(p->sock, p->buf + p->fill, sizeof(p->buf) - p->fill, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        p->fill += n;
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = "default";
+    const char *out_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:m:o:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'n': iterations = atoi(optarg); break;
+        case 'm': mode = optarg; break;
+        case 'o': out_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-n iterations] [-m mode_label] [-o out.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "Invalid iteration count\n");
+        return 1;
+    }
+
+    static Peer a, b;
+    a.sock = connect_and_login("bench0");
+    b.sock = connect_and_login("bench1");
+
+    double *samples = malloc(sizeof(double) * iterations);
+    char msg[64];
+    for (int i = 0; i < warmup + iterations; i++) {
+        double start = now_us();
+        int len = snprintf(msg, sizeof(msg), "/bench1 %d\n", i);
+        send(a.sock, msg, len, 0);
+        if (wait_pm(&b, i) < 0) {
+            fprintf(stderr, "bench1 lost PM %d\n", i);
+            return 1;
+        }
+        len = snprintf(msg, sizeof(msg), "/bench0 %d\n", i);
+        send(b.sock, msg, len, 0);
+        if (wait_pm(&a, i) < 0) {
+            fprintf(stderr, "bench0 lost PM %d\n", i);
+            return 1;
+        }
+        if (i >= warmup) {
+            samples[i - warmup] = now_us() - start;
+        }
+    }
+
+    qsort(samples, iterations, sizeof(double), compare_double);
+    double p50 = samples[iterations / 2], p99 = samples[(int)(iterations * 0.99)], max = samples[iterations - 1];
+    printf("%-12s samples=%d p50=%.1fus p99=%.1fus max=%.1fus\n", mode, iterations, p50, p99, max);
+    if (out_path) {
+        FILE *csv = fopen(out_path, "a");
+        if (!csv) {
+            perror(out_path);
+            return 1;
+        }
+        fprintf(csv, "%s,%d,%.1f,%.1f,%.1f\n", mode, iterations, p50, p99, max);
+        fclose(csv);
+    }
+    free(samples);
+    close(a.sock);
+    close(b.sock);
+    return 0;
+}
@@ -0,0 +1,179 @@
+// Thông lượng (GB/s) của các kernel dò byte trong scan.c theo từng ISA, so với libc.
+// Dữ liệu là các dòng lịch sử giả (độ dài 20..200 byte) giống file hội thoại:
+//   newline_split : tách dòng trong một khối nhận được (memchr vs scan_newline)
+//   line_length   : độ dài dòng sau fgets (strcspn + strlen vs scan_line_length)
+//   delimiter     : tìm ký tự phân cách nằm cuối khối 4KB (memchr vs scan_byte)
+//   marker        : tìm từ khóa không có trong dòng, như /search (strstr vs scan_marker)
+// In bảng và ghi CSV: kernel,impl,gb_per_s
+#include "../include/scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#define DATA_BYTES (8 * 1024 * 1024)
+#define DELIM_BLOCK 4096
+#define ROUNDS 7
+
+static char *lines;         // Các dòng nối nhau, mỗi dòng kết thúc bằng '\n'
+static size_t lines_len;
+static char *cstrings;      // Cùng nội dung, mỗi dòng "...\n\0" như buffer của fgets
+static size_t *cstring_offsets;
+static size_t *cstring_lens;
+static size_t cstrings_bytes;
+static size_t cstring_count;
+static char *blocks;        // Khối DELIM_BLOCK byte, ký tự phân cách ở byte cuối
+static const char *keyword = "deploy-rollback";
+static volatile size_t sink;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void build_data(void) {
+    static const char words[][8] = {"hello", "team", "build", "ok", "meeting", "lunch", "ship", "review"};
+    lines = malloc(DATA_BYTES + 256);
+    cstrings = malloc(DATA_BYTES * 2);
+    cstring_offsets = malloc(sizeof(size_t) * DATA_BYTES / 20);
+    cstring_lens = malloc(sizeof(size_t) * DATA_BYTES / 20);
+    blocks = malloc(DATA_BYTES);
+    unsigned seed = 42;
+    size_t cpos = 0;
+    while (lines_len < DATA_BYTES) {
+        int target = 20 + rand_r(&seed) % 181;
+        size_t start = lines_len;
+        lines_len += sprintf(lines + lines_len, "%u|[Mon Oct 19 10:00:00 2026] user%u:", rand_r(&seed) % 100000,
+                             rand_r(&seed) % 1000);
+        while ((int)(lines_len - start) < target) {
+            lines_len += sprintf(lines + lines_len, " %s", words[rand_r(&seed) % 8]);
+        }
+        lines[lines_len++] = '\n';
+        size_t n = lines_len - start;
+        cstring_offsets[cstring_count] = cpos;
+        cstring_lens[cstring_count++] = n;
+        cstrings_bytes += n;
+        memcpy(cstrings + cpos, lines + start, n);
+        cpos += n;
+        cstrings[cpos++] = '\0';
+    }
+    memset(blocks, 'x', DATA_BYTES);
+    for (size_t i = DELIM_BLOCK - 1; i < DATA_BYTES; i += DELIM_BLOCK) {
+        blocks[i] = ' ';
+    }
+}
+
+static size_t run_newline_split(int use_libc) {
+    size_t count = 0;
+    const char *p = lines, *end = lines + lines_len;
+    while (p < end) {
+        const char *nl = use_libc ? memchr(p, '\n', end - p) : scan_newline(p, end - p);
+        if (!nl) break;
+        count++;
+        p = nl + 1;
+    }
+    return count;
+}
+
+static size_t run_line_length(int use_libc) {
+    size_t total = 0;
+    for (size_t i = 0; i < cstring_count; i++) {
+        const char *s = cstrings + cstring_offsets[i];
+        total += use_libc ? strcspn(s, "\n") + strlen(s) : scan_line_length(s);
+    }
+    return total;
+}
+
+static size_t run_delimiter(int use_libc) {
+    size_t total = 0;
+    for (size_t off = 0; off < DATA_BYTES; off += DELIM_BLOCK) {
+        const char *p = blocks + off;
+        const char *hit = use_libc ? memchr(p, ' ', DELIM_BLOCK) : scan_byte(p, DELIM_BLOCK, ' ');
+        total += hit - p;
+    }
+    return total;
+}
+
+static size_t run_marker(int use_libc) {
+    size_t hits = 0, klen = strlen(keyword);
+    for (size_t i = 0; i < cstring_count; i++) {
+        const char *s = cstrings + cstring_offsets[i];
+        hits += use_libc ? strstr(s, keyword) != NULL : scan_marker(s, cstring_lens[i], keyword, klen) != NULL;
+    }
+    return hits;
+}
+
+typedef struct {
+    const char *name;
+    size_t (*run)(int use_libc);
+    size_t *bytes;
+} Kernel;
+
+// Lấy lượt nhanh nhất trong ROUNDS lượt
+static double measure(const Kernel *k, int use_libc) {
+    double best = 1e30;
+    for (int r = 0; r < ROUNDS; r++) {
+        double start = now_s();
+        sink += k->run(use_libc);
+        double elapsed = now_s() - start;
+        if (elapsed < best) best = elapsed;
+    }
+    return *k->bytes / best / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = "scan.csv";
+    int opt;
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o': out_path = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-o out.csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    build_data();
+    size_t delim_bytes = DATA_BYTES;
+    Kernel kernels[] = {
+        {"newline_split", run_newline_split, &lines_len},
+        {"line_length", run_line_length, &cstrings_bytes},
+        {"delimiter", run_delimiter, &delim_bytes},
+        {"marker", run_marker, &cstrings_bytes},
+    };
+
+    FILE *csv = fopen(out_path, "w");
+    if (!csv) {
+        perror(out_path);
+        return 1;
+    }
+    fprintf(csv, "kernel,impl,gb_per_s\n");
+    ScanIsa selected = scan_active_isa();
+    printf("%zu lines, %zu bytes; runtime-selected ISA: %s\n", cstring_count, lines_len, scan_isa_name(selected));
+    printf("%-14s %8s", "kernel", "libc");
+    for (int isa = 0; isa < SCAN_ISA_COUNT; isa++) {
+        printf(" %8s", scan_isa_name(isa));
+    }
+    printf("   (GB/s)\n");
+
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        double libc = measure(&kernels[k], 1);
+        printf("%-14s %8.2f", kernels[k].name, libc);
+        fprintf(csv, "%s,libc,%.3f\n", kernels[k].name, libc);
+        for (int isa = 0; isa < SCAN_ISA_COUNT; isa++) {
+            if (scan_set_isa(isa) < 0) {
+                printf(" %8s", "n/a");
+                continue;
+            }
+            double gbps = measure(&kernels[k], 0);
+            printf(" %8.2f", gbps);
+            fprintf(csv, "%s,%s,%.3f\n", kernels[k].name, scan_isa_name(isa), gbps);
+        }
+        printf("\n");
+        scan_set_isa(selected);
+    }
+    fclose(csv);
+    printf("CSV: %s\n", out_path);
+    return 0;
+}
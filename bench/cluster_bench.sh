@@ -0,0 +1,55 @@
+#!/bin/sh
+# Chạy 1, 2 rồi 3 node trên localhost và đo tổng throughput của cụm.
+# Usage: bench/cluster_bench.sh [build_dir]
+BINDIR=$(cd "${1:-build}" && pwd)
+RUNDIR=$(mktemp -d)
+BASE_PORT=18080
+CLIENTS=48
+MSGS=1000
+
+mkdir -p "$RUNDIR/data" "$RUNDIR/node"
+: > "$RUNDIR/data/user.txt"
+i=0
+while [ $i -lt $CLIENTS ]; do
+    echo "bench$i:1234" >> "$RUNDIR/data/user.txt"
+    i=$((i + 1))
+done
+echo "benchgroup:Bench:bench0" > "$RUNDIR/data/group.txt"
+# Shared secret cho liên kết giữa các node
+(umask 077 && echo "bench-$$-$(date +%s)" > "$RUNDIR/cluster.secret")
+
+for NODES in 1 2 3; do
+    PORTS=""
+    n=0
+    while [ $n -lt $NODES ]; do
+        PORTS="$PORTS${PORTS:+,}$((BASE_PORT + n))"
+        n=$((n + 1))
+    done
+
+    PIDS=""
+    n=0
+    while [ $n -lt $NODES ]; do
+        PORT=$((BASE_PORT + n))
+        # Mỗi node một thư mục hội thoại riêng (store khóa gốc, không dùng chung được)
+        CONV="$RUNDIR/conv$n"
+        rm -rf "$CONV"
+        mkdir -p "$CONV"
+        PEERS=$(echo "$PORTS" | tr ',' '\n' | grep -v "^$PORT$" | sed 's/^/127.0.0.1:/' | paste -sd, -)
+        if [ -n "$PEERS" ]; then
+            (cd "$RUNDIR/node" && exec "$BINDIR/socket_server" -p "$PORT" -P "$PEERS" -k "$RUNDIR/cluster.secret" -d "$CONV" > /dev/null) &
+        else
+            (cd "$RUNDIR/node" && exec "$BINDIR/socket_server" -p "$PORT" -d "$CONV" > /dev/null) &
+        fi
+        PIDS="$PIDS $!"
+        n=$((n + 1))
+    done
+    sleep 2
+
+    "$BINDIR/bench_cluster" -c $CLIENTS -m $MSGS -P "$PORTS"
+
+    kill $PIDS 2>/dev/null
+    wait $PIDS 2>/dev/null
+    sleep 1
+done
+
+rm -rf "$RUNDIR"
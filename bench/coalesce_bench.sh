@@ -0,0 +1,37 @@
+#!/bin/sh
+# Thông lượng group chat theo độ trễ thêm vào: chạy server với các cửa sổ gom khác nhau.
+# Kết quả (window_us,rate,delivered_per_sec,p50_ms,p99_ms,items_per_write) ghi vào coalesce.csv.
+# Usage: bench/coalesce_bench.sh [build_dir]
+BINDIR=$(cd "${1:-build}" && pwd)
+RUNDIR=$(mktemp -d)
+PORT=18380
+MEMBERS=50
+CSV="$BINDIR/coalesce.csv"
+
+mkdir -p "$RUNDIR/data" "$RUNDIR/conversation" "$RUNDIR/node"
+: > "$RUNDIR/data/user.txt"
+LIST=""
+i=0
+while [ $i -lt $MEMBERS ]; do
+    echo "c$i:1234" >> "$RUNDIR/data/user.txt"
+    LIST="$LIST${LIST:+,}c$i"
+    i=$((i + 1))
+done
+echo "cstat:1234" >> "$RUNDIR/data/user.txt"
+echo "cgroup:Coalesce:$LIST" > "$RUNDIR/data/group.txt"
+
+echo "window_us,rate,delivered_per_sec,p50_ms,p99_ms,items_per_write" > "$CSV"
+for WINDOW in 0 1000 2000 5000; do
+    (cd "$RUNDIR/node" && exec "$BINDIR/socket_server" -p "$PORT" -W "$WINDOW" > /dev/null 2>&1) &
+    PID=$!
+    sleep 1
+
+    "$BINDIR/bench_coalesce" -p "$PORT" -n "$MEMBERS" -w "$WINDOW" -o "$CSV"
+
+    kill $PID 2>/dev/null
+    wait $PID 2>/dev/null
+    sleep 1
+done
+echo "CSV: $CSV"
+
+rm -rf "$RUNDIR"
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Đo độ trễ PM real-time khi cùng kết nối đang tải lịch sử lớn.
+# Usage: bench/lanes_bench.sh [build_dir]
+BINDIR=$(cd "${1:-build}" && pwd)
+RUNDIR=$(mktemp -d)
+PORT=18180
+
+mkdir -p "$RUNDIR/data" "$RUNDIR/conversation" "$RUNDIR/node"
+printf 'bench0:1234\nbench1:1234\n' > "$RUNDIR/data/user.txt"
+echo "benchgroup:Bench:bench0,bench1" > "$RUNDIR/data/group.txt"
+
+(cd "$RUNDIR/node" && exec "$BINDIR/socket_server" -p "$PORT" > /dev/null) &
+PID=$!
+sleep 1
+
+"$BINDIR/bench_lanes" -p "$PORT"
+
+kill $PID 2>/dev/null
+wait $PID 2>/dev/null
+rm -rf "$RUNDIR"
@@ -0,0 +1,334 @@
+// Microbenchmark cho các hàm nóng của server, chạy riêng lẻ (không cần client thật).
+// Mỗi phép đo: warmup + hiệu chỉnh số lần lặp cho tới khi một lượt chạy đủ lâu,
+// rồi lặp lại nhiều lượt và báo cáo min/median/mean/stddev (ns mỗi lần gọi).
+// Kết quả được ghi thêm vào file CSV để so sánh giữa các build:
+//   benchmark,size,iterations,reps,min_ns,median_ns,mean_ns,stddev_ns
+// Build với -DMAX_USERS/-DMAX_GROUPS/-DMAX_CLIENTS đủ lớn (xem target microbench).
+#include "../include/server_utils.h"
+#include "../include/conversation_store.h"
+#include "../include/timer_wheel.h"
+#include "../include/outbound.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#define DEFAULT_REPS 15
+#define MIN_BATCH_SEC 0.02      // Mỗi lượt đo chạy ít nhất từng này
+#define MAX_OP_SEC 1.0          // Một lần gọi lâu hơn thế thì bỏ qua các kích thước lớn hơn
+#define QUERY_COUNT 1024        // Số khóa tra cứu xoay vòng
+#define GROUP_MEMBERS 8
+
+typedef void (*BenchFn)(long iters);
+
+static int sizes[] = {10, 100, 1000, 10000, 100000};
+static int size_count = sizeof(sizes) / sizeof(sizes[0]);
+static int reps = DEFAULT_REPS;
+static FILE *csv = NULL;
+
+// Khóa tra cứu được tạo sẵn để vòng đo không tốn thời gian snprintf
+static char query_users[QUERY_COUNT][32];
+static char query_groups[QUERY_COUNT][32];
+static volatile int sink;
+static int sink_fds[2];
+static Timer bench_timers[100000];  // Mỗi kích thước: n timer đang chờ, như n kết nối có hạn chờ
+static int timer_population = 0;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Đọc bỏ mọi thứ fan-out gửi tới client giả
+static void *drain_thread(void *arg) {
+    (void)arg;
+    char buffer[65536];
+    while (read(sink_fds[1], buffer, sizeof(buffer)) > 0) {
+    }
+    return NULL;
+}
+
+/**
+ * Tạo n user, n group (mỗi group GROUP_MEMBERS thành viên) và n client đăng nhập,
+ * tất cả client trỏ tới cùng một socket xả dữ liệu
+ */
+static void populate(int n) {
+    userCount = n < MAX_USERS ? n : MAX_USERS;
+    groupCount = n < MAX_GROUPS ? n : MAX_GROUPS;
+    int clients_wanted = n < MAX_CLIENTS ? n : MAX_CLIENTS;
+    for (int i = 0; i < userCount; i++) {
+        snprintf(users[i].username, sizeof(users[i].username), "user%d", i);
+        snprintf(users[i].password, sizeof(users[i].password), "pw%d", i);
+    }
+    for (int i = 0; i < groupCount; i++) {
+        snprintf(groups[i].groupId, sizeof(groups[i].groupId), "g%d", i);
+        snprintf(groups[i].groupName, sizeof(groups[i].groupName), "Group %d", i);
+        size_t pos = 0;
+        groups[i].members[0] = '\0';
+        for (int m = 0; m < GROUP_MEMBERS; m++) {
+            pos += snprintf(groups[i].members + pos, sizeof(groups[i].members) - pos, "%suser%d",
+                            m ? "," : "", (i + m) % n);
+        }
+    }
+    index_users();
+    index_groups();
+    clientCount = 0;
+    for (int i = 0; i < clients_wanted; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "user%d", i);
+        add_client(sink_fds[0], name, 0);
+    }
+    unsigned seed = 12345;
+    int timers_wanted = n < (int)(sizeof(bench_timers) / sizeof(bench_timers[0])) ? n : (int)(sizeof(bench_timers) / sizeof(bench_timers[0]));
+    for (int i = 0; i < timer_population; i++) {
+        timer_cancel(&bench_timers[i]);
+    }
+    for (int i = 0; i < timers_wanted; i++) {
+        timer_init(&bench_timers[i], NULL, NULL);
+        timer_schedule(&bench_timers[i], 1000 + rand_r(&seed) % 600000);
+    }
+    timer_population = timers_wanted;
+    for (int q = 0; q < QUERY_COUNT; q++) {
+        int idx = rand_r(&seed) % n;
+        snprintf(query_users[q], sizeof(query_users[q]), "user%d", idx);
+        snprintf(query_groups[q], sizeof(query_groups[q]), "g%d", idx);
+    }
+}
+
+// ===== CÁC HÀM ĐƯỢC ĐO =====
+
+static void bench_is_user_in_group(long iters) {
+    for (long i = 0; i < iters; i++) {
+        int q = i & (QUERY_COUNT - 1);
+        sink += is_user_in_group(query_groups[q], query_users[(q + 1) & (QUERY_COUNT - 1)]);
+    }
+}
+
+static void bench_is_group_id(long iters) {
+    for (long i = 0; i < iters; i++) {
+        sink += is_group_id(query_groups[i & (QUERY_COUNT - 1)]);
+    }
+}
+
+static void bench_check_login(long iters) {
+    for (long i = 0; i < iters; i++) {
+        sink += check_login(query_users[i & (QUERY_COUNT - 1)], "pw0");
+    }
+}
+
+static void bench_find_client_by_name(long iters) {
+    for (long i = 0; i < iters; i++) {
+        sink += find_client_by_name(query_users[i & (QUERY_COUNT - 1)]) != NULL;
+    }
+}
+
+static void bench_get_conversation_filename(long iters) {
+    char filename[PATH_MAX];
+    for (long i = 0; i < iters; i++) {
+        int q = i & (QUERY_COUNT - 1);
+        get_conversation_filename(filename, sizeof(filename), query_users[q],
+                                  query_users[(q + 7) & (QUERY_COUNT - 1)], 0);
+        sink += filename[0];
+    }
+}
+
+static void bench_broadcast_fanout(long iters) {
+    for (long i = 0; i < iters; i++) {
+        deliver_broadcast_local("user0", "microbench broadcast");
+    }
+}
+
+static void bench_group_fanout(long iters) {
+    for (long i = 0; i < iters; i++) {
+        deliver_group_local("user0", query_groups[i & (QUERY_COUNT - 1)], "microbench group message");
+    }
+}
+
+static void bench_save_conversation(long iters) {
+    for (long i = 0; i < iters; i++) {
+        save_conversation("user0", "user1", "microbench persisted message", 0);
+    }
+}
+
+// Đặt lại hạn của một timer bất kỳ (gỡ khỏi ô cũ, chèn vào ô mới, có thể khác tầng)
+static void bench_timer_reschedule(long iters) {
+    for (long i = 0; i < iters; i++) {
+        timer_schedule(&bench_timers[(i * 7919) % timer_population], 1000 + (i & 1023) * 500);
+    }
+}
+
+static void bench_log_event(long iters) {
+    for (long i = 0; i < iters; i++) {
+        log_event("microbench log line %ld from %s", i, "user0");
+    }
+}
+
+// ===== ĐO VÀ BÁO CÁO =====
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Đo một hàm ở một kích thước
+ * @return: ns mỗi lần gọi (median), hoặc -1 nếu không có kết quả
+ */
+static double run_bench(const char *name, int size, BenchFn fn) {
+    // Warmup + hiệu chỉnh: nhân đôi số lần lặp tới khi một lượt đủ dài
+    long iters = 1;
+    double elapsed;
+    while (1) {
+        double start = now_sec();
+        fn(iters);
+        elapsed = now_sec() - start;
+        if (elapsed >= MIN_BATCH_SEC || elapsed >= MAX_OP_SEC) break;
+        iters *= 2;
+    }
+    int run_reps = elapsed / iters > MAX_OP_SEC / 10 ? 3 : reps;
+
+    double samples[DEFAULT_REPS * 4];
+    if (run_reps > (int)(sizeof(samples) / sizeof(samples[0]))) {
+        run_reps = sizeof(samples) / sizeof(samples[0]);
+    }
+    double sum = 0;
+    for (int r = 0; r < run_reps; r++) {
+        double start = now_sec();
+        fn(iters);
+        samples[r] = (now_sec() - start) * 1e9 / iters;
+        sum += samples[r];
+    }
+    qsort(samples, run_reps, sizeof(double), compare_double);
+    double mean = sum / run_reps;
+    double var = 0;
+    for (int r = 0; r < run_reps; r++) {
+        var += (samples[r] - mean) * (samples[r] - mean);
+    }
+    double stddev = run_reps > 1 ? sqrt(var / (run_reps - 1)) : 0;
+    double median = samples[run_reps / 2];
+
+    printf("%-26s %7d  median %12.1f ns  min %12.1f  mean %12.1f  sd %10.1f  (%ld iters x %d)\n",
+           name, size, median, samples[0], mean, stddev, iters, run_reps);
+    fprintf(csv, "%s,%d,%ld,%d,%.1f,%.1f,%.1f,%.1f\n", name, size, iters, run_reps,
+            samples[0], median, mean, stddev);
+    fflush(stdout);
+    return median;
+}
+
+typedef struct {
+    const char *name;
+    BenchFn fn;
+    int scaled;     // 1 nếu phụ thuộc số user/group/client
+} BenchCase;
+
+static const BenchCase cases[] = {
+    {"is_user_in_group",          bench_is_user_in_group,          1},
+    {"is_group_id",               bench_is_group_id,               1},
+    {"check_login",               bench_check_login,               1},
+    {"find_client_by_name",       bench_find_client_by_name,       1},
+    {"broadcast_fanout",          bench_broadcast_fanout,          1},
+    {"group_fanout",              bench_group_fanout,              1},
+    {"timer_reschedule",          bench_timer_reschedule,          1},
+    {"get_conversation_filename", bench_get_conversation_filename, 0},
+    {"save_conversation",         bench_save_conversation,         0},
+    {"log_event",                 bench_log_event,                 0},
+};
+
+static void parse_sizes(char *list) {
+    size_count = 0;
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(list, ",", &saveptr); tok && size_count < 5; tok = strtok_r(NULL, ",", &saveptr)) {
+        int n = atoi(tok);
+        if (n > 0 && n <= MAX_CLIENTS && n <= MAX_USERS && n <= MAX_GROUPS) {
+            sizes[size_count++] = n;
+        } else {
+            fprintf(stderr, "Skipping size %s (build limits: %d users, %d groups, %d clients)\n",
+                    tok, MAX_USERS, MAX_GROUPS, MAX_CLIENTS);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = "microbench.csv";
+    const char *filter = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "o:s:r:b:")) != -1) {
+        switch (opt) {
+        case 'o': out_path = optarg; break;
+        case 's': parse_sizes(optarg); break;
+        case 'r': reps = atoi(optarg); break;
+        case 'b': filter = optarg; break;
+        default:
+            fprintf(stderr, "Usage: %s [-o results.csv] [-s 10,100,...] [-r reps] [-b benchmark]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (reps < 1 || reps > DEFAULT_REPS * 4) {
+        reps = DEFAULT_REPS;
+    }
+
+    // Môi trường tạm: log, thư mục hội thoại và socket xả dữ liệu của fan-out
+    char workdir[] = "/tmp/microbench.XXXXXX";
+    if (!mkdtemp(workdir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/server.log", workdir);
+    logFile = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s/conversation", workdir);
+    set_conversation_dir(path);
+    if (!logFile || conversation_store_init() < 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sink_fds) < 0) {
+        perror("setup");
+        return 1;
+    }
+    // Fan-out chỉ gửi qua hàng đợi của client: mọi client giả dùng chung hàng đợi của socket xả
+    outbox_create(sink_fds[0]);
+    pthread_t drainer;
+    pthread_create(&drainer, NULL, drain_thread, NULL);
+
+    csv = fopen(out_path, "w");
+    if (!csv) {
+        perror(out_path);
+        return 1;
+    }
+    fprintf(csv, "benchmark,size,iterations,reps,min_ns,median_ns,mean_ns,stddev_ns\n");
+
+    int case_count = sizeof(cases) / sizeof(cases[0]);
+    for (int c = 0; c < case_count; c++) {
+        if (filter && strcmp(filter, cases[c].name) != 0) continue;
+        if (!cases[c].scaled) {
+            populate(sizes[0]);
+            run_bench(cases[c].name, 1, cases[c].fn);
+            continue;
+        }
+        for (int s = 0; s < size_count; s++) {
+            populate(sizes[s]);
+            double median = run_bench(cases[c].name, sizes[s], cases[c].fn);
+            if (median > MAX_OP_SEC * 1e9 / 10 && s + 1 < size_count) {
+                // Độ phức tạp bậc hai: kích thước lớn hơn sẽ chạy quá lâu
+                printf("%-26s skipping sizes above %d\n", cases[c].name, sizes[s]);
+                for (int k = s + 1; k < size_count; k++) {
+                    fprintf(csv, "%s,%d,0,0,-1,-1,-1,-1\n", cases[c].name, sizes[k]);
+                }
+                break;
+            }
+        }
+    }
+
+    fclose(csv);
+    printf("Results written to %s\n", out_path);
+    conversation_store_flush();  // Writer của store còn có thể đang ghi vào workdir
+    snprintf(path, sizeof(path), "rm -rf %s", workdir);
+    if (system(path) != 0) {
+        fprintf(stderr, "Failed to remove %s\n", workdir);
+    }
+    return 0;
+}
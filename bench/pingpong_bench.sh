@@ -0,0 +1,37 @@
+#!/bin/sh
+# Round trip PM p50/p99 giữa hai phiên, server ở chế độ mặc định và chế độ độ trễ thấp (-S).
+# Usage: bench/pingpong_bench.sh [build_dir]
+#   SPIN_US : ngân sách quay của chế độ độ trễ thấp (mặc định 50)
+#   CPUS    : ghim thread của server vào các core này, ví dụ "2-5" (mặc định không ghim)
+# Kết quả nối vào <build_dir>/pingpong.csv
+BINDIR=$(cd "${1:-build}" && pwd)
+RUNDIR=$(mktemp -d)
+PORT=18185
+SPIN_US=${SPIN_US:-50}
+CSV="$BINDIR/pingpong.csv"
+
+mkdir -p "$RUNDIR/data" "$RUNDIR/conversation" "$RUNDIR/node"
+printf 'bench0:1234\nbench1:1234\n' > "$RUNDIR/data/user.txt"
+: > "$RUNDIR/data/group.txt"
+echo "mode,samples,p50_us,p99_us,max_us" > "$CSV"
+
+run_mode() {
+    label=$1
+    shift
+    (cd "$RUNDIR/node" && exec "$BINDIR/socket_server" -p "$PORT" "$@" > /dev/null) &
+    PID=$!
+    sleep 1
+    "$BINDIR/bench_pingpong" -p "$PORT" -m "$label" -o "$CSV"
+    kill $PID 2>/dev/null
+    wait $PID 2>/dev/null
+}
+
+run_mode blocking
+if [ -n "$CPUS" ]; then
+    run_mode busy_poll -S "$SPIN_US" -A "$CPUS"
+else
+    run_mode busy_poll -S "$SPIN_US"
+fi
+
+rm -rf "$RUNDIR"
+echo "CSV: $CSV"
@@ -0,0 +1,365 @@
+// Phát lại trace ghi bằng "socket_server -C trace.bin" vào một server mới.
+// Mỗi phiên trong trace được phát bởi một thread riêng, giữ nguyên thứ tự lệnh trong phiên
+// và khoảng cách thời gian (chia cho hệ số tốc độ; -s 0 = nhanh nhất có thể).
+// Độ trễ được đo cho các lệnh có phản hồi về người gửi (lịch sử, tìm kiếm, /users, ...):
+// thời gian từ lúc gửi đến byte phản hồi đầu tiên. Tin nhắn do phiên khác đẩy tới
+// trong khoảng đó cũng được tính, nên số đo là cận trên.
+// Trace không chứa mật khẩu: mật khẩu đăng nhập được lấy từ file user (-u, cùng định dạng
+// data/user.txt). Không có -u thì gửi chuỗi đăng nhập nguyên như trong trace.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include "../include/traffic_capture.h"
+
+#define REPLY_TIMEOUT_MS 2000
+#define USAGE "Usage: %s -f trace.bin [-u users.txt] [-H host] [-p port] [-s speed (1, 10, 0 = max)]\n"
+
+typedef struct {
+    int type;
+    uint64_t ns;
+    char *data;
+    uint32_t len;
+} TraceEvent;
+
+typedef struct {
+    TraceEvent *events;
+    int count;
+    int capacity;
+    int sock;
+    // Trạng thái reader: số lần nhận dữ liệu và thời điểm nhận gần nhất
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned long arrivals;
+    double last_arrival;
+    int closed;
+} Session;
+
+static Session *sessions = NULL;
+static uint32_t session_count = 0;
+static double speed = 1.0;              // 0 = tối đa
+static const char *host = "127.0.0.1";
+static int port = 8080;
+static double replay_start;
+
+typedef struct {
+    char username[32];
+    char password[32];
+} Credential;
+
+static Credential *credentials = NULL;
+static int credential_count = 0;
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static double *latencies = NULL;
+static size_t latency_count = 0, latency_capacity = 0;
+static long commands_sent = 0, logins_ok = 0, logins_failed = 0, replies_timed_out = 0;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t get_be(const unsigned char *in, int bytes) {
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v = (v << 8) | in[i];
+    }
+    return v;
+}
+
+static int load_trace(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char magic[CAPTURE_MAGIC_LEN];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, CAPTURE_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s is not a capture trace\n", path);
+        fclose(f);
+        return -1;
+    }
+    unsigned char header[CAPTURE_RECORD_HEADER];
+    while (fread(header, 1, sizeof(header), f) == sizeof(header)) {
+        TraceEvent ev;
+        ev.type = header[0];
+        uint32_t id = (uint32_t)get_be(header + 1, 4);
+        ev.ns = get_be(header + 5, 8);
+        ev.len = (uint32_t)get_be(header + 13, 4);
+        ev.data = malloc(ev.len + 1);
+        if (!ev.data || fread(ev.data, 1, ev.len, f) != ev.len) {
+            free(ev.data);
+            break;  // Bản ghi cuối bị cắt (server bị kill khi đang ghi)
+        }
+        ev.data[ev.len] = '\0';
+        if (id == 0) {
+            free(ev.data);
+            continue;
+        }
+        if (id > session_count) {
+            Session *grown = realloc(sessions, id * sizeof(Session));
+            if (!grown) break;
+            memset(grown + session_count, 0, (id - session_count) * sizeof(Session));
+            sessions = grown;
+            session_count = id;
+        }
+        Session *s = &sessions[id - 1];
+        if (s->count == s->capacity) {
+            s->capacity = s->capacity ? s->capacity * 2 : 16;
+            s->events = realloc(s->events, s->capacity * sizeof(TraceEvent));
+        }
+        s->events[s->count++] = ev;
+    }
+    fclose(f);
+    return 0;
+}
+
+static int load_credentials(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int capacity = 0;
+    Credential c;
+    while (fscanf(f, "%31[^:]:%31s\n", c.username, c.password) == 2) {
+        if (credential_count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            credentials = realloc(credentials, capacity * sizeof(Credential));
+        }
+        credentials[credential_count++] = c;
+    }
+    fclose(f);
+    return 0;
+}
+
+/**
+ * Dựng lại chuỗi đăng nhập: thay mật khẩu đã che trong trace bằng mật khẩu từ file user
+ * @return: Độ dài chuỗi trong out, -1 nếu user không có trong file
+ */
+static int build_login(const TraceEvent *ev, char *out, size_t size) {
+    if (!credentials) {
+        snprintf(out, size, "%s", ev->data);
+        return (int)strlen(out);
+    }
+    const char *colon = strchr(ev->data, ':');
+    if (!colon) {
+        return -1;
+    }
+    const char *rest = colon + strcspn(colon, " \t\r\n");
+    for (int i = 0; i < credential_count; i++) {
+        if (strlen(credentials[i].username) == (size_t)(colon - ev->data) &&
+            strncmp(credentials[i].username, ev->data, colon - ev->data) == 0) {
+            int n = snprintf(out, size, "%s:%s%s", credentials[i].username, credentials[i].password, rest);
+            return n < 0 || (size_t)n >= size ? -1 : n;
+        }
+    }
+    return -1;
+}
+
+static void record_latency(double sec) {
+    pthread_mutex_lock(&stats_mutex);
+    if (latency_count == latency_capacity) {
+        latency_capacity = latency_capacity ? latency_capacity * 2 : 1024;
+        latencies = realloc(latencies, latency_capacity * sizeof(double));
+    }
+    latencies[latency_count++] = sec;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+// Lệnh nào server chắc chắn trả lời cho chính người gửi
+static int expects_reply(const char *cmd) {
+    if (cmd[0] == '|') return 1;
+    return strncmp(cmd, "/search", 7) == 0 || strncmp(cmd, "/menu", 5) == 0 || strncmp(cmd, "/users", 6) == 0 ||
+           strncmp(cmd, "/groups", 7) == 0 || strncmp(cmd, "/stats", 6) == 0;
+}
+
+static void *session_reader(void *arg) {
+    Session *s = (Session *)arg;
+    char buffer[65536];
+    while (recv(s->sock, buffer, sizeof(buffer), 0) > 0) {
+        pthread_mutex_lock(&s->mutex);
+        s->arrivals++;
+        s->last_arrival = now_sec();
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+    pthread_mutex_lock(&s->mutex);
+    s->closed = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+/**
+ * Chờ dữ liệu mới sau mốc arrivals
+ * @return: thời điểm nhận, hoặc 0 nếu hết thời gian chờ / kết nối đóng
+ */
+static double wait_reply(Session *s, unsigned long after) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += REPLY_TIMEOUT_MS / 1000;
+    double arrival = 0;
+    pthread_mutex_lock(&s->mutex);
+    while (s->arrivals == after && !s->closed) {
+        if (pthread_cond_timedwait(&s->cond, &s->mutex, &deadline) == ETIMEDOUT) break;
+    }
+    if (s->arrivals != after) arrival = s->last_arrival;
+    pthread_mutex_unlock(&s->mutex);
+    return arrival;
+}
+
+static void wait_until(uint64_t ns) {
+    if (speed <= 0) return;
+    double due = replay_start + ns / 1e9 / speed;
+    double delay = due - now_sec();
+    if (delay > 0) usleep((useconds_t)(delay * 1e6));
+}
+
+static void *session_thread(void *arg) {
+    Session *s = (Session *)arg;
+    pthread_t reader;
+    int reader_started = 0;
+    s->sock = -1;
+
+    for (int i = 0; i < s->count; i++) {
+        TraceEvent *ev = &s->events[i];
+        wait_until(ev->ns);
+        if (ev->type == CAPTURE_OPEN) {
+            s->sock = socket(AF_INET, SOCK_STREAM, 0);
+            struct sockaddr_in addr = {0};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            inet_pton(AF_INET, host, &addr.sin_addr);
+            if (s->sock < 0 || connect(s->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+                perror("connect");
+                break;
+            }
+            int one = 1;
+            setsockopt(s->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        } else if (s->sock < 0) {
+            break;
+        } else if (ev->type == CAPTURE_LOGIN) {
+            char reply[256], login[512];
+            int login_len = build_login(ev, login, sizeof(login));
+            if (login_len < 0) {
+                __atomic_add_fetch(&logins_failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            double sent_at = now_sec();
+            send(s->sock, login, login_len, MSG_NOSIGNAL);
+            int len = recv(s->sock, reply, sizeof(reply) - 1, 0);
+            if (len <= 0) {
+                __atomic_add_fetch(&logins_failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            reply[len] = '\0';
+            if (!strstr(reply, "Login successful")) {
+                __atomic_add_fetch(&logins_failed, 1, __ATOMIC_RELAXED);
+                break;
+            }
+            __atomic_add_fetch(&logins_ok, 1, __ATOMIC_RELAXED);
+            record_latency(now_sec() - sent_at);
+            pthread_create(&reader, NULL, session_reader, s);
+            reader_started = 1;
+        } else if (ev->type == CAPTURE_COMMAND) {
+            int wait = expects_reply(ev->data);
+            pthread_mutex_lock(&s->mutex);
+            unsigned long before = s->arrivals;
+            pthread_mutex_unlock(&s->mutex);
+            double sent_at = now_sec();
+            if (send(s->sock, ev->data, ev->len, MSG_NOSIGNAL) < 0) break;
+            __atomic_add_fetch(&commands_sent, 1, __ATOMIC_RELAXED);
+            if (wait) {
+                double arrival = wait_reply(s, before);
+                if (arrival > 0) {
+                    record_latency(arrival - sent_at);
+                } else {
+                    __atomic_add_fetch(&replies_timed_out, 1, __ATOMIC_RELAXED);
+                }
+            }
+        } else if (ev->type == CAPTURE_CLOSE) {
+            break;
+        }
+    }
+
+    if (s->sock >= 0) {
+        shutdown(s->sock, SHUT_RDWR);
+    }
+    if (reader_started) {
+        pthread_join(reader, NULL);
+    }
+    if (s->sock >= 0) {
+        close(s->sock);
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double p) {
+    if (latency_count == 0) return 0;
+    size_t idx = (size_t)(p * (latency_count - 1));
+    return latencies[idx] * 1000;
+}
+
+int main(int argc, char *argv[]) {
+    const char *trace = NULL;
+    int opt;
+    const char *users = NULL;
+    while ((opt = getopt(argc, argv, "f:u:H:p:s:")) != -1) {
+        switch (opt) {
+        case 'f': trace = optarg; break;
+        case 'u': users = optarg; break;
+        case 'H': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 's': speed = atof(optarg); break;
+        default:
+            fprintf(stderr, USAGE, argv[0]);
+            return 1;
+        }
+    }
+    if (!trace) {
+        fprintf(stderr, USAGE, argv[0]);
+        return 1;
+    }
+    if ((users && load_credentials(users) < 0) || load_trace(trace) < 0) {
+        return 1;
+    }
+
+    pthread_t *threads = calloc(session_count, sizeof(pthread_t));
+    replay_start = now_sec();
+    for (uint32_t i = 0; i < session_count; i++) {
+        pthread_mutex_init(&sessions[i].mutex, NULL);
+        pthread_cond_init(&sessions[i].cond, NULL);
+        if (sessions[i].count > 0) {
+            pthread_create(&threads[i], NULL, session_thread, &sessions[i]);
+        }
+    }
+    for (uint32_t i = 0; i < session_count; i++) {
+        if (sessions[i].count > 0) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    double elapsed = now_sec() - replay_start;
+
+    qsort(latencies, latency_count, sizeof(double), compare_double);
+    printf("sessions=%u logins_ok=%ld logins_failed=%ld commands=%ld elapsed=%.3fs throughput=%.0f cmd/s\n",
+           session_count, logins_ok, logins_failed, commands_sent, elapsed,
+           elapsed > 0 ? commands_sent / elapsed : 0);
+    printf("latency_ms samples=%zu p50=%.3f p90=%.3f p99=%.3f max=%.3f timeouts=%ld\n",
+           latency_count, percentile(0.50), percentile(0.90), percentile(0.99), percentile(1.0), replies_timed_out);
+    return logins_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef ATTACHMENT_H
+#define ATTACHMENT_H
+
+#include <stddef.h>
+
+// Truyền file và tin nhắn lớn (vượt BUFFER_SIZE) theo từng chunk.
+// Upload:   "/upload <target> <size> <name>\n" rồi đúng <size> byte dữ liệu thô.
+//           Server splice thẳng từ socket qua pipe vào <conversation_dir>/attachments/<id>
+//           (dữ liệu không đi qua user space), rồi báo cho target bằng một tin nhắn thường.
+// Download: "/download <id>" -> dữ liệu được gửi qua làn bulk theo từng slice, mỗi slice dạng
+//           "@file <id> <size> <name> <offset> <len>\n" + <len> byte, nên tin nhắn
+//           real-time vẫn được xen vào giữa hai slice.
+// Chỉ người gửi và người nhận (hoặc thành viên group) được tải file.
+
+#define ATTACH_DIR_NAME "attachments"
+#define ATTACH_FILE_MARKER "@file "
+#define ATTACH_NAME_MAX 63
+#ifndef ATTACH_MAX_BYTES
+#define ATTACH_MAX_BYTES (256L * 1024 * 1024)
+#endif
+#define ATTACH_PIPE_CHUNK (64 * 1024)     // Byte tối đa mỗi lần splice từ socket
+
+/**
+ * Tạo thư mục attachments và lấy id lớn nhất đã có
+ * @return: 0 nếu thành công
+ */
+int attachment_store_init(void);
+
+/**
+ * Chuẩn hóa tên file do client gửi (bỏ đường dẫn, chỉ giữ [A-Za-z0-9._-])
+ */
+void attachment_sanitize_name(const char *name, char *out, size_t size);
+
+/**
+ * Nhận payload của một lệnh upload và lưu thành attachment mới
+ * @param prefix: Phần payload đã nằm sẵn trong buffer nhận (sau dòng lệnh)
+ * @param prefix_len: Số byte payload trong prefix (<= size)
+ * @param size: Tổng số byte payload
+ * @return: Id của attachment (> 0), 0 nếu đã đọc hết payload nhưng không lưu được,
+ *          -1 nếu kết nối lỗi giữa chừng (không còn dùng được)
+ */
+long attachment_receive(int sock, const char *prefix, size_t prefix_len, size_t size,
+                        const char *owner, const char *target, int isGroup, const char *name);
+
+/**
+ * Đọc và bỏ payload của một lệnh upload bị từ chối để giữ đồng bộ luồng lệnh
+ * @return: 0 nếu thành công, -1 nếu kết nối lỗi
+ */
+int attachment_discard(int sock, size_t remaining);
+
+/**
+ * Xếp attachment vào làn bulk của socket nếu username có quyền tải
+ * @return: 0 nếu đã xếp, -1 nếu không tồn tại hoặc không có quyền
+ */
+int attachment_send(int sock, const char *username, long id);
+
+#endif
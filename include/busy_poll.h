@@ -0,0 +1,51 @@
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Chế độ độ trễ thấp (tùy chọn): thay vì ngủ ngay trong recv() hay pthread_cond_wait(),
+// thread phiên và thread writer quay vòng kiểm tra dữ liệu mới tối đa một ngân sách
+// micro giây rồi mới ngủ, để tránh độ trễ đánh thức của scheduler. Socket phiên được đặt
+// SO_BUSY_POLL cùng ngân sách (có tác dụng với NIC có NAPI, loopback thì không).
+// Thread phiên và writer có thể được ghim lần lượt vào các core trong một danh sách
+// (nên là core đã cô lập, isolcpus/nohz_full), vì khi quay vòng mỗi thread chiếm trọn một core.
+
+#define BUSY_POLL_MAX_US 100000     // Ngân sách quay tối đa mỗi lần chờ
+
+/**
+ * Bật chế độ độ trễ thấp và/hoặc ghim thread
+ * @param spin_us: Ngân sách quay trước khi ngủ (0 = tắt)
+ * @param cpu_list: Danh sách core dạng "2,3,6-9", NULL = không ghim
+ * @return: 0 nếu thành công, -1 nếu tham số không hợp lệ
+ */
+int busy_poll_configure(unsigned int spin_us, const char *cpu_list);
+
+/**
+ * Ngân sách quay hiện tại (micro giây, 0 = tắt)
+ */
+unsigned int busy_poll_budget_us(void);
+
+/**
+ * Đặt SO_BUSY_POLL cho socket phiên (không làm gì nếu chế độ tắt)
+ */
+void busy_poll_setup_socket(int sock);
+
+/**
+ * recv() blocking, nhưng trước khi ngủ thì thử lại không chờ cho tới hết ngân sách quay
+ * @return: Như recv()
+ */
+ssize_t busy_poll_recv(int sock, void *buf, size_t len);
+
+/**
+ * Quay chờ *word khác seen, tối đa hết ngân sách (không giữ khóa nào khi gọi)
+ * @return: 1 nếu word đã đổi, 0 nếu hết ngân sách
+ */
+int busy_poll_wait(const unsigned int *word, unsigned int seen);
+
+/**
+ * Ghim thread gọi vào core kế tiếp trong danh sách (xoay vòng); không làm gì nếu không có danh sách
+ */
+void busy_poll_pin_thread(void);
+
+#endif
@@ -2,10 +2,17 @@
 #define CLIENT_UTILS_H
 #include <stddef.h>
 #define BUFFER_SIZE 1024
+#define CLIENT_CACHE_CONVERSATIONS 8    // Số hội thoại được cache lịch sử
+#define CLIENT_CACHE_MAX_LINES 2000     // Số dòng tối đa giữ cho mỗi hội thoại
+#define CLIENT_DOWNLOAD_DIR "downloads"   // Nơi lưu file tải bằng /download <id>
+#define CLIENT_ACK_BATCH 24             // Số tin nhận được thì gửi ngay một dòng ack gộp
+#define CLIENT_ACK_DELAY_MS 100         // Thời gian tối đa giữ ack của tin cũ nhất
 
 // Biến global để track chế độ chat
 extern char current_chat_target[32];
 extern int in_chat_mode;
+extern int compression_enabled;   // Server đã đồng ý nén lịch sử (CAP_ZLIB)
+extern int ack_enabled;           // Server gắn tag ack cho tin realtime (CAP_ACK)
 
 void print_menu();
 void clear_screen();
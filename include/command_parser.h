@@ -0,0 +1,60 @@
+#ifndef COMMAND_PARSER_H
+#define COMMAND_PARSER_H
+
+#include <stddef.h>
+
+// Loại lệnh mà client gửi lên server
+typedef enum {
+    CMD_NONE = 0,    // Dòng rỗng, bỏ qua
+    CMD_EXIT,        // /exit
+    CMD_MENU,        // /menu
+    CMD_USERS,       // /users
+    CMD_GROUPS,      // /groups
+    CMD_STATS,       // /stats
+    CMD_SEND,        // /<target> <msg>
+    CMD_HISTORY,     // |<target> [page]
+    CMD_SEARCH,      // /search <target> <text>
+    CMD_UPLOAD,      // /upload <target> <size> <name>, theo sau là <size> byte dữ liệu thô
+    CMD_DOWNLOAD,    // /download <id>
+    CMD_BROADCAST,   // Tin nhắn thường gửi cho tất cả
+    CMD_PONG,        // /pong, trả lời ping heartbeat
+    CMD_ACK,         // /ack <slot>.<gen>:<seq>+<held_ms> ..., ack gộp của client có CAP_ACK
+    CMD_COUNT
+} CommandType;
+
+// Heartbeat: server gửi dòng HEARTBEAT_PING khi kết nối im lặng, client tự trả lời HEARTBEAT_PONG
+#define HEARTBEAT_PING "@ping"
+#define HEARTBEAT_PONG "/pong"
+
+// Một lát cắt trỏ thẳng vào buffer nhận (không copy)
+typedef struct {
+    const char *ptr;
+    size_t len;
+} Slice;
+
+typedef struct {
+    CommandType type;
+    Slice target;    // Tên lệnh/target sau '/' hoặc '|' (với /search, /upload, /download, /ack:
+                     // từ đầu tiên sau tên lệnh), đã kết thúc bằng '\0' tại chỗ
+    Slice body;      // Phần nội dung sau dấu cách đầu tiên, đã kết thúc bằng '\0' tại chỗ
+} ParsedCommand;
+
+/**
+ * Tra bảng băm hoàn hảo các lệnh dành riêng (menu, users, groups, stats, exit, pong,
+ * search, upload, download, ack)
+ * @return: CMD_EXIT/CMD_MENU/... nếu là lệnh dành riêng, CMD_SEND nếu không
+ */
+CommandType lookup_reserved_command(const char *name, size_t len);
+
+/**
+ * Tách một lệnh (kết thúc bằng '\n' hoặc cuối buffer) trong một lần duyệt.
+ * Buffer bị sửa tại chỗ: '\n' và dấu cách sau target được thay bằng '\0'
+ * để target và body dùng được như chuỗi C mà không cần copy.
+ * @param cursor: Vị trí bắt đầu trong buffer nhận
+ * @param end: Cuối dữ liệu hợp lệ (end[0] phải ghi được, thường là '\0')
+ * @param cmd: Kết quả phân tích
+ * @return: Vị trí bắt đầu lệnh tiếp theo, hoặc NULL nếu đã hết dữ liệu
+ */
+char *parse_next_command(char *cursor, char *end, ParsedCommand *cmd);
+
+#endif
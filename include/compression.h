@@ -0,0 +1,54 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stddef.h>
+
+// Nén zlib cho lịch sử và các lượt gửi lớn, được thỏa thuận lúc đăng nhập:
+// client gửi "user:pass +zlib", server trả "Login successful [zlib]" nếu đồng ý.
+// Mỗi khối nén trên dây có dạng:  "@z <raw_len> <comp_len>\n" + comp_len byte deflate.
+// Tin nhắn real-time ngắn không bao giờ bị nén.
+
+#define CAP_ZLIB 0x1
+#define CAP_ZLIB_TOKEN "+zlib"
+#define CAP_ZLIB_ACK "[zlib]"
+#define COMPRESS_BLOCK_MARKER "@z "
+#define COMPRESS_THRESHOLD 2048          // Chỉ nén khối có ít nhất từng này byte
+#define REPLY_CHUNK_SIZE (16 * 1024)     // Kích thước khối gom trước khi gửi/nén (cũng là
+                                         // đơn vị xen kẽ của làn bulk, xem outbound.h)
+
+// Bộ gom phản hồi nhiều dòng (lịch sử, tìm kiếm...) để gửi theo khối qua làn bulk
+typedef struct {
+    int sock;
+    int compress;       // Phiên đã thỏa thuận CAP_ZLIB
+    char *data;
+    size_t len;
+    int failed;
+} ReplyBuffer;
+
+void reply_init(ReplyBuffer *rb, int sock, int compress);
+
+/**
+ * Thêm text vào phản hồi, tự gửi khi khối đầy
+ * @return: 0 nếu thành công, -1 nếu socket lỗi
+ */
+int reply_append(ReplyBuffer *rb, const char *text);
+
+/**
+ * Còn đủ chỗ để thêm len byte mà không phải gửi khối hiện tại không.
+ * Dùng khi đang giữ khóa để không bao giờ chờ làn bulk lúc giữ khóa.
+ */
+int reply_has_room(const ReplyBuffer *rb, size_t len);
+
+/**
+ * Gửi khối đang gom (có thể chờ nếu làn bulk đầy)
+ * @return: 0 nếu thành công, -1 nếu socket lỗi
+ */
+int reply_flush(ReplyBuffer *rb);
+
+/**
+ * Gửi phần còn lại và giải phóng bộ đệm
+ * @return: 0 nếu thành công, -1 nếu socket lỗi
+ */
+int reply_finish(ReplyBuffer *rb);
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef CONVERSATION_STORE_H
+#define CONVERSATION_STORE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/types.h>
+
+// Lưu trữ hội thoại theo segment.
+// File conversation_<key>.txt là phần "head" đang được append. Compactor chạy nền
+// định kỳ cuộn head thành segment bất biến trong thư mục segments/ cạnh head,
+// gộp các segment cũ thành archive (.arc) kèm file chỉ mục (.idx), và xóa
+// segment/archive theo chính sách retention của từng hội thoại.
+// Danh sách các phần được giữ trong bộ nhớ và được bảo vệ bởi file_mutex.
+//
+// Hội thoại được chia trên nhiều thư mục gốc (mỗi gốc nên nằm trên một đĩa riêng) theo
+// hash ổn định của stem (tên head bỏ ".txt"): gốc = hash % số gốc, rồi vào thư mục con
+// <gốc>/<hh>/ (hh = byte cao của hash, 256 thư mục) để mỗi thư mục không quá nhiều file.
+// Mỗi gốc có một thread writer: save_conversation() chỉ cấp seq và xếp dòng vào hàng đợi
+// của gốc, writer gom các dòng của cùng một file thành một lần ghi. Trước khi đọc hoặc cuộn
+// một hội thoại, các dòng còn chờ của chính hội thoại đó được ghi xong (đọc thấy ngay điều
+// vừa gửi). Gốc đầu tiên còn chứa checkpoint, journal, file layout và attachments.
+
+#ifndef SEGMENT_ROLL_BYTES
+#define SEGMENT_ROLL_BYTES (1024 * 1024)          // Cuộn head khi vượt kích thước này
+#endif
+#ifndef ARCHIVE_MERGE_SEGMENTS
+#define ARCHIVE_MERGE_SEGMENTS 8                  // Gộp khi có từng này segment
+#endif
+#ifndef COMPACT_INTERVAL_SEC
+#define COMPACT_INTERVAL_SEC 30
+#endif
+#ifndef COMPACT_IO_BYTES_PER_SEC
+#define COMPACT_IO_BYTES_PER_SEC (8 * 1024 * 1024) // Giới hạn I/O của compactor
+#endif
+#ifndef CHECKPOINT_INTERVAL_SEC
+#define CHECKPOINT_INTERVAL_SEC 300               // Ghi checkpoint ít nhất mỗi khoảng này nếu có thay đổi
+#endif
+#define ARCHIVE_INDEX_STRIDE 64                   // Một mục chỉ mục mỗi 64 dòng
+#define SEGMENT_DIR_NAME "segments"
+
+#define STORE_MAX_ROOTS 16
+#define STORE_SHARD_DIRS 256                      // Thư mục con mỗi gốc
+#ifndef STORE_WRITER_QUEUE_MAX
+#define STORE_WRITER_QUEUE_MAX 65536              // Dòng chờ mỗi gốc; đầy thì người ghi chờ trước file_mutex
+#endif
+#define STORE_WRITER_BATCH 256                    // Dòng tối đa writer lấy mỗi lượt
+// Danh sách gốc lúc bố trí file lần trước; khác danh sách hiện tại (hoặc chưa có, tức bố trí
+// phẳng cũ) thì lúc khởi động các file nằm sai chỗ được chuyển về đúng gốc/thư mục con một lần
+#define LAYOUT_NAME "store.layout"
+// Mỗi gốc giữ flock trên file này suốt đời process: hai server không thể dùng chung một gốc
+#define ROOT_LOCK_NAME "store.lock"
+
+// Khôi phục nhanh sau crash: checkpoint chụp danh sách phần, số dòng và seq/kích thước head
+// của mọi hội thoại; journal ghi (và fdatasync) từng thay đổi danh sách phần sau checkpoint.
+// Khởi động = nạp checkpoint + phát lại đuôi journal, không quét thư mục segments.
+// Cả hai nằm trong thư mục hội thoại, mỗi bản ghi kèm checksum nên bản ghi bị cắt dở bị bỏ.
+#define CHECKPOINT_NAME "store.ckpt"
+#define JOURNAL_NAME "store.journal"
+#define CHECKPOINT_VERSION 1
+#define JOURNAL_RECORD_MAX 2048
+
+// Mỗi dòng lưu trữ có dạng "<seq>|[thời gian] sender: msg", seq tăng dần trong từng hội thoại.
+// Dòng cũ không có tiền tố seq được coi là seq 0.
+#define SEQ_SEPARATOR '|'
+
+// Đọc tuần tự toàn bộ một hội thoại: archive -> segment -> head
+typedef struct {
+    char **parts;       // Đường dẫn đầy đủ của từng phần, theo thứ tự thời gian
+    int count;
+    long *lines;        // Số dòng đã biết của từng phần (-1 = chưa đếm)
+    int index;          // Phần đang đọc
+    FILE *f;
+} ConversationReader;
+
+// Vị trí đọc có thể tiếp tục sau khi đã đóng reader (và nhả file_mutex),
+// dùng để gửi lịch sử lớn theo từng chunk
+typedef struct {
+    char path[PATH_MAX];    // Phần đang đọc
+    ino_t inode;            // Phân biệt head mới sau khi head cũ bị cuộn thành segment
+    long offset;            // Byte tiếp theo trong phần đó
+} ReaderPosition;
+
+/**
+ * Đặt các thư mục gốc (gọi trước conversation_store_init). Gốc đầu tiên trở thành
+ * thư mục conversation của server. Không gọi thì chỉ có một gốc là get_conversation_dir().
+ * @param list: Các đường dẫn cách nhau bởi dấu phẩy, ví dụ /disk1/conv,/disk2/conv
+ * @return: 0 nếu thành công, -1 nếu danh sách không hợp lệ
+ */
+int conversation_store_set_roots(const char *list);
+
+/**
+ * Khởi tạo store: khóa từng gốc, chuyển file về đúng gốc nếu bố trí đã đổi, nạp danh sách
+ * segment/archive hiện có và chính sách retention, khởi động writer của từng gốc
+ * @return: 0 nếu thành công, -1 nếu không tạo/khóa được gốc (vd server khác đang dùng)
+ */
+int conversation_store_init(void);
+
+/**
+ * Đường dẫn đầy đủ của file head, ví dụ <gốc>/3f/conversation_group1.txt
+ * @param head_name: Tên file head (không kèm thư mục)
+ */
+void conversation_store_head_path(char *path, size_t size, const char *head_name);
+
+/**
+ * Chờ đến khi hàng đợi writer của gốc chứa head_path còn chỗ. Gọi TRƯỚC khi lấy file_mutex
+ * để một đĩa chậm chỉ chặn người ghi vào gốc đó, không chặn mọi hội thoại khác.
+ * Giới hạn là mềm: các luồng cùng qua được bước này có thể xếp vượt quá một chút.
+ */
+void conversation_store_wait_space(const char *head_path);
+
+/**
+ * Xếp một dòng (chưa có '\n') vào hàng đợi writer của gốc chứa head_path.
+ * Gọi khi đang giữ file_mutex, ngay sau conversation_store_next_seq, để thứ tự trong
+ * file đúng thứ tự seq. Không chờ (xem conversation_store_wait_space); ghi trực tiếp nếu
+ * writer chưa chạy.
+ * @return: 0 nếu thành công, -1 nếu lỗi cấp phát/ghi
+ */
+int conversation_store_append(const char *head_path, const char *line);
+
+/**
+ * Chờ writer của mọi gốc ghi hết các dòng đang chờ (gọi trước khi tắt server)
+ */
+void conversation_store_flush(void);
+
+/**
+ * Ghi checkpoint (file tạm + fsync + rename) rồi bắt đầu journal mới.
+ * Compactor gọi định kỳ; server gọi thêm một lần lúc tắt.
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+int conversation_store_checkpoint(void);
+
+/**
+ * Khởi động thread compactor chạy nền
+ * @return: 0 nếu thành công
+ */
+int compactor_start(void);
+
+/**
+ * Liệt kê tên file head (không kèm thư mục) của mọi hội thoại trên mọi gốc, kể cả
+ * hội thoại chỉ còn segment. Quét thư mục ngoài khóa rồi chỉ giữ file_mutex lúc đối chiếu
+ * registry; gọi khi KHÔNG giữ file_mutex. Người gọi giải phóng từng tên và mảng.
+ * @return: Số hội thoại
+ */
+int conversation_store_list(char ***names);
+
+/**
+ * Bước 1 của conversation_store_list: các head có trong thư mục con của mọi gốc.
+ * Không cần file_mutex.
+ * @return: Số tên trong *names
+ */
+int conversation_store_scan_heads(char ***names);
+
+/**
+ * Bước 2: bỏ tên trùng với registry rồi thêm mọi hội thoại registry biết là có dữ liệu
+ * (kể cả hội thoại được tạo sau bước 1). Gọi khi đang giữ file_mutex, để người gọi chụp
+ * thêm trạng thái khác trong cùng lần khóa.
+ * @return: Số tên sau khi gộp
+ */
+int conversation_store_merge_registry(char ***names, int count);
+
+/**
+ * Mở reader cho hội thoại có file head là head_path (gọi khi đang giữ file_mutex).
+ * Nếu còn dòng chờ writer, file_mutex được nhả trong lúc chờ rồi lấy lại.
+ * @return: 0 nếu hội thoại có ít nhất một phần, -1 nếu không có
+ */
+int conversation_reader_open(ConversationReader *r, const char *head_path);
+
+/**
+ * Đọc dòng tiếp theo (giống fgets, tự chuyển sang phần kế tiếp)
+ * @return: line, hoặc NULL khi hết
+ */
+char *conversation_reader_next(ConversationReader *r, char *line, size_t size);
+
+/**
+ * Đếm số dòng không rỗng của toàn bộ hội thoại (dùng chỉ mục của archive nếu có)
+ */
+long conversation_reader_count(ConversationReader *r);
+
+/**
+ * Bỏ qua n dòng không rỗng đầu tiên, nhảy thẳng theo chỉ mục trong archive
+ */
+void conversation_reader_skip(ConversationReader *r, long n);
+
+/**
+ * Đặt reader ở phần mới nhất có thể chứa seq after_seq + 1, để đồng bộ delta
+ * không phải đọc lại toàn bộ lịch sử. Người gọi vẫn phải lọc các dòng có seq <= after_seq.
+ */
+void conversation_reader_seek_after(ConversationReader *r, unsigned long long after_seq);
+
+/**
+ * Lưu vị trí đọc hiện tại
+ * @return: 0 nếu thành công, -1 nếu reader đã đọc hết
+ */
+int conversation_reader_tell(ConversationReader *r, ReaderPosition *pos);
+
+/**
+ * Tiếp tục đọc từ vị trí đã lưu (reader vừa được mở lại)
+ * @return: 0 nếu thành công, -1 nếu phần đó đã bị compactor cuộn/gộp/xóa
+ */
+int conversation_reader_resume(ConversationReader *r, const ReaderPosition *pos);
+
+void conversation_reader_rewind(ConversationReader *r);
+void conversation_reader_close(ConversationReader *r);
+
+/**
+ * Xóa mọi segment/archive của hội thoại và làm rỗng head (replica nhận snapshot mới).
+ * Gọi khi đang giữ file_mutex; có thể nhả tạm file_mutex để chờ writer ghi xong.
+ * @param head_name: Tên file head, ví dụ conversation_group1.txt
+ */
+void conversation_store_reset(const char *head_name);
+
+/**
+ * Cấp seq tiếp theo cho hội thoại (gọi khi đang giữ file_mutex).
+ * Seq cuối được nạp lười từ đĩa ở lần ghi đầu tiên; lần đó file_mutex có thể bị nhả tạm
+ * để chờ writer, nên gọi hàm này trước khi chụp trạng thái khác trong cùng lần khóa.
+ */
+unsigned long long conversation_store_next_seq(const char *head_path);
+
+/**
+ * Seq của dòng mới nhất đã cấp cho hội thoại, không cấp seq mới (gọi khi đang giữ file_mutex).
+ * Như conversation_store_next_seq, lần nạp đầu tiên có thể nhả tạm file_mutex.
+ */
+unsigned long long conversation_store_last_seq(const char *head_path);
+
+/**
+ * Tách tiền tố seq của một dòng lưu trữ
+ * @param text: Nếu khác NULL, trỏ tới phần nội dung sau tiền tố
+ * @return: seq, hoặc 0 nếu dòng không có seq
+ */
+unsigned long long parse_line_seq(const char *line, const char **text);
+
+#endif
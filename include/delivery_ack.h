@@ -0,0 +1,65 @@
+#ifndef DELIVERY_ACK_H
+#define DELIVERY_ACK_H
+
+#include <stddef.h>
+
+// Xác nhận đã nhận (ack) cho tin nhắn realtime: PM, group và broadcast.
+// Client đề nghị CAP_ACK lúc đăng nhập ("user:pass +ack"). Khi đó mỗi tin realtime gửi
+// cho nó có thêm tiền tố "~<slot>.<gen>:<seq> ", trong đó slot là hội thoại trong bảng theo
+// dõi của server, gen là thế hệ của slot và seq tăng dần trong hội thoại đó. Client không ack
+// từng tin: nó chỉ nhớ seq lớn nhất đã nhận của mỗi slot.gen và gửi gộp một dòng
+//     /ack <slot>.<gen>:<seq>+<held_ms> <slot>.<gen>:<seq>+<held_ms> ...
+// khi đủ CLIENT_ACK_BATCH tin hoặc tin cũ nhất đã chờ CLIENT_ACK_DELAY_MS
+// (held_ms = thời gian client đã giữ ack của tin đó).
+//
+// Server không giữ trạng thái theo từng người nhận: mỗi hội thoại chỉ có seq đã cấp,
+// high-water mark (seq lớn nhất đã được ai đó ack) và vòng DELIVERY_RING thời điểm gửi
+// của các tin gần nhất. Bộ nhớ là O(số hội thoại), không phụ thuộc số tin × số người nhận.
+// Mỗi mục ack cho một mẫu độ trễ = lúc nhận ack - lúc gửi - held_ms, tức thời gian một
+// vòng server -> client -> server (cận trên của độ trễ giao tin). Mẫu được gom vào
+// histogram lũy thừa 2 (micro giây), xem p50/p90/p99 bằng /stats.
+//
+// Slot không gửi gì trong DELIVERY_IDLE_SEC và đã được ack hết (hoặc không gửi gì trong
+// DELIVERY_STALE_SEC, vd người nhận đã thoát mà chưa ack) được dùng lại cho hội thoại mới
+// với gen mới; ack mang gen cũ bị bỏ qua.
+
+#define CAP_ACK 0x2                      // Cùng không gian bit với CAP_ZLIB
+#define CAP_ACK_TOKEN "+ack"
+#define CAP_ACK_ACK "[ack]"
+#define DELIVERY_TAG_PREFIX '~'          // Tiền tố tag ở dòng server gửi (chỉ server tạo, không phải lệnh)
+#define DELIVERY_ACK_COMMAND "/ack"       // Lệnh ack gộp của client
+
+#ifndef DELIVERY_MAX_CONVERSATIONS
+#define DELIVERY_MAX_CONVERSATIONS 4096  // Bảng đầy (không slot nào rảnh) thì tin của hội thoại mới không được gắn tag
+#endif
+#ifndef DELIVERY_IDLE_SEC
+#define DELIVERY_IDLE_SEC 60             // Slot đã ack hết và không gửi gì lâu hơn thì được dùng lại
+#endif
+#ifndef DELIVERY_STALE_SEC
+#define DELIVERY_STALE_SEC 600           // Slot không gửi gì lâu hơn thì được dùng lại dù còn tin chưa ack
+#endif
+#define DELIVERY_RING 32                 // Số thời điểm gửi giữ lại mỗi hội thoại
+#define DELIVERY_LATENCY_BUCKETS 32      // Bucket i: [2^i, 2^(i+1)) micro giây
+
+/**
+ * Cấp seq cho một tin sắp gửi trong hội thoại key và ghi thời điểm gửi
+ * @param key: Khóa hội thoại (groupId, "user1_user2" hoặc "*" cho broadcast)
+ * @param tag: Nhận "~<slot>.<gen>:<seq> "
+ * @return: Độ dài tag, 0 nếu không theo dõi được (bảng đầy)
+ */
+int delivery_tag(const char *key, char *tag, size_t size);
+
+/**
+ * Xử lý các mục "<slot>.<gen>:<seq>+<held_ms>" cách nhau bởi dấu cách
+ * @return: Số mục hợp lệ (mục của slot đã được dùng lại cho hội thoại khác không tính)
+ */
+int delivery_ack_entries(const char *list);
+
+/**
+ * Ghi số liệu ack dạng "name value\n" (số hội thoại, slot đã dùng lại, tin chưa ai ack,
+ * phân vị độ trễ)
+ * @return: Số byte đã ghi
+ */
+size_t delivery_ack_format(char *buffer, size_t size);
+
+#endif
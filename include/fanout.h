@@ -0,0 +1,43 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "outbound.h"
+#include <stddef.h>
+
+// Fan-out song song cho danh sách người nhận lớn (broadcast, group đông người).
+// Người nhận được chia theo shard kết nối (socket % số worker), mỗi worker có một hàng
+// đợi FIFO riêng. Một fan-out lớn được tách thành một job cho mỗi shard và xếp vào mọi
+// hàng đợi trong cùng một lần giữ khóa, nên mọi người nhận thấy các tin theo cùng thứ tự.
+// Khi còn job chưa xong, fan-out nhỏ cũng đi qua worker để không vượt lên trước tin cũ.
+// Job giữ tham chiếu tới hàng đợi của người nhận, không giữ fd: khi job tới lượt, fd có thể
+// đã được cấp lại cho một kết nối khác. Việc gửi không bao giờ chờ (outbox_push), nên một
+// người nhận chậm chỉ bị bỏ tin của chính nó mà không chặn cả shard.
+
+#define FANOUT_MAX_WORKERS 64
+#define FANOUT_DEFAULT_WORKERS 4
+#define FANOUT_DEFAULT_THRESHOLD 512   // Số người nhận tối thiểu để chia cho worker
+#define FANOUT_STACK_RECIPIENTS 256    // Danh sách người nhận nhỏ hơn thế nằm trên stack
+
+/**
+ * Khởi động các worker fan-out
+ * @param workers: Số worker (0 = luôn gửi trên thread gọi)
+ * @param threshold: Số người nhận tối thiểu để chia cho worker
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+int fanout_start(int workers, int threshold);
+
+/**
+ * Chờ các job còn lại xong rồi dừng mọi worker
+ */
+void fanout_stop(void);
+
+/**
+ * Gửi cùng một dữ liệu tới danh sách hàng đợi. Danh sách nhỏ được gửi ngay trên thread
+ * gọi; danh sách lớn được chia theo shard cho các worker và hàm trả về ngay.
+ * @param boxes: Hàng đợi của người nhận, lấy bằng outbox_acquire trong clients_mutex.
+ *               Hàm nhận các tham chiếu và tự trả sau khi gửi (kể cả khi lỗi); không giữ lại mảng.
+ * @return: 0 nếu đã gửi/xếp hàng, -1 nếu không cấp phát được job
+ */
+int fanout_send(Outbox **boxes, int count, OutboundLane lane, const char *data, size_t len);
+
+#endif
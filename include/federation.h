@@ -0,0 +1,60 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <stddef.h>
+
+// Liên kết nhiều tiến trình socket_server thành một cụm chat.
+// Mỗi node lắng nghe kết nối liên node ở cổng (port client + FEDERATION_PORT_OFFSET),
+// chủ động kết nối tới từng peer, công bố presence của các phiên local
+// và chuyển tiếp PM/group/broadcast theo frame được gom batch.
+// Cổng liên node chỉ bind vào địa chỉ được cấu hình (mặc định loopback). Frame đầu tiên
+// phải là HELLO mang node_id của một peer đã cấu hình và shared secret của cụm; mọi frame
+// đến trước một HELLO hợp lệ làm kết nối bị đóng. Liên kết không mã hóa: secret chỉ chặn
+// được peer lạ, nên cổng liên node vẫn phải nằm trong mạng riêng của cụm.
+
+#define FEDERATION_PORT_OFFSET 1000
+#define MAX_PEERS 16
+#define FEDERATION_BATCH_US 500          // Cửa sổ gom frame trước khi gửi
+#define FEDERATION_BATCH_BYTES 16384     // Gửi ngay khi batch vượt ngưỡng này
+#define FEDERATION_DEFAULT_BIND "127.0.0.1"
+#define FEDERATION_SECRET_MAX 128
+
+/**
+ * Khởi tạo federation
+ * @param node_id: Định danh node này (mặc định là port client)
+ * @param port: Port client của node này
+ * @param peer_list: Danh sách peer "[id@]host:port,..." (port client của peer), NULL nếu chạy đơn
+ * @param bind_addr: Địa chỉ IPv4 cho cổng liên node, NULL = FEDERATION_DEFAULT_BIND
+ * @param secret_path: File chứa shared secret của cụm (dòng đầu tiên), bắt buộc khi có peer
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+int federation_init(int node_id, int port, const char *peer_list, const char *bind_addr, const char *secret_path);
+int federation_enabled(void);
+
+// Presence của các phiên local
+void federation_publish_login(const char *username);
+void federation_publish_logout(const char *username);
+
+/**
+ * Tìm node đang giữ phiên của username
+ * @return: node_id của node từ xa, hoặc -1 nếu không có
+ */
+int federation_find_user(const char *username);
+
+/**
+ * Ghi danh sách user đang online ở các node khác vào buffer
+ * @return: Số byte đã ghi
+ */
+size_t federation_list_remote_users(char *buffer, size_t size);
+
+/**
+ * Số user đang online ở các node khác
+ */
+int federation_remote_user_count(void);
+
+// Chuyển tiếp tin nhắn tới các node khác
+int federation_forward_private(const char *sender, const char *target, const char *msg);
+void federation_forward_group(const char *sender, const char *groupId, const char *msg);
+void federation_forward_broadcast(const char *sender, const char *msg);
+
+#endif
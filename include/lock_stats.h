@@ -0,0 +1,65 @@
+#ifndef LOCK_STATS_H
+#define LOCK_STATS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Đo tranh chấp của hai mutex toàn cục clients_mutex và file_mutex.
+// Bật lúc build (make LOCK_STATS=1, tức -DLOCK_STATS); khi tắt, MUTEX_LOCK/MUTEX_UNLOCK
+// chỉ là pthread_mutex_lock/unlock. Khi bật, mỗi lần lấy khóa ghi lại: số lần lấy, số lần
+// phải chờ, histogram thời gian chờ và thời gian giữ (bucket lũy thừa 2 theo ns), và vị trí
+// (file:dòng) đã chờ lâu nhất / giữ khóa lâu nhất. Số liệu chỉ được cập nhật khi đang giữ
+// chính khóa đó nên không cần atomic. Xem bằng /stats, xóa bằng "/stats locks reset".
+
+#define LOCK_STATS_BUCKETS 32   // Bucket i: [2^i, 2^(i+1)) ns, bucket 0 gồm cả 0 (không phải chờ)
+
+#ifdef LOCK_STATS
+
+typedef struct {
+    const char *name;
+    unsigned long acquisitions;
+    unsigned long contended;            // Lần lấy khóa phải chờ (trylock thất bại)
+    unsigned long long wait_ns_total;
+    unsigned long long hold_ns_total;
+    unsigned long long wait_max_ns;
+    unsigned long long hold_max_ns;
+    const char *wait_max_site;
+    const char *hold_max_site;
+    unsigned long wait_hist[LOCK_STATS_BUCKETS];
+    unsigned long hold_hist[LOCK_STATS_BUCKETS];
+    uint64_t acquired_ns;               // Của người đang giữ khóa
+    const char *holder_site;
+} LockStats;
+
+extern LockStats clients_mutex_stats;
+extern LockStats file_mutex_stats;
+
+void lock_stats_lock(pthread_mutex_t *m, LockStats *st, const char *site);
+void lock_stats_unlock(pthread_mutex_t *m, LockStats *st);
+
+#define LOCK_STATS_STR2(x) #x
+#define LOCK_STATS_STR(x) LOCK_STATS_STR2(x)
+#define MUTEX_LOCK(m) lock_stats_lock(&(m), &m##_stats, __FILE__ ":" LOCK_STATS_STR(__LINE__))
+#define MUTEX_UNLOCK(m) lock_stats_unlock(&(m), &m##_stats)
+
+#else
+
+#define MUTEX_LOCK(m) pthread_mutex_lock(&(m))
+#define MUTEX_UNLOCK(m) pthread_mutex_unlock(&(m))
+
+#endif
+
+/**
+ * Ghi số liệu của mọi khóa được đo dạng "name value\n"
+ * @return: Số byte đã ghi (0 nếu build không bật LOCK_STATS)
+ */
+size_t lock_stats_format(char *buffer, size_t size);
+
+/**
+ * Xóa số liệu (bắt đầu một lượt đo mới)
+ * @return: 0 nếu thành công, -1 nếu build không bật LOCK_STATS
+ */
+int lock_stats_reset(void);
+
+#endif
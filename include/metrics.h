@@ -0,0 +1,61 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+
+// Các chỉ số runtime của server, xem bằng lệnh /stats
+typedef enum {
+    METRIC_REPL_FOLLOWERS = 0,     // Số follower đang kết nối (primary)
+    METRIC_REPL_HEAD_SEQ,          // Seq mới nhất của replication log (primary)
+    METRIC_REPL_APPLIED_SEQ,       // Seq đã áp dụng (follower)
+    METRIC_REPL_PRIMARY_SEQ,       // Seq mới nhất mà primary báo về (follower)
+    METRIC_REPL_LAG_RECORDS,       // Độ trễ replication tính theo số bản ghi (follower)
+    METRIC_REPL_LAG_MS,            // Độ trễ replication tính theo ms (follower)
+    METRIC_REPL_SNAPSHOTS,         // Số lần phải đồng bộ lại toàn bộ
+    METRIC_COMPRESS_BLOCKS,        // Số khối lịch sử đã gửi dạng nén
+    METRIC_COMPRESS_RAW_BYTES,     // Tổng byte trước khi nén
+    METRIC_COMPRESS_WIRE_BYTES,    // Tổng byte thực gửi (header + payload nén)
+    METRIC_COMPRESS_CPU_US,        // Thời gian CPU dùng để nén (micro giây)
+    METRIC_TRACE_SAMPLE_RATE,      // Tracing: lấy 1 trên N lệnh (0 = tắt)
+    METRIC_TRACE_SAMPLES,          // Số lệnh đã được trace
+    METRIC_ATTACH_UPLOADS,         // Số file/tin nhắn lớn đã nhận
+    METRIC_ATTACH_UPLOAD_BYTES,    // Tổng byte đã nhận qua upload
+    METRIC_ATTACH_DOWNLOADS,       // Số lượt tải attachment
+    METRIC_ACCEPTS,                // Tổng số kết nối đã accept
+    METRIC_ACCEPT_BATCH_MAX,       // Số kết nối lớn nhất nhận được trong một lần thức dậy
+    METRIC_COALESCE_WRITES,        // Số lần writer ghi tin nhắn thường xuống socket
+    METRIC_COALESCE_ITEMS,         // Số tin nhắn đã ghi trong các lần đó
+    METRIC_FANOUT_WORKERS,         // Số worker fan-out đang chạy
+    METRIC_FANOUT_PARALLEL,        // Số fan-out đã được chia cho các worker
+    METRIC_FANOUT_DROPPED,         // Số lần bỏ tin của người nhận có làn realtime đầy
+    METRIC_PRIVATE_DROPPED,        // Số tin riêng bị bỏ vì người nhận chưa có/đã hủy hàng đợi
+    METRIC_SESSIONS,               // Số phiên đang mở (Session trong slab)
+    METRIC_SESSION_LARGE_BUFFERS,  // Số buffer nhận lớn đang được phiên mượn
+    METRIC_SYMBOLS,                // Số username/groupId đã intern
+    METRIC_TIMERS,                 // Số timer đang chờ trong timer wheel
+    METRIC_LOGIN_TIMEOUTS,         // Số kết nối bị đóng vì không đăng nhập kịp
+    METRIC_IDLE_REAPED,            // Số kết nối bị đóng vì im lặng quá lâu
+    METRIC_HEARTBEAT_PINGS,        // Số ping heartbeat đã gửi
+    METRIC_QUEUE_EVICTIONS,        // Số kết nối bị đóng vì hàng đợi gửi kẹt quá hạn
+    METRIC_BUSY_POLL_HITS,         // Số lần chờ có dữ liệu trong lúc quay (chế độ độ trễ thấp)
+    METRIC_BUSY_POLL_SLEEPS,       // Số lần hết ngân sách quay và phải ngủ
+    METRIC_STORE_QUEUED,           // Số dòng hội thoại đang chờ writer của các gốc
+    METRIC_STORE_WRITES,           // Số lần writer ghi một nhóm dòng vào một file head
+    METRIC_DELIVERY_TAGGED,        // Số tin realtime đã gắn tag ack (mỗi tin một lần, không theo người nhận)
+    METRIC_DELIVERY_UNTRACKED,     // Số tin không gắn được tag vì bảng hội thoại đầy
+    METRIC_DELIVERY_ACK_BATCHES,   // Số dòng ack gộp client đã gửi
+    METRIC_DELIVERY_ACKS,          // Số mục ack hợp lệ trong các dòng đó
+    METRIC_COUNT
+} MetricId;
+
+void metrics_add(MetricId id, long value);
+void metrics_set(MetricId id, long value);
+long metrics_get(MetricId id);
+
+/**
+ * Ghi toàn bộ chỉ số dạng "name value\n" vào buffer
+ * @return: Số byte đã ghi
+ */
+size_t metrics_format(char *buffer, size_t size);
+
+#endif
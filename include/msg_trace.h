@@ -0,0 +1,60 @@
+#ifndef MSG_TRACE_H
+#define MSG_TRACE_H
+
+#include <stdint.h>
+
+// Tracing độ trễ theo từng lệnh, có lấy mẫu (bật bằng socket_server -T trace.json).
+// Mỗi lệnh được chọn mẫu ghi lại các giai đoạn: chờ recv, parse, handler, copy
+// danh sách client, save_conversation (xếp dòng cho writer của store), send tới từng người nhận.
+// Sự kiện nằm trong buffer vòng riêng của từng thread và được xuất ra file
+// dạng Chrome/Perfetto trace-event JSON bằng "/stats trace dump".
+// Tỉ lệ lấy mẫu đổi lúc chạy bằng "/stats trace <N>" (1 = mọi lệnh, 0 = tắt).
+
+#define TRACE_BUFFER_EVENTS 8192        // Số sự kiện giữ lại mỗi thread
+#define TRACE_DEFAULT_RATE 100          // Mặc định lấy 1 trên 100 lệnh
+
+// Id của lệnh đang được trace trên thread hiện tại (0 = không trace)
+extern __thread uint64_t msg_trace_current;
+
+static inline int msg_trace_active(void) {
+    return msg_trace_current != 0;
+}
+
+/**
+ * Bật tracing, file kết quả ghi ở out_path khi dump
+ * @return: 0 nếu thành công
+ */
+int msg_trace_init(const char *out_path);
+
+int msg_trace_enabled(void);
+void msg_trace_set_rate(unsigned every_n);
+unsigned msg_trace_get_rate(void);
+
+/**
+ * Quyết định có trace lệnh sắp xử lý không; nếu có, gán msg_trace_current
+ * @return: Id của lệnh được trace, 0 nếu không
+ */
+uint64_t msg_trace_begin(void);
+void msg_trace_end(void);
+
+// Thời gian hiện tại tính bằng micro giây (CLOCK_MONOTONIC)
+uint64_t msg_trace_now(void);
+
+/**
+ * Ghi một giai đoạn của lệnh đang trace
+ * @param arg: Thông tin thêm (ví dụ socket người nhận), -1 nếu không có
+ */
+void msg_trace_span(const char *name, uint64_t start_us, uint64_t end_us, int arg);
+
+/**
+ * Ghi toàn bộ buffer của mọi thread ra file JSON
+ * @return: Số sự kiện đã ghi, -1 nếu lỗi
+ */
+long msg_trace_dump(void);
+
+// Đánh dấu điểm bắt đầu/kết thúc của một giai đoạn (không tốn gì khi lệnh không được trace)
+#define TRACE_BEGIN(var) uint64_t var = msg_trace_active() ? msg_trace_now() : 0
+#define TRACE_END(name, var, arg) \
+    do { if (var) msg_trace_span((name), (var), msg_trace_now(), (arg)); } while (0)
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef OUTBOUND_H
+#define OUTBOUND_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Hàng đợi gửi đi theo từng kết nối, chia làm các làn ưu tiên.
+// Mỗi client đã đăng nhập có một thread writer riêng lấy dữ liệu từ các làn theo
+// trọng số, nên tin nhắn real-time không phải xếp sau hàng nghìn dòng lịch sử.
+// Dữ liệu bulk được đưa vào theo từng khối (chunk); writer chỉ xen làn khác vào
+// giữa các khối, không bao giờ cắt ngang một khối.
+
+typedef enum {
+    LANE_REALTIME = 0,  // Tin nhắn chat (PM, group, broadcast)
+    LANE_CONTROL,       // Phản hồi lệnh: /menu, /users, lỗi...
+    LANE_BULK,          // Lịch sử, tìm kiếm, đồng bộ delta
+    LANE_COUNT
+} OutboundLane;
+
+// Số mục tối đa mỗi làn được gửi trong một vòng của writer
+#define LANE_WEIGHT_REALTIME 16
+#define LANE_WEIGHT_CONTROL 4
+#define LANE_WEIGHT_BULK 1
+
+// Giới hạn byte chờ gửi mỗi làn; vượt quá thì người gửi phải chờ (flow control)
+#define LANE_LIMIT_REALTIME (4 * 1024 * 1024)
+#define LANE_LIMIT_CONTROL (1024 * 1024)
+#define LANE_LIMIT_BULK (256 * 1024)
+
+#define OUTBOX_MAX_FD 65536
+#define OUTBOX_NOTSENT_LOWAT (32 * 1024)  // Byte chưa gửi tối đa trong kernel mỗi socket
+#define OUTBOX_FILE_SLICE (64 * 1024)     // Byte file gửi mỗi lượt của làn (giữa các lượt làn khác được xen vào)
+#define OUTBOX_WRITER_STACK (64 * 1024)   // Stack của thread writer (mặc định 8MB)
+
+// Gom nhiều tin nhắn nhỏ của một người nhận thành một lần ghi (writev)
+#define OUTBOX_COALESCE_MAX_ITEMS 64          // Số mục tối đa mỗi lần ghi
+#define OUTBOX_COALESCE_MAX_BYTES (64 * 1024) // Byte tối đa mỗi lần ghi
+#define OUTBOX_COALESCE_TARGET 8              // Cửa sổ đủ dài để gom khoảng chừng này mục
+#define OUTBOX_COALESCE_IDLE_US 100000        // Khoảng cách được coi là rảnh (chặn trung bình trượt)
+
+// Người nhận không đọc nữa (peer chết, cửa sổ TCP bằng 0) làm người gửi chờ mãi ở làn đầy.
+// Khi có người gửi phải chờ, hàng đợi đặt một hạn; tới hạn mà writer không gửi được gì thêm
+// thì kết nối bị loại bỏ và người gửi được giải phóng.
+#ifndef OUTBOX_EVICT_SEC
+#define OUTBOX_EVICT_SEC 30
+#endif
+
+#define OUTBOX_FLUSH_ON_CLOSE_MS 1000  // Chờ tối đa để phản hồi cuối được gửi trước khi server đóng kết nối
+
+typedef struct Outbox Outbox;
+
+/**
+ * Tạo hàng đợi và thread writer cho socket (gọi sau khi client đăng nhập)
+ * @return: 0 nếu thành công, -1 nếu lỗi (khi đó dữ liệu được gửi trực tiếp)
+ */
+int outbox_create(int sock);
+
+/**
+ * Bật cửa sổ gom: khi tin nhắn tới dày, writer chờ thêm tối đa max_us micro giây để
+ * gom các tin tiếp theo vào cùng một lần ghi. Cửa sổ thực tế tự co theo khoảng cách
+ * giữa các tin và bằng 0 khi lưu lượng thưa. Các mục đã chờ sẵn luôn được gom, kể cả khi tắt.
+ * @param max_us: Độ trễ thêm tối đa mỗi tin nhắn (0 = tắt)
+ */
+void outbox_set_coalesce_window(unsigned int max_us);
+
+/**
+ * Đặt hạn loại bỏ hàng đợi kẹt (giây, 0 = tắt)
+ */
+void outbox_set_evict_timeout(unsigned int sec);
+
+/**
+ * Dừng writer, bỏ dữ liệu còn chờ và giải phóng hàng đợi (gọi trước khi đóng socket)
+ */
+void outbox_destroy(int sock);
+
+/**
+ * Đưa dữ liệu vào làn của socket. Nếu socket chưa có hàng đợi thì gửi trực tiếp.
+ * Chờ nếu làn đang đầy.
+ * @return: 0 nếu thành công, -1 nếu kết nối đã hỏng
+ */
+int outbox_send(int sock, OutboundLane lane, const char *data, size_t len, const char *error_context);
+
+/**
+ * Như outbox_send nhưng không bao giờ chờ (dùng từ callback của timer), xem outbox_push
+ * @return: 0 nếu đã xếp vào, -1 nếu socket không có hàng đợi, làn đầy hoặc kết nối đã hỏng
+ */
+int outbox_post(int sock, OutboundLane lane, const char *data, size_t len);
+
+/**
+ * Chờ writer gửi hết mọi làn của socket, dùng trước khi server chủ động đóng kết nối để
+ * phản hồi cuối (lý do đóng) không bị bỏ cùng hàng đợi
+ * @param timeout_ms: Thời gian chờ tối đa (client không đọc thì không chờ mãi)
+ * @return: 0 nếu đã gửi hết (hoặc socket không có hàng đợi), -1 nếu hết hạn hoặc kết nối đã hỏng
+ */
+int outbox_flush(int sock, unsigned int timeout_ms);
+
+/**
+ * Lấy tham chiếu tới hàng đợi của socket, để gửi sau mà không phải giữ fd (fd có thể đã được
+ * đóng và cấp lại cho kết nối khác). Gọi khi đang giữ clients_mutex: fd của client chỉ bị
+ * đóng trong clients_mutex, nên hàng đợi lấy được chắc chắn thuộc đúng client đó.
+ * @return: Hàng đợi (trả bằng outbox_release), NULL nếu socket chưa có hoặc đã hủy hàng đợi
+ */
+Outbox *outbox_acquire(int sock);
+
+void outbox_release(Outbox *box);
+
+/**
+ * Socket của hàng đợi (chỉ dùng để chia shard, không dùng để gửi)
+ */
+int outbox_socket(const Outbox *box);
+
+/**
+ * Xếp dữ liệu vào làn của hàng đợi đã giữ tham chiếu, không bao giờ chờ (fan-out: một người
+ * nhận chậm không được chặn những người nhận khác). Làn đầy thì dữ liệu bị bỏ và hạn loại bỏ
+ * được đặt: tới hạn mà writer vẫn không gửi được gì thêm thì kết nối bị loại bỏ.
+ * @return: 0 nếu đã xếp vào, -1 nếu làn đầy hoặc kết nối đã hỏng/đóng
+ */
+int outbox_push(Outbox *box, OutboundLane lane, const char *data, size_t len);
+
+/**
+ * Như outbox_push nhưng chờ nếu làn đang đầy (như outbox_send), cho tin gửi tới một người nhận
+ * @return: 0 nếu đã xếp vào, -1 nếu kết nối đã hỏng/đóng
+ */
+int outbox_push_wait(Outbox *box, OutboundLane lane, const char *data, size_t len);
+
+/**
+ * Đưa một đoạn file vào làn. Writer gửi theo từng slice tối đa OUTBOX_FILE_SLICE byte,
+ * mỗi slice có header riêng "<tag> <offset> <len>\n" (offset tính từ đầu đoạn), nên
+ * các làn khác được xen vào giữa hai slice mà người nhận vẫn tách được dữ liệu.
+ * Nội dung được splice (file -> pipe -> socket), không đi qua user space.
+ * Hàng đợi nhận quyền sở hữu fd và đóng nó khi xong (kể cả khi lỗi).
+ * @return: 0 nếu thành công, -1 nếu kết nối đã hỏng
+ */
+int outbox_send_file(int sock, OutboundLane lane, const char *tag, int fd, off_t offset, size_t len);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+// Replication lịch sử hội thoại từ primary sang các follower qua Unix socket.
+// Primary giữ một replication log trong bộ nhớ (ring các bản ghi append gần nhất);
+// follower gửi "FROM <epoch> <seq>" và nhận tiếp các bản ghi sau seq đó,
+// hoặc một snapshot toàn bộ thư mục conversation nếu seq đã rơi khỏi ring.
+
+#define REPL_RING_SIZE 4096             // Số bản ghi primary giữ lại để follower bắt kịp
+#define REPL_HEARTBEAT_MS 1000          // Chu kỳ heartbeat (mang seq mới nhất của primary)
+#define REPL_RECONNECT_DELAY_SEC 1
+
+/**
+ * Bật replication ở primary
+ * @param socket_path: Đường dẫn Unix socket để follower kết nối
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+int replication_primary_init(const char *socket_path);
+
+/**
+ * Ghi một dòng vừa append vào file hội thoại vào replication log.
+ * Phải được gọi khi đang giữ file_mutex để thứ tự bản ghi khớp thứ tự ghi file.
+ * @param file: Tên file hội thoại (không có thư mục), ví dụ conversation_alice_bob.txt
+ * @param line: Dòng đã ghi (không có '\n')
+ */
+void replication_publish(const char *file, const char *line);
+
+/**
+ * Chạy ở chế độ follower: tail replication stream của primary vào thư mục conversation local
+ * @param socket_path: Unix socket của primary
+ * @return: 0 nếu thread replication đã khởi động
+ */
+int replication_follower_init(const char *socket_path);
+
+#endif
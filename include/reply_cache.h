@@ -0,0 +1,33 @@
+#ifndef REPLY_CACHE_H
+#define REPLY_CACHE_H
+
+// Cache các phản hồi danh sách (/users, /groups) dưới dạng buffer đã định dạng sẵn,
+// chia thành trang. Mỗi loại có một bộ đếm thế hệ (generation): login/logout,
+// thay đổi presence trong cụm và nạp lại group tăng bộ đếm, lần yêu cầu tiếp theo
+// mới dựng lại. Các lần gọi giữa hai lần thay đổi chỉ gửi buffer có sẵn.
+
+#define LIST_PAGE_LINES 50              // Số mục mỗi trang
+#define GROUP_CACHE_BUCKETS 256         // Số bucket của cache nhóm theo user
+
+typedef enum {
+    REPLY_CACHE_USERS = 0,  // Danh sách user online (local + các node khác)
+    REPLY_CACHE_GROUPS,     // Danh sách group của từng user
+    REPLY_CACHE_COUNT
+} ReplyCacheKind;
+
+/**
+ * Đánh dấu cache của một loại đã cũ (gọi sau khi dữ liệu gốc thay đổi)
+ */
+void reply_cache_bump(ReplyCacheKind kind);
+
+/**
+ * Gửi trang page (bắt đầu từ 1, tự giới hạn vào khoảng hợp lệ) của danh sách user online
+ */
+void reply_cache_send_users(int sock, int page);
+
+/**
+ * Gửi trang page của danh sách group mà username là thành viên
+ */
+void reply_cache_send_groups(int sock, const char *username, int page);
+
+#endif
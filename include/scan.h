@@ -0,0 +1,53 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Các kernel dò byte dùng cho đường nóng: tách dòng, tìm ký tự phân cách, tìm chuỗi đánh dấu.
+// Mỗi kernel có bản scalar (SWAR 8 byte), SSE2 và AVX2; bản nhanh nhất CPU hỗ trợ được
+// chọn một lần lúc khởi động chương trình, không cần gọi hàm khởi tạo.
+
+typedef enum {
+    SCAN_ISA_SCALAR,
+    SCAN_ISA_SSE2,
+    SCAN_ISA_AVX2,
+    SCAN_ISA_COUNT
+} ScanIsa;
+
+/**
+ * Tìm byte c đầu tiên trong [p, p + len) (thay cho memchr/strchr)
+ * @return: Con trỏ tới byte đó, NULL nếu không có
+ */
+const char *scan_byte(const char *p, size_t len, char c);
+
+/**
+ * Tìm '\n' đầu tiên trong [p, p + len)
+ * @return: Con trỏ tới '\n', NULL nếu không có
+ */
+static inline const char *scan_newline(const char *p, size_t len) {
+    return scan_byte(p, len, '\n');
+}
+
+/**
+ * Độ dài phần đầu của chuỗi C trước '\n' hoặc '\0' đầu tiên, trong một lượt
+ * (thay cho strcspn(s, "\n") rồi strlen)
+ */
+size_t scan_line_length(const char *s);
+
+/**
+ * Tìm chuỗi needle (nlen byte) trong [hay, hay + len) (thay cho strstr/memmem)
+ * @return: Vị trí xuất hiện đầu tiên, hay nếu nlen == 0, NULL nếu không có
+ */
+const char *scan_marker(const char *hay, size_t len, const char *needle, size_t nlen);
+
+/**
+ * Chuyển sang bộ kernel của isa (dùng cho benchmark)
+ * @return: 0 nếu thành công, -1 nếu CPU không hỗ trợ
+ */
+int scan_set_isa(ScanIsa isa);
+
+int scan_isa_supported(ScanIsa isa);
+ScanIsa scan_active_isa(void);
+const char *scan_isa_name(ScanIsa isa);
+
+#endif
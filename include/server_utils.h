@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include <errno.h>
 #include <pthread.h>
+#include "symbol.h"
+#include "lock_stats.h"
+
+#define MAX_GROUP_MEMBERS 128   // members[256] chứa tối đa chừng này tên (mỗi tên >= 1 ký tự + dấu phẩy)
 
 typedef struct {
     char username[32];
@@ -14,18 +18,32 @@ typedef struct {
     char groupId[32];
     char groupName[64];
     char members[256];
+    SymbolId member_ids[MAX_GROUP_MEMBERS];   // Thành viên đã intern (chỉ user có trong users[])
+    int member_count;
 } Group;
 
 typedef struct {
     int socket;
     char username[32];
+    int caps;           // Khả năng đã thỏa thuận lúc đăng nhập (CAP_ZLIB...)
+    SymbolId user_id;
 } Client;
 
+// Giới hạn có thể ghi đè lúc build (microbench dùng tới 100k)
+#ifndef MAX_CLIENTS
 #define MAX_CLIENTS 100
+#endif
+#ifndef MAX_USERS
+#define MAX_USERS 100
+#endif
+#ifndef MAX_GROUPS
+#define MAX_GROUPS 50
+#endif
 #define BUFFER_SIZE 1024
+#define HISTORY_PAGE_SIZE 20
 
-extern User users[100];
-extern Group groups[50];
+extern User users[MAX_USERS];
+extern Group groups[MAX_GROUPS];
 extern int userCount;
 extern int groupCount;
 extern FILE *logFile;
@@ -36,16 +54,28 @@ extern Client clients[MAX_CLIENTS];
 extern int clientCount;
 extern pthread_mutex_t clients_mutex; // Mutex để đồng bộ hóa truy cập vào clients
 
+FILE *find_data_file(const char *filename);
 void load_users();
 void load_groups();
+// Dựng lại chỉ mục symbol -> user/group (load_* tự gọi; gọi lại nếu sửa users[]/groups[] trực tiếp)
+void index_users(void);
+void index_groups(void);
+int find_group_index(const char *groupId);            // Chỉ số trong groups[], -1 nếu không có
+int group_has_member(int group_index, SymbolId user);
 void log_event(const char *fmt, ...);
 int is_user_in_group(const char *groupId, const char *username);
 int is_group_id(const char *groupId);  // Kiểm tra xem groupId có tồn tại không
 void save_conversation(const char *sender, const char *target, const char *msg, int isGroup);
 void send_conversation_history(int sock, const char *sender, const char *target, int isGroup);
+void send_conversation_delta(int sock, const char *sender, const char *target, int isGroup,
+                             unsigned long long after_seq);
+void send_conversation_page(int sock, const char *sender, const char *target, int isGroup, int page);
+void search_conversation(int sock, const char *sender, const char *target, int isGroup, const char *keyword);
 
 // Client management functions
+int add_client(int socket, const char *username, int caps);  // -1 nếu server đầy, -2 nếu user đã online
 Client *find_client_by_name(const char *username);
+int find_client_socket_caps(const char *username, int *sock, int *caps);  // -1 nếu không online; caps có thể NULL
 void remove_client(int socket);
 int check_login(const char *username, const char *password);
 
@@ -54,11 +84,21 @@ void broadcast(const char *sender, const char *msg);
 void send_private(const char *sender, const char *target, const char *msg);
 void send_group_message(const char *sender, const char *groupId, const char *msg);
 void show_menu(int sock);
-void show_users(int sock);
-void show_groups_for_user(int sock, const char *username);
+
+// Giao tin nhắn cho các phiên trên node này (không chuyển tiếp sang node khác)
+void deliver_broadcast_local(const char *sender, const char *msg);
+int deliver_private_local(const char *sender, const char *target, const char *msg);
+void deliver_group_local(const char *sender, const char *groupId, const char *msg);
+void show_users(int sock, int page);
+void show_groups_for_user(int sock, const char *username, int page);
+void show_stats(int sock);
 
 // Utility functions
 int send_message_safe(int sock, const char *msg, const char *error_context);
+int send_buffer_safe(int sock, const char *data, size_t len, const char *error_context);
+int get_client_caps(int sock);
+const char *get_conversation_dir();
+void set_conversation_dir(const char *dir);
 void get_conversation_filename(char *filename, size_t size, const char *sender, const char *target, int isGroup);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,92 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "server_utils.h"
+#include "timer_wheel.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Trạng thái mỗi kết nối, cấp phát từ slab (nhiều Session liền nhau trong một khối lớn,
+// tái sử dụng qua free list). Buffer nhận mặc định nằm ngay trong Session; chỉ khi một
+// dòng lệnh chưa trọn vượt quá buffer nhỏ đó thì mới mượn một buffer lớn từ pool, và trả
+// lại ngay khi không còn dữ liệu dở. Phiên rảnh vì thế chỉ tốn sizeof(Session).
+
+#define SESSION_INLINE_BUF 256           // Buffer nhận nằm trong Session
+#define SESSION_LARGE_BUF BUFFER_SIZE    // Buffer lớn mượn từ pool khi có dòng dài đang nhận dở
+#define SESSION_SLAB_OBJECTS 256         // Số Session mỗi slab
+#define SESSION_POOL_MAX_FREE 256        // Số buffer lớn rảnh được giữ lại trong pool
+
+// Hạn chờ của phiên, đều dùng chung một Timer nằm trong Session. Thời điểm nhận dữ liệu chỉ
+// được ghi lại (không đụng tới wheel); khi timer nổ mới so với nó để đặt lại cho hạn kế tiếp.
+#ifndef LOGIN_TIMEOUT_SEC
+#define LOGIN_TIMEOUT_SEC 10             // Hạn gửi thông tin đăng nhập sau khi kết nối
+#endif
+#ifndef IDLE_TIMEOUT_SEC
+#define IDLE_TIMEOUT_SEC 0               // Đóng kết nối đã đăng nhập im lặng quá lâu (0 = tắt)
+#endif
+#ifndef HEARTBEAT_INTERVAL_SEC
+#define HEARTBEAT_INTERVAL_SEC 0         // Gửi ping khi im lặng chừng này (0 = tắt)
+#endif
+
+typedef struct Session {
+    struct Session *next_free;
+    int sock;
+    char username[32];
+    char *buf;                  // inline_buf hoặc buffer lớn từ pool
+    size_t buf_cap;
+    int carry;                  // Số byte của dòng chưa trọn ở đầu buf
+    int skipping_long_line;     // Đang bỏ phần còn lại của một dòng dài hơn buffer lớn
+    Timer timer;                // Hạn đăng nhập, rồi hạn ping/im lặng
+    int logged_in;
+    uint64_t last_rx_ms;        // Lần cuối nhận được dữ liệu
+    uint64_t pinged_ms;         // Lần cuối gửi ping
+    char inline_buf[SESSION_INLINE_BUF];
+} Session;
+
+/**
+ * Đặt các hạn chờ (giây, 0 = tắt), gọi trước khi nhận kết nối
+ */
+void session_set_timeouts(int login_sec, int idle_sec, int ping_sec);
+
+/**
+ * Lấy một Session trống từ slab cho socket
+ * @return: Session đã khởi tạo, NULL nếu hết bộ nhớ
+ */
+Session *session_alloc(int sock);
+
+/**
+ * Trả Session (và buffer lớn đang mượn, nếu có) về slab/pool.
+ * Hủy timer của phiên nên phải gọi trước khi đóng socket.
+ */
+void session_free(Session *s);
+
+/**
+ * Đăng nhập xong: bỏ hạn đăng nhập, chuyển sang hạn ping/im lặng (nếu bật)
+ */
+void session_login_done(Session *s);
+
+// Ghi nhận vừa nhận được dữ liệu (gọi sau mỗi recv)
+static inline void session_touch(Session *s) {
+    __atomic_store_n(&s->last_rx_ms, timer_now_ms(), __ATOMIC_RELAXED);
+}
+
+/**
+ * Chuyển buffer nhận sang buffer lớn từ pool, giữ nguyên carry byte đầu
+ * @return: 0 nếu thành công, -1 nếu đã là buffer lớn hoặc hết bộ nhớ
+ */
+int session_grow(Session *s);
+
+/**
+ * Trả buffer lớn về pool khi phần dữ liệu dở (carry) vừa với buffer inline
+ */
+void session_shrink(Session *s);
+
+/**
+ * Ghi thống kê bộ nhớ dạng "name value\n": sizeof(Session), bộ nhớ của các phiên đang sống
+ * (Session + buffer lớn đang mượn, tổng và trung bình mỗi kết nối), dung lượng slab và buffer
+ * rảnh trong pool (báo riêng, không chia cho kết nối), RSS của tiến trình
+ * @return: Số byte đã ghi
+ */
+size_t session_format_memory(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+// Bảng symbol: mỗi username/groupId được intern một lần (lúc nạp dữ liệu) thành một
+// id số nguyên liên tiếp. Các tra cứu nóng (đăng nhập, tìm client, kiểm tra group,
+// thành viên group, fan-out) chỉ còn băm tên một lần rồi dùng id làm chỉ số mảng.
+// Id không bao giờ bị thu hồi; tra cứu không cần khóa, chỉ intern mới khóa.
+
+typedef int SymbolId;
+#define SYMBOL_NONE (-1)
+
+#ifndef MAX_SYMBOLS
+#define MAX_SYMBOLS (MAX_USERS + MAX_GROUPS)
+#endif
+
+/**
+ * Lấy id của name, thêm mới nếu chưa có
+ * @return: Id (>= 0), SYMBOL_NONE nếu tên rỗng/quá dài hoặc bảng đầy
+ */
+SymbolId symbol_intern(const char *name);
+
+/**
+ * Lấy id của name mà không thêm mới (dùng cho dữ liệu từ client)
+ * @return: Id, hoặc SYMBOL_NONE nếu name chưa từng được intern
+ */
+SymbolId symbol_lookup(const char *name);
+
+/**
+ * Tên của id (chuỗi nằm cố định trong bảng), NULL nếu id không hợp lệ
+ */
+const char *symbol_name(SymbolId id);
+
+/**
+ * Số symbol đã intern
+ */
+int symbol_count(void);
+
+#endif
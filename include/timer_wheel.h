@@ -0,0 +1,86 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// Timer wheel phân cấp cho các hạn chờ của server: hạn đăng nhập, dọn kết nối rảnh,
+// ping heartbeat, hạn loại bỏ hàng đợi gửi bị kẹt.
+// TIMER_LEVELS tầng, mỗi tầng TIMER_WHEEL_SLOTS ô; tầng 0 có độ phân giải TIMER_TICK_MS,
+// mỗi tầng sau thô hơn TIMER_WHEEL_SLOTS lần. Timer nằm trong danh sách liên kết đôi của
+// một ô nên đặt/hủy là O(1); timer ở tầng cao được hạ tầng dần khi kim tầng 0 quay hết vòng.
+// Wheel được vòng lặp accept của server quay (poll chờ tới tick có timer kế tiếp), callback
+// chạy trên thread đó nên phải ngắn và không được chờ.
+
+#ifndef TIMER_TICK_MS
+#define TIMER_TICK_MS 10
+#endif
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_LEVELS 4      // Hạn xa nhất ~ TIMER_TICK_MS * 64^4 (~46 giờ), xa hơn thì bị chặn lại
+
+typedef void (*TimerCallback)(void *arg);
+
+// Nhúng trực tiếp trong đối tượng sở hữu (Session, Outbox...), không cấp phát riêng
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer **pprev;   // Con trỏ trỏ tới timer này (đầu ô hoặc next của timer trước)
+    uint64_t expires;       // Tick hết hạn
+    TimerCallback fn;
+    void *arg;
+    int slot;               // tầng * TIMER_WHEEL_SLOTS + ô, -1 nếu không nằm trong wheel
+} Timer;
+
+/**
+ * Tạo eventfd đánh thức vòng lặp I/O khi có timer hết hạn sớm hơn lúc nó định thức dậy
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+int timer_wheel_init(void);
+
+/**
+ * fd để vòng lặp I/O poll (POLLIN) cùng các socket của nó, -1 nếu chưa init
+ */
+int timer_wheel_fd(void);
+
+/**
+ * Khởi tạo timer (chưa được đặt)
+ */
+void timer_init(Timer *t, TimerCallback fn, void *arg);
+
+/**
+ * Đặt (hoặc đặt lại) timer hết hạn sau delay_ms, O(1)
+ */
+void timer_schedule(Timer *t, uint64_t delay_ms);
+
+/**
+ * Hủy timer, O(1). Nếu callback của nó đang chạy trên thread khác thì chờ callback xong,
+ * nên sau khi hàm trả về có thể giải phóng đối tượng chứa timer.
+ */
+void timer_cancel(Timer *t);
+
+/**
+ * Số ms mà vòng lặp I/O được chờ trước lần quay wheel tiếp theo
+ * @return: -1 nếu không có timer nào (chờ vô hạn)
+ */
+int timer_wheel_timeout_ms(void);
+
+/**
+ * Quay wheel tới thời điểm hiện tại và chạy callback của các timer đã hết hạn
+ * @return: Số callback đã chạy
+ */
+int timer_wheel_run(void);
+
+static inline int timer_pending(const Timer *t) {
+    return __atomic_load_n(&t->slot, __ATOMIC_RELAXED) >= 0;
+}
+
+/**
+ * Số timer đang chờ trong wheel
+ */
+long timer_wheel_count(void);
+
+/**
+ * Đồng hồ monotonic thô (ms), rẻ để gọi trên đường nóng
+ */
+uint64_t timer_now_ms(void);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef TRAFFIC_CAPTURE_H
+#define TRAFFIC_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Ghi lại lưu lượng vào server (-C trace.bin) để phát lại bằng build/replay.
+// File trace: magic "CHATTRC1", sau đó là các bản ghi
+//   [u8 type] [u32 session] [u64 ns từ lúc bắt đầu ghi] [u32 len] [payload]
+// Các số nguyên được ghi big-endian.
+// Trace chứa tên đăng nhập và toàn bộ nội dung tin nhắn nên được tạo với quyền 0600;
+// mật khẩu trong bản ghi đăng nhập được thay bằng CAPTURE_REDACTED, replay lấy lại mật khẩu
+// từ file user (-u).
+
+#define CAPTURE_MAGIC "CHATTRC1"
+#define CAPTURE_MAGIC_LEN 8
+#define CAPTURE_RECORD_HEADER (1 + 4 + 8 + 4)
+#define CAPTURE_FLUSH_INTERVAL_MS 1000
+#define CAPTURE_REDACTED "*"
+
+enum {
+    CAPTURE_OPEN = 'O',     // Kết nối mới được accept (payload rỗng)
+    CAPTURE_LOGIN = 'L',    // Chuỗi đăng nhập đã che mật khẩu, ví dụ "alice:* +zlib"
+    CAPTURE_COMMAND = 'C',  // Một lệnh, gồm cả '\n' kết thúc
+    CAPTURE_CLOSE = 'X',    // Phiên kết thúc
+};
+
+/**
+ * Bật capture, ghi vào file path (ghi đè, quyền 0600)
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+int capture_start(const char *path);
+
+int capture_enabled(void);
+
+/**
+ * Cấp id phiên mới và ghi bản ghi CAPTURE_OPEN
+ * @return: id phiên, 0 nếu capture đang tắt
+ */
+uint32_t capture_open_session(void);
+
+/**
+ * Ghi một bản ghi của phiên (không làm gì nếu capture đang tắt)
+ */
+void capture_record(uint32_t session, int type, const char *data, size_t len);
+
+/**
+ * Ghi bản ghi CAPTURE_LOGIN với mật khẩu đã được thay bằng CAPTURE_REDACTED
+ * @param login: Chuỗi đăng nhập nhận từ client ("user:pass [+cap ...]")
+ */
+void capture_login(uint32_t session, const char *login, size_t len);
+
+#endif
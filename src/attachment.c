@@ -0,0 +1,204 @@
+#define _GNU_SOURCE  // splice()
+#include "../include/attachment.h"
+#include "../include/server_utils.h"
+#include "../include/outbound.h"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+static long next_id = 0;
+static pthread_mutex_t id_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void attachment_path(char *path, size_t size, long id, const char *suffix) {
+    snprintf(path, size, "%s/%s/%ld%s", get_conversation_dir(), ATTACH_DIR_NAME, id, suffix);
+}
+
+int attachment_store_init(void) {
+    char dir_path[PATH_MAX];
+    snprintf(dir_path, sizeof(dir_path), "%s/%s", get_conversation_dir(), ATTACH_DIR_NAME);
+    if (mkdir(dir_path, 0777) == -1 && errno != EEXIST) {
+        log_event("[ERROR] Failed to create attachment directory %s: %s", dir_path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to create attachment directory %s: %s\n", dir_path, strerror(errno));
+        return -1;
+    }
+
+    // Tiếp tục đánh số sau attachment lớn nhất đã có
+    DIR *dir = opendir(dir_path);
+    if (dir) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            char *end;
+            long id = strtol(entry->d_name, &end, 10);
+            if (end != entry->d_name && strcmp(end, ".meta") == 0 && id > next_id) {
+                next_id = id;
+            }
+        }
+        closedir(dir);
+    }
+    log_event("Attachment store ready in %s (last id %ld)", dir_path, next_id);
+    return 0;
+}
+
+void attachment_sanitize_name(const char *name, char *out, size_t size) {
+    const char *base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    size_t len = 0;
+    for (; *base && len + 1 < size && len < ATTACH_NAME_MAX; base++) {
+        unsigned char c = (unsigned char)*base;
+        out[len++] = (isalnum(c) || c == '.' || c == '-' || c == '_') ? (char)c : '_';
+    }
+    out[len] = '\0';
+    if (len == 0 || strcmp(out, ".") == 0 || strcmp(out, "..") == 0) {
+        snprintf(out, size, "file");
+    }
+}
+
+/**
+ * Chuyển len byte từ socket sang fd bằng splice qua pipe (socket -> pipe -> fd).
+ * TCP tự điều tiết người gửi khi server ghi đĩa chậm hơn.
+ * @return: 0 nếu thành công, -1 nếu lỗi hoặc kết nối đóng giữa chừng
+ */
+static int splice_from_socket(int sock, int fd, size_t len) {
+    int pipefd[2];
+    if (pipe(pipefd) < 0) {
+        log_event("[ERROR] Failed to create pipe for socket %d: %s", sock, strerror(errno));
+        return -1;
+    }
+    int rc = 0;
+    while (len > 0 && rc == 0) {
+        ssize_t in = splice(sock, NULL, pipefd[1], NULL, len < ATTACH_PIPE_CHUNK ? len : ATTACH_PIPE_CHUNK,
+                            SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (in < 0 && errno == EINTR) continue;
+        if (in <= 0) {
+            log_event("[ERROR] Upload on socket %d ended with %zu bytes missing: %s", sock, len,
+                      in == 0 ? "Connection closed" : strerror(errno));
+            rc = -1;
+            break;
+        }
+        len -= in;
+        while (in > 0) {
+            ssize_t out = splice(pipefd[0], NULL, fd, NULL, in, SPLICE_F_MOVE);
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                log_event("[ERROR] Failed to store upload from socket %d: %s", sock, strerror(errno));
+                rc = -1;
+                break;
+            }
+            in -= out;
+        }
+    }
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return rc;
+}
+
+int attachment_discard(int sock, size_t remaining) {
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull < 0) {
+        return -1;
+    }
+    int rc = splice_from_socket(sock, devnull, remaining);
+    close(devnull);
+    return rc;
+}
+
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+long attachment_receive(int sock, const char *prefix, size_t prefix_len, size_t size,
+                        const char *owner, const char *target, int isGroup, const char *name) {
+    pthread_mutex_lock(&id_mutex);
+    long id = ++next_id;
+    pthread_mutex_unlock(&id_mutex);
+
+    // Ghi vào file tạm, chỉ đổi tên khi đã nhận đủ để không ai tải được file dở dang
+    char part_path[PATH_MAX], data_path[PATH_MAX], meta_path[PATH_MAX];
+    attachment_path(part_path, sizeof(part_path), id, ".part");
+    attachment_path(data_path, sizeof(data_path), id, "");
+    attachment_path(meta_path, sizeof(meta_path), id, ".meta");
+
+    int fd = open(part_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log_event("[ERROR] Failed to create attachment %s: %s", part_path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to create attachment %s: %s\n", part_path, strerror(errno));
+        return attachment_discard(sock, size - prefix_len) < 0 ? -1 : 0;
+    }
+    int rc = prefix_len > 0 ? write_all(fd, prefix, prefix_len) : 0;
+    if (rc == 0) {
+        rc = splice_from_socket(sock, fd, size - prefix_len);
+    }
+    if (close(fd) != 0) {
+        rc = -1;
+    }
+    if (rc < 0) {
+        unlink(part_path);
+        return -1;
+    }
+
+    FILE *meta = fopen(meta_path, "w");
+    if (!meta || fprintf(meta, "%s\n%s\n%d\n%zu\n%s\n", owner, target, isGroup, size, name) < 0 ||
+        fclose(meta) != 0 || rename(part_path, data_path) != 0) {
+        log_event("[ERROR] Failed to finalize attachment %ld: %s", id, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to finalize attachment %ld: %s\n", id, strerror(errno));
+        unlink(part_path);
+        unlink(meta_path);
+        return 0;
+    }
+    metrics_add(METRIC_ATTACH_UPLOADS, 1);
+    metrics_add(METRIC_ATTACH_UPLOAD_BYTES, (long)size);
+    log_event("Stored attachment %ld (%s, %zu bytes) from %s to %s", id, name, size, owner, target);
+    return id;
+}
+
+int attachment_send(int sock, const char *username, long id) {
+    char data_path[PATH_MAX], meta_path[PATH_MAX];
+    attachment_path(data_path, sizeof(data_path), id, "");
+    attachment_path(meta_path, sizeof(meta_path), id, ".meta");
+
+    FILE *meta = fopen(meta_path, "r");
+    if (!meta) {
+        return -1;
+    }
+    char owner[32], target[32], name[ATTACH_NAME_MAX + 1];
+    int isGroup;
+    size_t size;
+    int fields = fscanf(meta, "%31s %31s %d %zu %63s", owner, target, &isGroup, &size, name);
+    fclose(meta);
+    if (fields != 5) {
+        return -1;
+    }
+    int allowed = strcmp(owner, username) == 0 ||
+                  (isGroup ? is_user_in_group(target, username) : strcmp(target, username) == 0);
+    if (!allowed) {
+        return -1;
+    }
+
+    int fd = open(data_path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    // Mỗi slice trên dây: "@file <id> <size> <name> <offset> <len>\n" + len byte
+    char tag[128];
+    snprintf(tag, sizeof(tag), ATTACH_FILE_MARKER "%ld %zu %s", id, size, name);
+    metrics_add(METRIC_ATTACH_DOWNLOADS, 1);
+    log_event("Sending attachment %ld (%zu bytes) to %s", id, size, username);
+    outbox_send_file(sock, LANE_BULK, tag, fd, 0, size);
+    return 0;
+}
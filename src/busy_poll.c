@@ -0,0 +1,154 @@
+#define _GNU_SOURCE  // pthread_setaffinity_np(), cpu_set_t
+#include "../include/busy_poll.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+static unsigned int spin_budget_us = 0;
+static int pin_cpus[CPU_SETSIZE];
+static int pin_count = 0;
+static unsigned int pin_next = 0;
+static int busy_poll_warned = 0;
+static int pin_warned = 0;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/**
+ * Phân tích danh sách core "2,3,6-9" vào pin_cpus
+ * @return: 0 nếu hợp lệ, -1 nếu không
+ */
+static int parse_cpu_list(const char *list) {
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE) {
+            return -1;
+        }
+        long last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first || last >= CPU_SETSIZE) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last && pin_count < CPU_SETSIZE; cpu++) {
+            pin_cpus[pin_count++] = (int)cpu;
+        }
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        p = end;
+    }
+    return pin_count > 0 ? 0 : -1;
+}
+
+int busy_poll_configure(unsigned int spin_us, const char *cpu_list) {
+    if (spin_us > BUSY_POLL_MAX_US) {
+        return -1;
+    }
+    pin_count = 0;
+    if (cpu_list && parse_cpu_list(cpu_list) < 0) {
+        pin_count = 0;
+        return -1;
+    }
+    // Với một core, thread đang quay chỉ chiếm CPU của chính thread mà nó đang chờ
+    cpu_set_t allowed;
+    if (spin_us > 0 && sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) < 2) {
+        fprintf(stderr, "[WARNING] Spinning with only %d CPU available will add latency, not remove it\n",
+                CPU_COUNT(&allowed));
+    }
+    __atomic_store_n(&spin_budget_us, spin_us, __ATOMIC_RELAXED);
+    return 0;
+}
+
+unsigned int busy_poll_budget_us(void) {
+    return __atomic_load_n(&spin_budget_us, __ATOMIC_RELAXED);
+}
+
+void busy_poll_setup_socket(int sock) {
+    int us = (int)busy_poll_budget_us();
+    if (us == 0) {
+        return;
+    }
+    // Tăng quá net.core.busy_read cần CAP_NET_ADMIN; khi đó chỉ còn vòng quay ở user space
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0 &&
+        !__atomic_exchange_n(&busy_poll_warned, 1, __ATOMIC_RELAXED)) {
+        log_event("[WARNING] SO_BUSY_POLL not applied: %s (spinning in user space only)", strerror(errno));
+        fprintf(stderr, "[WARNING] SO_BUSY_POLL not applied: %s (spinning in user space only)\n", strerror(errno));
+    }
+}
+
+ssize_t busy_poll_recv(int sock, void *buf, size_t len) {
+    unsigned int budget = busy_poll_budget_us();
+    if (budget > 0) {
+        uint64_t deadline = now_ns() + (uint64_t)budget * 1000;
+        do {
+            ssize_t n = recv(sock, buf, len, MSG_DONTWAIT);
+            if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                metrics_add(METRIC_BUSY_POLL_HITS, 1);
+                return n;
+            }
+            cpu_relax();
+        } while (now_ns() < deadline);
+        metrics_add(METRIC_BUSY_POLL_SLEEPS, 1);
+    }
+    return recv(sock, buf, len, 0);
+}
+
+int busy_poll_wait(const unsigned int *word, unsigned int seen) {
+    unsigned int budget = busy_poll_budget_us();
+    if (budget == 0) {
+        return 0;
+    }
+    uint64_t deadline = now_ns() + (uint64_t)budget * 1000;
+    // Đọc đồng hồ mỗi 64 vòng, đủ mịn so với ngân sách tính bằng micro giây
+    for (unsigned int spins = 0;; spins++) {
+        if (__atomic_load_n(word, __ATOMIC_ACQUIRE) != seen) {
+            metrics_add(METRIC_BUSY_POLL_HITS, 1);
+            return 1;
+        }
+        if ((spins & 63) == 63 && now_ns() >= deadline) {
+            metrics_add(METRIC_BUSY_POLL_SLEEPS, 1);
+            return 0;
+        }
+        cpu_relax();
+    }
+}
+
+void busy_poll_pin_thread(void) {
+    if (pin_count == 0) {
+        return;
+    }
+    int cpu = pin_cpus[__atomic_fetch_add(&pin_next, 1, __ATOMIC_RELAXED) % pin_count];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0 && !__atomic_exchange_n(&pin_warned, 1, __ATOMIC_RELAXED)) {
+        log_event("[WARNING] Failed to pin thread to CPU %d: %s", cpu, strerror(rc));
+        fprintf(stderr, "[WARNING] Failed to pin thread to CPU %d: %s\n", cpu, strerror(rc));
+    }
+}
@@ -7,20 +7,39 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <time.h>
+#include "../include/compression.h"
+#include "../include/attachment.h"
+#include "../include/scan.h"
+#include "../include/command_parser.h"
+#include "../include/delivery_ack.h"
 
 // Biến global để track chế độ chat
 char current_chat_target[32] = "";
 int in_chat_mode = 0;
+int compression_enabled = 0;
+int ack_enabled = 0;
 
 void print_menu() {
     printf("\n=== COMMAND MENU ===\n");
     printf("/menu              : Show this menu\n");
-    printf("/users             : List online users\n");
-    printf("/groups            : List all groups\n");
+    printf("/users [page]      : List online users\n");
+    printf("/groups [page]     : List your groups\n");
     printf("|<username>        : Open chat with user\n");
     printf("|<groupId>         : View group chat history\n");
     printf("/<username> <msg>  : Send private message\n");
     printf("/<groupId> <msg>   : Send message to group\n");
+    printf("|<target> <page>   : View one page of chat history (1 = newest)\n");
+    printf("/search <target> <text> : Search chat history\n");
+    printf("/upload <target> <file> : Send a file or long text\n");
+    printf("/download <id>     : Download a file\n");
+    printf("/stats             : Show server metrics\n");
     printf("/esc               : Exit chat mode\n");
     printf("/exit              : Logout\n");
     printf("====================\n");
@@ -93,59 +112,468 @@ void parse_command(const char *input, char *target, size_t target_size, char *me
     }
 }
 
+// Thread nhận (trả lời ping) và thread nhập cùng ghi socket: một lệnh (kể cả payload file)
+// phải đi liền một khối
+static pthread_mutex_t send_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Gửi một dòng khi đang giữ send_mutex
+static int write_line(int sock, const char *line) {
+    char out[BUFFER_SIZE + 1];
+    size_t len = strlen(line);
+    if (len > BUFFER_SIZE - 1) {
+        len = BUFFER_SIZE - 1;
+    }
+    memcpy(out, line, len);
+    out[len++] = '\n';
+    return send(sock, out, len, 0);
+}
+
+/**
+ * Gửi một lệnh lên server, kết thúc bằng '\n' để server tách được
+ * nhiều lệnh trong cùng một lần recv
+ * @return: Số byte đã gửi hoặc -1 nếu lỗi
+ */
+static int send_line(int sock, const char *line) {
+    pthread_mutex_lock(&send_mutex);
+    int rc = write_line(sock, line);
+    pthread_mutex_unlock(&send_mutex);
+    return rc;
+}
+
+/**
+ * Gửi file cho target: dòng lệnh "/upload <target> <size> <name>" rồi toàn bộ nội dung bằng sendfile
+ * @param input: "/upload <target> <path>"
+ */
+static void send_file(int sock, const char *input) {
+    char target[32], path[PATH_MAX];
+    if (sscanf(input, "/upload %31s %4095[^\n]", target, path) != 2) {
+        printf("Usage: /upload <target> <path>\n");
+        return;
+    }
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        printf("Cannot open %s: %s\n", path, fd < 0 ? strerror(errno) : "not a regular file");
+        if (fd >= 0) close(fd);
+        return;
+    }
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char header[BUFFER_SIZE];
+    snprintf(header, sizeof(header), "/upload %s %lld %.*s", target, (long long)st.st_size, ATTACH_NAME_MAX, name);
+    pthread_mutex_lock(&send_mutex);
+    if (write_line(sock, header) < 0) {
+        pthread_mutex_unlock(&send_mutex);
+        printf("Failed to send file header: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t sent = sendfile(sock, fd, &offset, st.st_size - offset);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) {
+            printf("Failed to send %s: %s\n", path, sent < 0 ? strerror(errno) : "file shrank");
+            break;
+        }
+    }
+    pthread_mutex_unlock(&send_mutex);
+    close(fd);
+    if (offset == st.st_size) {
+        printf("Sent %s (%lld bytes) to %s\n", name, (long long)st.st_size, target);
+    }
+}
+
+// ========================= HISTORY CACHE =========================
+
+// Cache lịch sử của các hội thoại đã mở gần đây (LRU). Khi mở lại một hội thoại,
+// client in ngay phần đã cache rồi chỉ xin server các tin nhắn sau last_seq.
+typedef struct {
+    char target[32];
+    char **lines;
+    int count;
+    int capacity;
+    unsigned long long last_seq;
+    unsigned long last_used;
+} CachedConversation;
+
+static CachedConversation history_cache[CLIENT_CACHE_CONVERSATIONS];
+static unsigned long cache_clock = 0;
+static char sync_target[32] = "";   // Hội thoại đang chờ delta từ server
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_clear(CachedConversation *c) {
+    for (int i = 0; i < c->count; i++) {
+        free(c->lines[i]);
+    }
+    free(c->lines);
+    memset(c, 0, sizeof(*c));
+}
+
+// Gọi khi đang giữ cache_mutex
+static CachedConversation *cache_lookup(const char *target, int create) {
+    CachedConversation *oldest = &history_cache[0];
+    for (int i = 0; i < CLIENT_CACHE_CONVERSATIONS; i++) {
+        CachedConversation *c = &history_cache[i];
+        if (c->target[0] != '\0' && strcmp(c->target, target) == 0) {
+            c->last_used = ++cache_clock;
+            return c;
+        }
+        if (c->last_used < oldest->last_used) {
+            oldest = c;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    cache_clear(oldest);
+    strncpy(oldest->target, target, sizeof(oldest->target) - 1);
+    oldest->last_used = ++cache_clock;
+    return oldest;
+}
+
+static void cache_append(CachedConversation *c, unsigned long long seq, const char *text) {
+    if (c->count == CLIENT_CACHE_MAX_LINES) {
+        // Bỏ dòng cũ nhất để cache luôn nhỏ
+        free(c->lines[0]);
+        memmove(c->lines, c->lines + 1, (c->count - 1) * sizeof(char *));
+        c->count--;
+    }
+    if (c->count == c->capacity) {
+        int new_capacity = c->capacity ? c->capacity * 2 : 32;
+        char **grown = realloc(c->lines, new_capacity * sizeof(char *));
+        if (!grown) return;
+        c->lines = grown;
+        c->capacity = new_capacity;
+    }
+    c->lines[c->count] = strdup(text);
+    if (c->lines[c->count]) c->count++;
+    if (seq > c->last_seq) c->last_seq = seq;
+}
+
+/**
+ * In phần lịch sử đã cache và đánh dấu hội thoại đang chờ delta
+ * @return: last_seq đã cache (0 nếu chưa có gì)
+ */
+static unsigned long long cache_begin_sync(const char *target) {
+    pthread_mutex_lock(&cache_mutex);
+    CachedConversation *c = cache_lookup(target, 1);
+    if (c->last_seq == 0) {
+        // Chưa có seq nào: server sẽ gửi lại toàn bộ, bỏ các dòng cũ để tránh trùng
+        char keep[32];
+        strcpy(keep, c->target);
+        unsigned long used = c->last_used;
+        cache_clear(c);
+        strcpy(c->target, keep);
+        c->last_used = used;
+    }
+    for (int i = 0; i < c->count; i++) {
+        printf("%s\n", c->lines[i]);
+    }
+    unsigned long long last_seq = c->last_seq;
+    strncpy(sync_target, target, sizeof(sync_target) - 1);
+    sync_target[sizeof(sync_target) - 1] = '\0';
+    pthread_mutex_unlock(&cache_mutex);
+    fflush(stdout);
+    return last_seq;
+}
+
+/**
+ * Xử lý một dòng delta "@<seq> <nội dung>" hoặc "@end <target> <seq>"
+ * @return: 1 nếu đã xử lý, 0 nếu không phải dòng delta
+ */
+static int handle_sync_line(const char *line) {
+    if (line[0] != '@') {
+        return 0;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    if (strncmp(line, "@end ", 5) == 0) {
+        char target[32];
+        unsigned long long seq;
+        if (sscanf(line + 5, "%31s %llu", target, &seq) == 2) {
+            CachedConversation *c = cache_lookup(target, 0);
+            if (c && seq > c->last_seq) c->last_seq = seq;
+        }
+        sync_target[0] = '\0';
+        pthread_mutex_unlock(&cache_mutex);
+        return 1;
+    }
+    char *text = NULL;
+    unsigned long long seq = strtoull(line + 1, &text, 10);
+    if (!text || text == line + 1 || *text != ' ' || sync_target[0] == '\0') {
+        pthread_mutex_unlock(&cache_mutex);
+        return 0;
+    }
+    text++;
+    CachedConversation *c = cache_lookup(sync_target, 1);
+    cache_append(c, seq, text);
+    pthread_mutex_unlock(&cache_mutex);
+    printf("%s\n", text);
+    return 1;
+}
+
+// ========================= RECEIVE PATH =========================
+
+// Phần dữ liệu chưa tạo thành dòng hoàn chỉnh
+typedef struct {
+    char *data;
+    size_t len;
+} PendingLine;
+
+static int pending_append(PendingLine *p, const char *data, size_t len) {
+    char *grown = realloc(p->data, p->len + len + 1);
+    if (!grown) return -1;
+    p->data = grown;
+    memcpy(p->data + p->len, data, len);
+    p->len += len;
+    p->data[p->len] = '\0';
+    return 0;
+}
+
+// Dòng text hoàn chỉnh từ server: dòng delta được đưa vào cache, còn lại in ra
+static void handle_text_line(const char *line) {
+    if (!handle_sync_line(line)) {
+        printf("%s\n", line);
+    }
+}
+
+// Tách các dòng trong text đã giải nén (một khối có thể kết thúc giữa dòng)
+static void feed_text(PendingLine *p, const char *data, size_t len) {
+    if (pending_append(p, data, len) < 0) return;
+    char *line = p->data;
+    char *nl;
+    while ((nl = (char *)scan_newline(line, p->len - (line - p->data))) != NULL) {
+        *nl = '\0';
+        handle_text_line(line);
+        line = nl + 1;
+    }
+    p->len -= line - p->data;
+    memmove(p->data, line, p->len + 1);
+}
+
+// Trạng thái giải nén của khối "@z" đang nhận dở
+typedef struct {
+    z_stream zs;
+    size_t remaining;   // Số byte nén còn phải đọc từ socket
+    PendingLine text;
+} InflateState;
+
+/**
+ * Giải nén dần từng phần payload ngay khi nhận được, không chờ đủ cả khối
+ */
+static void inflate_feed(InflateState *st, const char *data, size_t len) {
+    char out[BUFFER_SIZE * 16];
+    st->zs.next_in = (Bytef *)data;
+    st->zs.avail_in = len;
+    while (st->zs.avail_in > 0) {
+        st->zs.next_out = (Bytef *)out;
+        st->zs.avail_out = sizeof(out);
+        int rc = inflate(&st->zs, Z_NO_FLUSH);
+        feed_text(&st->text, out, sizeof(out) - st->zs.avail_out);
+        if (rc == Z_STREAM_END) break;
+        if (rc != Z_OK) {
+            printf("[Client] Failed to decompress history block: %s\n", st->zs.msg ? st->zs.msg : "corrupt data");
+            break;
+        }
+    }
+    st->remaining -= len;
+    if (st->remaining == 0) {
+        inflateEnd(&st->zs);
+    }
+}
+
+// File đang tải về; mỗi slice có header "@file <id> <size> <name> <offset> <len>"
+typedef struct {
+    FILE *f;
+    size_t remaining;   // Số byte còn lại của slice hiện tại
+    int last_slice;     // Slice hiện tại là slice cuối của file
+    size_t size;
+    char path[PATH_MAX];
+} DownloadState;
+
+static void download_finish(DownloadState *dl) {
+    if (dl->f) {
+        fclose(dl->f);
+        dl->f = NULL;
+        printf("[Client] Saved %s (%zu bytes)\n", dl->path, dl->size);
+    }
+}
+
+static void download_begin(DownloadState *dl, const char *header) {
+    long id;
+    size_t size, offset, len;
+    char name[ATTACH_NAME_MAX + 1];
+    if (sscanf(header + strlen(ATTACH_FILE_MARKER), "%ld %zu %63s %zu %zu", &id, &size, name, &offset, &len) != 5) {
+        return;
+    }
+    if (offset == 0) {
+        // Slice đầu: tên đã được server chuẩn hóa, chỉ cần đặt vào thư mục downloads
+        if (dl->f) fclose(dl->f);
+        mkdir(CLIENT_DOWNLOAD_DIR, 0777);
+        snprintf(dl->path, sizeof(dl->path), "%s/%s", CLIENT_DOWNLOAD_DIR, name);
+        dl->size = size;
+        dl->f = fopen(dl->path, "wb");
+        if (!dl->f) {
+            printf("[Client] Cannot save %s: %s\n", dl->path, strerror(errno));
+        }
+    }
+    dl->remaining = len;
+    dl->last_slice = offset + len >= size;
+    if (len == 0 && dl->last_slice) {
+        download_finish(dl);
+    }
+}
+
+static void download_feed(DownloadState *dl, const char *data, size_t len) {
+    if (dl->f && fwrite(data, 1, len, dl->f) != len) {
+        printf("[Client] Failed to write %s: %s\n", dl->path, strerror(errno));
+        fclose(dl->f);
+        dl->f = NULL;
+    }
+    dl->remaining -= len;
+    if (dl->remaining == 0 && dl->last_slice) {
+        download_finish(dl);
+    }
+}
+
+// ========================= DELIVERY ACK =========================
+
+// Ack chờ gửi của một hội thoại: chỉ cần seq lớn nhất đã nhận
+typedef struct {
+    int slot;
+    unsigned int gen;       // Thế hệ của slot; slot được server dùng lại thì seq bắt đầu lại
+    unsigned long long seq;
+    long long recv_ms;      // Lúc nhận tin seq, để báo held_ms cho server
+} AckEntry;
+
+typedef struct {
+    AckEntry entries[CLIENT_ACK_BATCH];
+    int count;              // Số hội thoại có ack chờ gửi
+    int messages;           // Số tin chưa ack
+    long long first_ms;     // Lúc nhận tin cũ nhất chưa ack
+} AckBatch;
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Gửi một dòng "/ack <slot>.<gen>:<seq>+<held_ms> ..." cho mọi hội thoại đang chờ
+static void ack_flush(int sock, AckBatch *b) {
+    if (b->count == 0) return;
+    // CLIENT_ACK_BATCH mục, mỗi mục tối đa ~50 ký tự, vừa trong một dòng lệnh
+    char line[BUFFER_SIZE];
+    long long now = now_ms();
+    size_t pos = snprintf(line, sizeof(line), "%s", DELIVERY_ACK_COMMAND);
+    for (int i = 0; i < b->count && pos < sizeof(line); i++) {
+        pos += snprintf(line + pos, sizeof(line) - pos, " %d.%u:%llu+%lld",
+                        b->entries[i].slot, b->entries[i].gen, b->entries[i].seq, now - b->entries[i].recv_ms);
+    }
+    send_line(sock, line);
+    b->count = 0;
+    b->messages = 0;
+}
+
+/**
+ * Tách tag "~<slot>.<gen>:<seq> " ở đầu dòng realtime và ghi nhận ack chờ gửi
+ * @return: Phần dòng sau tag (chính line nếu không có tag)
+ */
+static const char *ack_take_tag(int sock, AckBatch *b, const char *line) {
+    int slot, used = 0;
+    unsigned int gen;
+    unsigned long long seq;
+    if (line[0] != DELIVERY_TAG_PREFIX ||
+        sscanf(line + 1, "%d.%u:%llu %n", &slot, &gen, &seq, &used) != 3 || used == 0) {
+        return line;
+    }
+    long long now = now_ms();
+    int i = 0;
+    while (i < b->count && (b->entries[i].slot != slot || b->entries[i].gen != gen)) i++;
+    if (i == b->count) {
+        b->entries[b->count++] = (AckEntry){.slot = slot, .gen = gen, .seq = seq, .recv_ms = now};
+    } else if (seq > b->entries[i].seq) {
+        b->entries[i].seq = seq;
+        b->entries[i].recv_ms = now;
+    }
+    if (b->messages++ == 0) {
+        b->first_ms = now;
+    }
+    if (b->messages >= CLIENT_ACK_BATCH) {
+        ack_flush(sock, b);
+    }
+    return line + 1 + used;
+}
+
 void *recv_thread(void *arg) {
     int sock = *(int *)arg;
-    char buffer[BUFFER_SIZE];
-    char *full_message = NULL;
-    size_t total_len = 0;
+    char buffer[BUFFER_SIZE * 16];
+    PendingLine wire = {0};          // Dòng đang nhận dở từ socket
+    InflateState inflater = {0};
+    DownloadState download = {0};
+    AckBatch acks = {0};
     int len;
-    int expecting_history = 0;
-
-    while ((len = recv(sock, buffer, sizeof(buffer) - 1, 0)) > 0) {
-        buffer[len] = '\0';
-        full_message = realloc(full_message, total_len + len + 1);
-        memcpy(full_message + total_len, buffer, len);
-        total_len += len;
-        full_message[total_len] = '\0';
-
-        // Kiểm tra nếu đang nhận lịch sử chat
-        if (strstr(full_message, "=== History with") != NULL) {
-            expecting_history = 1;
-        }
 
-        // Nếu nhận xong lịch sử hoặc tin nhắn ngắn
-        if (strstr(full_message, "=== End of History ===\n") != NULL || 
-            (!expecting_history && total_len < BUFFER_SIZE - 1)) {
-            
-            // Luôn hiển thị lịch sử khi nhận được
-            if (expecting_history || strstr(full_message, "=== History with") != NULL || 
-                strstr(full_message, "=== End of History") != NULL) {
-                printf("%s", full_message);
-            } 
-            // Nếu đang trong chat mode và không phải lịch sử, đây là tin nhắn mới
-            else if (in_chat_mode) {
-                // Tin nhắn mới trong chat mode
-                printf("%s", full_message);
-            } 
-            // Không trong chat mode, hiển thị bình thường
-            else {
-                printf("%s", full_message);
+    while (1) {
+        // Có ack đang chờ: chỉ đợi dữ liệu tới hạn CLIENT_ACK_DELAY_MS của tin cũ nhất
+        if (acks.messages > 0) {
+            long long wait = acks.first_ms + CLIENT_ACK_DELAY_MS - now_ms();
+            struct pollfd pfd = {.fd = sock, .events = POLLIN};
+            if (wait <= 0 || poll(&pfd, 1, (int)wait) == 0) {
+                ack_flush(sock, &acks);
+                continue;
             }
-            
-            if (strstr(full_message, "=== End of History ===\n") != NULL) {
-                expecting_history = 0;
+        }
+        if ((len = recv(sock, buffer, sizeof(buffer), 0)) <= 0) break;
+        size_t off = 0;
+        while (off < (size_t)len) {
+            if (inflater.remaining > 0 || download.remaining > 0) {
+                size_t *remaining = inflater.remaining > 0 ? &inflater.remaining : &download.remaining;
+                size_t n = (size_t)len - off;
+                if (n > *remaining) n = *remaining;
+                if (inflater.remaining > 0) {
+                    inflate_feed(&inflater, buffer + off, n);
+                } else {
+                    download_feed(&download, buffer + off, n);
+                }
+                off += n;
+                continue;
             }
-            
-            free(full_message);
-            full_message = NULL;
-            total_len = 0;
+
+            const char *nl = scan_newline(buffer + off, len - off);
+            size_t n = nl ? (size_t)(nl - (buffer + off)) : (size_t)len - off;
+            if (pending_append(&wire, buffer + off, n) < 0) break;
+            off += n;
+            if (!nl) break;
+            off++;  // Bỏ qua '\n'
+
+            // Header khối nén "@z <raw_len> <comp_len>", payload theo ngay sau
+            size_t raw_len, comp_len;
+            if (compression_enabled &&
+                strncmp(wire.data, COMPRESS_BLOCK_MARKER, strlen(COMPRESS_BLOCK_MARKER)) == 0 &&
+                sscanf(wire.data + strlen(COMPRESS_BLOCK_MARKER), "%zu %zu", &raw_len, &comp_len) == 2 &&
+                comp_len > 0) {
+                memset(&inflater.zs, 0, sizeof(inflater.zs));
+                if (inflateInit(&inflater.zs) == Z_OK) {
+                    inflater.remaining = comp_len;
+                }
+            } else if (strncmp(wire.data, ATTACH_FILE_MARKER, strlen(ATTACH_FILE_MARKER)) == 0) {
+                // File tải về: dữ liệu thô theo ngay sau header
+                download_begin(&download, wire.data);
+            } else if (strcmp(wire.data, HEARTBEAT_PING) == 0) {
+                // Heartbeat của server: trả lời ngay, không hiển thị
+                send_line(sock, HEARTBEAT_PONG);
+            } else {
+                handle_text_line(ack_enabled ? ack_take_tag(sock, &acks, wire.data) : wire.data);
+            }
+            wire.len = 0;
         }
         fflush(stdout);
     }
 
-    if (full_message) {
-        free(full_message);
-    }
+    free(wire.data);
+    free(inflater.text.data);
+    if (download.f) fclose(download.f);
     printf("\n[Disconnected from server]: %s\n", len == 0 ? "Server closed connection" : strerror(errno));
     close(sock);
     exit(0);
@@ -183,7 +611,7 @@ void handle_user_input(int sock, const char *username) {
 
         // Xử lý lệnh /exit
         if (strcmp(msg, "/exit") == 0) {
-            if (send(sock, "/exit", 5, 0) < 0) {
+            if (send_line(sock, "/exit") < 0) {
                 printf("Failed to send /exit: %s\n", strerror(errno));
             }
             break;
@@ -201,8 +629,22 @@ void handle_user_input(int sock, const char *username) {
             continue;
         }
 
+        // Gửi file: "/upload <target> <path>" -> header "/upload <target> <size> <name>" rồi nội dung file
+        if (strncmp(msg, "/upload ", 8) == 0) {
+            send_file(sock, msg);
+            continue;
+        }
+
         // Xử lý lệnh |username để vào chat mode
         if (msg[0] == '|' && strlen(msg) > 1) {
+            // "|target <page>" chỉ là truy vấn, không vào chat mode
+            if (strchr(msg, ' ')) {
+                if (send_line(sock, msg) < 0) {
+                    printf("Failed to send to server: %s\n", strerror(errno));
+                }
+                continue;
+            }
+
             char target[32] = {0};
             strncpy(target, msg + 1, sizeof(target) - 1);
             target[sizeof(target) - 1] = '\0';
@@ -220,8 +662,11 @@ void handle_user_input(int sock, const char *username) {
                 clear_screen();
                 show_chat_header(current_chat_target);
                 
-                // Gửi lệnh yêu cầu lịch sử chat
-                if (send(sock, msg, strlen(msg), 0) < 0) {
+                // In ngay phần đã cache, chỉ xin server các tin nhắn mới hơn
+                unsigned long long last_seq = cache_begin_sync(current_chat_target);
+                char request[BUFFER_SIZE];
+                snprintf(request, sizeof(request), "|%s @%llu", current_chat_target, last_seq);
+                if (send_line(sock, request) < 0) {
                     printf("Failed to request chat history: %s\n", strerror(errno));
                     in_chat_mode = 0;
                     current_chat_target[0] = '\0';
@@ -251,7 +696,7 @@ void handle_user_input(int sock, const char *username) {
             memcpy(send_msg + 1 + target_len + 1, msg, message_len);
             send_msg[1 + target_len + 1 + message_len] = '\0';
 
-            if (send(sock, send_msg, strlen(send_msg), 0) < 0) {
+            if (send_line(sock, send_msg) < 0) {
                 printf("Failed to send message: %s\n", strerror(errno));
             } else {
                 printf("[You] %s\n", msg);
@@ -260,8 +705,9 @@ void handle_user_input(int sock, const char *username) {
         }
 
         // Xử lý các lệnh khác khi không trong chat mode
-        if (msg[0] == '/' && strcmp(msg, "/menu") != 0 && 
-            strcmp(msg, "/users") != 0 && strcmp(msg, "/groups") != 0) {
+        if (msg[0] == '/' && strcmp(msg, "/menu") != 0 && strncmp(msg, "/users", 6) != 0 &&
+            strncmp(msg, "/groups", 7) != 0 && strncmp(msg, "/stats", 6) != 0 &&
+            strncmp(msg, "/search ", 8) != 0 && strncmp(msg, "/download ", 10) != 0) {
             char target[32] = {0}, message[BUFFER_SIZE] = {0};
             parse_command(msg, target, sizeof(target), message, sizeof(message));
             if (strlen(message) > 0) {
@@ -273,7 +719,7 @@ void handle_user_input(int sock, const char *username) {
             printf("Sending to server: %s\n", msg);
         }
 
-        if (send(sock, msg, strlen(msg), 0) < 0) {
+        if (send_line(sock, msg) < 0) {
             printf("Failed to send to server: %s\n", strerror(errno));
         }
     }
@@ -0,0 +1,122 @@
+#include "../include/command_parser.h"
+#include "../include/scan.h"
+#include <string.h>
+
+// ========================= RESERVED COMMAND TABLE =========================
+
+// Bảng băm hoàn hảo cho các lệnh dành riêng: (ký tự đầu ^ ký tự thứ hai) & 31 của tên lệnh
+// đã khác nhau, nên mỗi lệnh có đúng một ô và việc tra chỉ cần một phép so sánh độ dài + memcmp.
+#define RESERVED_MASK 31u
+#define RESERVED_HASH(a, b) (((unsigned char)(a) ^ (unsigned char)(b)) & RESERVED_MASK)
+
+// Hai ký tự đầu của mọi lệnh dành riêng. Không trùng ô <=> OR các bit bằng tổng các bit
+// (trùng thì phép cộng sinh nhớ).
+#define RESERVED_PREFIXES(X) X('m', 'e') X('u', 's') X('g', 'r') X('s', 't') X('e', 'x') \
+                             X('p', 'o') X('s', 'e') X('u', 'p') X('d', 'o') X('a', 'c')
+#define RESERVED_BIT(a, b) (1ull << RESERVED_HASH(a, b))
+#define RESERVED_OR(a, b) | RESERVED_BIT(a, b)
+#define RESERVED_SUM(a, b) + RESERVED_BIT(a, b)
+_Static_assert((0 RESERVED_PREFIXES(RESERVED_OR)) == (0 RESERVED_PREFIXES(RESERVED_SUM)),
+               "reserved command hash collision");
+
+typedef struct {
+    const char *name;
+    size_t len;
+    CommandType type;
+} ReservedCommand;
+
+static const ReservedCommand reserved_table[RESERVED_MASK + 1] = {
+    [RESERVED_HASH('m', 'e')] = {"menu",     4, CMD_MENU},
+    [RESERVED_HASH('u', 's')] = {"users",    5, CMD_USERS},
+    [RESERVED_HASH('g', 'r')] = {"groups",   6, CMD_GROUPS},
+    [RESERVED_HASH('s', 't')] = {"stats",    5, CMD_STATS},
+    [RESERVED_HASH('e', 'x')] = {"exit",     4, CMD_EXIT},
+    [RESERVED_HASH('p', 'o')] = {"pong",     4, CMD_PONG},
+    [RESERVED_HASH('s', 'e')] = {"search",   6, CMD_SEARCH},
+    [RESERVED_HASH('u', 'p')] = {"upload",   6, CMD_UPLOAD},
+    [RESERVED_HASH('d', 'o')] = {"download", 8, CMD_DOWNLOAD},
+    [RESERVED_HASH('a', 'c')] = {"ack",      3, CMD_ACK},
+};
+
+CommandType lookup_reserved_command(const char *name, size_t len) {
+    if (len < 2) {
+        return CMD_SEND;
+    }
+    const ReservedCommand *entry = &reserved_table[RESERVED_HASH(name[0], name[1])];
+    if (entry->len == len && memcmp(entry->name, name, len) == 0) {
+        return entry->type;
+    }
+    return CMD_SEND;
+}
+
+// ========================= PARSER =========================
+
+char *parse_next_command(char *cursor, char *end, ParsedCommand *cmd) {
+    if (!cursor || cursor >= end) {
+        return NULL;
+    }
+
+    // Tìm cuối dòng; không có '\n' thì cuối buffer là cuối lệnh (client_handler chỉ đưa vào dòng đã trọn)
+    char *line_end = (char *)scan_newline(cursor, end - cursor);
+    char *next = line_end ? line_end + 1 : end;
+    if (!line_end) {
+        line_end = end;
+    }
+    if (line_end > cursor && line_end[-1] == '\r') {
+        line_end--;
+    }
+    *line_end = '\0';
+
+    size_t line_len = line_end - cursor;
+    cmd->target.ptr = cursor;
+    cmd->target.len = 0;
+    cmd->body.ptr = line_end;
+    cmd->body.len = 0;
+
+    if (line_len == 0) {
+        cmd->type = CMD_NONE;
+        return next;
+    }
+
+    if (cursor[0] != '/' && cursor[0] != '|') {
+        cmd->type = CMD_BROADCAST;
+        cmd->body.ptr = cursor;
+        cmd->body.len = line_len;
+        return next;
+    }
+
+    char *name = cursor + 1;
+    char *space = (char *)scan_byte(name, line_end - name, ' ');
+    cmd->target.ptr = name;
+    if (space) {
+        *space = '\0';
+        cmd->target.len = space - name;
+        cmd->body.ptr = space + 1;
+        cmd->body.len = line_end - (space + 1);
+    } else {
+        cmd->target.len = line_end - name;
+    }
+
+    if (cursor[0] == '|') {
+        cmd->type = CMD_HISTORY;
+        return next;
+    }
+    cmd->type = lookup_reserved_command(cmd->target.ptr, cmd->target.len);
+    if (cmd->type == CMD_SEARCH || cmd->type == CMD_UPLOAD || cmd->type == CMD_DOWNLOAD || cmd->type == CMD_ACK) {
+        // "/search <target> <text>": bỏ tên lệnh, target là từ đầu tiên của phần còn lại
+        name = (char *)cmd->body.ptr;
+        space = (char *)scan_byte(name, line_end - name, ' ');
+        cmd->target.ptr = name;
+        if (space) {
+            *space = '\0';
+            cmd->target.len = space - name;
+            cmd->body.ptr = space + 1;
+            cmd->body.len = line_end - (space + 1);
+        } else {
+            cmd->target.len = line_end - name;
+            cmd->body.ptr = line_end;
+            cmd->body.len = 0;
+        }
+    }
+    return next;
+}
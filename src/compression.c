@@ -0,0 +1,106 @@
+#include "../include/compression.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include "../include/outbound.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+static long thread_cpu_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+/**
+ * Nén một khối và gửi kèm header "@z <raw_len> <comp_len>\n"
+ * @return: 0 nếu thành công, 1 nếu không nén được (gửi thô), -1 nếu lỗi socket
+ */
+static int send_compressed_block(int sock, const char *data, size_t len) {
+    long cpu_start = thread_cpu_us();
+    uLongf comp_len = compressBound(len);
+    char *out = malloc(comp_len + 64);
+    if (!out) {
+        return 1;
+    }
+    char *payload = out + 64;
+    if (compress2((Bytef *)payload, &comp_len, (const Bytef *)data, len, Z_DEFAULT_COMPRESSION) != Z_OK ||
+        comp_len >= len) {
+        free(out);
+        return 1;  // Không có lợi, gửi thô
+    }
+
+    char header[64];
+    int header_len = snprintf(header, sizeof(header), "%s%zu %lu\n", COMPRESS_BLOCK_MARKER, len, (unsigned long)comp_len);
+    char *frame = payload - header_len;
+    memcpy(frame, header, header_len);
+    metrics_add(METRIC_COMPRESS_CPU_US, thread_cpu_us() - cpu_start);
+
+    int rc = outbox_send(sock, LANE_BULK, frame, header_len + comp_len, "send compressed block");
+    free(out);
+    if (rc < 0) {
+        return -1;
+    }
+    metrics_add(METRIC_COMPRESS_BLOCKS, 1);
+    metrics_add(METRIC_COMPRESS_RAW_BYTES, (long)len);
+    metrics_add(METRIC_COMPRESS_WIRE_BYTES, (long)(header_len + comp_len));
+    return 0;
+}
+
+int reply_flush(ReplyBuffer *rb) {
+    if (rb->failed || rb->len == 0) {
+        return rb->failed ? -1 : 0;
+    }
+    int rc = 1;
+    if (rb->compress && rb->len >= COMPRESS_THRESHOLD) {
+        rc = send_compressed_block(rb->sock, rb->data, rb->len);
+    }
+    if (rc == 1) {
+        rc = outbox_send(rb->sock, LANE_BULK, rb->data, rb->len, "send reply block");
+    }
+    rb->len = 0;
+    if (rc < 0) {
+        rb->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+void reply_init(ReplyBuffer *rb, int sock, int compress) {
+    rb->sock = sock;
+    rb->compress = compress;
+    rb->data = malloc(REPLY_CHUNK_SIZE);
+    rb->len = 0;
+    rb->failed = rb->data == NULL;
+    if (!rb->data) {
+        log_event("[ERROR] Failed to allocate reply buffer for socket %d", sock);
+    }
+}
+
+int reply_append(ReplyBuffer *rb, const char *text) {
+    if (rb->failed) {
+        return -1;
+    }
+    size_t len = strlen(text);
+    if (rb->len + len > REPLY_CHUNK_SIZE && reply_flush(rb) < 0) {
+        return -1;
+    }
+    if (len > REPLY_CHUNK_SIZE) {
+        return outbox_send(rb->sock, LANE_BULK, text, len, "send reply block");
+    }
+    memcpy(rb->data + rb->len, text, len);
+    rb->len += len;
+    return 0;
+}
+
+int reply_has_room(const ReplyBuffer *rb, size_t len) {
+    return rb->len + len <= REPLY_CHUNK_SIZE;
+}
+
+int reply_finish(ReplyBuffer *rb) {
+    int rc = reply_flush(rb);
+    free(rb->data);
+    rb->data = NULL;
+    return rc;
+}
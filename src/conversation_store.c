@@ -0,0 +1,2206 @@
+#include "../include/conversation_store.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/file.h>
+
+#define STORE_HASH_BUCKETS 4096
+#define MAX_RETENTION_RULES 64
+#define ROOT_PATH_MAX (PATH_MAX / 2)    // Chừa chỗ cho <hh>/segments/<tên file> trong PATH_MAX
+
+// Danh sách segment/archive của một hội thoại (tên file trong thư mục segments)
+typedef struct ConversationParts {
+    char stem[96];                  // Tên file head bỏ ".txt", ví dụ conversation_group1
+    int root;                       // Gốc chứa hội thoại (theo hash của stem)
+    unsigned int shard;             // Thư mục con trong gốc
+    unsigned long queued_lines;     // Số dòng đã xếp cho writer (giữ mutex của gốc)
+    unsigned long written_lines;    // Số dòng writer đã ghi xong (giữ mutex của gốc)
+    char **parts;                   // Sắp xếp theo thứ tự thời gian
+    long *part_lines;               // Số dòng không rỗng của từng phần (-1 = chưa đếm)
+    int count;
+    int capacity;
+    int next_segment;               // Số thứ tự cho segment kế tiếp
+    unsigned long long last_seq;    // Seq của tin nhắn mới nhất
+    int seq_loaded;                 // last_seq đã được nạp từ đĩa chưa
+    // Trạng thái head tại checkpoint gần nhất: seq cuối và kích thước/inode lúc đó
+    unsigned long long ckpt_seq;
+    long long ckpt_head_bytes;      // -1 = không có
+    unsigned long long ckpt_head_inode;
+    struct ConversationParts *next; // Chuỗi trong bucket
+} ConversationParts;
+
+// Chính sách retention: key là phần sau "conversation_" hoặc "*" cho mặc định
+typedef struct {
+    char key[64];
+    long max_age_sec;               // 0 = không giới hạn
+    long long max_bytes;            // 0 = không giới hạn
+} RetentionRule;
+
+// Một dòng chờ writer ghi vào head của hội thoại cp
+typedef struct StoreWrite {
+    struct StoreWrite *next;
+    ConversationParts *cp;
+    size_t len;
+    char data[];                    // Dòng kèm '\n'
+} StoreWrite;
+
+// Một thư mục gốc (thường là một đĩa) cùng hàng đợi và thread writer của nó
+typedef struct {
+    char path[ROOT_PATH_MAX];
+    StoreWrite *head;
+    StoreWrite *tail;
+    long queued;                    // Số dòng trong hàng đợi
+    int running;                    // Writer đã chạy; chưa thì ghi trực tiếp
+    int lock_fd;                    // Giữ flock ROOT_LOCK_NAME, không đóng đến khi process thoát
+    pthread_mutex_t mutex;
+    pthread_cond_t work;            // Báo writer có dòng mới
+    pthread_cond_t done;            // Báo người chờ: writer vừa ghi xong một lượt
+} StoreRoot;
+
+static ConversationParts *store_buckets[STORE_HASH_BUCKETS];
+static RetentionRule retention_rules[MAX_RETENTION_RULES];
+static int retentionRuleCount = 0;
+static StoreRoot store_roots[STORE_MAX_ROOTS];
+static int store_root_count = 0;
+
+// ========================= STORAGE ROOTS =========================
+
+static void add_root(const char *path, size_t len) {
+    StoreRoot *root = &store_roots[store_root_count++];
+    memset(root, 0, sizeof(*root));
+    snprintf(root->path, sizeof(root->path), "%.*s", (int)len, path);
+    root->lock_fd = -1;
+    pthread_mutex_init(&root->mutex, NULL);
+    pthread_cond_init(&root->work, NULL);
+    pthread_cond_init(&root->done, NULL);
+}
+
+int conversation_store_set_roots(const char *list) {
+    if (store_root_count > 0 || !list || !*list) {
+        return -1;
+    }
+    const char *p = list;
+    while (1) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        if (len == 0 || len >= ROOT_PATH_MAX || store_root_count == STORE_MAX_ROOTS) {
+            store_root_count = 0;
+            return -1;
+        }
+        add_root(p, len);
+        if (!comma) {
+            break;
+        }
+        p = comma + 1;
+    }
+    // Gốc đầu tiên cũng là thư mục conversation của server (checkpoint, journal, attachments)
+    set_conversation_dir(store_roots[0].path);
+    return 0;
+}
+
+// Không cấu hình gốc: dùng thư mục conversation mặc định làm gốc duy nhất
+static void ensure_roots(void) {
+    if (store_root_count == 0) {
+        const char *dir = get_conversation_dir();
+        add_root(dir, strlen(dir));
+    }
+}
+
+// FNV-1a của stem: chọn bucket registry, gốc và thư mục con. Không được đổi,
+// vì vị trí của mọi file trên đĩa phụ thuộc vào nó.
+static uint32_t stem_hash(const char *stem) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)stem; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    return h;
+}
+
+static void place_stem(const char *stem, int *root, unsigned int *shard) {
+    ensure_roots();
+    uint32_t h = stem_hash(stem);
+    *root = (int)(h % store_root_count);
+    *shard = (h >> 24) % STORE_SHARD_DIRS;
+}
+
+/**
+ * Thư mục con <base>/<hh> của một gốc (segments = 1: thư mục segments của nó).
+ * shard < 0 cho chính thư mục gốc (bố trí phẳng cũ).
+ * @return: 0 nếu thành công, -1 nếu đường dẫn quá dài
+ */
+static int shard_dir(char *path, size_t size, const char *base, int shard, int segments) {
+    size_t len = strlen(base);
+    if (len + sizeof("/xx/" SEGMENT_DIR_NAME) > size) {
+        return -1;
+    }
+    memcpy(path, base, len);
+    if (shard >= 0) {
+        len += sprintf(path + len, "/%02x", shard & 0xff);
+    }
+    sprintf(path + len, "%s", segments ? "/" SEGMENT_DIR_NAME : "");
+    return 0;
+}
+
+static int shard_dir_path(char *path, size_t size, const char *stem, int segments) {
+    int root;
+    unsigned int shard;
+    place_stem(stem, &root, &shard);
+    return shard_dir(path, size, store_roots[root].path, (int)shard, segments);
+}
+
+static void head_path_for(char *path, size_t size, const char *stem) {
+    char dir[PATH_MAX];
+    shard_dir_path(dir, sizeof(dir), stem, 0);
+    snprintf(path, size, "%s/%s.txt", dir, stem);
+}
+
+// Tạo thư mục cha của path nếu chưa có (thư mục con của gốc được tạo lười)
+static void make_parent_dir(const char *path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (!slash) {
+        return;
+    }
+    *slash = '\0';
+    if (mkdir(dir, 0777) == -1 && errno == ENOENT) {
+        make_parent_dir(dir);
+        mkdir(dir, 0777);
+    }
+}
+
+/**
+ * Append các dòng vào file bằng một lần writev (lặp lại nếu ghi thiếu)
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+static int append_lines(const char *path, struct iovec *iov, int count) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0 && errno == ENOENT) {
+        make_parent_dir(path);
+        fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    int rc = 0;
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            rc = -1;
+            break;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    if (close(fd) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+/**
+ * Ghi một lượt của writer: các dòng của cùng một hội thoại (giữ nguyên thứ tự) đi chung
+ * một lần mở file và một writev
+ */
+static void write_batch(StoreWrite **batch, int count) {
+    char taken[STORE_WRITER_BATCH] = {0};
+    struct iovec iov[STORE_WRITER_BATCH];
+    for (int i = 0; i < count; i++) {
+        if (taken[i]) {
+            continue;
+        }
+        ConversationParts *cp = batch[i]->cp;
+        int lines = 0;
+        for (int j = i; j < count; j++) {
+            if (!taken[j] && batch[j]->cp == cp) {
+                taken[j] = 1;
+                iov[lines].iov_base = batch[j]->data;
+                iov[lines].iov_len = batch[j]->len;
+                lines++;
+            }
+        }
+        char path[PATH_MAX];
+        head_path_for(path, sizeof(path), cp->stem);
+        if (append_lines(path, iov, lines) < 0) {
+            log_event("[ERROR] Failed to write %d lines to conversation file %s: %s", lines, path, strerror(errno));
+            fprintf(stderr, "[ERROR] Failed to write %d lines to conversation file %s: %s\n", lines, path,
+                    strerror(errno));
+        }
+        metrics_add(METRIC_STORE_WRITES, 1);
+    }
+}
+
+static void *store_writer_thread(void *arg) {
+    StoreRoot *root = (StoreRoot *)arg;
+    StoreWrite *batch[STORE_WRITER_BATCH];
+    while (1) {
+        pthread_mutex_lock(&root->mutex);
+        while (!root->head) {
+            pthread_cond_wait(&root->work, &root->mutex);
+        }
+        int count = 0;
+        while (root->head && count < STORE_WRITER_BATCH) {
+            batch[count++] = root->head;
+            root->head = root->head->next;
+        }
+        if (!root->head) {
+            root->tail = NULL;
+        }
+        pthread_mutex_unlock(&root->mutex);
+
+        write_batch(batch, count);
+
+        pthread_mutex_lock(&root->mutex);
+        for (int i = 0; i < count; i++) {
+            batch[i]->cp->written_lines++;
+        }
+        root->queued -= count;
+        pthread_cond_broadcast(&root->done);
+        pthread_mutex_unlock(&root->mutex);
+        metrics_add(METRIC_STORE_QUEUED, -count);
+        for (int i = 0; i < count; i++) {
+            free(batch[i]);
+        }
+    }
+    return NULL;
+}
+
+static int start_writers(void) {
+    for (int i = 0; i < store_root_count; i++) {
+        StoreRoot *root = &store_roots[i];
+        if (root->running) {
+            continue;
+        }
+        pthread_t tid;
+        int rc = pthread_create(&tid, NULL, store_writer_thread, root);
+        if (rc != 0) {
+            log_event("[ERROR] Failed to create writer thread for %s: %s", root->path, strerror(rc));
+            fprintf(stderr, "[ERROR] Failed to create writer thread for %s: %s\n", root->path, strerror(rc));
+            return -1;
+        }
+        pthread_detach(tid);
+        root->running = 1;
+    }
+    return 0;
+}
+
+/**
+ * Chờ writer ghi xong mọi dòng đã xếp của hội thoại. Gọi khi đang giữ file_mutex;
+ * file_mutex được nhả trong lúc chờ để đĩa chậm của một gốc không chặn mọi hội thoại khác.
+ * Khi trả về, file_mutex lại được giữ và không còn dòng nào của cp đang chờ ghi, nhưng
+ * registry có thể đã đổi trong lúc chờ: người gọi phải đọc lại trạng thái của cp sau đó.
+ */
+static void wait_written(ConversationParts *cp) {
+    StoreRoot *root = &store_roots[cp->root];
+    pthread_mutex_lock(&root->mutex);
+    while (cp->written_lines != cp->queued_lines) {
+        // Chỉ chờ tới mốc hiện tại: dòng xếp thêm trong lúc nhả khóa được kiểm lại ở vòng sau
+        unsigned long target = cp->queued_lines;
+        pthread_mutex_unlock(&root->mutex);
+        MUTEX_UNLOCK(file_mutex);
+        pthread_mutex_lock(&root->mutex);
+        while ((long)(cp->written_lines - target) < 0) {
+            pthread_cond_wait(&root->done, &root->mutex);
+        }
+        // Thứ tự khóa là file_mutex rồi root->mutex (như conversation_store_append)
+        pthread_mutex_unlock(&root->mutex);
+        MUTEX_LOCK(file_mutex);
+        pthread_mutex_lock(&root->mutex);
+    }
+    pthread_mutex_unlock(&root->mutex);
+}
+
+void conversation_store_flush(void) {
+    for (int i = 0; i < store_root_count; i++) {
+        StoreRoot *root = &store_roots[i];
+        pthread_mutex_lock(&root->mutex);
+        while (root->queued > 0) {
+            pthread_cond_wait(&root->done, &root->mutex);
+        }
+        pthread_mutex_unlock(&root->mutex);
+    }
+}
+
+// ========================= PARTS REGISTRY (giữ file_mutex) =========================
+
+static ConversationParts *find_parts(const char *stem, int create) {
+    unsigned int b = stem_hash(stem) % STORE_HASH_BUCKETS;
+    for (ConversationParts *cp = store_buckets[b]; cp; cp = cp->next) {
+        if (strcmp(cp->stem, stem) == 0) {
+            return cp;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    ConversationParts *cp = calloc(1, sizeof(*cp));
+    if (!cp) {
+        log_event("[ERROR] Failed to allocate conversation parts for %s", stem);
+        return NULL;
+    }
+    strncpy(cp->stem, stem, sizeof(cp->stem) - 1);
+    place_stem(cp->stem, &cp->root, &cp->shard);
+    cp->next_segment = 1;
+    cp->ckpt_head_bytes = -1;
+    cp->next = store_buckets[b];
+    store_buckets[b] = cp;
+    return cp;
+}
+
+/**
+ * Tìm kiếm nhị phân name trong danh sách phần (đã sắp xếp)
+ * @param found: Nhận 1 nếu có name
+ * @return: Vị trí của name, hoặc vị trí cần chèn
+ */
+static int part_position(const ConversationParts *cp, const char *name, int *found) {
+    int lo = 0, hi = cp->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp(cp->parts[mid], name);
+        if (cmp == 0) {
+            *found = 1;
+            return mid;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = 0;
+    return lo;
+}
+
+static void add_part(ConversationParts *cp, const char *name, long lines) {
+    int found;
+    int pos = part_position(cp, name, &found);
+    if (found) {
+        return;
+    }
+    if (cp->count == cp->capacity) {
+        int new_capacity = cp->capacity ? cp->capacity * 2 : 8;
+        char **grown = realloc(cp->parts, new_capacity * sizeof(char *));
+        if (grown) {
+            cp->parts = grown;
+        }
+        long *grown_lines = realloc(cp->part_lines, new_capacity * sizeof(long));
+        if (grown_lines) {
+            cp->part_lines = grown_lines;
+        }
+        if (!grown || !grown_lines) {
+            log_event("[ERROR] Failed to grow part list for %s", cp->stem);
+            return;
+        }
+        cp->capacity = new_capacity;
+    }
+    char *copy = strdup(name);
+    if (!copy) {
+        return;
+    }
+    // Chèn đúng vị trí thay vì sắp xếp lại cả danh sách mỗi lần thêm
+    memmove(&cp->parts[pos + 1], &cp->parts[pos], (cp->count - pos) * sizeof(char *));
+    memmove(&cp->part_lines[pos + 1], &cp->part_lines[pos], (cp->count - pos) * sizeof(long));
+    cp->parts[pos] = copy;
+    cp->part_lines[pos] = lines;
+    cp->count++;
+}
+
+static void remove_part(ConversationParts *cp, const char *name) {
+    int found;
+    int i = part_position(cp, name, &found);
+    if (!found) {
+        return;
+    }
+    free(cp->parts[i]);
+    memmove(&cp->parts[i], &cp->parts[i + 1], (cp->count - i - 1) * sizeof(char *));
+    memmove(&cp->part_lines[i], &cp->part_lines[i + 1], (cp->count - i - 1) * sizeof(long));
+    cp->count--;
+}
+
+// Segment/archive của một hội thoại nằm trong segments/ cạnh head của nó
+static void segment_path(char *path, size_t size, const char *stem, const char *name) {
+    char dir[PATH_MAX];
+    if (shard_dir_path(dir, sizeof(dir), stem, 1) < 0 || snprintf(path, size, "%s/%s", dir, name) >= (int)size) {
+        path[0] = '\0';
+    }
+}
+
+static void stem_from_head(char *stem, size_t size, const char *head_name) {
+    const char *base = strrchr(head_name, '/');
+    base = base ? base + 1 : head_name;
+    size_t len = strlen(base);
+    if (len > 4 && strcmp(base + len - 4, ".txt") == 0) {
+        len -= 4;
+    }
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(stem, base, len);
+    stem[len] = '\0';
+}
+
+void conversation_store_head_path(char *path, size_t size, const char *head_name) {
+    char stem[96];
+    stem_from_head(stem, sizeof(stem), head_name);
+    head_path_for(path, size, stem);
+}
+
+static int is_archive(const char *name) {
+    size_t len = strlen(name);
+    return len > 4 && strcmp(name + len - 4, ".arc") == 0;
+}
+
+/**
+ * Tách tên file trong thư mục segments thành stem và số segment cuối cùng
+ * "<stem>.<first>.seg" hoặc "<stem>.<first>-<last>.arc"
+ * @return: 0 nếu là segment/archive hợp lệ
+ */
+static int parse_part_name(const char *name, char *stem, size_t size, int *last_segment) {
+    const char *ext = strrchr(name, '.');
+    if (!ext || (strcmp(ext, ".seg") != 0 && strcmp(ext, ".arc") != 0)) {
+        return -1;
+    }
+    const char *num = ext - 1;
+    while (num > name && *num != '.') {
+        num--;
+    }
+    if (num == name || (size_t)(num - name) >= size) {
+        return -1;
+    }
+    memcpy(stem, name, num - name);
+    stem[num - name] = '\0';
+    const char *dash = memchr(num + 1, '-', ext - (num + 1));
+    *last_segment = atoi(dash ? dash + 1 : num + 1);
+    return 0;
+}
+
+// ========================= RETENTION POLICY =========================
+
+static void load_retention_rules(void) {
+    FILE *f = find_data_file("retention.txt");
+    if (!f) {
+        return;  // Không có chính sách: giữ toàn bộ lịch sử
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f) && retentionRuleCount < MAX_RETENTION_RULES) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        RetentionRule *rule = &retention_rules[retentionRuleCount];
+        long days = 0;
+        long long kb = 0;
+        if (sscanf(line, "%63[^:]:%ld:%lld", rule->key, &days, &kb) == 3) {
+            rule->max_age_sec = days * 24 * 3600;
+            rule->max_bytes = kb * 1024;
+            retentionRuleCount++;
+        }
+    }
+    fclose(f);
+    log_event("Loaded %d retention rules from retention.txt", retentionRuleCount);
+}
+
+static const RetentionRule *find_retention_rule(const char *stem) {
+    const char *key = strncmp(stem, "conversation_", 13) == 0 ? stem + 13 : stem;
+    const RetentionRule *fallback = NULL;
+    for (int i = 0; i < retentionRuleCount; i++) {
+        if (strcmp(retention_rules[i].key, key) == 0) {
+            return &retention_rules[i];
+        }
+        if (strcmp(retention_rules[i].key, "*") == 0) {
+            fallback = &retention_rules[i];
+        }
+    }
+    return fallback;
+}
+
+// ========================= CHECKPOINT & JOURNAL =========================
+// Checkpoint (store.ckpt) chụp lại danh sách phần, seq cuối, kích thước/inode của head và
+// số dòng của từng phần. Journal (store.journal) ghi ý định của mỗi thay đổi danh sách phần
+// *trước khi* đổi file trên đĩa; lúc phát lại, mỗi bản ghi được đối chiếu với file thật nên
+// crash ở bất kỳ bước nào cũng cho kết quả đúng. Khởi động chỉ đọc checkpoint và phần journal
+// ghi sau nó thay vì liệt kê thư mục segments. Các hàm ở đây gọi khi đang giữ file_mutex.
+
+static FILE *journal;                   // Mở ở chế độ append
+static unsigned long journal_gen = 0;   // Thế hệ journal, tăng mỗi lần làm mới sau checkpoint
+static long journal_length = 0;
+static long journal_checkpointed = 0;   // Độ dài journal mà checkpoint gần nhất đã bao phủ
+static int checkpoint_needed = 0;       // Không có checkpoint dùng được lúc khởi động
+static int seq_dirty = 0;               // Có seq mới kể từ checkpoint gần nhất
+static time_t last_checkpoint = 0;
+static pthread_mutex_t checkpoint_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void store_file_path(char *path, size_t size, const char *name) {
+    snprintf(path, size, "%s/%s", get_conversation_dir(), name);
+}
+
+// FNV-1a, đủ để phát hiện bản ghi/checkpoint ghi dở
+static uint32_t store_checksum(const char *data, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)data[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void note_segment_number(ConversationParts *cp, const char *name) {
+    char stem[96];
+    int last_segment;
+    if (parse_part_name(name, stem, sizeof(stem), &last_segment) == 0 && last_segment + 1 > cp->next_segment) {
+        cp->next_segment = last_segment + 1;
+    }
+}
+
+// Xóa file của một phần (và chỉ mục nếu là archive)
+static void unlink_part(const char *stem, const char *name) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), stem, name);
+    unlink(path);
+    if (is_archive(name)) {
+        char idx_path[PATH_MAX];
+        snprintf(idx_path, sizeof(idx_path), "%.*s.idx", (int)(strlen(path) - 4), path);
+        unlink(idx_path);
+    }
+}
+
+static void drop_all_parts(ConversationParts *cp) {
+    for (int i = 0; i < cp->count; i++) {
+        unlink_part(cp->stem, cp->parts[i]);
+        free(cp->parts[i]);
+    }
+    cp->count = 0;
+    cp->seq_loaded = 0;
+    cp->ckpt_head_bytes = -1;
+}
+
+/**
+ * Ghi một bản ghi "<payload> *<checksum>\n" vào journal và đẩy xuống đĩa
+ */
+static void journal_append(const char *fmt, ...) {
+    if (!journal) {
+        return;
+    }
+    char record[JOURNAL_RECORD_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(record, sizeof(record) - 16, fmt, args);
+    va_end(args);
+    if (len < 0 || len >= (int)sizeof(record) - 16) {
+        log_event("[ERROR] Store journal record too long, skipped");
+        return;
+    }
+    len += snprintf(record + len, sizeof(record) - len, " *%08x\n", store_checksum(record, len));
+    if (fputs(record, journal) == EOF || fflush(journal) != 0 || fdatasync(fileno(journal)) != 0) {
+        log_event("[ERROR] Failed to write store journal: %s", strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to write store journal: %s\n", strerror(errno));
+        return;
+    }
+    journal_length += len;
+}
+
+/**
+ * Kiểm tra một dòng journal và bỏ phần checksum
+ * @return: 1 nếu bản ghi trọn vẹn và đúng checksum
+ */
+static int journal_record_valid(char *line) {
+    size_t len = strlen(line);
+    if (len == 0 || line[len - 1] != '\n') {
+        return 0;
+    }
+    line[--len] = '\0';
+    char *mark = strrchr(line, '*');
+    if (!mark || mark == line || mark[-1] != ' ') {
+        return 0;
+    }
+    char *end;
+    unsigned long sum = strtoul(mark + 1, &end, 16);
+    if (*end != '\0') {
+        return 0;
+    }
+    mark[-1] = '\0';
+    return store_checksum(line, mark - 1 - line) == sum;
+}
+
+static int part_file_exists(const char *stem, const char *name) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), stem, name);
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * Phát lại một bản ghi, đối chiếu với file trên đĩa:
+ *   "+ <stem> <segment>"                   head đã/sắp được cuộn thành segment
+ *   "- <stem> <part>"                      retention xóa một phần
+ *   "m <stem> <archive> <lines> <seg>..."  gộp segment thành archive
+ *   "r <stem>"                             xóa mọi phần (replica nhận snapshot mới)
+ */
+static void journal_replay_record(char *payload) {
+    char *saveptr = NULL;
+    char *op = strtok_r(payload, " ", &saveptr);
+    char *stem = strtok_r(NULL, " ", &saveptr);
+    ConversationParts *cp = op && stem ? find_parts(stem, 1) : NULL;
+    if (!cp) {
+        return;
+    }
+    char *name = strtok_r(NULL, " ", &saveptr);
+    switch (op[0]) {
+    case '+':
+        // Chỉ có hiệu lực nếu rename đã diễn ra trước khi crash
+        if (name && part_file_exists(stem, name)) {
+            add_part(cp, name, -1);
+            note_segment_number(cp, name);
+        }
+        break;
+    case '-':
+        if (name) {
+            unlink_part(stem, name);
+            remove_part(cp, name);
+        }
+        break;
+    case 'm': {
+        // Archive chỉ xuất hiện sau khi đã ghi xong; chưa có thì các segment vẫn là dữ liệu thật
+        char *lines = strtok_r(NULL, " ", &saveptr);
+        if (!name || !lines || !part_file_exists(stem, name)) {
+            break;
+        }
+        for (char *seg = strtok_r(NULL, " ", &saveptr); seg; seg = strtok_r(NULL, " ", &saveptr)) {
+            unlink_part(stem, seg);
+            remove_part(cp, seg);
+        }
+        add_part(cp, name, atol(lines));
+        note_segment_number(cp, name);
+        break;
+    }
+    case 'r':
+        drop_all_parts(cp);
+        break;
+    }
+}
+
+/**
+ * Mở journal để ghi tiếp. Nếu replay, phát lại các bản ghi mà checkpoint chưa bao phủ
+ * và cắt bản ghi cuối ghi dở; nếu không, bắt đầu một thế hệ journal mới.
+ * @return: Số bản ghi đã phát lại, -1 nếu journal không khớp checkpoint (mất hoặc hỏng)
+ */
+static int journal_open(int replay, unsigned long ckpt_gen, long ckpt_offset) {
+    char path[PATH_MAX];
+    store_file_path(path, sizeof(path), JOURNAL_NAME);
+    int replayed = 0;
+    unsigned long gen = 0;
+    long start = -1;
+    FILE *f = fopen(path, "r+");
+    struct stat st;
+    if (f && fscanf(f, "journal %lu", &gen) == 1 && fgetc(f) == '\n' && fstat(fileno(f), &st) == 0) {
+        // Cùng thế hệ: phát lại từ offset của checkpoint; thế hệ kế tiếp: mọi bản ghi đều mới hơn checkpoint
+        if (replay && gen == ckpt_gen && ckpt_offset <= st.st_size) {
+            start = ckpt_offset;
+        } else if (replay && gen == ckpt_gen + 1) {
+            start = ftell(f);
+        }
+    }
+    if (start >= 0 && fseek(f, start, SEEK_SET) == 0) {
+        char line[JOURNAL_RECORD_MAX + 32];
+        long valid_end = start;
+        while (fgets(line, sizeof(line), f)) {
+            if (!journal_record_valid(line)) {
+                break;
+            }
+            journal_replay_record(line);
+            replayed++;
+            valid_end = ftell(f);
+        }
+        if (st.st_size > valid_end) {
+            // Crash giữa lúc ghi bản ghi cuối: cắt để append tiếp từ ranh giới bản ghi
+            if (ftruncate(fileno(f), valid_end) == 0) {
+                log_event("Store journal: truncated torn record (%lld bytes)", (long long)(st.st_size - valid_end));
+            }
+        }
+        fclose(f);
+        journal_gen = gen;
+        journal_length = valid_end;
+        journal_checkpointed = gen == ckpt_gen ? ckpt_offset : start;
+        journal = fopen(path, "a");
+    } else {
+        if (f) {
+            fclose(f);
+        }
+        journal_gen = (gen > ckpt_gen ? gen : ckpt_gen) + 1;
+        journal = fopen(path, "w");
+        if (journal) {
+            journal_length = fprintf(journal, "journal %lu\n", journal_gen);
+            fflush(journal);
+            fdatasync(fileno(journal));
+        }
+        journal_checkpointed = replay ? -1 : journal_length;
+        if (replay) {
+            replayed = -1;
+        }
+    }
+    if (!journal) {
+        log_event("[ERROR] Failed to open store journal %s: %s", path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to open store journal %s: %s\n", path, strerror(errno));
+    }
+    if (journal_checkpointed < 0) {
+        journal_checkpointed = 0;
+        checkpoint_needed = 1;
+    }
+    return replayed;
+}
+
+/**
+ * Nạp danh sách phần và trạng thái head từ checkpoint. Cả file được kiểm tra checksum
+ * trước khi áp dụng, nên checkpoint ghi dở hoặc hỏng đơn giản là bị bỏ qua.
+ * @return: Số phần đã nạp, -1 nếu không có checkpoint hợp lệ
+ */
+static long load_checkpoint(unsigned long *gen, long *offset) {
+    char path[PATH_MAX];
+    store_file_path(path, sizeof(path), CHECKPOINT_NAME);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    struct stat st;
+    char *data = NULL;
+    if (fstat(fileno(f), &st) == 0 && st.st_size > 0) {
+        data = malloc(st.st_size + 1);
+    }
+    if (!data || fread(data, 1, st.st_size, f) != (size_t)st.st_size) {
+        free(data);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    data[st.st_size] = '\0';
+
+    // Dòng cuối: "end <số hội thoại> <checksum của mọi byte phía trước>"
+    char *end_line = NULL;
+    if (st.st_size >= 2 && data[st.st_size - 1] == '\n') {
+        data[st.st_size - 1] = '\0';
+        end_line = strrchr(data, '\n');
+        end_line = end_line ? end_line + 1 : NULL;
+    }
+    int conversations;
+    unsigned int sum;
+    int version;
+    if (!end_line || sscanf(end_line, "end %d %x", &conversations, &sum) != 2 ||
+        store_checksum(data, end_line - data) != sum ||
+        sscanf(data, "checkpoint %d %lu %ld", &version, gen, offset) != 3 || version != CHECKPOINT_VERSION) {
+        log_event("[WARNING] Ignoring invalid store checkpoint %s", path);
+        free(data);
+        return -1;
+    }
+    end_line[-1] = '\0';
+
+    long parts = 0;
+    ConversationParts *cp = NULL;
+    char *saveptr = NULL;
+    for (char *line = strtok_r(data, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        char name[160];
+        if (line[0] == 'c') {
+            int next_segment;
+            unsigned long long seq, inode;
+            long long head_bytes;
+            if (sscanf(line, "c %95s %d %llu %lld %llu", name, &next_segment, &seq, &head_bytes, &inode) != 5) {
+                cp = NULL;
+                continue;
+            }
+            cp = find_parts(name, 1);
+            if (cp) {
+                cp->next_segment = next_segment;
+                cp->ckpt_seq = seq;
+                cp->ckpt_head_bytes = head_bytes;
+                cp->ckpt_head_inode = inode;
+            }
+        } else if (line[0] == 'p' && cp) {
+            long lines;
+            if (sscanf(line, "p %159s %ld", name, &lines) == 2) {
+                add_part(cp, name, lines);  // Đã sắp xếp sẵn nên luôn chèn ở cuối
+                parts++;
+            }
+        }
+    }
+    free(data);
+    return parts;
+}
+
+// Bỏ toàn bộ danh sách phần đã nạp (checkpoint không dùng được)
+static void clear_registry(void) {
+    for (int b = 0; b < STORE_HASH_BUCKETS; b++) {
+        ConversationParts *cp = store_buckets[b];
+        while (cp) {
+            ConversationParts *next = cp->next;
+            for (int i = 0; i < cp->count; i++) {
+                free(cp->parts[i]);
+            }
+            free(cp->parts);
+            free(cp->part_lines);
+            free(cp);
+            cp = next;
+        }
+        store_buckets[b] = NULL;
+    }
+}
+
+// Liệt kê một thư mục segments (khi không có checkpoint)
+static long scan_segment_dir(const char *dir_path) {
+    DIR *dir = opendir(dir_path);
+    long loaded = 0;
+    if (!dir) {
+        return 0;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        char stem[96];
+        int last_segment;
+        if (parse_part_name(ent->d_name, stem, sizeof(stem), &last_segment) < 0) {
+            continue;
+        }
+        ConversationParts *cp = find_parts(stem, 1);
+        if (!cp) continue;
+        add_part(cp, ent->d_name, -1);
+        note_segment_number(cp, ent->d_name);
+        loaded++;
+    }
+    closedir(dir);
+    return loaded;
+}
+
+// Liệt kê thư mục segments của mọi thư mục con trên mọi gốc
+static long scan_all_segments(void) {
+    long loaded = 0;
+    for (int r = 0; r < store_root_count; r++) {
+        for (int shard = 0; shard < STORE_SHARD_DIRS; shard++) {
+            char dir_path[PATH_MAX];
+            shard_dir(dir_path, sizeof(dir_path), store_roots[r].path, shard, 1);
+            loaded += scan_segment_dir(dir_path);
+        }
+    }
+    return loaded;
+}
+
+// ========================= LAYOUT MIGRATION =========================
+// Chạy một lần lúc khởi động, trước khi nạp checkpoint (checkpoint chỉ ghi tên phần,
+// không ghi đường dẫn, nên vẫn dùng được sau khi file đổi chỗ).
+
+/**
+ * Chuyển file sang đường dẫn mới; khác đĩa thì copy + fsync + rename rồi mới xóa file cũ
+ * @return: 0 nếu thành công
+ */
+static int move_file(const char *from, const char *to) {
+    make_parent_dir(to);
+    if (rename(from, to) == 0) {
+        return 0;
+    }
+    if (errno != EXDEV) {
+        return -1;
+    }
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", to);
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    int ok = in >= 0 && out >= 0;
+    char buf[65536];
+    ssize_t n;
+    while (ok && (n = read(in, buf, sizeof(buf))) != 0) {
+        ok = n > 0 && write(out, buf, n) == n;
+    }
+    ok = ok && fsync(out) == 0;
+    if (out >= 0 && close(out) != 0) ok = 0;
+    if (in >= 0) close(in);
+    ok = ok && rename(tmp_path, to) == 0;
+    if (!ok) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return unlink(from);
+}
+
+/**
+ * Chuyển các file nằm sai chỗ trong một thư mục về đúng gốc/thư mục con
+ * @param segments: 1 nếu là thư mục segments (segment, archive, chỉ mục), 0 nếu chứa head
+ * @return: Số file đã chuyển
+ */
+static int relocate_dir(const char *dir_path, int segments) {
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        return 0;
+    }
+    int moved = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        const char *name = ent->d_name;
+        size_t len = strlen(name);
+        char stem[96], target[PATH_MAX], from[PATH_MAX];
+        int last_segment;
+        if (segments) {
+            // Chỉ mục <stem>.<a>-<b>.idx đi theo archive cùng tên
+            char arc_name[256];
+            snprintf(arc_name, sizeof(arc_name), "%s", name);
+            if (len > 4 && strcmp(name + len - 4, ".idx") == 0) {
+                memcpy(arc_name + len - 4, ".arc", 4);
+            }
+            if (parse_part_name(arc_name, stem, sizeof(stem), &last_segment) < 0) {
+                continue;
+            }
+            segment_path(target, sizeof(target), stem, name);
+        } else {
+            if (strncmp(name, "conversation_", 13) != 0 || len < 5 || strcmp(name + len - 4, ".txt") != 0) {
+                continue;
+            }
+            stem_from_head(stem, sizeof(stem), name);
+            head_path_for(target, sizeof(target), stem);
+        }
+        snprintf(from, sizeof(from), "%s/%s", dir_path, name);
+        if (strcmp(from, target) == 0) {
+            continue;
+        }
+        if (access(target, F_OK) == 0) {
+            log_event("[WARNING] Store layout: %s already exists, leaving %s in place", target, from);
+            fprintf(stderr, "[WARNING] Store layout: %s already exists, leaving %s in place\n", target, from);
+            continue;
+        }
+        if (move_file(from, target) != 0) {
+            log_event("[ERROR] Store layout: failed to move %s to %s: %s", from, target, strerror(errno));
+            fprintf(stderr, "[ERROR] Store layout: failed to move %s to %s: %s\n", from, target, strerror(errno));
+            continue;
+        }
+        moved++;
+    }
+    closedir(dir);
+    return moved;
+}
+
+// Chuyển mọi head/segment đang nằm dưới một gốc (cũ hoặc mới) về đúng chỗ
+static int relocate_root(const char *base) {
+    char dir_path[PATH_MAX];
+    int moved = relocate_dir(base, 0);
+    if (shard_dir(dir_path, sizeof(dir_path), base, -1, 1) == 0) {
+        moved += relocate_dir(dir_path, 1);
+        rmdir(dir_path);  // Thư mục segments phẳng cũ, chỉ xóa được khi đã rỗng
+    }
+    for (int shard = 0; shard < STORE_SHARD_DIRS; shard++) {
+        if (shard_dir(dir_path, sizeof(dir_path), base, shard, 0) == 0) {
+            moved += relocate_dir(dir_path, 0);
+        }
+        if (shard_dir(dir_path, sizeof(dir_path), base, shard, 1) == 0) {
+            moved += relocate_dir(dir_path, 1);
+        }
+    }
+    return moved;
+}
+
+/**
+ * So danh sách gốc với file layout; nếu khác (hoặc chưa có: bố trí phẳng cũ) thì chuyển
+ * mọi head/segment về đúng chỗ rồi ghi lại file layout. Gốc có trong layout cũ nhưng đã bị
+ * bỏ khỏi danh sách cũng được dọn sang các gốc còn lại.
+ * @return: Số file đã chuyển, -1 nếu bố trí không đổi
+ */
+static int relocate_if_layout_changed(void) {
+    static char layout[STORE_MAX_ROOTS * (ROOT_PATH_MAX + 8)];
+    static char previous[sizeof(layout)];
+    size_t pos = 0;
+    for (int r = 0; r < store_root_count; r++) {
+        pos += snprintf(layout + pos, sizeof(layout) - pos, "root %s\n", store_roots[r].path);
+    }
+
+    char path[PATH_MAX];
+    store_file_path(path, sizeof(path), LAYOUT_NAME);
+    FILE *f = fopen(path, "r");
+    size_t previous_len = f ? fread(previous, 1, sizeof(previous) - 1, f) : 0;
+    if (f) fclose(f);
+    previous[previous_len] = '\0';
+    if (previous_len == pos && memcmp(previous, layout, pos) == 0) {
+        return -1;
+    }
+
+    int moved = 0;
+    for (int r = 0; r < store_root_count; r++) {
+        moved += relocate_root(store_roots[r].path);
+    }
+    char *saveptr = NULL;
+    for (char *line = strtok_r(previous, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        if (strncmp(line, "root ", 5) != 0) {
+            continue;
+        }
+        int current = 0;
+        for (int r = 0; r < store_root_count && !current; r++) {
+            current = strcmp(line + 5, store_roots[r].path) == 0;
+        }
+        if (!current) {
+            moved += relocate_root(line + 5);
+        }
+    }
+
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int ok = fd >= 0 && write(fd, layout, pos) == (ssize_t)pos && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        log_event("[ERROR] Failed to write store layout %s: %s", path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to write store layout %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+    log_event("Store layout updated for %d roots: %d files relocated", store_root_count, moved);
+    return moved;
+}
+
+int conversation_store_checkpoint(void) {
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *mem = open_memstream(&buf, &size);
+    if (!mem) {
+        return -1;
+    }
+    pthread_mutex_lock(&checkpoint_mutex);
+
+    // Chụp trạng thái trong file_mutex (không I/O ngoài stat head), ghi file ngoài lock
+    MUTEX_LOCK(file_mutex);
+    unsigned long gen = journal_gen;
+    long covered = journal_length;
+    fprintf(mem, "checkpoint %d %lu %ld\n", CHECKPOINT_VERSION, gen, covered);
+    int conversations = 0;
+    for (int b = 0; b < STORE_HASH_BUCKETS; b++) {
+        for (ConversationParts *cp = store_buckets[b]; cp; cp = cp->next) {
+            if (cp->seq_loaded) {
+                char head_path[PATH_MAX];
+                struct stat st;
+                head_path_for(head_path, sizeof(head_path), cp->stem);
+                int exists = stat(head_path, &st) == 0;
+                cp->ckpt_seq = cp->last_seq;
+                cp->ckpt_head_bytes = exists ? (long long)st.st_size : 0;
+                cp->ckpt_head_inode = exists ? (unsigned long long)st.st_ino : 0;
+            }
+            if (cp->count == 0 && cp->ckpt_head_bytes < 0) {
+                continue;
+            }
+            fprintf(mem, "c %s %d %llu %lld %llu\n", cp->stem, cp->next_segment, cp->ckpt_seq,
+                    cp->ckpt_head_bytes, cp->ckpt_head_inode);
+            for (int i = 0; i < cp->count; i++) {
+                fprintf(mem, "p %s %ld\n", cp->parts[i], cp->part_lines[i]);
+            }
+            conversations++;
+        }
+    }
+    seq_dirty = 0;
+    MUTEX_UNLOCK(file_mutex);
+
+    fflush(mem);
+    fprintf(mem, "end %d %08x\n", conversations, store_checksum(buf, size));
+    fclose(mem);
+
+    char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+    store_file_path(path, sizeof(path), CHECKPOINT_NAME);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int ok = fd >= 0 && write(fd, buf, size) == (ssize_t)size && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    ok = ok && rename(tmp_path, path) == 0;
+    free(buf);
+    if (!ok) {
+        log_event("[ERROR] Failed to write store checkpoint %s: %s", path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to write store checkpoint %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        pthread_mutex_unlock(&checkpoint_mutex);
+        return -1;
+    }
+
+    // Làm mới journal nếu không có bản ghi nào mới hơn checkpoint vừa ghi
+    MUTEX_LOCK(file_mutex);
+    if (journal && journal_length == covered && journal_gen == gen) {
+        char journal_path[PATH_MAX];
+        store_file_path(journal_path, sizeof(journal_path), JOURNAL_NAME);
+        FILE *fresh = freopen(journal_path, "w", journal);
+        journal = fresh;
+        if (!fresh) {
+            log_event("[ERROR] Failed to reopen store journal %s: %s", journal_path, strerror(errno));
+        } else {
+            journal_gen = gen + 1;
+            journal_length = fprintf(fresh, "journal %lu\n", journal_gen);
+            fflush(fresh);
+            fdatasync(fileno(fresh));
+        }
+        covered = journal_length;
+    }
+    journal_checkpointed = covered;
+    checkpoint_needed = 0;
+    last_checkpoint = time(NULL);
+    MUTEX_UNLOCK(file_mutex);
+    pthread_mutex_unlock(&checkpoint_mutex);
+
+    log_event("Store checkpoint written: %d conversations, journal generation %lu", conversations, gen);
+    return 0;
+}
+
+// Ghi checkpoint khi danh sách phần đã đổi, hoặc định kỳ khi chỉ có seq mới
+static void checkpoint_if_needed(void) {
+    MUTEX_LOCK(file_mutex);
+    int needed = checkpoint_needed || journal_length > journal_checkpointed ||
+                 (seq_dirty && time(NULL) - last_checkpoint >= CHECKPOINT_INTERVAL_SEC);
+    MUTEX_UNLOCK(file_mutex);
+    if (needed) {
+        conversation_store_checkpoint();
+    }
+}
+
+// ========================= STORE INIT =========================
+
+/**
+ * Lấy flock độc quyền trên file khóa của gốc; fd được giữ mở nên khóa tự nhả khi process thoát
+ * @param root: Gốc cần khóa
+ * @return: 0 nếu khóa được, -1 nếu lỗi hoặc process khác đang giữ
+ */
+static int lock_root(StoreRoot *root) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root->path, ROOT_LOCK_NAME);
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        log_event("[ERROR] Failed to open lock file %s: %s", path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to open lock file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) == -1) {
+        const char *reason = errno == EWOULDBLOCK ? "already in use by another server" : strerror(errno);
+        log_event("[ERROR] Conversation root %s: %s", root->path, reason);
+        fprintf(stderr, "[ERROR] Conversation root %s: %s\n", root->path, reason);
+        close(fd);
+        return -1;
+    }
+    root->lock_fd = fd;
+    return 0;
+}
+
+int conversation_store_init(void) {
+    ensure_roots();
+    for (int r = 0; r < store_root_count; r++) {
+        const char *root = store_roots[r].path;
+        if (mkdir(root, 0777) == -1 && errno != EEXIST) {
+            log_event("[ERROR] Failed to create conversation root %s: %s", root, strerror(errno));
+            fprintf(stderr, "[ERROR] Failed to create conversation root %s: %s\n", root, strerror(errno));
+            return -1;
+        }
+        if (lock_root(&store_roots[r]) < 0) {
+            return -1;
+        }
+    }
+    int relocated = relocate_if_layout_changed();
+
+    // Checkpoint + phần cuối journal; chỉ liệt kê thư mục segments khi không có checkpoint
+    MUTEX_LOCK(file_mutex);
+    unsigned long ckpt_gen = 0;
+    long ckpt_offset = 0;
+    long loaded = load_checkpoint(&ckpt_gen, &ckpt_offset);
+    int from_checkpoint = loaded >= 0;
+    int replayed = journal_open(from_checkpoint, ckpt_gen, ckpt_offset);
+    if (replayed < 0) {
+        // Checkpoint không còn khớp journal thì có thể thiếu thay đổi: bỏ đi và quét lại
+        log_event("[WARNING] Store journal does not match checkpoint, rescanning %d roots", store_root_count);
+        clear_registry();
+        from_checkpoint = 0;
+    }
+    if (!from_checkpoint) {
+        loaded = scan_all_segments();
+    }
+    if (!from_checkpoint || relocated > 0) {
+        checkpoint_needed = 1;
+    }
+    last_checkpoint = time(NULL);
+    MUTEX_UNLOCK(file_mutex);
+
+    load_retention_rules();
+    if (from_checkpoint) {
+        log_event("Conversation store recovered from checkpoint: %ld segments/archives, %d journal records replayed",
+                  loaded, replayed);
+    } else {
+        log_event("Conversation store initialized by directory scan: %ld segments/archives", loaded);
+    }
+    return start_writers();
+}
+
+void conversation_store_reset(const char *head_name) {
+    char stem[96], path[PATH_MAX];
+    stem_from_head(stem, sizeof(stem), head_name);
+    ConversationParts *cp = find_parts(stem, 1);
+    if (!cp) {
+        return;
+    }
+    wait_written(cp);
+    if (cp->count > 0) {
+        journal_append("r %s", stem);
+    }
+    drop_all_parts(cp);
+
+    head_path_for(path, sizeof(path), stem);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0 && errno == ENOENT) {
+        make_parent_dir(path);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    }
+    if (fd < 0) {
+        log_event("[ERROR] Failed to truncate conversation file %s: %s", path, strerror(errno));
+        return;
+    }
+    close(fd);
+}
+
+void conversation_store_wait_space(const char *head_path) {
+    char stem[96];
+    int r;
+    unsigned int shard;
+    stem_from_head(stem, sizeof(stem), head_path);
+    place_stem(stem, &r, &shard);
+    StoreRoot *root = &store_roots[r];
+    if (!root->running) {
+        return;
+    }
+    // Đĩa chậm hơn tốc độ gửi: chặn người ghi thay vì để hàng đợi phình không giới hạn
+    pthread_mutex_lock(&root->mutex);
+    while (root->queued >= STORE_WRITER_QUEUE_MAX) {
+        pthread_cond_wait(&root->done, &root->mutex);
+    }
+    pthread_mutex_unlock(&root->mutex);
+}
+
+int conversation_store_append(const char *head_path, const char *line) {
+    char stem[96];
+    stem_from_head(stem, sizeof(stem), head_path);
+    ConversationParts *cp = find_parts(stem, 1);
+    if (!cp) {
+        return -1;
+    }
+    size_t len = strlen(line);
+    StoreRoot *root = &store_roots[cp->root];
+    if (!root->running) {
+        char path[PATH_MAX];
+        struct iovec iov[2] = {{(void *)line, len}, {"\n", 1}};
+        head_path_for(path, sizeof(path), stem);
+        return append_lines(path, iov, 2);
+    }
+
+    StoreWrite *w = malloc(sizeof(*w) + len + 1);
+    if (!w) {
+        return -1;
+    }
+    w->next = NULL;
+    w->cp = cp;
+    w->len = len + 1;
+    memcpy(w->data, line, len);
+    w->data[len] = '\n';
+
+    // Không chờ ở đây: người gọi đang giữ file_mutex; backpressure nằm ở conversation_store_wait_space
+    pthread_mutex_lock(&root->mutex);
+    int was_empty = root->head == NULL;
+    if (root->tail) {
+        root->tail->next = w;
+    } else {
+        root->head = w;
+    }
+    root->tail = w;
+    root->queued++;
+    cp->queued_lines++;
+    if (was_empty) {
+        pthread_cond_signal(&root->work);  // Hàng đợi đã có dòng thì writer đã được báo
+    }
+    pthread_mutex_unlock(&root->mutex);
+    metrics_add(METRIC_STORE_QUEUED, 1);
+    return 0;
+}
+
+// ========================= SEQUENCE NUMBERS =========================
+
+unsigned long long parse_line_seq(const char *line, const char **text) {
+    unsigned long long seq = 0;
+    const char *p = line;
+    while (*p >= '0' && *p <= '9') {
+        seq = seq * 10 + (*p - '0');
+        p++;
+    }
+    if (p == line || *p != SEQ_SEPARATOR) {
+        if (text) *text = line;  // Dòng cũ chưa có seq
+        return 0;
+    }
+    if (text) *text = p + 1;
+    return seq;
+}
+
+/**
+ * Đọc seq lớn nhất trong phần cuối của một file
+ * @return: seq, hoặc 0 nếu file không có dòng nào mang seq
+ */
+static unsigned long long last_seq_in_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char line[BUFFER_SIZE * 2];
+    unsigned long long last = 0;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        long size = ftell(f);
+        long start = size > (long)sizeof(line) * 4 ? size - (long)sizeof(line) * 4 : 0;
+        fseek(f, start, SEEK_SET);
+        // Bỏ dòng bị cắt dở ở đầu vùng đọc
+        if (start > 0 && !fgets(line, sizeof(line), f)) {
+            fclose(f);
+            return 0;
+        }
+    }
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long long seq = parse_line_seq(line, NULL);
+        if (seq > last) {
+            last = seq;
+        }
+    }
+    fclose(f);
+    return last;
+}
+
+// Seq lớn nhất trong các dòng từ offset tới cuối file (offset nằm ở ranh giới dòng)
+static unsigned long long max_seq_from(const char *path, long long offset) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char line[BUFFER_SIZE * 2];
+    unsigned long long last = 0;
+    if (fseeko(f, offset, SEEK_SET) == 0) {
+        while (fgets(line, sizeof(line), f)) {
+            unsigned long long seq = parse_line_seq(line, NULL);
+            if (seq > last) {
+                last = seq;
+            }
+        }
+    }
+    fclose(f);
+    return last;
+}
+
+/**
+ * Độ dài phần head kết thúc bằng '\n'
+ * @param torn_has_seq: Nhận 1 nếu phần dở ở cuối mang tiền tố seq (bản ghi mới bị ghi dở)
+ */
+static off_t complete_length(int fd, off_t size, int *torn_has_seq) {
+    char buf[4096];
+    off_t end = size;
+    *torn_has_seq = 0;
+    while (end > 0) {
+        off_t start = end > (off_t)sizeof(buf) ? end - (off_t)sizeof(buf) : 0;
+        ssize_t n = pread(fd, buf, end - start, start);
+        if (n != end - start) {
+            return size;
+        }
+        if (end == size && buf[n - 1] == '\n') {
+            return size;
+        }
+        ssize_t i = n - 1;
+        while (i >= 0 && buf[i] != '\n') {
+            i--;
+        }
+        if (i >= 0) {
+            end = start + i + 1;
+            break;
+        }
+        end = start;
+    }
+    char head[32] = {0};
+    if (pread(fd, head, sizeof(head) - 1, end) > 0) {
+        *torn_has_seq = parse_line_seq(head, NULL) > 0;
+    }
+    return end;
+}
+
+/**
+ * Khôi phục lười một hội thoại ở lần chạm đầu tiên sau khi khởi động (ghi, đọc hoặc cuộn head):
+ * bỏ bản ghi cuối bị ghi dở của head (crash giữa lúc ghi), rồi tính seq cuối. Nếu head vẫn là file đã thấy lúc
+ * checkpoint thì chỉ đọc phần được ghi sau checkpoint.
+ * @return: Seq cuối của hội thoại
+ */
+static unsigned long long recover_head(ConversationParts *cp, const char *head_path) {
+    struct stat st;
+    int exists = stat(head_path, &st) == 0;
+    if (exists && st.st_size > 0) {
+        int fd = open(head_path, O_RDWR);
+        int torn_has_seq = 0;
+        off_t keep = fd >= 0 ? complete_length(fd, st.st_size, &torn_has_seq) : st.st_size;
+        if (keep < st.st_size && torn_has_seq && ftruncate(fd, keep) == 0) {
+            log_event("Recovered %s: truncated torn final record (%lld bytes)", head_path,
+                      (long long)(st.st_size - keep));
+            st.st_size = keep;
+        } else if (keep < st.st_size && !torn_has_seq && pwrite(fd, "\n", 1, st.st_size) == 1) {
+            // Dòng cũ không có seq và không có '\n' cuối: giữ nguyên, chỉ kết thúc dòng
+            st.st_size++;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    unsigned long long floor = cp->ckpt_head_bytes >= 0 ? cp->ckpt_seq : 0;
+    if (cp->ckpt_head_bytes >= 0 && exists && (unsigned long long)st.st_ino == cp->ckpt_head_inode &&
+        st.st_size >= cp->ckpt_head_bytes) {
+        unsigned long long tail = max_seq_from(head_path, cp->ckpt_head_bytes);
+        return tail > floor ? tail : floor;
+    }
+    // Head đã bị cuộn sau checkpoint (hoặc không có checkpoint): head trước, rồi các phần từ mới tới cũ
+    unsigned long long last = exists ? last_seq_in_file(head_path) : 0;
+    for (int i = cp->count - 1; i >= 0 && last == 0; i--) {
+        char path[PATH_MAX];
+        segment_path(path, sizeof(path), cp->stem, cp->parts[i]);
+        last = last_seq_in_file(path);
+    }
+    return last > floor ? last : floor;
+}
+
+static void load_last_seq(ConversationParts *cp, const char *head_path) {
+    if (cp->seq_loaded) {
+        return;
+    }
+    wait_written(cp);  // Có thể có dòng replica đang chờ ghi; recover_head sửa cuối head
+    if (!cp->seq_loaded) {  // Luồng khác có thể đã nạp trong lúc chờ
+        cp->last_seq = recover_head(cp, head_path);
+        cp->seq_loaded = 1;
+    }
+}
+
+unsigned long long conversation_store_next_seq(const char *head_path) {
+    char stem[96];
+    stem_from_head(stem, sizeof(stem), head_path);
+    ConversationParts *cp = find_parts(stem, 1);
+    if (!cp) {
+        return 0;
+    }
+    load_last_seq(cp, head_path);
+    seq_dirty = 1;
+    return ++cp->last_seq;
+}
+
+unsigned long long conversation_store_last_seq(const char *head_path) {
+    char stem[96];
+    stem_from_head(stem, sizeof(stem), head_path);
+    ConversationParts *cp = find_parts(stem, 1);
+    if (!cp) {
+        return 0;
+    }
+    load_last_seq(cp, head_path);
+    return cp->last_seq;
+}
+
+static int push_name(char ***names, int *count, int *capacity, const char *name) {
+    if (*count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 64;
+        char **grown = realloc(*names, new_capacity * sizeof(char *));
+        if (!grown) {
+            return -1;
+        }
+        *names = grown;
+        *capacity = new_capacity;
+    }
+    (*names)[*count] = strdup(name);
+    if (!(*names)[*count]) {
+        return -1;
+    }
+    (*count)++;
+    return 0;
+}
+
+int conversation_store_scan_heads(char ***out) {
+    char **names = NULL;
+    int count = 0, capacity = 0;
+    // Chỉ đọc thư mục, không đụng registry: không cần file_mutex
+    for (int r = 0; r < store_root_count; r++) {
+        for (int shard = 0; shard < STORE_SHARD_DIRS; shard++) {
+            char dir_path[PATH_MAX];
+            shard_dir(dir_path, sizeof(dir_path), store_roots[r].path, shard, 0);
+            DIR *dir = opendir(dir_path);
+            if (!dir) {
+                continue;
+            }
+            struct dirent *ent;
+            while ((ent = readdir(dir)) != NULL) {
+                size_t len = strlen(ent->d_name);
+                if (strncmp(ent->d_name, "conversation_", 13) != 0 || len < 5 ||
+                    strcmp(ent->d_name + len - 4, ".txt") != 0) {
+                    continue;
+                }
+                push_name(&names, &count, &capacity, ent->d_name);
+            }
+            closedir(dir);
+        }
+    }
+    *out = names;
+    return count;
+}
+
+// Hội thoại registry biết chắc là có dữ liệu: có segment/archive, hoặc đã được ghi thêm từ lúc khởi động
+static int registry_has_data(const ConversationParts *cp) {
+    return cp->count > 0 || cp->queued_lines > 0;
+}
+
+int conversation_store_merge_registry(char ***out, int count) {
+    char **names = *out;
+    int capacity = count;
+
+    // Bỏ các head mà registry sẽ thêm lại bên dưới, để mỗi hội thoại chỉ xuất hiện một lần
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        char stem[96];
+        stem_from_head(stem, sizeof(stem), names[i]);
+        ConversationParts *cp = find_parts(stem, 0);
+        if (cp && registry_has_data(cp)) {
+            free(names[i]);
+        } else {
+            names[kept++] = names[i];
+        }
+    }
+    count = kept;
+
+    // Hội thoại có segment/archive (head có thể vừa bị cuộn đi) hoặc được tạo sau lúc quét thư mục
+    for (int b = 0; b < STORE_HASH_BUCKETS; b++) {
+        for (ConversationParts *cp = store_buckets[b]; cp; cp = cp->next) {
+            if (registry_has_data(cp)) {
+                char head_name[128];
+                snprintf(head_name, sizeof(head_name), "%s.txt", cp->stem);
+                push_name(&names, &count, &capacity, head_name);
+            }
+        }
+    }
+    *out = names;
+    return count;
+}
+
+int conversation_store_list(char ***out) {
+    int count = conversation_store_scan_heads(out);
+    MUTEX_LOCK(file_mutex);
+    count = conversation_store_merge_registry(out, count);
+    MUTEX_UNLOCK(file_mutex);
+    return count;
+}
+
+// ========================= READER =========================
+
+int conversation_reader_open(ConversationReader *r, const char *head_path) {
+    memset(r, 0, sizeof(*r));
+    char stem[96];
+    stem_from_head(stem, sizeof(stem), head_path);
+    ConversationParts *cp = find_parts(stem, access(head_path, F_OK) == 0);
+    if (cp) {
+        // Lần đọc đầu sau khởi động cũng khôi phục head, để không ai đọc được bản ghi ghi dở
+        load_last_seq(cp, head_path);
+        wait_written(cp);  // Người đọc phải thấy mọi dòng đã lưu trước đó
+    }
+    // Đọc danh sách phần sau khi chờ: compactor có thể đã cuộn/gộp trong lúc nhả file_mutex
+    int part_count = cp ? cp->count : 0;
+
+    r->parts = calloc(part_count + 1, sizeof(char *));
+    r->lines = malloc((part_count + 1) * sizeof(long));
+    if (!r->parts || !r->lines) {
+        free(r->parts);
+        free(r->lines);
+        r->parts = NULL;
+        r->lines = NULL;
+        return -1;
+    }
+    for (int i = 0; i < part_count; i++) {
+        char path[PATH_MAX];
+        segment_path(path, sizeof(path), stem, cp->parts[i]);
+        r->parts[r->count] = strdup(path);
+        if (r->parts[r->count]) r->lines[r->count++] = cp->part_lines[i];
+    }
+    if (access(head_path, F_OK) == 0) {
+        r->parts[r->count] = strdup(head_path);
+        if (r->parts[r->count]) r->lines[r->count++] = -1;  // Head còn thay đổi, không cache
+    }
+    if (r->count == 0) {
+        conversation_reader_close(r);
+        return -1;
+    }
+    return 0;
+}
+
+char *conversation_reader_next(ConversationReader *r, char *line, size_t size) {
+    while (r->index < r->count) {
+        if (!r->f) {
+            r->f = fopen(r->parts[r->index], "r");
+            if (!r->f) {
+                r->index++;  // Phần đã bị xóa bởi retention, bỏ qua
+                continue;
+            }
+        }
+        if (fgets(line, size, r->f)) {
+            return line;
+        }
+        fclose(r->f);
+        r->f = NULL;
+        r->index++;
+    }
+    return NULL;
+}
+
+static void index_path_for(char *path, size_t size, const char *archive_path) {
+    snprintf(path, size, "%.*s.idx", (int)(strlen(archive_path) - 4), archive_path);
+}
+
+/**
+ * Đọc số dòng từ file chỉ mục của archive
+ * @return: Số dòng, hoặc -1 nếu không có chỉ mục
+ */
+static long archive_line_count(const char *archive_path) {
+    char idx_path[PATH_MAX];
+    index_path_for(idx_path, sizeof(idx_path), archive_path);
+    FILE *f = fopen(idx_path, "r");
+    if (!f) {
+        return -1;
+    }
+    long lines = -1;
+    if (fscanf(f, "lines %ld", &lines) != 1) {
+        lines = -1;
+    }
+    fclose(f);
+    return lines;
+}
+
+static long count_file_lines(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    char line[BUFFER_SIZE * 2];
+    long lines = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] != '\n') {
+            lines++;
+        }
+    }
+    fclose(f);
+    return lines;
+}
+
+static long part_line_count(const char *path) {
+    if (is_archive(path)) {
+        long lines = archive_line_count(path);
+        if (lines >= 0) {
+            return lines;
+        }
+    }
+    return count_file_lines(path);
+}
+
+/**
+ * Ghi lại số dòng của một segment/archive vào danh sách phần để lần mở reader
+ * sau (và checkpoint) không phải đếm lại
+ */
+static void remember_part_lines(const char *path, long lines) {
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char stem[96];
+    int last_segment;
+    if (parse_part_name(name, stem, sizeof(stem), &last_segment) < 0) {
+        return;
+    }
+    ConversationParts *cp = find_parts(stem, 0);
+    int found;
+    int i = cp ? part_position(cp, name, &found) : 0;
+    if (cp && found) {
+        cp->part_lines[i] = lines;
+    }
+}
+
+// Số dòng của phần i, ưu tiên giá trị đã cache (segment/archive bất biến)
+static long reader_part_lines(ConversationReader *r, int i) {
+    if (r->lines[i] >= 0) {
+        return r->lines[i];
+    }
+    long lines = part_line_count(r->parts[i]);
+    if (strstr(r->parts[i], "/" SEGMENT_DIR_NAME "/")) {
+        r->lines[i] = lines;
+        remember_part_lines(r->parts[i], lines);
+    }
+    return lines;
+}
+
+long conversation_reader_count(ConversationReader *r) {
+    long total = 0;
+    for (int i = 0; i < r->count; i++) {
+        total += reader_part_lines(r, i);
+    }
+    return total;
+}
+
+void conversation_reader_rewind(ConversationReader *r) {
+    if (r->f) {
+        fclose(r->f);
+        r->f = NULL;
+    }
+    r->index = 0;
+}
+
+void conversation_reader_skip(ConversationReader *r, long n) {
+    conversation_reader_rewind(r);
+    char line[BUFFER_SIZE * 2];
+
+    // Bỏ qua nguyên cả phần nếu đủ dòng
+    while (n > 0 && r->index < r->count) {
+        long lines = reader_part_lines(r, r->index);
+        if (lines > n) {
+            break;
+        }
+        n -= lines;
+        r->index++;
+    }
+    if (n <= 0 || r->index >= r->count) {
+        return;
+    }
+
+    // Trong archive: nhảy tới mục chỉ mục gần nhất phía trước
+    if (is_archive(r->parts[r->index])) {
+        char idx_path[PATH_MAX];
+        index_path_for(idx_path, sizeof(idx_path), r->parts[r->index]);
+        FILE *idx = fopen(idx_path, "r");
+        long target_entry = n / ARCHIVE_INDEX_STRIDE;
+        long offset = -1;
+        if (idx && target_entry > 0) {
+            long lines, entry_line, entry_offset;
+            if (fscanf(idx, "lines %ld\n", &lines) == 1) {
+                while (fscanf(idx, "%ld %ld\n", &entry_line, &entry_offset) == 2) {
+                    if (entry_line > n) break;
+                    offset = entry_offset;
+                    target_entry = entry_line;
+                }
+            }
+        }
+        if (idx) fclose(idx);
+        if (offset >= 0) {
+            r->f = fopen(r->parts[r->index], "r");
+            if (r->f && fseek(r->f, offset, SEEK_SET) == 0) {
+                n -= target_entry;
+            } else if (r->f) {
+                rewind(r->f);
+            }
+        }
+    }
+
+    while (n > 0 && conversation_reader_next(r, line, sizeof(line))) {
+        if (line[0] != '\n') n--;
+    }
+}
+
+void conversation_reader_seek_after(ConversationReader *r, unsigned long long after_seq) {
+    conversation_reader_rewind(r);
+    if (after_seq == 0) {
+        return;
+    }
+    // Tìm phần mới nhất có dòng đầu tiên không vượt quá after_seq + 1
+    char line[BUFFER_SIZE * 2];
+    for (int i = r->count - 1; i >= 0; i--) {
+        FILE *f = fopen(r->parts[i], "r");
+        if (!f) continue;
+        unsigned long long first = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (line[0] == '\n') continue;
+            first = parse_line_seq(line, NULL);
+            break;
+        }
+        fclose(f);
+        if (first <= after_seq + 1) {
+            r->index = i;
+            return;
+        }
+    }
+}
+
+int conversation_reader_tell(ConversationReader *r, ReaderPosition *pos) {
+    if (r->index >= r->count) {
+        return -1;
+    }
+    if (!r->f) {
+        r->f = fopen(r->parts[r->index], "r");
+        if (!r->f) {
+            return -1;
+        }
+    }
+    struct stat st;
+    if (fstat(fileno(r->f), &st) != 0) {
+        return -1;
+    }
+    snprintf(pos->path, sizeof(pos->path), "%s", r->parts[r->index]);
+    pos->inode = st.st_ino;
+    pos->offset = ftell(r->f);
+    return pos->offset < 0 ? -1 : 0;
+}
+
+int conversation_reader_resume(ConversationReader *r, const ReaderPosition *pos) {
+    conversation_reader_rewind(r);
+    for (int i = 0; i < r->count; i++) {
+        if (strcmp(r->parts[i], pos->path) != 0) {
+            continue;
+        }
+        FILE *f = fopen(r->parts[i], "r");
+        struct stat st;
+        if (!f) {
+            return -1;
+        }
+        if (fstat(fileno(f), &st) != 0 || st.st_ino != pos->inode || fseek(f, pos->offset, SEEK_SET) != 0) {
+            fclose(f);
+            return -1;
+        }
+        r->f = f;
+        r->index = i;
+        return 0;
+    }
+    return -1;
+}
+
+void conversation_reader_close(ConversationReader *r) {
+    if (r->f) {
+        fclose(r->f);
+        r->f = NULL;
+    }
+    for (int i = 0; i < r->count; i++) {
+        free(r->parts[i]);
+    }
+    free(r->parts);
+    free(r->lines);
+    r->parts = NULL;
+    r->lines = NULL;
+    r->count = 0;
+}
+
+// ========================= COMPACTOR =========================
+
+// Token bucket giới hạn I/O của compactor để không ảnh hưởng độ trễ foreground
+static double throttle_tokens = COMPACT_IO_BYTES_PER_SEC;
+static struct timespec throttle_last;
+
+static void throttle_io(size_t bytes) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (now.tv_sec - throttle_last.tv_sec) + (now.tv_nsec - throttle_last.tv_nsec) / 1e9;
+    throttle_last = now;
+    throttle_tokens += elapsed * COMPACT_IO_BYTES_PER_SEC;
+    if (throttle_tokens > COMPACT_IO_BYTES_PER_SEC) {
+        throttle_tokens = COMPACT_IO_BYTES_PER_SEC;
+    }
+    throttle_tokens -= bytes;
+    if (throttle_tokens < 0) {
+        usleep((useconds_t)(-throttle_tokens / COMPACT_IO_BYTES_PER_SEC * 1e6));
+    }
+}
+
+/**
+ * Cuộn head thành segment bất biến nếu đã vượt SEGMENT_ROLL_BYTES.
+ * Chỉ giữ file_mutex trong lúc rename nên không chặn save_conversation().
+ */
+static void roll_head_if_needed(const char *head_name) {
+    char stem[96], head_path[PATH_MAX];
+    stem_from_head(stem, sizeof(stem), head_name);
+    head_path_for(head_path, sizeof(head_path), stem);
+    struct stat st;
+    if (stat(head_path, &st) != 0 || st.st_size < SEGMENT_ROLL_BYTES) {
+        return;
+    }
+
+    MUTEX_LOCK(file_mutex);
+    ConversationParts *cp = find_parts(stem, 1);
+    if (cp) {
+        // Cắt bản ghi dở (nếu chưa khôi phục) trước khi head thành segment bất biến;
+        // writer cũng không được còn ghi vào head khi đó
+        load_last_seq(cp, head_path);
+        wait_written(cp);
+    }
+    // Head có thể đã bị reset trong lúc wait_written nhả file_mutex: kiểm lại kích thước
+    if (cp && stat(head_path, &st) == 0 && st.st_size >= SEGMENT_ROLL_BYTES) {
+        char name[160], path[PATH_MAX];
+        snprintf(name, sizeof(name), "%s.%08d.seg", stem, cp->next_segment);
+        segment_path(path, sizeof(path), stem, name);
+        journal_append("+ %s %s", stem, name);
+        int rc = rename(head_path, path);
+        if (rc != 0 && errno == ENOENT) {
+            make_parent_dir(path);
+            rc = rename(head_path, path);
+        }
+        if (rc == 0) {
+            cp->next_segment++;
+            add_part(cp, name, -1);
+            log_event("Compactor rolled %s into segment %s (%lld bytes)", head_name, name, (long long)st.st_size);
+        } else {
+            log_event("[ERROR] Compactor failed to roll %s: %s", head_path, strerror(errno));
+        }
+    }
+    MUTEX_UNLOCK(file_mutex);
+}
+
+static void delete_part_locked(ConversationParts *cp, const char *name) {
+    char path[PATH_MAX];
+    segment_path(path, sizeof(path), cp->stem, name);
+    journal_append("- %s %s", cp->stem, name);
+    if (unlink(path) != 0 && errno != ENOENT) {
+        log_event("[ERROR] Compactor failed to delete %s: %s", path, strerror(errno));
+        return;
+    }
+    if (is_archive(name)) {
+        char idx_path[PATH_MAX];
+        index_path_for(idx_path, sizeof(idx_path), path);
+        unlink(idx_path);
+    }
+    log_event("Compactor retention removed %s", name);
+    remove_part(cp, name);
+}
+
+/**
+ * Áp dụng retention theo tuổi và tổng kích thước cho các phần đã cuộn
+ */
+static void apply_retention(const char *stem) {
+    const RetentionRule *rule = find_retention_rule(stem);
+    if (!rule || (rule->max_age_sec == 0 && rule->max_bytes == 0)) {
+        return;
+    }
+
+    // Lấy bản sao danh sách để stat ngoài file_mutex
+    MUTEX_LOCK(file_mutex);
+    ConversationParts *cp = find_parts(stem, 0);
+    int count = cp ? cp->count : 0;
+    char **names = count ? calloc(count, sizeof(char *)) : NULL;
+    for (int i = 0; i < count && names; i++) {
+        names[i] = strdup(cp->parts[i]);
+    }
+    MUTEX_UNLOCK(file_mutex);
+    if (!names) {
+        return;
+    }
+
+    long long *sizes = calloc(count, sizeof(long long));
+    int *expired = calloc(count, sizeof(int));
+    long long total = 0;
+    time_t now = time(NULL);
+    for (int i = 0; i < count && sizes && expired; i++) {
+        char path[PATH_MAX];
+        struct stat st;
+        segment_path(path, sizeof(path), stem, names[i] ? names[i] : "");
+        if (names[i] && stat(path, &st) == 0) {
+            sizes[i] = st.st_size;
+            total += st.st_size;
+            if (rule->max_age_sec > 0 && now - st.st_mtime > rule->max_age_sec) {
+                expired[i] = 1;
+            }
+        }
+    }
+    // Xóa phần cũ nhất trước cho tới khi đủ điều kiện kích thước
+    for (int i = 0; i < count && sizes && expired; i++) {
+        if (!expired[i] && rule->max_bytes > 0 && total > rule->max_bytes) {
+            expired[i] = 1;
+        }
+        if (expired[i]) {
+            total -= sizes[i];
+        }
+    }
+
+    MUTEX_LOCK(file_mutex);
+    cp = find_parts(stem, 0);
+    for (int i = 0; i < count && cp && expired; i++) {
+        if (expired[i] && names[i]) {
+            delete_part_locked(cp, names[i]);
+        }
+    }
+    MUTEX_UNLOCK(file_mutex);
+
+    for (int i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(sizes);
+    free(expired);
+}
+
+/**
+ * Gộp ARCHIVE_MERGE_SEGMENTS segment cũ nhất thành một archive có chỉ mục.
+ * Việc copy chạy ngoài file_mutex (segment là bất biến); chỉ bước thay thế
+ * danh sách phần mới giữ lock.
+ */
+static void merge_segments_if_needed(const char *stem) {
+    char *merge[ARCHIVE_MERGE_SEGMENTS];
+    int merge_count = 0;
+
+    MUTEX_LOCK(file_mutex);
+    ConversationParts *cp = find_parts(stem, 0);
+    for (int i = 0; cp && i < cp->count && merge_count < ARCHIVE_MERGE_SEGMENTS; i++) {
+        if (!is_archive(cp->parts[i])) {
+            merge[merge_count++] = strdup(cp->parts[i]);
+        }
+    }
+    MUTEX_UNLOCK(file_mutex);
+
+    if (merge_count < ARCHIVE_MERGE_SEGMENTS) {
+        for (int i = 0; i < merge_count; i++) free(merge[i]);
+        return;
+    }
+
+    char stem_check[96];
+    int first = 0, last = 0;
+    parse_part_name(merge[0], stem_check, sizeof(stem_check), &first);
+    parse_part_name(merge[merge_count - 1], stem_check, sizeof(stem_check), &last);
+
+    char arc_name[192], arc_path[PATH_MAX], idx_path[PATH_MAX];
+    char tmp_path[PATH_MAX + 8], idx_tmp[PATH_MAX + 8];
+    snprintf(arc_name, sizeof(arc_name), "%s.%08d-%08d.arc", stem, first, last);
+    segment_path(arc_path, sizeof(arc_path), stem, arc_name);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", arc_path);
+    index_path_for(idx_path, sizeof(idx_path), arc_path);
+    snprintf(idx_tmp, sizeof(idx_tmp), "%s.tmp", idx_path);
+
+    FILE *out = fopen(tmp_path, "w");
+    FILE *idx_body = tmpfile();
+    int ok = out && idx_body;
+    long lines = 0;
+    long offset = 0;
+    char line[BUFFER_SIZE * 2];
+    for (int i = 0; ok && i < merge_count; i++) {
+        char path[PATH_MAX];
+        segment_path(path, sizeof(path), stem, merge[i]);
+        FILE *in = fopen(path, "r");
+        if (!in) {
+            ok = 0;
+            break;
+        }
+        while (fgets(line, sizeof(line), in)) {
+            size_t len = strlen(line);
+            if (line[0] == '\n') continue;
+            if (line[len - 1] != '\n' && len + 1 < sizeof(line)) {
+                line[len++] = '\n';
+                line[len] = '\0';
+            }
+            if (lines % ARCHIVE_INDEX_STRIDE == 0 && lines > 0) {
+                fprintf(idx_body, "%ld %ld\n", lines, offset);
+            }
+            if (fwrite(line, 1, len, out) != len) {
+                ok = 0;
+                break;
+            }
+            offset += len;
+            lines++;
+            throttle_io(len * 2);  // đọc + ghi
+        }
+        fclose(in);
+    }
+    if (out && fclose(out) != 0) ok = 0;
+
+    // File chỉ mục: "lines N" rồi "<dòng thứ k> <offset byte>" mỗi ARCHIVE_INDEX_STRIDE dòng
+    if (ok) {
+        FILE *idx = fopen(idx_tmp, "w");
+        ok = idx != NULL;
+        if (ok) {
+            fprintf(idx, "lines %ld\n", lines);
+            rewind(idx_body);
+            while (fgets(line, sizeof(line), idx_body)) {
+                fputs(line, idx);
+            }
+            ok = fclose(idx) == 0;
+        }
+    }
+    if (idx_body) fclose(idx_body);
+
+    if (ok) {
+        MUTEX_LOCK(file_mutex);
+        cp = find_parts(stem, 0);
+        int still_present = cp != NULL;
+        for (int i = 0; still_present && i < merge_count; i++) {
+            int found = 0;
+            for (int j = 0; j < cp->count; j++) {
+                if (strcmp(cp->parts[j], merge[i]) == 0) {
+                    found = 1;
+                    break;
+                }
+            }
+            still_present = found;
+        }
+        if (still_present) {
+            // Một bản ghi cho cả lần gộp: khi phát lại chỉ có hiệu lực nếu archive đã được rename xong
+            char record[JOURNAL_RECORD_MAX - 64];
+            int len = snprintf(record, sizeof(record), "m %s %s %ld", stem, arc_name, lines);
+            for (int i = 0; i < merge_count && len < (int)sizeof(record); i++) {
+                len += snprintf(record + len, sizeof(record) - len, " %s", merge[i]);
+            }
+            journal_append("%s", record);
+        }
+        if (still_present && rename(idx_tmp, idx_path) == 0 && rename(tmp_path, arc_path) == 0) {
+            for (int i = 0; i < merge_count; i++) {
+                char path[PATH_MAX];
+                segment_path(path, sizeof(path), stem, merge[i]);
+                unlink(path);
+                remove_part(cp, merge[i]);
+            }
+            add_part(cp, arc_name, lines);
+            log_event("Compactor merged %d segments of %s into %s (%ld lines)", merge_count, stem, arc_name, lines);
+        } else {
+            ok = 0;
+        }
+        MUTEX_UNLOCK(file_mutex);
+    }
+    if (!ok) {
+        log_event("[ERROR] Compactor failed to build archive %s", arc_name);
+        unlink(tmp_path);
+        unlink(idx_tmp);
+    }
+
+    for (int i = 0; i < merge_count; i++) free(merge[i]);
+}
+
+static void compact_pass(void) {
+    checkpoint_if_needed();
+    char **names = NULL;
+    int count = conversation_store_list(&names);
+
+    for (int i = 0; i < count; i++) {
+        char stem[96];
+        stem_from_head(stem, sizeof(stem), names[i]);
+        roll_head_if_needed(names[i]);
+        apply_retention(stem);
+        merge_segments_if_needed(stem);
+        free(names[i]);
+    }
+    free(names);
+    checkpoint_if_needed();
+}
+
+static void *compactor_thread(void *arg) {
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &throttle_last);
+    // Khởi động không có checkpoint: ghi ngay ở nền để lần khởi động sau không phải quét thư mục
+    checkpoint_if_needed();
+    while (1) {
+        sleep(COMPACT_INTERVAL_SEC);
+        compact_pass();
+    }
+    return NULL;
+}
+
+int compactor_start(void) {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, compactor_thread, NULL) != 0) {
+        log_event("[ERROR] Failed to create compactor thread: %s", strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to create compactor thread: %s\n", strerror(errno));
+        return -1;
+    }
+    pthread_detach(tid);
+    log_event("Compactor started (roll %d bytes, merge %d segments, %d bytes/s I/O)",
+              SEGMENT_ROLL_BYTES, ARCHIVE_MERGE_SEGMENTS, COMPACT_IO_BYTES_PER_SEC);
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include "../include/delivery_ack.h"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+// Trạng thái theo dõi của một hội thoại (không có gì theo từng người nhận)
+typedef struct {
+    char key[80];
+    unsigned int gen;               // Tăng mỗi lần slot được dùng lại, ack của thế hệ cũ bị bỏ
+    uint64_t last_sent_us;          // Lần gắn tag gần nhất, để nhận ra slot rảnh
+    unsigned long long next_seq;    // Seq đã cấp gần nhất
+    unsigned long long acked_seq;   // High-water mark: seq lớn nhất đã được ack
+    struct {
+        unsigned long long seq;
+        uint64_t sent_us;
+    } ring[DELIVERY_RING];          // Thời điểm gửi của các tin gần nhất, theo seq % DELIVERY_RING
+} DeliveryConversation;
+
+static DeliveryConversation *conversations[DELIVERY_MAX_CONVERSATIONS];
+static int conversation_count = 0;
+static unsigned int next_gen = 0;
+static unsigned long evicted_total = 0;         // Số lần một slot rảnh được dùng lại
+static unsigned long acked_total = 0;           // Tổng số tin mà high-water mark đã vượt qua
+static unsigned long latency_hist[DELIVERY_LATENCY_BUCKETS];
+static unsigned long latency_samples = 0;
+static uint64_t latency_max_us = 0;
+static pthread_mutex_t ack_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+// Slot không còn tin nào chờ ack (hoặc đã bị bỏ quá lâu) và không gửi gì từ lâu
+static int slot_idle(const DeliveryConversation *c, uint64_t now) {
+    uint64_t idle = now - c->last_sent_us;
+    return (c->acked_seq == c->next_seq && idle >= DELIVERY_IDLE_SEC * 1000000ull) ||
+           idle >= DELIVERY_STALE_SEC * 1000000ull;
+}
+
+/**
+ * Tìm (hoặc tạo) hội thoại theo key bằng dò tuyến tính. Slot không bao giờ trở về NULL
+ * nên chuỗi dò không bị cắt; key chưa có thì lấy slot trống đầu tiên, hoặc slot rảnh
+ * đầu tiên gặp trên đường dò (đổi sang gen mới). Gọi khi đang giữ ack_mutex.
+ * @return: Slot, -1 nếu bảng đầy và không slot nào rảnh
+ */
+static int find_slot(const char *key, uint64_t now) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)key; *p; p++) {
+        h = (h ^ *p) * 16777619u;
+    }
+    int reusable = -1;
+    for (int probe = 0; probe < DELIVERY_MAX_CONVERSATIONS; probe++) {
+        int slot = (h + probe) % DELIVERY_MAX_CONVERSATIONS;
+        DeliveryConversation *c = conversations[slot];
+        if (!c) {
+            if (reusable >= 0) {
+                break;
+            }
+            c = calloc(1, sizeof(*c));
+            if (!c) {
+                return -1;
+            }
+            snprintf(c->key, sizeof(c->key), "%s", key);
+            c->gen = ++next_gen;
+            conversations[slot] = c;
+            conversation_count++;
+            return slot;
+        }
+        if (strncmp(c->key, key, sizeof(c->key) - 1) == 0) {
+            return slot;
+        }
+        if (reusable < 0 && slot_idle(c, now)) {
+            reusable = slot;
+        }
+    }
+    if (reusable < 0) {
+        return -1;
+    }
+    DeliveryConversation *c = conversations[reusable];
+    memset(c, 0, sizeof(*c));
+    snprintf(c->key, sizeof(c->key), "%s", key);
+    c->gen = ++next_gen;
+    evicted_total++;
+    return reusable;
+}
+
+int delivery_tag(const char *key, char *tag, size_t size) {
+    uint64_t now = now_us();
+    pthread_mutex_lock(&ack_mutex);
+    int slot = find_slot(key, now);
+    if (slot < 0) {
+        pthread_mutex_unlock(&ack_mutex);
+        metrics_add(METRIC_DELIVERY_UNTRACKED, 1);
+        return 0;
+    }
+    DeliveryConversation *c = conversations[slot];
+    unsigned long long seq = ++c->next_seq;
+    unsigned int gen = c->gen;
+    c->ring[seq % DELIVERY_RING].seq = seq;
+    c->ring[seq % DELIVERY_RING].sent_us = now;
+    c->last_sent_us = now;
+    pthread_mutex_unlock(&ack_mutex);
+
+    metrics_add(METRIC_DELIVERY_TAGGED, 1);
+    int len = snprintf(tag, size, "%c%d.%u:%llu ", DELIVERY_TAG_PREFIX, slot, gen, seq);
+    return len > 0 && (size_t)len < size ? len : 0;
+}
+
+static int bucket_of(uint64_t us) {
+    if (us == 0) {
+        return 0;
+    }
+    int b = 63 - __builtin_clzll(us);
+    return b < DELIVERY_LATENCY_BUCKETS ? b : DELIVERY_LATENCY_BUCKETS - 1;
+}
+
+// Một mục "<slot>.<gen>:<seq>+<held_ms>", gọi khi đang giữ ack_mutex
+static int apply_ack(int slot, unsigned int gen, unsigned long long seq, unsigned long held_ms, uint64_t now) {
+    if (slot < 0 || slot >= DELIVERY_MAX_CONVERSATIONS || !conversations[slot]) {
+        return -1;
+    }
+    DeliveryConversation *c = conversations[slot];
+    if (c->gen != gen || seq == 0 || seq > c->next_seq) {
+        return -1;
+    }
+    if (seq > c->acked_seq) {
+        acked_total += seq - c->acked_seq;
+        c->acked_seq = seq;
+    }
+    // Tin đã ra khỏi vòng (client giữ ack quá lâu) chỉ đẩy high-water mark, không cho mẫu
+    if (c->ring[seq % DELIVERY_RING].seq == seq) {
+        uint64_t elapsed = now - c->ring[seq % DELIVERY_RING].sent_us;
+        uint64_t held = (uint64_t)held_ms * 1000;
+        uint64_t latency = elapsed > held ? elapsed - held : 0;
+        latency_hist[bucket_of(latency)]++;
+        latency_samples++;
+        if (latency > latency_max_us) {
+            latency_max_us = latency;
+        }
+    }
+    return 0;
+}
+
+int delivery_ack_entries(const char *list) {
+    int valid = 0;
+    uint64_t now = now_us();
+    pthread_mutex_lock(&ack_mutex);
+    const char *p = list;
+    while (*p) {
+        while (*p == ' ') p++;
+        int slot, used = 0;
+        unsigned int gen;
+        unsigned long long seq;
+        unsigned long held_ms = 0;
+        if (sscanf(p, "%d.%u:%llu%n", &slot, &gen, &seq, &used) == 3) {
+            if (p[used] == '+') {
+                char *end;
+                held_ms = strtoul(p + used + 1, &end, 10);
+                used = end - p;
+            }
+            if (apply_ack(slot, gen, seq, held_ms, now) == 0) {
+                valid++;
+            }
+        }
+        while (p[used] && p[used] != ' ') used++;
+        p += used;
+    }
+    pthread_mutex_unlock(&ack_mutex);
+    metrics_add(METRIC_DELIVERY_ACKS, valid);
+    return valid;
+}
+
+// Cận trên (micro giây) của bucket chứa phân vị q
+static unsigned long long hist_percentile(double q) {
+    if (latency_samples == 0) {
+        return 0;
+    }
+    unsigned long rank = (unsigned long)(q * latency_samples);
+    unsigned long seen = 0;
+    for (int i = 0; i < DELIVERY_LATENCY_BUCKETS; i++) {
+        seen += latency_hist[i];
+        if (seen > rank) {
+            return 1ull << (i + 1);
+        }
+    }
+    return 1ull << DELIVERY_LATENCY_BUCKETS;
+}
+
+size_t delivery_ack_format(char *buffer, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&ack_mutex);
+    unsigned long unacked = 0;
+    for (int i = 0; i < DELIVERY_MAX_CONVERSATIONS; i++) {
+        if (conversations[i]) {
+            unacked += conversations[i]->next_seq - conversations[i]->acked_seq;
+        }
+    }
+    size_t pos = snprintf(buffer, size,
+        "delivery_conversations %d\n"
+        "delivery_evicted %lu\n"
+        "delivery_acked %lu\n"
+        "delivery_unacked %lu\n"
+        "delivery_latency_samples %lu\n"
+        "delivery_latency_p50_us %llu\n"
+        "delivery_latency_p90_us %llu\n"
+        "delivery_latency_p99_us %llu\n"
+        "delivery_latency_max_us %llu\n",
+        conversation_count, evicted_total, acked_total, unacked, latency_samples,
+        hist_percentile(0.50), hist_percentile(0.90), hist_percentile(0.99),
+        (unsigned long long)latency_max_us);
+    pthread_mutex_unlock(&ack_mutex);
+    return pos < size ? pos : size - 1;
+}
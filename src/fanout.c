@@ -0,0 +1,228 @@
+#include "../include/fanout.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include "../include/msg_trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+// Dữ liệu dùng chung của các job thuộc cùng một fan-out
+typedef struct {
+    int refs;
+    size_t len;
+    char data[];
+} FanoutMessage;
+
+typedef struct FanoutJob {
+    struct FanoutJob *next;
+    FanoutMessage *msg;
+    OutboundLane lane;
+    int count;
+    Outbox *boxes[];
+} FanoutJob;
+
+typedef struct {
+    pthread_t thread;
+    FanoutJob *head;
+    FanoutJob *tail;
+    int stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} FanoutWorker;
+
+static FanoutWorker workers[FANOUT_MAX_WORKERS];
+static int worker_count = 0;
+static int fanout_threshold = FANOUT_DEFAULT_THRESHOLD;
+static int pending_jobs = 0;                 // Job đã xếp nhưng chưa gửi xong
+static pthread_mutex_t submit_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void message_put(FanoutMessage *msg) {
+    if (__atomic_sub_fetch(&msg->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(msg);
+    }
+}
+
+// Làn đầy: bỏ tin của người nhận này thay vì chờ (hàng đợi tự đặt hạn loại bỏ kết nối).
+// Không ghi log mỗi lần bỏ: người nhận kẹt sẽ làm rơi hàng loạt tin liên tiếp.
+static void push_one(Outbox *box, OutboundLane lane, const char *data, size_t len) {
+    if (outbox_push(box, lane, data, len) < 0) {
+        metrics_add(METRIC_FANOUT_DROPPED, 1);
+    }
+    outbox_release(box);
+}
+
+static void *worker_thread(void *arg) {
+    FanoutWorker *w = (FanoutWorker *)arg;
+    pthread_mutex_lock(&w->mutex);
+    while (1) {
+        while (!w->head && !w->stopping) {
+            pthread_cond_wait(&w->cond, &w->mutex);
+        }
+        FanoutJob *job = w->head;
+        if (!job) {
+            break;  // Đang dừng và đã hết job
+        }
+        w->head = job->next;
+        if (!w->head) {
+            w->tail = NULL;
+        }
+        pthread_mutex_unlock(&w->mutex);
+
+        for (int i = 0; i < job->count; i++) {
+            push_one(job->boxes[i], job->lane, job->msg->data, job->msg->len);
+        }
+        message_put(job->msg);
+        free(job);
+        __atomic_sub_fetch(&pending_jobs, 1, __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&w->mutex);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+int fanout_start(int count, int threshold) {
+    if (count < 0 || count > FANOUT_MAX_WORKERS || threshold < 0) {
+        return -1;
+    }
+    fanout_threshold = threshold;
+    for (int i = 0; i < count; i++) {
+        FanoutWorker *w = &workers[i];
+        memset(w, 0, sizeof(*w));
+        pthread_mutex_init(&w->mutex, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        if (pthread_create(&w->thread, NULL, worker_thread, w) != 0) {
+            log_event("[ERROR] Failed to create fan-out worker %d: %s", i, strerror(errno));
+            fprintf(stderr, "[ERROR] Failed to create fan-out worker %d: %s\n", i, strerror(errno));
+            pthread_mutex_destroy(&w->mutex);
+            pthread_cond_destroy(&w->cond);
+            worker_count = i;
+            fanout_stop();
+            return -1;
+        }
+    }
+    __atomic_store_n(&worker_count, count, __ATOMIC_RELEASE);
+    metrics_set(METRIC_FANOUT_WORKERS, count);
+    if (count > 0) {
+        log_event("Fan-out: %d workers, threshold %d recipients", count, threshold);
+    }
+    return 0;
+}
+
+void fanout_stop(void) {
+    pthread_mutex_lock(&submit_mutex);
+    int count = worker_count;
+    __atomic_store_n(&worker_count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&submit_mutex);
+    for (int i = 0; i < count; i++) {
+        FanoutWorker *w = &workers[i];
+        pthread_mutex_lock(&w->mutex);
+        w->stopping = 1;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->mutex);
+        pthread_cond_destroy(&w->cond);
+    }
+    metrics_set(METRIC_FANOUT_WORKERS, 0);
+}
+
+static void send_inline(Outbox **boxes, int count, OutboundLane lane, const char *data, size_t len) {
+    for (int i = 0; i < count; i++) {
+        TRACE_BEGIN(send_start);
+        int sock = outbox_socket(boxes[i]);
+        push_one(boxes[i], lane, data, len);
+        TRACE_END("send", send_start, sock);
+    }
+}
+
+static void release_all(Outbox **boxes, int count) {
+    for (int i = 0; i < count; i++) {
+        outbox_release(boxes[i]);
+    }
+}
+
+int fanout_send(Outbox **boxes, int count, OutboundLane lane, const char *data, size_t len) {
+    if (count <= 0) {
+        return 0;
+    }
+    if (__atomic_load_n(&worker_count, __ATOMIC_ACQUIRE) == 0 ||
+        (count < fanout_threshold && __atomic_load_n(&pending_jobs, __ATOMIC_ACQUIRE) == 0)) {
+        send_inline(boxes, count, lane, data, len);
+        return 0;
+    }
+
+    FanoutMessage *msg = malloc(sizeof(FanoutMessage) + len);
+    if (!msg) {
+        log_event("[ERROR] Failed to allocate fan-out message (%d recipients)", count);
+        release_all(boxes, count);
+        return -1;
+    }
+    msg->len = len;
+    memcpy(msg->data, data, len);
+
+    pthread_mutex_lock(&submit_mutex);
+    int shards = worker_count;
+    if (shards == 0) {
+        // Worker vừa bị dừng
+        pthread_mutex_unlock(&submit_mutex);
+        free(msg);
+        send_inline(boxes, count, lane, data, len);
+        return 0;
+    }
+
+    // Chia người nhận theo shard kết nối, giữ thứ tự trong mỗi shard
+    int per_shard[FANOUT_MAX_WORKERS] = {0};
+    for (int i = 0; i < count; i++) {
+        per_shard[outbox_socket(boxes[i]) % shards]++;
+    }
+    FanoutJob *jobs[FANOUT_MAX_WORKERS] = {0};
+    int job_count = 0;
+    for (int s = 0; s < shards; s++) {
+        if (per_shard[s] == 0) {
+            continue;
+        }
+        jobs[s] = malloc(sizeof(FanoutJob) + sizeof(Outbox *) * per_shard[s]);
+        if (!jobs[s]) {
+            for (int k = 0; k < s; k++) {
+                free(jobs[k]);
+            }
+            pthread_mutex_unlock(&submit_mutex);
+            free(msg);
+            release_all(boxes, count);
+            log_event("[ERROR] Failed to allocate fan-out job (%d recipients)", per_shard[s]);
+            return -1;
+        }
+        jobs[s]->next = NULL;
+        jobs[s]->msg = msg;
+        jobs[s]->lane = lane;
+        jobs[s]->count = 0;
+        job_count++;
+    }
+    for (int i = 0; i < count; i++) {
+        FanoutJob *job = jobs[outbox_socket(boxes[i]) % shards];
+        job->boxes[job->count++] = boxes[i];
+    }
+
+    msg->refs = job_count;
+    __atomic_add_fetch(&pending_jobs, job_count, __ATOMIC_RELEASE);
+    for (int s = 0; s < shards; s++) {
+        if (!jobs[s]) {
+            continue;
+        }
+        FanoutWorker *w = &workers[s];
+        pthread_mutex_lock(&w->mutex);
+        if (w->tail) {
+            w->tail->next = jobs[s];
+        } else {
+            w->head = jobs[s];
+        }
+        w->tail = jobs[s];
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->mutex);
+    }
+    pthread_mutex_unlock(&submit_mutex);
+    metrics_add(METRIC_FANOUT_PARALLEL, 1);
+    return 0;
+}
@@ -0,0 +1,645 @@
+#include "../include/federation.h"
+#include "../include/reply_cache.h"
+#include "../include/server_utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <pthread.h>
+
+// Loại frame trên liên kết giữa các node
+// Frame: [u32 độ dài payload (network order)] [u8 type] [các trường kết thúc bằng '\0']
+enum {
+    FRAME_HELLO = 1,        // node_id, shared secret
+    FRAME_PRESENCE_RESET,   // (không có trường) - xóa toàn bộ presence của node gửi
+    FRAME_PRESENCE_ADD,     // username
+    FRAME_PRESENCE_DEL,     // username
+    FRAME_PRIVATE,          // sender, target, msg
+    FRAME_GROUP,            // sender, groupId, msg
+    FRAME_BROADCAST,        // sender, msg
+};
+
+#define FRAME_MAX_PAYLOAD (BUFFER_SIZE + 128)
+#define PEER_BUFFER_SIZE (256 * 1024)
+#define RECONNECT_DELAY_SEC 1
+
+// Liên kết gửi tới một peer: buffer batch + thread ghi
+typedef struct {
+    int node_id;
+    char host[128];
+    int link_port;
+    int sock;
+    char *pending;          // Frame chờ gửi
+    size_t pending_len;
+    int connected;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} PeerLink;
+
+// Presence của một user ở node khác
+typedef struct {
+    char username[32];
+    int node_id;
+} RemoteUser;
+
+static int local_node_id = -1;
+static char cluster_secret[FEDERATION_SECRET_MAX];
+static PeerLink peers[MAX_PEERS];
+static int peerCount = 0;
+
+static RemoteUser *remote_users = NULL;
+static int remoteUserCount = 0;
+static int remoteUserCapacity = 0;
+static pthread_mutex_t remote_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// ========================= FRAME ENCODING =========================
+
+/**
+ * Thêm một frame vào buffer batch của peer (gọi khi đang giữ link->mutex)
+ * @return: 0 nếu thành công, -1 nếu buffer đầy hoặc chưa kết nối
+ */
+static int append_frame_locked(PeerLink *link, uint8_t type, const char **fields, int nfields) {
+    size_t payload = 1;
+    for (int i = 0; i < nfields; i++) {
+        payload += strlen(fields[i]) + 1;
+    }
+    if (payload > FRAME_MAX_PAYLOAD || link->pending_len + 4 + payload > PEER_BUFFER_SIZE) {
+        return -1;
+    }
+
+    uint32_t be_len = htonl((uint32_t)payload);
+    char *out = link->pending + link->pending_len;
+    memcpy(out, &be_len, 4);
+    out[4] = (char)type;
+    size_t pos = 5;
+    for (int i = 0; i < nfields; i++) {
+        size_t flen = strlen(fields[i]) + 1;
+        memcpy(out + pos, fields[i], flen);
+        pos += flen;
+    }
+    link->pending_len += pos;
+    return 0;
+}
+
+static void queue_frame(PeerLink *link, uint8_t type, const char **fields, int nfields) {
+    pthread_mutex_lock(&link->mutex);
+    if (link->connected) {
+        if (append_frame_locked(link, type, fields, nfields) < 0) {
+            log_event("[ERROR] Federation buffer full for node %d, dropping frame type %d", link->node_id, type);
+        } else {
+            pthread_cond_signal(&link->cond);
+        }
+    }
+    pthread_mutex_unlock(&link->mutex);
+}
+
+static PeerLink *find_peer(int node_id) {
+    for (int i = 0; i < peerCount; i++) {
+        if (peers[i].node_id == node_id) {
+            return &peers[i];
+        }
+    }
+    return NULL;
+}
+
+static void queue_frame_all(uint8_t type, const char **fields, int nfields) {
+    for (int i = 0; i < peerCount; i++) {
+        queue_frame(&peers[i], type, fields, nfields);
+    }
+}
+
+// ========================= OUTBOUND LINKS =========================
+
+static int connect_peer(PeerLink *link) {
+    char port_str[16];
+    snprintf(port_str, sizeof(port_str), "%d", link->link_port);
+
+    struct addrinfo hints = {0}, *res = NULL;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(link->host, port_str, &hints, &res) != 0 || !res) {
+        return -1;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype, 0);
+    if (sock < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+    if (connect(sock, res->ai_addr, res->ai_addrlen) < 0) {
+        close(sock);
+        freeaddrinfo(res);
+        return -1;
+    }
+    freeaddrinfo(res);
+
+    int opt = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+    return sock;
+}
+
+static int send_all(int sock, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Gửi HELLO và snapshot presence của các phiên local ngay sau khi kết nối
+ * Lock order: link->mutex rồi clients_mutex
+ */
+static void queue_handshake_locked(PeerLink *link) {
+    char id_str[16];
+    snprintf(id_str, sizeof(id_str), "%d", local_node_id);
+    const char *hello[] = {id_str, cluster_secret};
+    append_frame_locked(link, FRAME_HELLO, hello, 2);
+    append_frame_locked(link, FRAME_PRESENCE_RESET, NULL, 0);
+
+    MUTEX_LOCK(clients_mutex);
+    for (int i = 0; i < clientCount; i++) {
+        const char *user[] = {clients[i].username};
+        append_frame_locked(link, FRAME_PRESENCE_ADD, user, 1);
+    }
+    MUTEX_UNLOCK(clients_mutex);
+}
+
+static void *peer_writer_thread(void *arg) {
+    PeerLink *link = (PeerLink *)arg;
+    char *batch = malloc(PEER_BUFFER_SIZE);
+    if (!batch) {
+        log_event("[ERROR] Failed to allocate federation batch buffer for node %d", link->node_id);
+        return NULL;
+    }
+
+    while (1) {
+        int sock = connect_peer(link);
+        if (sock < 0) {
+            sleep(RECONNECT_DELAY_SEC);
+            continue;
+        }
+        log_event("Federation link to node %d (%s:%d) established", link->node_id, link->host, link->link_port);
+
+        pthread_mutex_lock(&link->mutex);
+        link->sock = sock;
+        link->connected = 1;
+        link->pending_len = 0;
+        queue_handshake_locked(link);
+
+        while (1) {
+            while (link->pending_len == 0) {
+                pthread_cond_wait(&link->cond, &link->mutex);
+            }
+            // Chờ thêm một cửa sổ ngắn để gom nhiều frame vào một lần send()
+            if (link->pending_len < FEDERATION_BATCH_BYTES) {
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                deadline.tv_nsec += FEDERATION_BATCH_US * 1000L;
+                if (deadline.tv_nsec >= 1000000000L) {
+                    deadline.tv_sec++;
+                    deadline.tv_nsec -= 1000000000L;
+                }
+                pthread_cond_timedwait(&link->cond, &link->mutex, &deadline);
+            }
+
+            size_t len = link->pending_len;
+            memcpy(batch, link->pending, len);
+            link->pending_len = 0;
+            pthread_mutex_unlock(&link->mutex);
+
+            int rc = send_all(sock, batch, len);
+            pthread_mutex_lock(&link->mutex);
+            if (rc < 0) {
+                break;
+            }
+        }
+
+        link->connected = 0;
+        link->pending_len = 0;
+        link->sock = -1;
+        pthread_mutex_unlock(&link->mutex);
+        log_event("[ERROR] Federation link to node %d lost: %s", link->node_id, strerror(errno));
+        close(sock);
+        sleep(RECONNECT_DELAY_SEC);
+    }
+    return NULL;
+}
+
+// ========================= REMOTE PRESENCE =========================
+
+static void remote_add(const char *username, int node_id) {
+    pthread_mutex_lock(&remote_mutex);
+    for (int i = 0; i < remoteUserCount; i++) {
+        if (strcmp(remote_users[i].username, username) == 0) {
+            remote_users[i].node_id = node_id;
+            pthread_mutex_unlock(&remote_mutex);
+            return;
+        }
+    }
+    if (remoteUserCount == remoteUserCapacity) {
+        int new_capacity = remoteUserCapacity ? remoteUserCapacity * 2 : 64;
+        RemoteUser *grown = realloc(remote_users, new_capacity * sizeof(RemoteUser));
+        if (!grown) {
+            log_event("[ERROR] Failed to grow remote presence table");
+            pthread_mutex_unlock(&remote_mutex);
+            return;
+        }
+        remote_users = grown;
+        remoteUserCapacity = new_capacity;
+    }
+    strncpy(remote_users[remoteUserCount].username, username, sizeof(remote_users[0].username) - 1);
+    remote_users[remoteUserCount].username[sizeof(remote_users[0].username) - 1] = '\0';
+    remote_users[remoteUserCount].node_id = node_id;
+    remoteUserCount++;
+    pthread_mutex_unlock(&remote_mutex);
+    reply_cache_bump(REPLY_CACHE_USERS);
+}
+
+static void remote_remove(const char *username, int node_id) {
+    pthread_mutex_lock(&remote_mutex);
+    for (int i = 0; i < remoteUserCount; i++) {
+        if (remote_users[i].node_id == node_id && strcmp(remote_users[i].username, username) == 0) {
+            remote_users[i] = remote_users[--remoteUserCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&remote_mutex);
+    reply_cache_bump(REPLY_CACHE_USERS);
+}
+
+static void remote_remove_node(int node_id) {
+    pthread_mutex_lock(&remote_mutex);
+    for (int i = 0; i < remoteUserCount; ) {
+        if (remote_users[i].node_id == node_id) {
+            remote_users[i] = remote_users[--remoteUserCount];
+        } else {
+            i++;
+        }
+    }
+    pthread_mutex_unlock(&remote_mutex);
+    reply_cache_bump(REPLY_CACHE_USERS);
+}
+
+int federation_remote_user_count(void) {
+    pthread_mutex_lock(&remote_mutex);
+    int count = remoteUserCount;
+    pthread_mutex_unlock(&remote_mutex);
+    return count;
+}
+
+int federation_find_user(const char *username) {
+    int node_id = -1;
+    pthread_mutex_lock(&remote_mutex);
+    for (int i = 0; i < remoteUserCount; i++) {
+        if (strcmp(remote_users[i].username, username) == 0) {
+            node_id = remote_users[i].node_id;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&remote_mutex);
+    return node_id;
+}
+
+size_t federation_list_remote_users(char *buffer, size_t size) {
+    size_t pos = 0;
+    pthread_mutex_lock(&remote_mutex);
+    for (int i = 0; i < remoteUserCount && pos < size; i++) {
+        int written = snprintf(buffer + pos, size - pos, "%s (node %d)\n",
+                               remote_users[i].username, remote_users[i].node_id);
+        if (written < 0 || (size_t)written >= size - pos) {
+            break;  // Buffer đầy
+        }
+        pos += written;
+    }
+    pthread_mutex_unlock(&remote_mutex);
+    return pos;
+}
+
+// ========================= INBOUND LINKS =========================
+
+static int recv_all(int sock, char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(sock, data, len, 0);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Tách các trường '\0' trong payload
+ * @return: Số trường tìm được
+ */
+static int split_fields(char *payload, size_t len, const char **fields, int max_fields) {
+    int n = 0;
+    size_t pos = 0;
+    while (pos < len && n < max_fields) {
+        fields[n++] = payload + pos;
+        char *nul = memchr(payload + pos, '\0', len - pos);
+        if (!nul) {
+            payload[len - 1] = '\0';
+            break;
+        }
+        pos = (nul - payload) + 1;
+    }
+    return n;
+}
+
+// So sánh secret không dừng sớm ở byte khác đầu tiên
+static int secret_matches(const char *given) {
+    size_t len = strlen(cluster_secret);
+    size_t given_len = strlen(given);
+    unsigned char diff = given_len != len;
+    for (size_t i = 0; i < len; i++) {
+        diff |= (unsigned char)cluster_secret[i] ^ (unsigned char)(i < given_len ? given[i] : 0);
+    }
+    return diff == 0;
+}
+
+/**
+ * Kiểm tra HELLO: node_id phải là một peer đã cấu hình và secret phải khớp
+ * @return: node_id của peer, -1 nếu bị từ chối
+ */
+static int check_hello(const char **f, int nfields) {
+    if (nfields < 2 || !secret_matches(f[1])) {
+        return -1;
+    }
+    int node_id = atoi(f[0]);
+    return find_peer(node_id) ? node_id : -1;
+}
+
+static void *peer_reader_thread(void *arg) {
+    int sock = (int)(intptr_t)arg;
+    int remote_node = -1;
+    char payload[FRAME_MAX_PAYLOAD + 1];
+    char peer_addr[INET_ADDRSTRLEN] = "?";
+    struct sockaddr_in sa;
+    socklen_t sa_len = sizeof(sa);
+    if (getpeername(sock, (struct sockaddr *)&sa, &sa_len) == 0) {
+        inet_ntop(AF_INET, &sa.sin_addr, peer_addr, sizeof(peer_addr));
+    }
+
+    while (1) {
+        uint32_t be_len;
+        if (recv_all(sock, (char *)&be_len, 4) < 0) break;
+        uint32_t len = ntohl(be_len);
+        if (len == 0 || len > FRAME_MAX_PAYLOAD) {
+            log_event("[ERROR] Invalid federation frame length %u from node %d", len, remote_node);
+            break;
+        }
+        if (recv_all(sock, payload, len) < 0) break;
+        payload[len] = '\0';
+
+        uint8_t type = (uint8_t)payload[0];
+        const char *f[3] = {"", "", ""};
+        int nfields = split_fields(payload + 1, len - 1, f, 3);
+
+        // Chưa có HELLO hợp lệ thì không xử lý frame nào khác
+        if (remote_node < 0) {
+            if (type != FRAME_HELLO || (remote_node = check_hello(f, nfields)) < 0) {
+                log_event("[ERROR] Federation link from %s rejected: %s", peer_addr,
+                          type == FRAME_HELLO ? "bad node id or secret" : "frame before HELLO");
+                break;
+            }
+            log_event("Federation inbound link from node %d (%s)", remote_node, peer_addr);
+            continue;
+        }
+
+        switch (type) {
+        case FRAME_HELLO:
+            log_event("[ERROR] Duplicate federation HELLO from node %d", remote_node);
+            break;
+        case FRAME_PRESENCE_RESET:
+            remote_remove_node(remote_node);
+            break;
+        case FRAME_PRESENCE_ADD:
+            if (nfields >= 1) remote_add(f[0], remote_node);
+            break;
+        case FRAME_PRESENCE_DEL:
+            if (nfields >= 1) remote_remove(f[0], remote_node);
+            break;
+        case FRAME_PRIVATE:
+            if (nfields >= 3) deliver_private_local(f[0], f[1], f[2]);
+            break;
+        case FRAME_GROUP:
+            if (nfields >= 3) deliver_group_local(f[0], f[1], f[2]);
+            break;
+        case FRAME_BROADCAST:
+            if (nfields >= 2) deliver_broadcast_local(f[0], f[1]);
+            break;
+        default:
+            log_event("[ERROR] Unknown federation frame type %d from node %d", type, remote_node);
+            break;
+        }
+    }
+
+    log_event("Federation inbound link from node %d closed", remote_node);
+    if (remote_node >= 0) {
+        remote_remove_node(remote_node);
+    }
+    close(sock);
+    return NULL;
+}
+
+static void *link_listener_thread(void *arg) {
+    int listen_sock = (int)(intptr_t)arg;
+    while (1) {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0) {
+            if (errno != EINTR) {
+                log_event("[ERROR] Federation accept failed: %s", strerror(errno));
+            }
+            continue;
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, peer_reader_thread, (void *)(intptr_t)sock) != 0) {
+            log_event("[ERROR] Failed to create federation reader thread: %s", strerror(errno));
+            close(sock);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+// ========================= PUBLIC API =========================
+
+/**
+ * Phân tích một peer "[id@]host:port"
+ * @return: 0 nếu hợp lệ
+ */
+static int parse_peer(const char *spec, PeerLink *link) {
+    const char *at = strchr(spec, '@');
+    const char *hostport = at ? at + 1 : spec;
+    const char *colon = strrchr(hostport, ':');
+    if (!colon || colon == hostport || (size_t)(colon - hostport) >= sizeof(link->host)) {
+        return -1;
+    }
+    int port = atoi(colon + 1);
+    if (port <= 0 || port + FEDERATION_PORT_OFFSET > 65535) {
+        return -1;
+    }
+    memcpy(link->host, hostport, colon - hostport);
+    link->host[colon - hostport] = '\0';
+    link->link_port = port + FEDERATION_PORT_OFFSET;
+    link->node_id = at ? atoi(spec) : port;
+    return 0;
+}
+
+/**
+ * Đọc shared secret của cụm từ dòng đầu tiên của file
+ * @return: 0 nếu thành công, -1 nếu không đọc được hoặc secret rỗng
+ */
+static int load_secret(const char *path) {
+    if (!path) {
+        fprintf(stderr, "[ERROR] Federation requires a cluster secret file (-k)\n");
+        return -1;
+    }
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "[ERROR] Cannot read cluster secret %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (!fgets(cluster_secret, sizeof(cluster_secret), f)) {
+        cluster_secret[0] = '\0';
+    }
+    fclose(f);
+    cluster_secret[strcspn(cluster_secret, "\r\n")] = '\0';
+    if (cluster_secret[0] == '\0') {
+        fprintf(stderr, "[ERROR] Cluster secret file %s is empty\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int federation_init(int node_id, int port, const char *peer_list, const char *bind_addr, const char *secret_path) {
+    if (!peer_list || peer_list[0] == '\0') {
+        return 0;
+    }
+    local_node_id = node_id;
+    if (load_secret(secret_path) < 0) {
+        return -1;
+    }
+    if (!bind_addr) {
+        bind_addr = FEDERATION_DEFAULT_BIND;
+    }
+
+    char list[1024];
+    strncpy(list, peer_list, sizeof(list) - 1);
+    list[sizeof(list) - 1] = '\0';
+    char *saveptr = NULL;
+    for (char *tok = strtok_r(list, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        if (peerCount >= MAX_PEERS) {
+            fprintf(stderr, "[WARNING] Maximum peers limit (%d) reached. Ignoring remaining peers.\n", MAX_PEERS);
+            break;
+        }
+        PeerLink *link = &peers[peerCount];
+        memset(link, 0, sizeof(*link));
+        if (parse_peer(tok, link) < 0) {
+            fprintf(stderr, "[ERROR] Invalid peer address: %s\n", tok);
+            return -1;
+        }
+        link->sock = -1;
+        link->pending = malloc(PEER_BUFFER_SIZE);
+        if (!link->pending) {
+            fprintf(stderr, "[ERROR] Failed to allocate federation buffer\n");
+            return -1;
+        }
+        pthread_mutex_init(&link->mutex, NULL);
+        pthread_cond_init(&link->cond, NULL);
+        peerCount++;
+    }
+
+    int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        fprintf(stderr, "[ERROR] Federation socket creation failed: %s\n", strerror(errno));
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port + FEDERATION_PORT_OFFSET);
+    if (inet_pton(AF_INET, bind_addr, &addr.sin_addr) != 1) {
+        fprintf(stderr, "[ERROR] Invalid federation bind address: %s\n", bind_addr);
+        close(listen_sock);
+        return -1;
+    }
+    if (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_sock, MAX_PEERS) < 0) {
+        log_event("[ERROR] Federation bind/listen failed on %s:%d: %s", bind_addr, port + FEDERATION_PORT_OFFSET, strerror(errno));
+        fprintf(stderr, "[ERROR] Federation bind/listen failed on %s:%d: %s\n", bind_addr, port + FEDERATION_PORT_OFFSET, strerror(errno));
+        close(listen_sock);
+        return -1;
+    }
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, link_listener_thread, (void *)(intptr_t)listen_sock) != 0) {
+        fprintf(stderr, "[ERROR] Failed to create federation listener thread: %s\n", strerror(errno));
+        close(listen_sock);
+        return -1;
+    }
+    pthread_detach(tid);
+
+    for (int i = 0; i < peerCount; i++) {
+        if (pthread_create(&tid, NULL, peer_writer_thread, &peers[i]) != 0) {
+            fprintf(stderr, "[ERROR] Failed to create federation writer thread: %s\n", strerror(errno));
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+
+    log_event("Federation enabled: node %d, link %s:%d, %d peers", node_id, bind_addr, port + FEDERATION_PORT_OFFSET, peerCount);
+    printf("Federation node %d: link %s:%d, %d peers\n", node_id, bind_addr, port + FEDERATION_PORT_OFFSET, peerCount);
+    return 0;
+}
+
+int federation_enabled(void) {
+    return peerCount > 0;
+}
+
+void federation_publish_login(const char *username) {
+    const char *fields[] = {username};
+    queue_frame_all(FRAME_PRESENCE_ADD, fields, 1);
+}
+
+void federation_publish_logout(const char *username) {
+    const char *fields[] = {username};
+    queue_frame_all(FRAME_PRESENCE_DEL, fields, 1);
+}
+
+int federation_forward_private(const char *sender, const char *target, const char *msg) {
+    int node_id = federation_find_user(target);
+    PeerLink *link = node_id >= 0 ? find_peer(node_id) : NULL;
+    if (!link) {
+        return -1;
+    }
+    const char *fields[] = {sender, target, msg};
+    queue_frame(link, FRAME_PRIVATE, fields, 3);
+    return 0;
+}
+
+void federation_forward_group(const char *sender, const char *groupId, const char *msg) {
+    const char *fields[] = {sender, groupId, msg};
+    queue_frame_all(FRAME_GROUP, fields, 3);
+}
+
+void federation_forward_broadcast(const char *sender, const char *msg) {
+    const char *fields[] = {sender, msg};
+    queue_frame_all(FRAME_BROADCAST, fields, 2);
+}
@@ -0,0 +1,164 @@
+#include "../include/lock_stats.h"
+#include "../include/server_utils.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef LOCK_STATS
+
+LockStats clients_mutex_stats = {.name = "clients_mutex"};
+LockStats file_mutex_stats = {.name = "file_mutex"};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns == 0) {
+        return 0;
+    }
+    int b = 63 - __builtin_clzll(ns);
+    return b < LOCK_STATS_BUCKETS ? b : LOCK_STATS_BUCKETS - 1;
+}
+
+void lock_stats_lock(pthread_mutex_t *m, LockStats *st, const char *site) {
+    uint64_t wait = 0;
+    if (pthread_mutex_trylock(m) != 0) {
+        // Chỉ đo đồng hồ khi thật sự phải chờ, đường không tranh chấp chỉ tốn một trylock
+        uint64_t start = now_ns();
+        pthread_mutex_lock(m);
+        wait = now_ns() - start;
+        st->contended++;
+    }
+    st->acquisitions++;
+    st->wait_ns_total += wait;
+    st->wait_hist[bucket_of(wait)]++;
+    if (wait > st->wait_max_ns) {
+        st->wait_max_ns = wait;
+        st->wait_max_site = site;
+    }
+    st->holder_site = site;
+    st->acquired_ns = now_ns();
+}
+
+void lock_stats_unlock(pthread_mutex_t *m, LockStats *st) {
+    uint64_t hold = now_ns() - st->acquired_ns;
+    st->hold_ns_total += hold;
+    st->hold_hist[bucket_of(hold)]++;
+    if (hold > st->hold_max_ns) {
+        st->hold_max_ns = hold;
+        st->hold_max_site = st->holder_site;
+    }
+    pthread_mutex_unlock(m);
+}
+
+// Cận trên (ns) của bucket chứa phân vị q
+static unsigned long long hist_percentile(const unsigned long *hist, unsigned long total, double q) {
+    if (total == 0) {
+        return 0;
+    }
+    unsigned long rank = (unsigned long)(q * total);
+    unsigned long seen = 0;
+    for (int i = 0; i < LOCK_STATS_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen > rank) {
+            return i == 0 ? 0 : 1ull << (i + 1);
+        }
+    }
+    return 1ull << LOCK_STATS_BUCKETS;
+}
+
+static size_t format_hist(char *buffer, size_t size, const char *name, const char *kind, const unsigned long *hist) {
+    size_t pos = snprintf(buffer, size, "lock_%s_%s_hist", name, kind);
+    for (int i = 0; i < LOCK_STATS_BUCKETS && pos < size; i++) {
+        if (hist[i]) {
+            pos += snprintf(buffer + pos, size - pos, " %d:%lu", i, hist[i]);
+        }
+    }
+    if (pos < size) {
+        pos += snprintf(buffer + pos, size - pos, "\n");
+    }
+    return pos;
+}
+
+static size_t format_one(char *buffer, size_t size, pthread_mutex_t *m, LockStats *live) {
+    // Chụp dưới chính khóa đó (khóa thẳng, không tính lần lấy này vào số liệu)
+    pthread_mutex_lock(m);
+    LockStats st = *live;
+    pthread_mutex_unlock(m);
+
+    unsigned long n = st.acquisitions;
+    size_t pos = snprintf(buffer, size,
+        "lock_%s_acquired %lu\n"
+        "lock_%s_contended %lu\n"
+        "lock_%s_wait_avg_ns %llu\n"
+        "lock_%s_wait_p50_ns %llu\n"
+        "lock_%s_wait_p99_ns %llu\n"
+        "lock_%s_wait_max_ns %llu\n"
+        "lock_%s_wait_max_site %s\n"
+        "lock_%s_hold_avg_ns %llu\n"
+        "lock_%s_hold_p50_ns %llu\n"
+        "lock_%s_hold_p99_ns %llu\n"
+        "lock_%s_hold_max_ns %llu\n"
+        "lock_%s_hold_max_site %s\n",
+        st.name, n,
+        st.name, st.contended,
+        st.name, n ? st.wait_ns_total / n : 0,
+        st.name, hist_percentile(st.wait_hist, n, 0.50),
+        st.name, hist_percentile(st.wait_hist, n, 0.99),
+        st.name, st.wait_max_ns,
+        st.name, st.wait_max_site ? st.wait_max_site : "-",
+        st.name, n ? st.hold_ns_total / n : 0,
+        st.name, hist_percentile(st.hold_hist, n, 0.50),
+        st.name, hist_percentile(st.hold_hist, n, 0.99),
+        st.name, st.hold_max_ns,
+        st.name, st.hold_max_site ? st.hold_max_site : "-");
+    if (pos < size) {
+        pos += format_hist(buffer + pos, size - pos, st.name, "wait", st.wait_hist);
+    }
+    if (pos < size) {
+        pos += format_hist(buffer + pos, size - pos, st.name, "hold", st.hold_hist);
+    }
+    return pos < size ? pos : size - 1;
+}
+
+size_t lock_stats_format(char *buffer, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    size_t pos = format_one(buffer, size, &clients_mutex, &clients_mutex_stats);
+    if (pos + 1 < size) {
+        pos += format_one(buffer + pos, size - pos, &file_mutex, &file_mutex_stats);
+    }
+    return pos;
+}
+
+static void reset_one(pthread_mutex_t *m, LockStats *st) {
+    pthread_mutex_lock(m);
+    const char *name = st->name;
+    memset(st, 0, sizeof(*st));
+    st->name = name;
+    pthread_mutex_unlock(m);
+}
+
+int lock_stats_reset(void) {
+    reset_one(&clients_mutex, &clients_mutex_stats);
+    reset_one(&file_mutex, &file_mutex_stats);
+    return 0;
+}
+
+#else
+
+size_t lock_stats_format(char *buffer, size_t size) {
+    (void)buffer;
+    (void)size;
+    return 0;
+}
+
+int lock_stats_reset(void) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include "../include/metrics.h"
+#include <stdio.h>
+
+static long metric_values[METRIC_COUNT];
+
+static const char *metric_names[METRIC_COUNT] = {
+    [METRIC_REPL_FOLLOWERS]    = "repl_followers",
+    [METRIC_REPL_HEAD_SEQ]     = "repl_head_seq",
+    [METRIC_REPL_APPLIED_SEQ]  = "repl_applied_seq",
+    [METRIC_REPL_PRIMARY_SEQ]  = "repl_primary_seq",
+    [METRIC_REPL_LAG_RECORDS]  = "repl_lag_records",
+    [METRIC_REPL_LAG_MS]       = "repl_lag_ms",
+    [METRIC_REPL_SNAPSHOTS]    = "repl_snapshots",
+    [METRIC_COMPRESS_BLOCKS]     = "compress_blocks",
+    [METRIC_COMPRESS_RAW_BYTES]  = "compress_raw_bytes",
+    [METRIC_COMPRESS_WIRE_BYTES] = "compress_wire_bytes",
+    [METRIC_COMPRESS_CPU_US]     = "compress_cpu_us",
+    [METRIC_TRACE_SAMPLE_RATE]   = "trace_sample_rate",
+    [METRIC_TRACE_SAMPLES]       = "trace_samples",
+    [METRIC_ATTACH_UPLOADS]      = "attach_uploads",
+    [METRIC_ATTACH_UPLOAD_BYTES] = "attach_upload_bytes",
+    [METRIC_ATTACH_DOWNLOADS]    = "attach_downloads",
+    [METRIC_ACCEPTS]             = "accepts",
+    [METRIC_ACCEPT_BATCH_MAX]    = "accept_batch_max",
+    [METRIC_COALESCE_WRITES]     = "coalesce_writes",
+    [METRIC_COALESCE_ITEMS]      = "coalesce_items",
+    [METRIC_FANOUT_WORKERS]      = "fanout_workers",
+    [METRIC_FANOUT_PARALLEL]     = "fanout_parallel",
+    [METRIC_FANOUT_DROPPED]      = "fanout_dropped",
+    [METRIC_PRIVATE_DROPPED]     = "private_dropped",
+    [METRIC_SESSIONS]            = "sessions",
+    [METRIC_SESSION_LARGE_BUFFERS] = "session_large_buffers",
+    [METRIC_SYMBOLS] = "symbols",
+    [METRIC_TIMERS]              = "timers",
+    [METRIC_LOGIN_TIMEOUTS]      = "login_timeouts",
+    [METRIC_IDLE_REAPED]         = "idle_reaped",
+    [METRIC_HEARTBEAT_PINGS]     = "heartbeat_pings",
+    [METRIC_QUEUE_EVICTIONS]     = "queue_evictions",
+    [METRIC_BUSY_POLL_HITS]      = "busy_poll_hits",
+    [METRIC_BUSY_POLL_SLEEPS]    = "busy_poll_sleeps",
+    [METRIC_STORE_QUEUED]        = "store_queued",
+    [METRIC_STORE_WRITES]        = "store_writes",
+    [METRIC_DELIVERY_TAGGED]     = "delivery_tagged",
+    [METRIC_DELIVERY_UNTRACKED]  = "delivery_untracked",
+    [METRIC_DELIVERY_ACK_BATCHES] = "delivery_ack_batches",
+    [METRIC_DELIVERY_ACKS]       = "delivery_acks",
+};
+
+void metrics_add(MetricId id, long value) {
+    __atomic_add_fetch(&metric_values[id], value, __ATOMIC_RELAXED);
+}
+
+void metrics_set(MetricId id, long value) {
+    __atomic_store_n(&metric_values[id], value, __ATOMIC_RELAXED);
+}
+
+long metrics_get(MetricId id) {
+    return __atomic_load_n(&metric_values[id], __ATOMIC_RELAXED);
+}
+
+size_t metrics_format(char *buffer, size_t size) {
+    size_t pos = 0;
+    for (int i = 0; i < METRIC_COUNT && pos < size; i++) {
+        int written = snprintf(buffer + pos, size - pos, "%s %ld\n", metric_names[i], metrics_get(i));
+        if (written < 0 || (size_t)written >= size - pos) {
+            break;  // Buffer đầy
+        }
+        pos += written;
+    }
+    return pos;
+}
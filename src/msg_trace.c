@@ -0,0 +1,194 @@
+#include "../include/msg_trace.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <errno.h>
+
+typedef struct {
+    const char *name;       // Chuỗi hằng, không cần copy
+    uint64_t msg_id;
+    uint64_t ts_us;
+    uint32_t dur_us;
+    int arg;
+} TraceEvent;
+
+// Buffer vòng của một thread. Khi thread kết thúc, buffer được đánh dấu rảnh
+// để thread sau dùng lại (các sự kiện cũ vẫn còn cho tới khi bị ghi đè).
+typedef struct TraceBuffer {
+    TraceEvent events[TRACE_BUFFER_EVENTS];
+    unsigned long written;          // Tổng số sự kiện đã ghi (vị trí = written % size)
+    int tid;
+    int in_use;
+    pthread_mutex_t mutex;          // Chỉ tranh chấp khi đang dump
+    struct TraceBuffer *next;
+} TraceBuffer;
+
+__thread uint64_t msg_trace_current = 0;
+static __thread TraceBuffer *thread_buffer = NULL;
+
+static int trace_enabled = 0;
+static unsigned sample_rate = TRACE_DEFAULT_RATE;
+static uint64_t command_counter = 0;
+static uint64_t next_msg_id = 0;
+static char trace_path[PATH_MAX];
+static TraceBuffer *buffers = NULL;
+static int buffer_count = 0;
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t buffer_key;
+
+uint64_t msg_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void release_buffer(void *arg) {
+    TraceBuffer *buf = (TraceBuffer *)arg;
+    pthread_mutex_lock(&registry_mutex);
+    buf->in_use = 0;
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+static TraceBuffer *acquire_buffer(void) {
+    pthread_mutex_lock(&registry_mutex);
+    TraceBuffer *buf = buffers;
+    while (buf && buf->in_use) {
+        buf = buf->next;
+    }
+    if (!buf) {
+        buf = calloc(1, sizeof(TraceBuffer));
+        if (!buf) {
+            pthread_mutex_unlock(&registry_mutex);
+            return NULL;
+        }
+        pthread_mutex_init(&buf->mutex, NULL);
+        buf->tid = ++buffer_count;
+        buf->next = buffers;
+        buffers = buf;
+    }
+    buf->in_use = 1;
+    pthread_mutex_unlock(&registry_mutex);
+    pthread_setspecific(buffer_key, buf);
+    return buf;
+}
+
+int msg_trace_init(const char *out_path) {
+    strncpy(trace_path, out_path, sizeof(trace_path) - 1);
+    trace_path[sizeof(trace_path) - 1] = '\0';
+    if (pthread_key_create(&buffer_key, release_buffer) != 0) {
+        log_event("[ERROR] Failed to create trace buffer key");
+        fprintf(stderr, "[ERROR] Failed to create trace buffer key\n");
+        return -1;
+    }
+    metrics_set(METRIC_TRACE_SAMPLE_RATE, sample_rate);
+    trace_enabled = 1;
+    log_event("Message tracing enabled (1 in %u commands), output %s", sample_rate, trace_path);
+    return 0;
+}
+
+int msg_trace_enabled(void) {
+    return trace_enabled;
+}
+
+void msg_trace_set_rate(unsigned every_n) {
+    __atomic_store_n(&sample_rate, every_n, __ATOMIC_RELAXED);
+    metrics_set(METRIC_TRACE_SAMPLE_RATE, every_n);
+    log_event("Message trace sampling rate set to %u", every_n);
+}
+
+unsigned msg_trace_get_rate(void) {
+    return __atomic_load_n(&sample_rate, __ATOMIC_RELAXED);
+}
+
+uint64_t msg_trace_begin(void) {
+    msg_trace_current = 0;
+    unsigned rate = msg_trace_get_rate();
+    if (!trace_enabled || rate == 0) {
+        return 0;
+    }
+    if (__atomic_fetch_add(&command_counter, 1, __ATOMIC_RELAXED) % rate != 0) {
+        return 0;
+    }
+    msg_trace_current = __atomic_add_fetch(&next_msg_id, 1, __ATOMIC_RELAXED);
+    metrics_add(METRIC_TRACE_SAMPLES, 1);
+    return msg_trace_current;
+}
+
+void msg_trace_end(void) {
+    msg_trace_current = 0;
+}
+
+void msg_trace_span(const char *name, uint64_t start_us, uint64_t end_us, int arg) {
+    if (!msg_trace_current) {
+        return;
+    }
+    TraceBuffer *buf = thread_buffer;
+    if (!buf) {
+        buf = thread_buffer = acquire_buffer();
+        if (!buf) {
+            return;
+        }
+    }
+    pthread_mutex_lock(&buf->mutex);
+    TraceEvent *ev = &buf->events[buf->written % TRACE_BUFFER_EVENTS];
+    ev->name = name;
+    ev->msg_id = msg_trace_current;
+    ev->ts_us = start_us;
+    ev->dur_us = (uint32_t)(end_us - start_us);
+    ev->arg = arg;
+    buf->written++;
+    pthread_mutex_unlock(&buf->mutex);
+}
+
+long msg_trace_dump(void) {
+    if (!trace_enabled) {
+        return -1;
+    }
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", trace_path);
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        log_event("[ERROR] Failed to open trace file %s: %s", tmp_path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to open trace file %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    long total = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    pthread_mutex_lock(&registry_mutex);
+    for (TraceBuffer *buf = buffers; buf; buf = buf->next) {
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"worker-%d\"}}",
+                total ? ",\n" : "", buf->tid, buf->tid);
+        total++;
+        pthread_mutex_lock(&buf->mutex);
+        unsigned long first = buf->written > TRACE_BUFFER_EVENTS ? buf->written - TRACE_BUFFER_EVENTS : 0;
+        for (unsigned long i = first; i < buf->written; i++) {
+            TraceEvent *ev = &buf->events[i % TRACE_BUFFER_EVENTS];
+            fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"msg\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                       "\"ts\":%llu,\"dur\":%u,\"args\":{\"msg\":%llu",
+                    ev->name, buf->tid, (unsigned long long)ev->ts_us, ev->dur_us,
+                    (unsigned long long)ev->msg_id);
+            if (ev->arg >= 0) {
+                fprintf(f, ",\"sock\":%d", ev->arg);
+            }
+            fprintf(f, "}}");
+            total++;
+        }
+        pthread_mutex_unlock(&buf->mutex);
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0 || rename(tmp_path, trace_path) != 0) {
+        log_event("[ERROR] Failed to write trace file %s: %s", trace_path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to write trace file %s: %s\n", trace_path, strerror(errno));
+        return -1;
+    }
+    log_event("Dumped %ld trace events to %s", total, trace_path);
+    return total;
+}
@@ -0,0 +1,699 @@
+#define _GNU_SOURCE  // splice()
+#include "../include/outbound.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include "../include/timer_wheel.h"
+#include "../include/busy_poll.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+
+typedef struct OutItem {
+    struct OutItem *next;
+    size_t len;
+    int fd;                 // >= 0: mục là một đoạn file, data là tag của header mỗi slice
+    off_t start;            // Offset đầu đoạn trong file
+    off_t offset;           // Offset của slice tiếp theo
+    size_t file_len;        // Số byte file còn lại
+    int sent_any;           // Đã gửi ít nhất một slice (đoạn rỗng vẫn cần một header)
+    char data[];
+} OutItem;
+
+typedef struct {
+    OutItem *head;
+    OutItem *tail;
+    size_t bytes;
+} Lane;
+
+struct Outbox {
+    int sock;
+    Lane lanes[LANE_COUNT];
+    int closing;
+    int failed;             // Socket hỏng: bỏ mọi dữ liệu tiếp theo
+    int overflowed;         // Người gửi không chờ đã gặp làn đầy (dữ liệu bị bỏ)
+    int refs;               // Số người đang dùng (bảng, các thread đang gửi, job fan-out)
+    long last_enqueue_us;   // Thời điểm mục gần nhất được xếp vào
+    long gap_us;            // Trung bình trượt khoảng cách giữa hai mục liên tiếp
+    int coalescing;         // Writer đang chờ trong cửa sổ gom (không cần đánh thức mỗi mục)
+    int waiters;            // Số người gửi đang chờ làn đầy
+    int flushers;           // Số người đang chờ hàng đợi gửi hết (outbox_flush)
+    int sending;            // Writer đang gửi một batch/slice ngoài khóa
+    unsigned long progress; // Số lần writer gửi xong một batch/slice
+    unsigned long evict_progress; // progress lúc đặt hạn loại bỏ
+    unsigned int wakeups;   // Tăng mỗi lần xếp mục hoặc đóng; writer quay theo dõi nó (chế độ độ trễ thấp)
+    Timer evict_timer;
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;    // Báo writer có dữ liệu / báo người gửi có chỗ trống
+};
+
+static const int lane_weights[LANE_COUNT] = {
+    [LANE_REALTIME] = LANE_WEIGHT_REALTIME,
+    [LANE_CONTROL]  = LANE_WEIGHT_CONTROL,
+    [LANE_BULK]     = LANE_WEIGHT_BULK,
+};
+
+static const size_t lane_limits[LANE_COUNT] = {
+    [LANE_REALTIME] = LANE_LIMIT_REALTIME,
+    [LANE_CONTROL]  = LANE_LIMIT_CONTROL,
+    [LANE_BULK]     = LANE_LIMIT_BULK,
+};
+
+static Outbox *outboxes[OUTBOX_MAX_FD];
+static pthread_mutex_t table_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int coalesce_max_us = 0;   // Cửa sổ gom tối đa, 0 = tắt
+static unsigned int evict_ms = OUTBOX_EVICT_SEC * 1000;
+
+static long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+void outbox_set_coalesce_window(unsigned int max_us) {
+    __atomic_store_n(&coalesce_max_us, max_us, __ATOMIC_RELAXED);
+}
+
+void outbox_set_evict_timeout(unsigned int sec) {
+    __atomic_store_n(&evict_ms, sec * 1000, __ATOMIC_RELAXED);
+}
+
+static Outbox *outbox_get(int sock) {
+    if (sock < 0 || sock >= OUTBOX_MAX_FD) {
+        return NULL;
+    }
+    pthread_mutex_lock(&table_mutex);
+    Outbox *box = outboxes[sock];
+    if (box) {
+        box->refs++;
+    }
+    pthread_mutex_unlock(&table_mutex);
+    return box;
+}
+
+static void free_item(OutItem *item) {
+    if (item && item->fd >= 0) {
+        close(item->fd);
+    }
+    free(item);
+}
+
+static void free_lanes(Outbox *box) {
+    for (int l = 0; l < LANE_COUNT; l++) {
+        OutItem *item = box->lanes[l].head;
+        while (item) {
+            OutItem *next = item->next;
+            free_item(item);
+            item = next;
+        }
+        box->lanes[l].head = box->lanes[l].tail = NULL;
+        box->lanes[l].bytes = 0;
+    }
+}
+
+static void outbox_put(Outbox *box) {
+    pthread_mutex_lock(&table_mutex);
+    int last = --box->refs == 0;
+    pthread_mutex_unlock(&table_mutex);
+    if (last) {
+        free_lanes(box);
+        pthread_mutex_destroy(&box->mutex);
+        pthread_cond_destroy(&box->cond);
+        free(box);
+    }
+}
+
+/**
+ * Gửi slice tiếp theo của đoạn file: header "<tag> <offset> <len>\n" rồi dữ liệu bằng
+ * splice qua pipe; nếu file/socket không hỗ trợ splice thì đọc rồi gửi như bình thường
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+static int send_file_slice(int sock, int pipefd[2], OutItem *item) {
+    size_t len = item->file_len < OUTBOX_FILE_SLICE ? item->file_len : OUTBOX_FILE_SLICE;
+    char header[BUFFER_SIZE];
+    int header_len = snprintf(header, sizeof(header), "%.*s %lld %zu\n", (int)item->len, item->data,
+                              (long long)(item->offset - item->start), len);
+    item->sent_any = 1;
+    if (send_buffer_safe(sock, header, header_len, "send file slice header") < 0) {
+        return -1;
+    }
+    if (pipefd[0] < 0 && pipe(pipefd) < 0) {
+        pipefd[0] = pipefd[1] = -1;
+    }
+    while (len > 0) {
+        ssize_t in = pipefd[0] >= 0 ? splice(item->fd, &item->offset, pipefd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE) : -1;
+        if (in < 0 && errno == EINTR) continue;
+        if (in < 0 && pipefd[0] >= 0 && errno != EINVAL) {
+            log_event("[ERROR] Failed to splice file data for socket %d: %s", sock, strerror(errno));
+            return -1;
+        }
+        if (in < 0) {
+            // Không splice được: copy qua user space
+            char buf[BUFFER_SIZE * 16];
+            ssize_t n = pread(item->fd, buf, len < sizeof(buf) ? len : sizeof(buf), item->offset);
+            if (n <= 0 || send_buffer_safe(sock, buf, n, "send file data") < 0) {
+                return -1;
+            }
+            item->offset += n;
+            item->file_len -= n;
+            len -= n;
+            continue;
+        }
+        if (in == 0) {
+            log_event("[ERROR] File data for socket %d ended early", sock);
+            return -1;
+        }
+        item->file_len -= in;
+        len -= in;
+        while (in > 0) {
+            ssize_t out = splice(pipefd[0], NULL, sock, NULL, in, SPLICE_F_MOVE | (len > 0 ? SPLICE_F_MORE : 0));
+            if (out < 0 && errno == EINTR) continue;
+            if (out <= 0) {
+                log_event("[ERROR] Failed to splice file data to socket %d: %s", sock, strerror(errno));
+                return -1;
+            }
+            in -= out;
+        }
+    }
+    return 0;
+}
+
+// Lấy mục tiếp theo theo vòng có trọng số; gọi khi đang giữ box->mutex
+static OutItem *next_item(Outbox *box, int *lane_idx, int *credit) {
+    for (int tries = 0; tries <= LANE_COUNT; tries++) {
+        Lane *lane = &box->lanes[*lane_idx];
+        if (lane->head && *credit > 0) {
+            OutItem *item = lane->head;
+            lane->head = item->next;
+            if (!lane->head) {
+                lane->tail = NULL;
+            }
+            lane->bytes -= item->len;
+            (*credit)--;
+            return item;
+        }
+        // Hết lượt hoặc làn rỗng: chuyển sang làn kế tiếp
+        *lane_idx = (*lane_idx + 1) % LANE_COUNT;
+        *credit = lane_weights[*lane_idx];
+    }
+    return NULL;
+}
+
+// Đặt mục về lại đầu làn (giữ thứ tự); gọi khi đang giữ box->mutex
+static void push_front(Outbox *box, int lane_idx, OutItem *item) {
+    Lane *lane = &box->lanes[lane_idx];
+    item->next = lane->head;
+    lane->head = item;
+    if (!lane->tail) {
+        lane->tail = item;
+    }
+    lane->bytes += item->len;
+}
+
+/**
+ * Lấy thêm các mục thường đang chờ vào batch; gặp đoạn file thì đặt lại đầu làn và dừng
+ * (đoạn file được gửi riêng sau batch). Gọi khi đang giữ box->mutex.
+ * @param stop: Đặt 1 nếu batch đã đầy hoặc gặp đoạn file
+ * @return: Số mục trong batch
+ */
+static int gather_items(Outbox *box, OutItem **batch, int count, size_t *bytes,
+                        int *lane_idx, int *credit, int *stop) {
+    while (count < OUTBOX_COALESCE_MAX_ITEMS && *bytes < OUTBOX_COALESCE_MAX_BYTES) {
+        OutItem *item = next_item(box, lane_idx, credit);
+        if (!item) {
+            return count;
+        }
+        if (item->fd >= 0) {
+            push_front(box, *lane_idx, item);
+            *stop = 1;
+            return count;
+        }
+        batch[count++] = item;
+        *bytes += item->len;
+    }
+    *stop = 1;
+    return count;
+}
+
+/**
+ * Cửa sổ gom hiện tại của hàng đợi: tỉ lệ với khoảng cách trung bình giữa các mục
+ * (chờ đủ để gom khoảng OUTBOX_COALESCE_TARGET mục), giảm về 0 khi lưu lượng thưa
+ * @return: Số micro giây writer được chờ thêm trước khi ghi
+ */
+static long coalesce_window_us(const Outbox *box) {
+    long max_us = __atomic_load_n(&coalesce_max_us, __ATOMIC_RELAXED);
+    if (max_us == 0 || box->gap_us >= max_us) {
+        return 0;
+    }
+    long window = box->gap_us * OUTBOX_COALESCE_TARGET;
+    return window < max_us ? window : max_us;
+}
+
+// Ghi cả batch bằng một (hoặc vài, nếu ghi dở) lời gọi sendmsg
+static int send_batch(int sock, OutItem **batch, int count) {
+    struct iovec iov[OUTBOX_COALESCE_MAX_ITEMS];
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = batch[i]->data;
+        iov[i].iov_len = batch[i]->len;
+    }
+    struct iovec *cur = iov;
+    int left = count;
+    while (left > 0) {
+        struct msghdr msg = {0};
+        msg.msg_iov = cur;
+        msg.msg_iovlen = left;
+        ssize_t sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            log_event("[ERROR] Failed to send queued data on socket %d: %s", sock, strerror(errno));
+            fprintf(stderr, "[ERROR] Failed to send queued data on socket %d: %s\n", sock, strerror(errno));
+            return -1;
+        }
+        while (left > 0 && (size_t)sent >= cur->iov_len) {
+            sent -= cur->iov_len;
+            cur++;
+            left--;
+        }
+        if (left > 0) {
+            cur->iov_base = (char *)cur->iov_base + sent;
+            cur->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+static void *writer_thread(void *arg) {
+    Outbox *box = (Outbox *)arg;
+    int lane_idx = LANE_REALTIME;
+    int credit = lane_weights[LANE_REALTIME];
+    int pipefd[2] = {-1, -1};     // Pipe cho splice, tạo khi gặp đoạn file đầu tiên
+    OutItem *batch[OUTBOX_COALESCE_MAX_ITEMS];
+
+    busy_poll_pin_thread();
+    pthread_mutex_lock(&box->mutex);
+    while (1) {
+        OutItem *item = NULL;
+        int spun = 0;
+        while (!box->closing && (item = next_item(box, &lane_idx, &credit)) == NULL) {
+            // Chế độ độ trễ thấp: quay (đã nhả khóa) chờ mục mới trước khi ngủ trên cond
+            if (!spun && busy_poll_budget_us() > 0) {
+                unsigned int seen = box->wakeups;
+                pthread_mutex_unlock(&box->mutex);
+                busy_poll_wait(&box->wakeups, seen);
+                pthread_mutex_lock(&box->mutex);
+                spun = 1;
+                continue;
+            }
+            pthread_cond_wait(&box->cond, &box->mutex);
+        }
+        if (box->closing) {
+            free_item(item);
+            break;
+        }
+
+        if (item->fd >= 0) {
+            int item_lane = lane_idx;
+            // Có chỗ trống trong làn: đánh thức người gửi đang chờ
+            pthread_cond_broadcast(&box->cond);
+            box->sending = 1;
+            pthread_mutex_unlock(&box->mutex);
+
+            int rc = send_file_slice(box->sock, pipefd, item);
+
+            pthread_mutex_lock(&box->mutex);
+            box->sending = 0;
+            if (rc == 0 && item->file_len > 0 && !box->closing) {
+                // Còn dữ liệu file: đặt lại đầu làn để giữ thứ tự, các làn khác được xen vào trước
+                push_front(box, item_lane, item);
+                item = NULL;
+            }
+            free_item(item);
+            if (rc < 0) {
+                box->failed = 1;
+                free_lanes(box);
+                pthread_cond_broadcast(&box->cond);
+            } else {
+                box->progress++;
+            }
+            if (box->flushers > 0) {
+                pthread_cond_broadcast(&box->cond);
+            }
+            continue;
+        }
+
+        // Gom mọi mục thường đang chờ thành một lần ghi; nếu lưu lượng dày thì chờ thêm
+        // trong cửa sổ gom để các tin nhắn tới sát nhau đi chung một segment
+        int count = 0, stop = 0;
+        size_t bytes = item->len;
+        batch[count++] = item;
+        count = gather_items(box, batch, count, &bytes, &lane_idx, &credit, &stop);
+        // Đã có sẵn đủ mục (đang dồn ứ) thì ghi ngay, chờ thêm chỉ tăng độ trễ
+        long window = stop || count >= OUTBOX_COALESCE_TARGET ? 0 : coalesce_window_us(box);
+        if (window > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += window * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            box->coalescing = 1;
+            while (!stop && !box->closing) {
+                int timed_out = pthread_cond_timedwait(&box->cond, &box->mutex, &deadline) == ETIMEDOUT;
+                count = gather_items(box, batch, count, &bytes, &lane_idx, &credit, &stop);
+                if (timed_out) {
+                    break;
+                }
+            }
+            box->coalescing = 0;
+        }
+        if (box->closing) {
+            for (int i = 0; i < count; i++) {
+                free_item(batch[i]);
+            }
+            break;
+        }
+        pthread_cond_broadcast(&box->cond);
+        box->sending = 1;
+        pthread_mutex_unlock(&box->mutex);
+
+        int rc = count == 1 ? send_buffer_safe(box->sock, item->data, item->len, "send queued data")
+                            : send_batch(box->sock, batch, count);
+        metrics_add(METRIC_COALESCE_WRITES, 1);
+        metrics_add(METRIC_COALESCE_ITEMS, count);
+        for (int i = 0; i < count; i++) {
+            free_item(batch[i]);
+        }
+
+        pthread_mutex_lock(&box->mutex);
+        box->sending = 0;
+        if (rc < 0) {
+            box->failed = 1;
+            free_lanes(box);
+            pthread_cond_broadcast(&box->cond);
+        } else {
+            box->progress++;
+        }
+        if (box->flushers > 0) {
+            pthread_cond_broadcast(&box->cond);
+        }
+    }
+    pthread_mutex_unlock(&box->mutex);
+    if (pipefd[0] >= 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    return NULL;
+}
+
+// Hạn loại bỏ tới: nếu writer vẫn gửi được (chỉ chậm) thì gia hạn, nếu không thì bỏ kết nối
+static void evict_timer_fired(void *arg) {
+    Outbox *box = (Outbox *)arg;
+    pthread_mutex_lock(&box->mutex);
+    if (box->closing || box->failed || (box->waiters == 0 && !box->overflowed)) {
+        pthread_mutex_unlock(&box->mutex);
+        return;
+    }
+    unsigned int deadline = __atomic_load_n(&evict_ms, __ATOMIC_RELAXED);
+    if (box->progress != box->evict_progress && box->waiters == 0) {
+        // Chỉ có người gửi không chờ bị bỏ dữ liệu và writer vẫn tiến: chưa cần loại bỏ
+        box->overflowed = 0;
+        pthread_mutex_unlock(&box->mutex);
+        return;
+    }
+    if (box->progress != box->evict_progress && deadline > 0) {
+        box->evict_progress = box->progress;
+        timer_schedule(&box->evict_timer, deadline);
+        pthread_mutex_unlock(&box->mutex);
+        return;
+    }
+    box->failed = 1;
+    free_lanes(box);
+    pthread_cond_broadcast(&box->cond);
+    pthread_mutex_unlock(&box->mutex);
+    metrics_add(METRIC_QUEUE_EVICTIONS, 1);
+    log_event("[WARNING] Send queue of socket %d stuck, evicting connection", box->sock);
+    // Writer đang kẹt trong send() và thread phiên trong recv() đều thoát ra
+    shutdown(box->sock, SHUT_RDWR);
+}
+
+int outbox_create(int sock) {
+    if (sock < 0 || sock >= OUTBOX_MAX_FD) {
+        return -1;
+    }
+    Outbox *box = calloc(1, sizeof(Outbox));
+    if (!box) {
+        log_event("[ERROR] Failed to allocate outbox for socket %d", sock);
+        return -1;
+    }
+    box->sock = sock;
+    box->refs = 1;
+    // Giữ ít dữ liệu chưa gửi trong kernel để thứ tự ưu tiên do writer quyết định,
+    // không bị chôn sau hàng MB lịch sử đã nằm sẵn trong send buffer
+    int lowat = OUTBOX_NOTSENT_LOWAT;
+    setsockopt(sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+    box->gap_us = OUTBOX_COALESCE_IDLE_US;
+    timer_init(&box->evict_timer, evict_timer_fired, box);
+    pthread_mutex_init(&box->mutex, NULL);
+    // Cửa sổ gom dùng pthread_cond_timedwait theo đồng hồ monotonic
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&box->cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, OUTBOX_WRITER_STACK);
+    int rc = pthread_create(&box->writer, &attr, writer_thread, box);
+    pthread_attr_destroy(&attr);
+    if (rc != 0) {
+        log_event("[ERROR] Failed to create writer thread for socket %d: %s", sock, strerror(rc));
+        fprintf(stderr, "[ERROR] Failed to create writer thread for socket %d: %s\n", sock, strerror(rc));
+        pthread_mutex_destroy(&box->mutex);
+        pthread_cond_destroy(&box->cond);
+        free(box);
+        return -1;
+    }
+    pthread_mutex_lock(&table_mutex);
+    outboxes[sock] = box;
+    pthread_mutex_unlock(&table_mutex);
+    return 0;
+}
+
+void outbox_destroy(int sock) {
+    if (sock < 0 || sock >= OUTBOX_MAX_FD) {
+        return;
+    }
+    pthread_mutex_lock(&table_mutex);
+    Outbox *box = outboxes[sock];
+    outboxes[sock] = NULL;
+    pthread_mutex_unlock(&table_mutex);
+    if (!box) {
+        return;
+    }
+
+    pthread_mutex_lock(&box->mutex);
+    box->closing = 1;
+    __atomic_store_n(&box->wakeups, box->wakeups + 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&box->cond);
+    pthread_mutex_unlock(&box->mutex);
+    // closing đã được đặt nên callback không đặt lại timer nữa
+    timer_cancel(&box->evict_timer);
+    // Writer có thể đang kẹt trong send() tới client chậm
+    shutdown(sock, SHUT_RDWR);
+    pthread_join(box->writer, NULL);
+    outbox_put(box);
+}
+
+// Xếp mục vào làn, chờ nếu làn đầy (trừ khi !wait); giải phóng mục nếu không xếp được
+static int enqueue_item(Outbox *box, OutboundLane lane, OutItem *item, int wait) {
+    size_t len = item->len;
+    pthread_mutex_lock(&box->mutex);
+    Lane *l = &box->lanes[lane];
+    // Flow control: chờ writer gửi bớt (một mục lớn hơn giới hạn vẫn được nhận khi làn rỗng)
+    int full = 0;
+    while (!box->closing && !box->failed && l->bytes > 0 && l->bytes + len > lane_limits[lane]) {
+        unsigned int deadline = __atomic_load_n(&evict_ms, __ATOMIC_RELAXED);
+        if (deadline > 0 && !timer_pending(&box->evict_timer)) {
+            box->evict_progress = box->progress;
+            timer_schedule(&box->evict_timer, deadline);
+        }
+        if (!wait) {
+            box->overflowed = 1;
+            full = 1;
+            break;
+        }
+        box->waiters++;
+        pthread_cond_wait(&box->cond, &box->mutex);
+        box->waiters--;
+    }
+    int rc = 0;
+    if (box->closing || box->failed || full) {
+        free_item(item);
+        rc = -1;
+    } else {
+        if (l->tail) {
+            l->tail->next = item;
+        } else {
+            l->head = item;
+        }
+        l->tail = item;
+        l->bytes += len;
+        // Cập nhật khoảng cách trung bình giữa các mục (một lần nghỉ dài bị chặn ở mức idle)
+        long now = monotonic_us();
+        long gap = now - box->last_enqueue_us;
+        if (gap > OUTBOX_COALESCE_IDLE_US) {
+            gap = OUTBOX_COALESCE_IDLE_US;
+        }
+        box->gap_us = (box->gap_us * 7 + gap) / 8;
+        box->last_enqueue_us = now;
+        __atomic_store_n(&box->wakeups, box->wakeups + 1, __ATOMIC_RELEASE);
+        // Trong cửa sổ gom chỉ đánh thức writer khi đã đủ một lần ghi đầy
+        if (!box->coalescing || l->bytes >= OUTBOX_COALESCE_MAX_BYTES) {
+            pthread_cond_broadcast(&box->cond);
+        }
+    }
+    pthread_mutex_unlock(&box->mutex);
+    return rc;
+}
+
+static OutItem *new_item(const char *data, size_t len, int fd, off_t offset, size_t file_len) {
+    OutItem *item = malloc(sizeof(OutItem) + len);
+    if (!item) {
+        return NULL;
+    }
+    item->next = NULL;
+    item->len = len;
+    item->fd = fd;
+    item->start = offset;
+    item->offset = offset;
+    item->file_len = file_len;
+    item->sent_any = 0;
+    if (len > 0) {
+        memcpy(item->data, data, len);
+    }
+    return item;
+}
+
+int outbox_send(int sock, OutboundLane lane, const char *data, size_t len, const char *error_context) {
+    Outbox *box = outbox_get(sock);
+    if (!box) {
+        return send_buffer_safe(sock, data, len, error_context);
+    }
+    int rc = outbox_push_wait(box, lane, data, len);
+    outbox_put(box);
+    return rc;
+}
+
+int outbox_post(int sock, OutboundLane lane, const char *data, size_t len) {
+    Outbox *box = outbox_get(sock);
+    if (!box) {
+        return -1;
+    }
+    int rc = outbox_push(box, lane, data, len);
+    outbox_put(box);
+    return rc;
+}
+
+int outbox_flush(int sock, unsigned int timeout_ms) {
+    Outbox *box = outbox_get(sock);
+    if (!box) {
+        return 0;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&box->mutex);
+    box->flushers++;
+    int rc = 0;
+    while (!box->closing && !box->failed) {
+        int pending = box->sending;
+        for (int i = 0; i < LANE_COUNT && !pending; i++) {
+            pending = box->lanes[i].head != NULL;
+        }
+        if (!pending) {
+            break;
+        }
+        if (pthread_cond_timedwait(&box->cond, &box->mutex, &deadline) == ETIMEDOUT) {
+            rc = -1;
+            break;
+        }
+    }
+    if (box->closing || box->failed) {
+        rc = -1;
+    }
+    box->flushers--;
+    pthread_mutex_unlock(&box->mutex);
+    outbox_put(box);
+    return rc;
+}
+
+Outbox *outbox_acquire(int sock) {
+    return outbox_get(sock);
+}
+
+void outbox_release(Outbox *box) {
+    outbox_put(box);
+}
+
+int outbox_socket(const Outbox *box) {
+    return box->sock;
+}
+
+int outbox_push(Outbox *box, OutboundLane lane, const char *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    OutItem *item = new_item(data, len, -1, 0, 0);
+    return item ? enqueue_item(box, lane, item, 0) : -1;
+}
+
+int outbox_push_wait(Outbox *box, OutboundLane lane, const char *data, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    OutItem *item = new_item(data, len, -1, 0, 0);
+    if (!item) {
+        log_event("[ERROR] Failed to allocate outbound item for socket %d", box->sock);
+        return -1;
+    }
+    return enqueue_item(box, lane, item, 1);
+}
+
+int outbox_send_file(int sock, OutboundLane lane, const char *tag, int fd, off_t offset, size_t len) {
+    OutItem *item = new_item(tag, strlen(tag), fd, offset, len);
+    if (!item) {
+        log_event("[ERROR] Failed to allocate outbound file item for socket %d", sock);
+        close(fd);
+        return -1;
+    }
+    Outbox *box = outbox_get(sock);
+    if (!box) {
+        // Chưa có hàng đợi: gửi thẳng trên thread hiện tại
+        int pipefd[2] = {-1, -1};
+        int rc = 0;
+        while (rc == 0 && (item->file_len > 0 || !item->sent_any)) {
+            rc = send_file_slice(sock, pipefd, item);
+        }
+        if (pipefd[0] >= 0) {
+            close(pipefd[0]);
+            close(pipefd[1]);
+        }
+        free_item(item);
+        return rc;
+    }
+    // Chỉ tag được tính vào giới hạn của làn; phần file được gửi dần theo slice
+    int rc = enqueue_item(box, lane, item, 1);
+    outbox_put(box);
+    return rc;
+}
@@ -0,0 +1,573 @@
+#include "../include/replication.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include "../include/conversation_store.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+
+// Loại frame trên replication stream
+// Frame: [u32 độ dài payload] [u8 type] [u64 seq] [u64 ts_ms] [file '\0'] [line '\0']
+enum {
+    REPL_EPOCH = 'E',       // seq = epoch của primary
+    REPL_TRUNCATE = 'T',    // Snapshot: xóa nội dung file trước khi nạp lại
+    REPL_APPEND = 'A',      // Một dòng mới (seq = 0 với dòng thuộc snapshot)
+    REPL_SNAPSHOT_DONE = 'D',
+    REPL_HEARTBEAT = 'H',   // seq = head hiện tại của primary
+};
+
+#define REPL_HEADER_SIZE (1 + 8 + 8)
+#define REPL_MAX_PAYLOAD (REPL_HEADER_SIZE + PATH_MAX + BUFFER_SIZE * 2)
+#define REPL_BATCH_RECORDS 64
+
+typedef struct {
+    uint64_t seq;
+    uint64_t ts_ms;
+    char *file;
+    char *line;
+} ReplRecord;
+
+// Replication log ở primary
+static ReplRecord ring[REPL_RING_SIZE];
+static uint64_t head_seq = 0;            // Seq của bản ghi mới nhất (0 = chưa có)
+static uint64_t epoch = 0;               // Đổi mỗi lần primary khởi động lại
+static int primary_enabled = 0;
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void put_u64(char *out, uint64_t v) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = (char)(v & 0xff);
+        v >>= 8;
+    }
+}
+
+static uint64_t get_u64(const char *in) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v = (v << 8) | (unsigned char)in[i];
+    }
+    return v;
+}
+
+static int send_all(int sock, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(sock, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(int sock, char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(sock, data, len, 0);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * Mã hóa một frame vào out
+ * @return: Số byte của frame, 0 nếu quá lớn
+ */
+static size_t encode_frame(char *out, size_t size, char type, uint64_t seq, uint64_t ts_ms,
+                           const char *file, const char *line) {
+    size_t file_len = strlen(file) + 1;
+    size_t line_len = strlen(line) + 1;
+    size_t payload = REPL_HEADER_SIZE + file_len + line_len;
+    if (payload > REPL_MAX_PAYLOAD || payload + 4 > size) {
+        return 0;
+    }
+    uint32_t be_len = htonl((uint32_t)payload);
+    memcpy(out, &be_len, 4);
+    out[4] = type;
+    put_u64(out + 5, seq);
+    put_u64(out + 13, ts_ms);
+    memcpy(out + 4 + REPL_HEADER_SIZE, file, file_len);
+    memcpy(out + 4 + REPL_HEADER_SIZE + file_len, line, line_len);
+    return payload + 4;
+}
+
+static int send_frame(int sock, char type, uint64_t seq, uint64_t ts_ms, const char *file, const char *line) {
+    char frame[REPL_MAX_PAYLOAD + 4];
+    size_t len = encode_frame(frame, sizeof(frame), type, seq, ts_ms, file, line);
+    if (len == 0) {
+        return 0;  // Bỏ qua bản ghi quá lớn
+    }
+    return send_all(sock, frame, len);
+}
+
+// ========================= PRIMARY =========================
+
+void replication_publish(const char *file, const char *line) {
+    if (!primary_enabled) {
+        return;
+    }
+    pthread_mutex_lock(&ring_mutex);
+    uint64_t seq = head_seq + 1;
+    ReplRecord *rec = &ring[seq % REPL_RING_SIZE];
+    free(rec->file);
+    free(rec->line);
+    rec->file = strdup(file);
+    rec->line = strdup(line);
+    if (!rec->file || !rec->line) {
+        log_event("[ERROR] Failed to allocate replication record");
+    }
+    rec->seq = seq;
+    rec->ts_ms = now_ms();
+    head_seq = seq;
+    metrics_set(METRIC_REPL_HEAD_SEQ, (long)seq);
+    pthread_cond_broadcast(&ring_cond);
+    pthread_mutex_unlock(&ring_mutex);
+}
+
+static int is_conversation_file(const char *name) {
+    size_t len = strlen(name);
+    return strncmp(name, "conversation_", 13) == 0 && len > 4 &&
+           strcmp(name + len - 4, ".txt") == 0 && strchr(name, '/') == NULL;
+}
+
+// Vị trí đọc một hội thoại của snapshot giữa các chunk (giống HistoryCursor của lịch sử)
+typedef struct {
+    ReaderPosition pos;
+    int started;
+    long consumed;                  // Số dòng không rỗng đã đọc
+    unsigned long long last_seq;    // Seq của dòng cuối đã đọc
+    unsigned long long min_seq;     // Bỏ các dòng có seq <= min_seq sau khi tìm lại theo seq
+} SnapshotCursor;
+
+/**
+ * Đọc một chunk của hội thoại thành các frame REPL_APPEND. Chỉ giữ file_mutex trong lúc đọc;
+ * dừng ở dòng đầu tiên có seq > bound (dòng đó đã nằm trong ring log sau điểm snapshot).
+ * @param done: Nhận 1 khi đã đọc hết phần thuộc snapshot
+ * @return: Số byte frame đã ghi vào out
+ */
+static size_t read_snapshot_chunk(const char *name, unsigned long long bound, SnapshotCursor *cur,
+                                  char *out, size_t size, int *done) {
+    char path[PATH_MAX];
+    char line[BUFFER_SIZE * 2];
+    size_t len = 0;
+    conversation_store_head_path(path, sizeof(path), name);
+    *done = 1;
+
+    MUTEX_LOCK(file_mutex);
+    ConversationReader reader;
+    if (conversation_reader_open(&reader, path) < 0) {
+        MUTEX_UNLOCK(file_mutex);
+        return 0;
+    }
+    // Compactor đã cuộn/gộp phần đang đọc thì tìm lại theo seq (hoặc số dòng với dữ liệu cũ)
+    if (cur->started && conversation_reader_resume(&reader, &cur->pos) < 0) {
+        if (cur->last_seq > 0) {
+            conversation_reader_seek_after(&reader, cur->last_seq);
+            cur->min_seq = cur->last_seq;
+        } else {
+            conversation_reader_skip(&reader, cur->consumed);
+        }
+    }
+    cur->started = 1;
+    while (1) {
+        if (len + REPL_MAX_PAYLOAD + 4 > size) {
+            *done = conversation_reader_tell(&reader, &cur->pos) < 0;
+            break;
+        }
+        if (!conversation_reader_next(&reader, line, sizeof(line))) break;
+        line[strcspn(line, "\n")] = 0;
+        if (line[0] == '\0') continue;
+        unsigned long long seq = parse_line_seq(line, NULL);
+        cur->consumed++;
+        if (cur->min_seq > 0 && seq <= cur->min_seq) continue;
+        if (seq > bound) break;
+        cur->last_seq = seq;
+        len += encode_frame(out + len, size - len, REPL_APPEND, 0, 0, name, line);
+    }
+    conversation_reader_close(&reader);
+    MUTEX_UNLOCK(file_mutex);
+    return len;
+}
+
+/**
+ * Gửi snapshot toàn bộ thư mục conversation cho follower.
+ * Chỉ chụp điểm snapshot trong file_mutex: head_seq và seq cuối của từng hội thoại.
+ * Nội dung được đọc theo từng chunk và gửi ngoài khóa, nên follower chậm không chặn
+ * save_conversation(); dòng mới hơn điểm snapshot đi theo phần đuôi ring log.
+ * @return: head_seq tại thời điểm snapshot, hoặc UINT64_MAX nếu lỗi socket
+ */
+static uint64_t send_snapshot(int sock) {
+    size_t chunk_size = (REPL_MAX_PAYLOAD + 4) * REPL_BATCH_RECORDS;
+    char *chunk = malloc(chunk_size);
+    if (!chunk) {
+        log_event("[ERROR] Failed to allocate replication snapshot buffer");
+        return UINT64_MAX;
+    }
+
+    // Quét thư mục ngoài khóa; hội thoại tạo sau lúc quét vẫn có trong registry khi gộp dưới khóa
+    char **names = NULL;
+    int count = conversation_store_scan_heads(&names);
+    MUTEX_LOCK(file_mutex);
+    count = conversation_store_merge_registry(&names, count);
+    // Nạp trước seq cuối của từng hội thoại: lần nạp đầu có thể nhả tạm file_mutex, nên phải
+    // xong trước khi chụp head_seq để bounds và điểm snapshot thuộc cùng một lần khóa
+    for (int i = 0; i < count; i++) {
+        char path[PATH_MAX];
+        conversation_store_head_path(path, sizeof(path), names[i]);
+        conversation_store_last_seq(path);
+    }
+    // Gộp lại: hội thoại tạo trong lúc nhả khóa đã được nạp seq khi cấp seq đầu tiên
+    count = conversation_store_merge_registry(&names, count);
+    pthread_mutex_lock(&ring_mutex);
+    uint64_t snapshot_seq = head_seq;
+    pthread_mutex_unlock(&ring_mutex);
+    unsigned long long *bounds = calloc(count > 0 ? count : 1, sizeof(*bounds));
+    for (int i = 0; bounds && i < count; i++) {
+        char path[PATH_MAX];
+        conversation_store_head_path(path, sizeof(path), names[i]);
+        bounds[i] = conversation_store_last_seq(path);
+    }
+    MUTEX_UNLOCK(file_mutex);
+
+    int failed = !bounds;
+    for (int i = 0; i < count; i++) {
+        // Gửi toàn bộ hội thoại (archive, segment và head) dưới tên file head
+        SnapshotCursor cur = {0};
+        int done = 0;
+        if (!failed) {
+            failed = send_frame(sock, REPL_TRUNCATE, 0, 0, names[i], "") < 0;
+        }
+        while (!failed && !done) {
+            size_t len = read_snapshot_chunk(names[i], bounds[i], &cur, chunk, chunk_size, &done);
+            failed = len > 0 && send_all(sock, chunk, len) < 0;
+        }
+        free(names[i]);
+    }
+    free(names);
+    free(bounds);
+    free(chunk);
+
+    if (failed || send_frame(sock, REPL_SNAPSHOT_DONE, snapshot_seq, now_ms(), "", "") < 0) {
+        return UINT64_MAX;
+    }
+    metrics_add(METRIC_REPL_SNAPSHOTS, 1);
+    log_event("Replication snapshot sent to follower (seq %llu)", (unsigned long long)snapshot_seq);
+    return snapshot_seq;
+}
+
+static void *follower_session_thread(void *arg) {
+    int sock = (int)(intptr_t)arg;
+    metrics_add(METRIC_REPL_FOLLOWERS, 1);
+
+    // Đọc yêu cầu "FROM <epoch> <seq>\n"
+    char request[128];
+    size_t req_len = 0;
+    while (req_len < sizeof(request) - 1) {
+        ssize_t n = recv(sock, request + req_len, 1, 0);
+        if (n <= 0) {
+            goto done;
+        }
+        if (request[req_len++] == '\n') break;
+    }
+    request[req_len] = '\0';
+    unsigned long long req_epoch = 0, req_seq = 0;
+    if (sscanf(request, "FROM %llu %llu", &req_epoch, &req_seq) != 2) {
+        log_event("[ERROR] Invalid replication request: %s", request);
+        goto done;
+    }
+
+    if (send_frame(sock, REPL_EPOCH, epoch, now_ms(), "", "") < 0) {
+        goto done;
+    }
+
+    uint64_t cursor;
+    pthread_mutex_lock(&ring_mutex);
+    int can_resume = req_epoch == epoch && req_seq <= head_seq &&
+                     head_seq - req_seq < REPL_RING_SIZE;
+    pthread_mutex_unlock(&ring_mutex);
+    if (can_resume) {
+        cursor = req_seq + 1;
+        log_event("Replication follower resumed from seq %llu", req_seq);
+    } else {
+        uint64_t seq = send_snapshot(sock);
+        if (seq == UINT64_MAX) goto done;
+        cursor = seq + 1;
+    }
+
+    char *batch = malloc((REPL_MAX_PAYLOAD + 4) * REPL_BATCH_RECORDS);
+    if (!batch) {
+        log_event("[ERROR] Failed to allocate replication batch buffer");
+        goto done;
+    }
+
+    while (1) {
+        size_t batch_len = 0;
+        int need_snapshot = 0;
+
+        pthread_mutex_lock(&ring_mutex);
+        if (cursor > head_seq) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += REPL_HEARTBEAT_MS / 1000;
+            pthread_cond_timedwait(&ring_cond, &ring_mutex, &deadline);
+        }
+        if (head_seq >= cursor && head_seq - cursor >= REPL_RING_SIZE) {
+            need_snapshot = 1;  // Follower chậm quá, bản ghi đã bị ghi đè
+        } else {
+            for (int n = 0; n < REPL_BATCH_RECORDS && cursor <= head_seq; n++, cursor++) {
+                ReplRecord *rec = &ring[cursor % REPL_RING_SIZE];
+                batch_len += encode_frame(batch + batch_len, (REPL_MAX_PAYLOAD + 4) * REPL_BATCH_RECORDS - batch_len,
+                                          REPL_APPEND, rec->seq, rec->ts_ms,
+                                          rec->file ? rec->file : "", rec->line ? rec->line : "");
+            }
+        }
+        uint64_t head = head_seq;
+        pthread_mutex_unlock(&ring_mutex);
+
+        if (need_snapshot) {
+            uint64_t seq = send_snapshot(sock);
+            if (seq == UINT64_MAX) break;
+            cursor = seq + 1;
+            continue;
+        }
+        if (batch_len > 0) {
+            if (send_all(sock, batch, batch_len) < 0) break;
+        } else if (send_frame(sock, REPL_HEARTBEAT, head, now_ms(), "", "") < 0) {
+            break;
+        }
+    }
+    free(batch);
+
+done:
+    log_event("Replication follower disconnected");
+    metrics_add(METRIC_REPL_FOLLOWERS, -1);
+    close(sock);
+    return NULL;
+}
+
+static void *primary_listener_thread(void *arg) {
+    int listen_sock = (int)(intptr_t)arg;
+    while (1) {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0) {
+            if (errno != EINTR) {
+                log_event("[ERROR] Replication accept failed: %s", strerror(errno));
+            }
+            continue;
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, follower_session_thread, (void *)(intptr_t)sock) != 0) {
+            log_event("[ERROR] Failed to create replication thread: %s", strerror(errno));
+            close(sock);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+static int make_unix_address(const char *socket_path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "[ERROR] Replication socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(addr->sun_path, socket_path);
+    return 0;
+}
+
+int replication_primary_init(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (make_unix_address(socket_path, &addr) < 0) {
+        return -1;
+    }
+    int listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        fprintf(stderr, "[ERROR] Replication socket creation failed: %s\n", strerror(errno));
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_sock, 8) < 0) {
+        log_event("[ERROR] Replication bind/listen failed on %s: %s", socket_path, strerror(errno));
+        fprintf(stderr, "[ERROR] Replication bind/listen failed on %s: %s\n", socket_path, strerror(errno));
+        close(listen_sock);
+        return -1;
+    }
+
+    epoch = now_ms();
+    primary_enabled = 1;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, primary_listener_thread, (void *)(intptr_t)listen_sock) != 0) {
+        fprintf(stderr, "[ERROR] Failed to create replication listener thread: %s\n", strerror(errno));
+        close(listen_sock);
+        return -1;
+    }
+    pthread_detach(tid);
+    log_event("Replication primary listening on %s", socket_path);
+    printf("Replication primary listening on %s\n", socket_path);
+    return 0;
+}
+
+// ========================= FOLLOWER =========================
+
+static char follower_socket_path[PATH_MAX];
+
+static void apply_record(char type, const char *file, const char *line) {
+    if (!is_conversation_file(file)) {
+        return;
+    }
+    char path[PATH_MAX];
+    conversation_store_head_path(path, sizeof(path), file);
+    if (type != REPL_TRUNCATE) {
+        conversation_store_wait_space(path);
+    }
+
+    MUTEX_LOCK(file_mutex);
+    if (type == REPL_TRUNCATE) {
+        conversation_store_reset(file);
+    } else if (conversation_store_append(path, line) != 0) {
+        log_event("[ERROR] Failed to store replica line for %s: %s", path, strerror(errno));
+    }
+    MUTEX_UNLOCK(file_mutex);
+}
+
+static void update_lag(uint64_t applied_seq, uint64_t primary_seq, uint64_t applied_ts_ms) {
+    metrics_set(METRIC_REPL_APPLIED_SEQ, (long)applied_seq);
+    metrics_set(METRIC_REPL_PRIMARY_SEQ, (long)primary_seq);
+    metrics_set(METRIC_REPL_LAG_RECORDS, primary_seq > applied_seq ? (long)(primary_seq - applied_seq) : 0);
+    if (applied_ts_ms > 0) {
+        uint64_t now = now_ms();
+        metrics_set(METRIC_REPL_LAG_MS, now > applied_ts_ms ? (long)(now - applied_ts_ms) : 0);
+    } else if (primary_seq <= applied_seq) {
+        metrics_set(METRIC_REPL_LAG_MS, 0);
+    }
+}
+
+static void *follower_thread(void *arg) {
+    (void)arg;
+    uint64_t known_epoch = 0, applied_seq = 0;
+    char *payload = malloc(REPL_MAX_PAYLOAD + 1);
+    if (!payload) {
+        log_event("[ERROR] Failed to allocate replication receive buffer");
+        return NULL;
+    }
+
+    while (1) {
+        struct sockaddr_un addr;
+        make_unix_address(follower_socket_path, &addr);
+        int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            if (sock >= 0) close(sock);
+            sleep(REPL_RECONNECT_DELAY_SEC);
+            continue;
+        }
+
+        char request[128];
+        int req_len = snprintf(request, sizeof(request), "FROM %llu %llu\n",
+                               (unsigned long long)known_epoch, (unsigned long long)applied_seq);
+        if (send_all(sock, request, req_len) < 0) {
+            close(sock);
+            continue;
+        }
+        log_event("Replication follower connected to %s (epoch %llu, seq %llu)", follower_socket_path,
+                  (unsigned long long)known_epoch, (unsigned long long)applied_seq);
+
+        uint64_t primary_seq = applied_seq;
+        while (1) {
+            uint32_t be_len;
+            if (recv_all(sock, (char *)&be_len, 4) < 0) break;
+            uint32_t len = ntohl(be_len);
+            if (len < REPL_HEADER_SIZE || len > REPL_MAX_PAYLOAD) {
+                log_event("[ERROR] Invalid replication frame length %u", len);
+                break;
+            }
+            if (recv_all(sock, payload, len) < 0) break;
+            payload[len] = '\0';
+
+            char type = payload[0];
+            uint64_t seq = get_u64(payload + 1);
+            uint64_t ts_ms = get_u64(payload + 9);
+            const char *file = payload + REPL_HEADER_SIZE;
+            const char *line = file + strnlen(file, len - REPL_HEADER_SIZE) + 1;
+            if (line > payload + len) line = payload + len;
+
+            switch (type) {
+            case REPL_EPOCH:
+                if (seq != known_epoch) {
+                    known_epoch = seq;
+                    applied_seq = 0;
+                }
+                break;
+            case REPL_TRUNCATE:
+            case REPL_APPEND:
+                apply_record(type, file, line);
+                if (seq > 0) {
+                    applied_seq = seq;
+                    if (primary_seq < seq) primary_seq = seq;
+                    update_lag(applied_seq, primary_seq, ts_ms);
+                }
+                break;
+            case REPL_SNAPSHOT_DONE:
+                applied_seq = seq;
+                primary_seq = seq;
+                update_lag(applied_seq, primary_seq, 0);
+                log_event("Replication snapshot applied (seq %llu)", (unsigned long long)seq);
+                break;
+            case REPL_HEARTBEAT:
+                primary_seq = seq;
+                update_lag(applied_seq, primary_seq, 0);
+                break;
+            default:
+                log_event("[ERROR] Unknown replication frame type %d", type);
+                break;
+            }
+        }
+
+        log_event("[ERROR] Replication stream from %s lost, reconnecting", follower_socket_path);
+        close(sock);
+        sleep(REPL_RECONNECT_DELAY_SEC);
+    }
+    return NULL;
+}
+
+int replication_follower_init(const char *socket_path) {
+    if (strlen(socket_path) >= sizeof(follower_socket_path)) {
+        fprintf(stderr, "[ERROR] Replication socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(follower_socket_path, socket_path);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, follower_thread, NULL) != 0) {
+        fprintf(stderr, "[ERROR] Failed to create replication follower thread: %s\n", strerror(errno));
+        return -1;
+    }
+    pthread_detach(tid);
+    log_event("Running as read replica of %s", socket_path);
+    printf("Running as read replica of %s\n", socket_path);
+    return 0;
+}
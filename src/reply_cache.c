@@ -0,0 +1,258 @@
+#include "../include/reply_cache.h"
+#include "../include/server_utils.h"
+#include "../include/federation.h"
+#include "../include/outbound.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// Toàn bộ các trang của một danh sách, đã định dạng sẵn và nằm liền nhau trong text.
+// Có đếm tham chiếu để thread đang gửi vẫn dùng được khi cache đã được dựng lại.
+typedef struct {
+    int refs;
+    unsigned long generation;
+    int page_count;
+    size_t *offsets;        // page_count + 1 vị trí, trang p nằm trong [offsets[p-1], offsets[p])
+    char *text;
+} PageSet;
+
+typedef struct GroupCacheEntry {
+    char username[32];
+    PageSet *pages;
+    struct GroupCacheEntry *next;
+} GroupCacheEntry;
+
+static unsigned long generations[REPLY_CACHE_COUNT] = {1, 1};
+static PageSet *users_pages = NULL;
+static GroupCacheEntry *group_cache[GROUP_CACHE_BUCKETS];
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void reply_cache_bump(ReplyCacheKind kind) {
+    __atomic_add_fetch(&generations[kind], 1, __ATOMIC_RELEASE);
+}
+
+static unsigned long current_generation(ReplyCacheKind kind) {
+    return __atomic_load_n(&generations[kind], __ATOMIC_ACQUIRE);
+}
+
+// Gọi khi đang giữ cache_mutex (hoặc khi PageSet chưa được chia sẻ)
+static void page_set_put(PageSet *set) {
+    if (set && --set->refs == 0) {
+        free(set->offsets);
+        free(set->text);
+        free(set);
+    }
+}
+
+/**
+ * Chia các mục (mỗi mục một dòng) thành các trang có header/footer
+ * @param entries: Các dòng kết thúc bằng '\n'
+ * @param empty_text: Dòng in ra khi không có mục nào (NULL nếu không cần)
+ * @param more_cmd: Lệnh để xem trang sau, ví dụ "/users"
+ */
+static PageSet *build_pages(const char *title, const char *entries, size_t entries_len,
+                            const char *empty_text, const char *more_cmd) {
+    int lines = 0;
+    for (size_t i = 0; i < entries_len; i++) {
+        if (entries[i] == '\n') lines++;
+    }
+    int pages = lines == 0 ? 1 : (lines + LIST_PAGE_LINES - 1) / LIST_PAGE_LINES;
+
+    PageSet *set = calloc(1, sizeof(PageSet));
+    size_t capacity = entries_len + (size_t)pages * 128 + (empty_text ? strlen(empty_text) : 0) + 1;
+    if (!set || !(set->offsets = malloc((pages + 1) * sizeof(size_t))) || !(set->text = malloc(capacity))) {
+        log_event("[ERROR] Failed to allocate list cache for %s", title);
+        if (set) {
+            free(set->offsets);
+            free(set);
+        }
+        return NULL;
+    }
+    set->refs = 1;
+    set->page_count = pages;
+
+    size_t pos = 0;
+    const char *line = entries;
+    const char *end = entries + entries_len;
+    for (int p = 1; p <= pages; p++) {
+        set->offsets[p - 1] = pos;
+        if (pages == 1) {
+            pos += snprintf(set->text + pos, capacity - pos, "=== %s ===\n", title);
+        } else {
+            pos += snprintf(set->text + pos, capacity - pos, "=== %s (page %d/%d) ===\n", title, p, pages);
+        }
+        // Copy nguyên khối LIST_PAGE_LINES dòng tiếp theo
+        const char *page_end = line;
+        for (int n = 0; n < LIST_PAGE_LINES && page_end < end; n++) {
+            const char *nl = memchr(page_end, '\n', end - page_end);
+            page_end = nl ? nl + 1 : end;
+        }
+        memcpy(set->text + pos, line, page_end - line);
+        pos += page_end - line;
+        line = page_end;
+        if (lines == 0 && empty_text) {
+            pos += snprintf(set->text + pos, capacity - pos, "%s", empty_text);
+        }
+        if (p < pages) {
+            pos += snprintf(set->text + pos, capacity - pos, "(more: %s %d)\n", more_cmd, p + 1);
+        }
+    }
+    set->offsets[pages] = pos;
+    return set;
+}
+
+// Nối text vào buffer động
+static int append_text(char **buf, size_t *len, size_t *capacity, const char *text, size_t text_len) {
+    if (*len + text_len + 1 > *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+        while (new_capacity < *len + text_len + 1) new_capacity *= 2;
+        char *grown = realloc(*buf, new_capacity);
+        if (!grown) return -1;
+        *buf = grown;
+        *capacity = new_capacity;
+    }
+    memcpy(*buf + *len, text, text_len);
+    *len += text_len;
+    (*buf)[*len] = '\0';
+    return 0;
+}
+
+static PageSet *build_users_pages(unsigned long generation) {
+    // Chỉ copy tên trong lúc giữ clients_mutex, định dạng sau khi đã nhả khóa
+    MUTEX_LOCK(clients_mutex);
+    int count = clientCount;
+    char (*names)[32] = malloc(sizeof(char[32]) * (count > 0 ? count : 1));
+    if (names) {
+        for (int i = 0; i < count; i++) {
+            memcpy(names[i], clients[i].username, sizeof(names[i]));
+        }
+    }
+    MUTEX_UNLOCK(clients_mutex);
+    if (!names) {
+        return NULL;
+    }
+
+    char *entries = NULL;
+    size_t len = 0, capacity = 0;
+    for (int i = 0; i < count; i++) {
+        append_text(&entries, &len, &capacity, names[i], strnlen(names[i], sizeof(names[i]) - 1));
+        append_text(&entries, &len, &capacity, "\n", 1);
+    }
+    free(names);
+
+    // Các user đang online ở node khác trong cụm
+    int remote = federation_enabled() ? federation_remote_user_count() : 0;
+    if (remote > 0) {
+        size_t room = (size_t)remote * 64;
+        char *remote_text = malloc(room);
+        if (remote_text) {
+            size_t remote_len = federation_list_remote_users(remote_text, room);
+            append_text(&entries, &len, &capacity, remote_text, remote_len);
+            free(remote_text);
+        }
+    }
+
+    PageSet *set = build_pages("Online Users", entries ? entries : "", len, NULL, "/users");
+    free(entries);
+    if (set) {
+        set->generation = generation;
+    }
+    return set;
+}
+
+static PageSet *build_groups_pages(const char *username, unsigned long generation) {
+    char *entries = NULL;
+    size_t len = 0, capacity = 0;
+    char line[128];
+    SymbolId user = symbol_lookup(username);
+    for (int i = 0; i < groupCount; i++) {
+        if (group_has_member(i, user)) {
+            int written = snprintf(line, sizeof(line), "%s - %s\n", groups[i].groupId, groups[i].groupName);
+            append_text(&entries, &len, &capacity, line, written);
+        }
+    }
+    PageSet *set = build_pages("Your Groups", entries ? entries : "", len,
+                               "(You are not in any groups)\n", "/groups");
+    free(entries);
+    if (set) {
+        set->generation = generation;
+    }
+    return set;
+}
+
+static unsigned int hash_username(const char *username) {
+    unsigned int h = 5381;
+    while (*username) {
+        h = h * 33 + (unsigned char)*username++;
+    }
+    return h % GROUP_CACHE_BUCKETS;
+}
+
+// Gửi một trang rồi trả tham chiếu
+static void send_page(int sock, PageSet *set, int page) {
+    if (page < 1) page = 1;
+    if (page > set->page_count) page = set->page_count;
+    size_t start = set->offsets[page - 1];
+    outbox_send(sock, LANE_CONTROL, set->text + start, set->offsets[page] - start, "send list page");
+    pthread_mutex_lock(&cache_mutex);
+    page_set_put(set);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void reply_cache_send_users(int sock, int page) {
+    unsigned long generation = current_generation(REPLY_CACHE_USERS);
+    pthread_mutex_lock(&cache_mutex);
+    if (!users_pages || users_pages->generation != generation) {
+        PageSet *fresh = build_users_pages(generation);
+        if (fresh) {
+            page_set_put(users_pages);
+            users_pages = fresh;
+        }
+    }
+    PageSet *set = users_pages;
+    if (set) {
+        set->refs++;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (!set) {
+        send_message_safe(sock, "[Server] Failed to build user list.\n", "send user list error");
+        return;
+    }
+    send_page(sock, set, page);
+}
+
+void reply_cache_send_groups(int sock, const char *username, int page) {
+    unsigned long generation = current_generation(REPLY_CACHE_GROUPS);
+    unsigned int bucket = hash_username(username);
+    pthread_mutex_lock(&cache_mutex);
+    GroupCacheEntry *entry = group_cache[bucket];
+    while (entry && strcmp(entry->username, username) != 0) {
+        entry = entry->next;
+    }
+    if (!entry && (entry = calloc(1, sizeof(GroupCacheEntry))) != NULL) {
+        strncpy(entry->username, username, sizeof(entry->username) - 1);
+        entry->next = group_cache[bucket];
+        group_cache[bucket] = entry;
+    }
+    PageSet *set = NULL;
+    if (entry) {
+        if (!entry->pages || entry->pages->generation != generation) {
+            PageSet *fresh = build_groups_pages(username, generation);
+            if (fresh) {
+                page_set_put(entry->pages);
+                entry->pages = fresh;
+            }
+        }
+        set = entry->pages;
+        if (set) {
+            set->refs++;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (!set) {
+        send_message_safe(sock, "[Server] Failed to build group list.\n", "send group list error");
+        return;
+    }
+    send_page(sock, set, page);
+}
@@ -0,0 +1,336 @@
+#include "../include/scan.h"
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define SCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+// SWAR: có byte 0 trong từ 8 byte (byte thấp nhất được báo là chính xác)
+#define SWAR_ONES 0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_HAS_ZERO(v) (((v) - SWAR_ONES) & ~(v) & SWAR_HIGHS)
+
+// Đọc được width byte từ p mà không vượt sang trang bộ nhớ kế tiếp (đọc thừa sau cuối dữ liệu
+// trong cùng trang là an toàn), dùng cho đầu vào ngắn hơn một thanh ghi vector
+#define SCAN_PAGE_SIZE 4096
+#define SCAN_SAME_PAGE(p, width) (((uintptr_t)(p) & (SCAN_PAGE_SIZE - 1)) <= SCAN_PAGE_SIZE - (width))
+
+// Các hàm xử lý một khối phải được inline, nếu không thanh ghi vector bị đẩy ra stack mỗi lần gọi
+#define SCAN_BLOCK static inline __attribute__((always_inline))
+
+static uint64_t load_word(const char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// ===== SCALAR =====
+
+static const char *byte_scalar(const char *p, size_t len, char c) {
+    const char *end = p + len;
+    for (; p < end && ((uintptr_t)p & 7); p++) {
+        if (*p == c) return p;
+    }
+    uint64_t pattern = SWAR_ONES * (unsigned char)c;
+    for (; end - p >= 8; p += 8) {
+        uint64_t v = load_word(p) ^ pattern;
+        if (SWAR_HAS_ZERO(v)) break;
+    }
+    for (; p < end; p++) {
+        if (*p == c) return p;
+    }
+    return NULL;
+}
+
+static size_t line_length_scalar(const char *s) {
+    const char *p = s;
+    for (; (uintptr_t)p & 7; p++) {
+        if (*p == '\n' || *p == '\0') return p - s;
+    }
+    // Đọc theo từ 8 byte đã căn lề nên không bao giờ vượt sang trang bộ nhớ kế tiếp
+    for (;; p += 8) {
+        uint64_t v = load_word(p);
+        if (SWAR_HAS_ZERO(v) || SWAR_HAS_ZERO(v ^ (SWAR_ONES * '\n'))) break;
+    }
+    while (*p != '\n' && *p != '\0') p++;
+    return p - s;
+}
+
+static const char *marker_scalar(const char *hay, size_t len, const char *needle, size_t nlen) {
+    while (len >= nlen) {
+        const char *hit = byte_scalar(hay, len - nlen + 1, needle[0]);
+        if (!hit) return NULL;
+        if (memcmp(hit + 1, needle + 1, nlen - 1) == 0) return hit;
+        len -= hit + 1 - hay;
+        hay = hit + 1;
+    }
+    return NULL;
+}
+
+#ifdef SCAN_HAVE_X86
+
+// ===== SSE2 =====
+
+SCAN_BLOCK unsigned byte_mask_sse2(const char *p, __m128i pattern) {
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), pattern));
+}
+
+static const char *byte_sse2(const char *p, size_t len, char c) {
+    const __m128i pattern = _mm_set1_epi8(c);
+    if (len < 16) {
+        if (!SCAN_SAME_PAGE(p, 16)) {
+            return byte_scalar(p, len, c);
+        }
+        // Một lần đọc, bỏ các byte nằm sau len
+        unsigned mask = byte_mask_sse2(p, pattern) & ((1u << len) - 1);
+        return mask ? p + __builtin_ctz(mask) : NULL;
+    }
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = byte_mask_sse2(p + i, pattern);
+        if (mask) return p + i + __builtin_ctz(mask);
+    }
+    // Phần đuôi: một lần đọc chồng lên khối trước thay vì lặp từng byte
+    if (i < len) {
+        unsigned mask = byte_mask_sse2(p + len - 16, pattern);
+        if (mask) return p + len - 16 + __builtin_ctz(mask);
+    }
+    return NULL;
+}
+
+static size_t line_length_sse2(const char *s) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+    unsigned misalign = (uintptr_t)s & 15;
+    const char *p = s - misalign;
+    for (;; p += 16) {
+        __m128i v = _mm_load_si128((const __m128i *)p);
+        unsigned mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, zero)));
+        mask = mask >> misalign << misalign;    // Bỏ các byte nằm trước s trong khối đầu
+        misalign = 0;
+        if (mask) return p + __builtin_ctz(mask) - s;
+    }
+}
+
+// Lọc theo hai byte đầu và byte cuối của needle, chỉ memcmp ở các vị trí khớp cả ba
+SCAN_BLOCK const char *marker_block_sse2(const char *at, const char *needle, size_t nlen,
+                                         __m128i first, __m128i second, __m128i last, unsigned valid) {
+    __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)at), first);
+    __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(at + 1)), second);
+    __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(at + nlen - 1)), last);
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c)) & valid;
+    for (; mask; mask &= mask - 1) {
+        const char *candidate = at + __builtin_ctz(mask);
+        if (memcmp(candidate + 1, needle + 1, nlen - 1) == 0) return candidate;
+    }
+    return NULL;
+}
+
+static const char *marker_sse2(const char *hay, size_t len, const char *needle, size_t nlen) {
+    size_t starts = len - nlen + 1;     // Số vị trí bắt đầu có thể
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i second = _mm_set1_epi8(needle[1]);
+    const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+    if (starts < 16) {
+        if (nlen > 16 || !SCAN_SAME_PAGE(hay, nlen - 1 + 16)) {
+            return marker_scalar(hay, len, needle, nlen);
+        }
+        return marker_block_sse2(hay, needle, nlen, first, second, last, (1u << starts) - 1);
+    }
+    const char *hit;
+    size_t i = 0;
+    for (; i + 16 <= starts; i += 16) {
+        if ((hit = marker_block_sse2(hay + i, needle, nlen, first, second, last, ~0u))) return hit;
+    }
+    // Các vị trí chồng lên khối trước đã bị loại nên kết quả vẫn là lần xuất hiện đầu tiên
+    if (i < starts) {
+        return marker_block_sse2(hay + starts - 16, needle, nlen, first, second, last, ~0u);
+    }
+    return NULL;
+}
+
+// ===== AVX2 =====
+
+__attribute__((target("avx2")))
+SCAN_BLOCK unsigned byte_mask_avx2(const char *p, __m256i pattern) {
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), pattern));
+}
+
+__attribute__((target("avx2")))
+static const char *byte_avx2(const char *p, size_t len, char c) {
+    const __m256i pattern = _mm256_set1_epi8(c);
+    if (len < 32) {
+        if (!SCAN_SAME_PAGE(p, 32)) {
+            return byte_sse2(p, len, c);
+        }
+        unsigned mask = byte_mask_avx2(p, pattern) & ((1u << len) - 1);
+        return mask ? p + __builtin_ctz(mask) : NULL;
+    }
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), pattern);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + 32)), pattern);
+        if (_mm256_movemask_epi8(_mm256_or_si256(a, b))) {
+            unsigned mask = _mm256_movemask_epi8(a);
+            if (mask) return p + i + __builtin_ctz(mask);
+            return p + i + 32 + __builtin_ctz((unsigned)_mm256_movemask_epi8(b));
+        }
+    }
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = byte_mask_avx2(p + i, pattern);
+        if (mask) return p + i + __builtin_ctz(mask);
+    }
+    if (i < len) {
+        unsigned mask = byte_mask_avx2(p + len - 32, pattern);
+        if (mask) return p + len - 32 + __builtin_ctz(mask);
+    }
+    return NULL;
+}
+
+__attribute__((target("avx2")))
+static size_t line_length_avx2(const char *s) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned misalign = (uintptr_t)s & 31;
+    const char *p = s - misalign;
+    for (;; p += 32) {
+        __m256i v = _mm256_load_si256((const __m256i *)p);
+        unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, newline),
+                                                             _mm256_cmpeq_epi8(v, zero)));
+        mask = mask >> misalign << misalign;
+        misalign = 0;
+        if (mask) return p + __builtin_ctz(mask) - s;
+    }
+}
+
+__attribute__((target("avx2")))
+SCAN_BLOCK const char *marker_block_avx2(const char *at, const char *needle, size_t nlen,
+                                         __m256i first, __m256i second, __m256i last, unsigned valid) {
+    __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)at), first);
+    __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(at + 1)), second);
+    __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(at + nlen - 1)), last);
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), c)) & valid;
+    for (; mask; mask &= mask - 1) {
+        const char *candidate = at + __builtin_ctz(mask);
+        if (memcmp(candidate + 1, needle + 1, nlen - 1) == 0) return candidate;
+    }
+    return NULL;
+}
+
+__attribute__((target("avx2")))
+static const char *marker_avx2(const char *hay, size_t len, const char *needle, size_t nlen) {
+    size_t starts = len - nlen + 1;
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i second = _mm256_set1_epi8(needle[1]);
+    const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+    if (starts < 32) {
+        if (nlen > 32 || !SCAN_SAME_PAGE(hay, nlen - 1 + 32)) {
+            return marker_sse2(hay, len, needle, nlen);
+        }
+        return marker_block_avx2(hay, needle, nlen, first, second, last, (1u << starts) - 1);
+    }
+    const char *hit;
+    size_t i = 0;
+    for (; i + 32 <= starts; i += 32) {
+        if ((hit = marker_block_avx2(hay + i, needle, nlen, first, second, last, ~0u))) return hit;
+    }
+    if (i < starts) {
+        return marker_block_avx2(hay + starts - 32, needle, nlen, first, second, last, ~0u);
+    }
+    return NULL;
+}
+
+#endif
+
+// ===== DISPATCH =====
+
+typedef struct {
+    const char *(*byte)(const char *p, size_t len, char c);
+    size_t (*line_length)(const char *s);
+    const char *(*marker)(const char *hay, size_t len, const char *needle, size_t nlen);
+} ScanKernels;
+
+static const ScanKernels kernels[SCAN_ISA_COUNT] = {
+    [SCAN_ISA_SCALAR] = {byte_scalar, line_length_scalar, marker_scalar},
+#ifdef SCAN_HAVE_X86
+    [SCAN_ISA_SSE2] = {byte_sse2, line_length_sse2, marker_sse2},
+    [SCAN_ISA_AVX2] = {byte_avx2, line_length_avx2, marker_avx2},
+#endif
+};
+
+static const char *isa_names[SCAN_ISA_COUNT] = {
+    [SCAN_ISA_SCALAR] = "scalar",
+    [SCAN_ISA_SSE2] = "sse2",
+    [SCAN_ISA_AVX2] = "avx2",
+};
+
+static ScanIsa active_isa = SCAN_ISA_SCALAR;
+static const ScanKernels *active = &kernels[SCAN_ISA_SCALAR];
+
+int scan_isa_supported(ScanIsa isa) {
+    switch (isa) {
+    case SCAN_ISA_SCALAR:
+        return 1;
+#ifdef SCAN_HAVE_X86
+    case SCAN_ISA_SSE2:
+        return 1;   // Luôn có trên x86-64
+    case SCAN_ISA_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return 0;
+    }
+}
+
+int scan_set_isa(ScanIsa isa) {
+    if (isa < 0 || isa >= SCAN_ISA_COUNT || !scan_isa_supported(isa)) {
+        return -1;
+    }
+    active_isa = isa;
+    active = &kernels[isa];
+    return 0;
+}
+
+ScanIsa scan_active_isa(void) {
+    return active_isa;
+}
+
+const char *scan_isa_name(ScanIsa isa) {
+    return isa >= 0 && isa < SCAN_ISA_COUNT ? isa_names[isa] : "unknown";
+}
+
+// Chọn bộ kernel tốt nhất trước main(), để mọi thread thấy cùng một lựa chọn
+__attribute__((constructor))
+static void scan_select_isa(void) {
+    for (int isa = SCAN_ISA_COUNT - 1; isa > SCAN_ISA_SCALAR; isa--) {
+        if (scan_set_isa(isa) == 0) {
+            return;
+        }
+    }
+}
+
+// ===== PUBLIC API =====
+
+const char *scan_byte(const char *p, size_t len, char c) {
+    return active->byte(p, len, c);
+}
+
+size_t scan_line_length(const char *s) {
+    return active->line_length(s);
+}
+
+const char *scan_marker(const char *hay, size_t len, const char *needle, size_t nlen) {
+    if (nlen == 0) {
+        return hay;
+    }
+    if (nlen > len) {
+        return NULL;
+    }
+    if (nlen == 1) {
+        return active->byte(hay, len, needle[0]);
+    }
+    return active->marker(hay, len, needle, nlen);
+}
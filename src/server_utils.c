@@ -1,4 +1,16 @@
 #include "../include/server_utils.h"
+#include "../include/federation.h"
+#include "../include/replication.h"
+#include "../include/metrics.h"
+#include "../include/conversation_store.h"
+#include "../include/compression.h"
+#include "../include/msg_trace.h"
+#include "../include/outbound.h"
+#include "../include/reply_cache.h"
+#include "../include/fanout.h"
+#include "../include/session.h"
+#include "../include/scan.h"
+#include "../include/delivery_ack.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
@@ -11,8 +23,8 @@
 #include <pthread.h>
 #include <limits.h>
 
-User users[100];
-Group groups[50];
+User users[MAX_USERS];
+Group groups[MAX_GROUPS];
 int userCount = 0;
 int groupCount = 0;
 FILE *logFile = NULL;
@@ -23,6 +35,11 @@ Client clients[MAX_CLIENTS];
 int clientCount = 0;
 pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+// Chỉ mục theo SymbolId, lưu chỉ số + 1 (0 = không có) để mảng tĩnh không cần khởi tạo
+static int user_slots[MAX_SYMBOLS];     // -> users[]
+static int group_slots[MAX_SYMBOLS];    // -> groups[]
+static int client_slots[MAX_SYMBOLS];   // -> clients[] (cập nhật dưới clients_mutex)
+
 void log_event(const char *fmt, ...) {
     if (!logFile) {
         fprintf(stderr, "[ERROR] logFile is NULL in log_event: %s\n", strerror(errno));
@@ -45,7 +62,7 @@ void log_event(const char *fmt, ...) {
 }
 
 // Hàm helper để tìm file data
-static FILE* find_data_file(const char* filename) {
+FILE* find_data_file(const char* filename) {
     // Danh sách các đường dẫn có thể thử
     const char* paths[] = {
         "./data/%s",           // Thư mục hiện tại
@@ -73,12 +90,22 @@ static FILE* find_data_file(const char* filename) {
     return NULL;
 }
 
+// Thư mục conversation (có thể chỉ định qua set_conversation_dir())
+static char conv_dir[PATH_MAX] = "";
+static int conv_dir_initialized = 0;
+
+void set_conversation_dir(const char *dir) {
+    strncpy(conv_dir, dir, sizeof(conv_dir) - 1);
+    conv_dir[sizeof(conv_dir) - 1] = '\0';
+    if (mkdir(conv_dir, 0777) == -1 && errno != EEXIST) {
+        fprintf(stderr, "[ERROR] Failed to create conversation directory %s: %s\n", conv_dir, strerror(errno));
+    }
+    conv_dir_initialized = 1;
+}
+
 // Hàm helper để lấy đường dẫn đến thư mục conversation đúng
-static const char* get_conversation_dir() {
-    static char conv_dir[PATH_MAX] = "";
-    static int initialized = 0;
-    
-    if (initialized) {
+const char* get_conversation_dir() {
+    if (conv_dir_initialized) {
         return conv_dir;
     }
     
@@ -95,7 +122,7 @@ static const char* get_conversation_dir() {
         if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode)) {
             strncpy(conv_dir, paths[i], sizeof(conv_dir) - 1);
             conv_dir[sizeof(conv_dir) - 1] = '\0';
-            initialized = 1;
+            conv_dir_initialized = 1;
             if (logFile) {
                 log_event("Found conversation directory at: %s", conv_dir);
             } else {
@@ -110,7 +137,7 @@ static const char* get_conversation_dir() {
         if (mkdir(paths[i], 0777) == 0 || errno == EEXIST) {
             strncpy(conv_dir, paths[i], sizeof(conv_dir) - 1);
             conv_dir[sizeof(conv_dir) - 1] = '\0';
-            initialized = 1;
+            conv_dir_initialized = 1;
             if (logFile) {
                 log_event("Created/found conversation directory at: %s", conv_dir);
             } else {
@@ -123,7 +150,7 @@ static const char* get_conversation_dir() {
     // Mặc định dùng thư mục hiện tại
     strncpy(conv_dir, "./conversation", sizeof(conv_dir) - 1);
     conv_dir[sizeof(conv_dir) - 1] = '\0';
-    initialized = 1;
+    conv_dir_initialized = 1;
     return conv_dir;
 }
 
@@ -142,14 +169,15 @@ void load_users() {
         exit(1);
     }
     while (fscanf(f, "%31[^:]:%31s\n", users[userCount].username, users[userCount].password) == 2) {
-        if (userCount >= 100) {
-            fprintf(stderr, "[WARNING] Maximum users limit (100) reached. Ignoring remaining users.\n");
-            log_event("[WARNING] Maximum users limit (100) reached");
-            break;
-        } 
         userCount++;
+        if (userCount >= MAX_USERS) {
+            fprintf(stderr, "[WARNING] Maximum users limit (%d) reached. Ignoring remaining users.\n", MAX_USERS);
+            log_event("[WARNING] Maximum users limit (%d) reached", MAX_USERS);
+            break;
+        }
     }
     fclose(f);
+    index_users();
     log_event("Loaded %d users from user.txt", userCount);
 }
 
@@ -171,125 +199,273 @@ void load_groups() {
                   groups[groupCount].groupId,
                   groups[groupCount].groupName,
                   groups[groupCount].members) == 3) {
-        if (groupCount >= 50) {
-            fprintf(stderr, "[WARNING] Maximum groups limit (50) reached. Ignoring remaining groups.\n");
-            log_event("[WARNING] Maximum groups limit (50) reached");
+        groupCount++;
+        if (groupCount >= MAX_GROUPS) {
+            fprintf(stderr, "[WARNING] Maximum groups limit (%d) reached. Ignoring remaining groups.\n", MAX_GROUPS);
+            log_event("[WARNING] Maximum groups limit (%d) reached", MAX_GROUPS);
             break;
         }
-        groupCount++;
     }
     fclose(f);
+    index_groups();
+    reply_cache_bump(REPLY_CACHE_GROUPS);
     log_event("Loaded %d groups from group.txt", groupCount);
 }
 
-int is_user_in_group(const char *groupId, const char *username) {
+void index_users(void) {
+    memset(user_slots, 0, sizeof(user_slots));
+    for (int i = 0; i < userCount; i++) {
+        SymbolId id = symbol_intern(users[i].username);
+        if (id != SYMBOL_NONE && !user_slots[id]) {
+            user_slots[id] = i + 1;
+        }
+    }
+}
+
+void index_groups(void) {
+    memset(group_slots, 0, sizeof(group_slots));
     for (int i = 0; i < groupCount; i++) {
-        if (strcmp(groups[i].groupId, groupId) == 0) {
-            char tmp[256];
-            strncpy(tmp, groups[i].members, sizeof(tmp) - 1);
-            tmp[sizeof(tmp) - 1] = '\0';
-            char *tok = strtok(tmp, ",");
-            while (tok) {
-                if (strcmp(tok, username) == 0)
-                    return 1;
-                tok = strtok(NULL, ",");
+        Group *g = &groups[i];
+        SymbolId id = symbol_intern(g->groupId);
+        if (id != SYMBOL_NONE && !group_slots[id]) {
+            group_slots[id] = i + 1;
+        }
+        // Danh sách thành viên được tách một lần; tên không phải user thì không đăng nhập được nên bỏ qua
+        char tmp[sizeof(g->members)];
+        strncpy(tmp, g->members, sizeof(tmp) - 1);
+        tmp[sizeof(tmp) - 1] = '\0';
+        g->member_count = 0;
+        char *saveptr = NULL;
+        for (char *tok = strtok_r(tmp, ",", &saveptr); tok && g->member_count < MAX_GROUP_MEMBERS;
+             tok = strtok_r(NULL, ",", &saveptr)) {
+            SymbolId member = symbol_lookup(tok);
+            if (member != SYMBOL_NONE && user_slots[member]) {
+                g->member_ids[g->member_count++] = member;
             }
         }
     }
-    return 0;
 }
 
-// Kiểm tra xem groupId có tồn tại trong danh sách groups không
-int is_group_id(const char *groupId) {
-    for (int i = 0; i < groupCount; i++) {
-        if (strcmp(groups[i].groupId, groupId) == 0) {
+int find_group_index(const char *groupId) {
+    SymbolId id = symbol_lookup(groupId);
+    return id != SYMBOL_NONE && group_slots[id] ? group_slots[id] - 1 : -1;
+}
+
+int group_has_member(int group_index, SymbolId user) {
+    if (group_index < 0 || user == SYMBOL_NONE) {
+        return 0;
+    }
+    const Group *g = &groups[group_index];
+    for (int i = 0; i < g->member_count; i++) {
+        if (g->member_ids[i] == user) {
             return 1;
         }
     }
     return 0;
 }
 
-void save_conversation(const char *sender, const char *target, const char *msg, int isGroup) {
-    pthread_mutex_lock(&file_mutex);
-    
-    // Đảm bảo thư mục conversation tồn tại
-    const char* conv_dir = get_conversation_dir();
-    if (mkdir(conv_dir, 0777) == -1 && errno != EEXIST) {
-        log_event("[ERROR] Failed to create conversation directory %s: %s", conv_dir, strerror(errno));
-        fprintf(stderr, "[ERROR] Failed to create conversation directory %s: %s\n", conv_dir, strerror(errno));
-    }
+int is_user_in_group(const char *groupId, const char *username) {
+    return group_has_member(find_group_index(groupId), symbol_lookup(username));
+}
 
+// Kiểm tra xem groupId có tồn tại trong danh sách groups không
+int is_group_id(const char *groupId) {
+    return find_group_index(groupId) >= 0;
+}
+
+void save_conversation(const char *sender, const char *target, const char *msg, int isGroup) {
     char filename[PATH_MAX];
     get_conversation_filename(filename, sizeof(filename), sender, target, isGroup);
+    // Chờ hàng đợi của gốc còn chỗ trước khi khóa, để đĩa chậm không giữ file_mutex của mọi người
+    conversation_store_wait_space(filename);
 
-    FILE *f = fopen(filename, "a");
-    if (!f) {
-        log_event("[ERROR] Failed to open conversation file %s for writing: %s", filename, strerror(errno));
-        fprintf(stderr, "[ERROR] Failed to open conversation file %s for writing: %s\n", filename, strerror(errno));
-        pthread_mutex_unlock(&file_mutex);
-        return;
-    }
+    TRACE_BEGIN(lock_start);
+    MUTEX_LOCK(file_mutex);
+    TRACE_END("file_mutex_wait", lock_start, -1);
+    TRACE_BEGIN(save_start);
 
     time_t now = time(NULL);
     char *t = ctime(&now);
     t[strcspn(t, "\n")] = 0;
-    fprintf(f, "[%s] %s: %s\n", t, sender, msg);
-    if (fflush(f) != 0) {
-        log_event("[ERROR] Failed to flush conversation file %s: %s", filename, strerror(errno));
-        fprintf(stderr, "[ERROR] Failed to flush conversation file %s: %s\n", filename, strerror(errno));
+    char line[BUFFER_SIZE * 2];
+    unsigned long long seq = conversation_store_next_seq(filename);
+    snprintf(line, sizeof(line), "%llu%c[%s] %s: %s", seq, SEQ_SEPARATOR, t, sender, msg);
+    // Writer của gốc chứa hội thoại ghi xuống đĩa; ở đây chỉ xếp hàng
+    TRACE_BEGIN(enqueue_start);
+    if (conversation_store_append(filename, line) != 0) {
+        log_event("[ERROR] Failed to store line for conversation file %s: %s", filename, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to store line for conversation file %s: %s\n", filename, strerror(errno));
+    }
+    TRACE_END("store_enqueue", enqueue_start, -1);
+    log_event("Saved conversation to %s: %s: %s", filename, sender, msg);
+
+    // Đẩy dòng vừa ghi vào replication log (vẫn giữ file_mutex để giữ đúng thứ tự)
+    const char *base = strrchr(filename, '/');
+    replication_publish(base ? base + 1 : filename, line);
+    TRACE_END("save_conversation", save_start, -1);
+    MUTEX_UNLOCK(file_mutex);
+}
+
+// Vị trí của một lượt gửi lịch sử giữa các chunk. file_mutex chỉ được giữ trong lúc
+// đọc một chunk; việc gửi chunk qua làn bulk (có thể chờ client chậm) diễn ra ngoài khóa.
+typedef struct {
+    ReaderPosition pos;
+    int started;
+    long consumed;                  // Số dòng không rỗng đã đọc, tính cả phần bỏ qua
+    unsigned long long last_seq;    // Seq của dòng cuối đã đọc
+    unsigned long long min_seq;     // Bỏ các dòng có seq <= min_seq (0 = không lọc)
+} HistoryCursor;
+
+// Mở lại reader ở vị trí đã dừng. Nếu compactor đã cuộn/gộp phần đang đọc thì
+// tìm lại theo seq, hoặc theo số dòng với dữ liệu cũ không có seq.
+static void history_cursor_resume(HistoryCursor *cur, ConversationReader *reader) {
+    if (conversation_reader_resume(reader, &cur->pos) == 0) {
+        return;
     }
-    if (fclose(f) != 0) {
-        log_event("[ERROR] Failed to close conversation file %s: %s", filename, strerror(errno));
-        fprintf(stderr, "[ERROR] Failed to close conversation file %s: %s\n", filename, strerror(errno));
+    if (cur->last_seq > 0) {
+        conversation_reader_seek_after(reader, cur->last_seq);
+        cur->min_seq = cur->last_seq;
+    } else {
+        conversation_reader_skip(reader, cur->consumed);
     }
-    log_event("Saved conversation to %s: %s: %s", filename, sender, msg);
-    pthread_mutex_unlock(&file_mutex);
 }
 
-void send_conversation_history(int sock, const char *sender, const char *target, int isGroup) {
-    pthread_mutex_lock(&file_mutex);
-    
+/**
+ * Gửi các dòng lịch sử đã lọc cho client, theo từng chunk
+ * @param page: 0 để gửi toàn bộ, N >= 1 để gửi trang thứ N tính từ mới nhất
+ * @param keyword: NULL hoặc chuỗi cần tìm (chỉ gửi các dòng chứa nó)
+ * @param delta: 1 để chỉ gửi các dòng có seq > after_seq dạng "@<seq> <nội dung>" và kết thúc bằng "@end"
+ */
+static void stream_conversation(int sock, const char *sender, const char *target, int isGroup,
+                                int page, const char *keyword, int delta, unsigned long long after_seq) {
     char filename[PATH_MAX];
     get_conversation_filename(filename, sizeof(filename), sender, target, isGroup);
     log_event("Attempting to read conversation file: %s", filename);
 
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        char msg[128];
-        snprintf(msg, sizeof(msg), "[Server] No conversation history with %s.\n", target);
-        send_message_safe(sock, msg, "send no history message");
-        pthread_mutex_unlock(&file_mutex);
-        return;
-    }
+    char line[BUFFER_SIZE * 2];
+    char formatted_line[BUFFER_SIZE * 2 + 32];
+
+    // Gom các dòng thành khối lớn, nén nếu client đã thỏa thuận lúc đăng nhập
+    ReplyBuffer reply;
+    reply_init(&reply, sock, get_client_caps(sock) & CAP_ZLIB);
 
-    // Bỏ header và footer, chỉ gửi nội dung lịch sử
-    char line[512];
+    HistoryCursor cur = {0};
+    cur.min_seq = delta ? after_seq : 0;
+    unsigned long long last_sent_seq = after_seq;
+    size_t keyword_len = keyword ? strlen(keyword) : 0;
+    int limit = -1;
     int lines_sent = 0;
-    while (fgets(line, sizeof(line), f)) {
-        line[strcspn(line, "\n")] = 0;
-        if (strlen(line) == 0) continue;
-        log_event("Sending history line: %s", line);
-        
-        // Tạo message với newline
-        char formatted_line[512 + 2];
-        snprintf(formatted_line, sizeof(formatted_line), "%s\n", line);
-        
-        if (send_message_safe(sock, formatted_line, "send history line") < 0) {
+    int done = 0;
+    while (!done) {
+        MUTEX_LOCK(file_mutex);
+
+        // Đọc lần lượt archive -> segment -> head của hội thoại
+        ConversationReader reader;
+        if (conversation_reader_open(&reader, filename) < 0) {
+            MUTEX_UNLOCK(file_mutex);
+            if (!cur.started && !delta) {
+                char msg[128];
+                snprintf(msg, sizeof(msg), "[Server] No conversation history with %s.\n", target);
+                send_message_safe(sock, msg, "send no history message");
+                reply_finish(&reply);
+                return;
+            }
             break;
         }
-        lines_sent++;
-    }
 
-    if (lines_sent == 0) {
-        send_message_safe(sock, "No messages found.\n", "send no messages message");
+        if (cur.started) {
+            history_cursor_resume(&cur, &reader);
+        } else if (delta) {
+            conversation_reader_seek_after(&reader, after_seq);
+        } else if (page > 0) {
+            // Phân trang: đếm số dòng trước (dùng chỉ mục của archive) để biết trang N bắt đầu từ đâu
+            long total = conversation_reader_count(&reader);
+            int pages = (int)((total + HISTORY_PAGE_SIZE - 1) / HISTORY_PAGE_SIZE);
+            if (pages == 0) pages = 1;
+            if (page > pages) page = pages;
+            long first = total - (long)page * HISTORY_PAGE_SIZE;
+            limit = HISTORY_PAGE_SIZE;
+            if (first < 0) {
+                limit += first;
+                first = 0;
+            }
+            conversation_reader_skip(&reader, first);
+            cur.consumed = first;
+            char header[96];
+            snprintf(header, sizeof(header), "=== Page %d/%d ===\n", page, pages);
+            reply_append(&reply, header);
+        }
+        cur.started = 1;
+
+        // Đọc tới khi chunk đầy; bỏ header và footer, chỉ gửi nội dung lịch sử (không kèm tiền tố seq)
+        done = 1;
+        while (1) {
+            if (limit >= 0 && lines_sent >= limit) break;
+            if (!reply_has_room(&reply, sizeof(formatted_line))) {
+                done = conversation_reader_tell(&reader, &cur.pos) < 0;
+                break;
+            }
+            if (!conversation_reader_next(&reader, line, sizeof(line))) break;
+            // Một lượt dò tìm cả '\n' lẫn '\0' thay cho strcspn + strlen
+            size_t line_len = scan_line_length(line);
+            line[line_len] = 0;
+            if (line_len == 0) continue;
+            const char *text;
+            unsigned long long seq = parse_line_seq(line, &text);
+            cur.consumed++;
+            if (cur.min_seq > 0 && seq <= cur.min_seq) continue;
+            cur.last_seq = seq;
+            if (keyword && !scan_marker(text, line_len - (text - line), keyword, keyword_len)) continue;
+
+            if (delta) {
+                snprintf(formatted_line, sizeof(formatted_line), "@%llu %s\n", seq, text);
+                if (seq > last_sent_seq) last_sent_seq = seq;
+            } else {
+                log_event("Sending history line: %s", text);
+                snprintf(formatted_line, sizeof(formatted_line), "%s\n", text);
+            }
+            reply_append(&reply, formatted_line);
+            lines_sent++;
+        }
+        conversation_reader_close(&reader);
+        MUTEX_UNLOCK(file_mutex);
+
+        // Gửi chunk ngoài khóa: client chậm chỉ làm chậm chính lượt tải này
+        if (!done && reply_flush(&reply) < 0) {
+            break;
+        }
     }
 
-    if (fclose(f) != 0) {
-        log_event("[ERROR] Failed to close file %s: %s", filename, strerror(errno));
-        fprintf(stderr, "[ERROR] Failed to close file %s: %s\n", filename, strerror(errno));
+    if (delta) {
+        char footer[96];
+        snprintf(footer, sizeof(footer), "@end %s %llu\n", target, last_sent_seq);
+        reply_append(&reply, footer);
+        log_event("Sent history delta for %s after seq %llu to socket %d (lines sent: %d)",
+                  target, after_seq, sock, lines_sent);
+    } else {
+        if (lines_sent == 0) {
+            reply_append(&reply, "No messages found.\n");
+        }
+        log_event("Sent conversation history for %s to socket %d (lines sent: %d)", target, sock, lines_sent);
     }
-    log_event("Sent conversation history for %s to socket %d (lines sent: %d)", target, sock, lines_sent);
-    pthread_mutex_unlock(&file_mutex);
+    reply_finish(&reply);
+}
+
+void send_conversation_history(int sock, const char *sender, const char *target, int isGroup) {
+    stream_conversation(sock, sender, target, isGroup, 0, NULL, 0, 0);
+}
+
+void send_conversation_delta(int sock, const char *sender, const char *target, int isGroup,
+                             unsigned long long after_seq) {
+    stream_conversation(sock, sender, target, isGroup, 0, NULL, 1, after_seq);
+}
+
+void send_conversation_page(int sock, const char *sender, const char *target, int isGroup, int page) {
+    stream_conversation(sock, sender, target, isGroup, page, NULL, 0, 0);
+}
+
+void search_conversation(int sock, const char *sender, const char *target, int isGroup, const char *keyword) {
+    stream_conversation(sock, sender, target, isGroup, 0, keyword, 0, 0);
 }
 
 // ========================= UTILITY FUNCTIONS =========================
@@ -304,15 +480,28 @@ int send_message_safe(int sock, const char *msg, const char *error_context) {
         return 0;
     }
     
-    if (send(sock, msg, msg_len, 0) < 0) {
-        if (error_context) {
+    // Phản hồi lệnh đi qua làn control của client (gửi thẳng nếu chưa đăng nhập)
+    return outbox_send(sock, LANE_CONTROL, msg, msg_len, error_context ? error_context : "send message");
+}
+
+/**
+ * Gửi toàn bộ buffer (có thể chứa byte 0), lặp lại khi send chỉ gửi được một phần
+ * @return: 0 nếu thành công, -1 nếu lỗi
+ */
+int send_buffer_safe(int sock, const char *data, size_t len, const char *error_context) {
+    if (sock < 0 || !data) {
+        return -1;
+    }
+    while (len > 0) {
+        ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
             log_event("[ERROR] Failed to %s on socket %d: %s", error_context, sock, strerror(errno));
             fprintf(stderr, "[ERROR] Failed to %s on socket %d: %s\n", error_context, sock, strerror(errno));
-        } else {
-            log_event("[ERROR] Failed to send message on socket %d: %s", sock, strerror(errno));
-            fprintf(stderr, "[ERROR] Failed to send message on socket %d: %s\n", sock, strerror(errno));
+            return -1;
         }
-        return -1;
+        data += sent;
+        len -= sent;
     }
     return 0;
 }
@@ -326,167 +515,395 @@ int send_message_safe(int sock, const char *msg, const char *error_context) {
  * @param isGroup: 1 nếu là group, 0 nếu là private message
  */
 void get_conversation_filename(char *filename, size_t size, const char *sender, const char *target, int isGroup) {
-    const char* conv_dir = get_conversation_dir();
-    
+    char head_name[NAME_MAX + 1];
+
     if (isGroup) {
-        snprintf(filename, size, "%s/conversation_%s.txt", conv_dir, target);
+        snprintf(head_name, sizeof(head_name), "conversation_%s.txt", target);
     } else {
         // Sắp xếp tên user theo thứ tự alphabet để đảm bảo tên file nhất quán
         const char *user1 = strcmp(sender, target) < 0 ? sender : target;
         const char *user2 = strcmp(sender, target) < 0 ? target : sender;
-        snprintf(filename, size, "%s/conversation_%s_%s.txt", conv_dir, user1, user2);
+        snprintf(head_name, sizeof(head_name), "conversation_%s_%s.txt", user1, user2);
     }
+    // Gốc và thư mục con do store chọn theo hash của tên
+    conversation_store_head_path(filename, size, head_name);
 }
 
 // ========================= CLIENT MANAGEMENT FUNCTIONS =========================
 
+// Chỉ số của user trong clients[], -1 nếu không online; gọi khi đang giữ clients_mutex
+static int client_index(SymbolId user) {
+    if (user == SYMBOL_NONE) {
+        return -1;
+    }
+    int slot = client_slots[user] - 1;
+    // Chỉ mục có thể cũ nếu clients[] bị ghi trực tiếp (microbench): kiểm tra lại
+    return slot >= 0 && slot < clientCount && clients[slot].user_id == user ? slot : -1;
+}
+
+int add_client(int socket, const char *username, int caps) {
+    SymbolId user = symbol_lookup(username);
+    MUTEX_LOCK(clients_mutex);
+    // Kiểm tra trùng và thêm trong cùng một lần khóa: hai lần đăng nhập đồng thời chỉ một lần thành công
+    int online = client_index(user) >= 0;
+    for (int i = 0; user == SYMBOL_NONE && !online && i < clientCount; i++) {
+        online = strncmp(clients[i].username, username, sizeof(clients[i].username) - 1) == 0;
+    }
+    if (online) {
+        MUTEX_UNLOCK(clients_mutex);
+        return -2;
+    }
+    if (clientCount >= MAX_CLIENTS) {
+        MUTEX_UNLOCK(clients_mutex);
+        return -1;
+    }
+    Client *c = &clients[clientCount];
+    strncpy(c->username, username, sizeof(c->username) - 1);
+    c->username[sizeof(c->username) - 1] = '\0';
+    c->socket = socket;
+    c->caps = caps;
+    c->user_id = user;
+    clientCount++;
+    if (c->user_id != SYMBOL_NONE) {
+        client_slots[c->user_id] = clientCount;
+    }
+    MUTEX_UNLOCK(clients_mutex);
+    return 0;
+}
+
 Client *find_client_by_name(const char *username) {
-    pthread_mutex_lock(&clients_mutex);
-    Client *result = NULL;
+    SymbolId user = symbol_lookup(username);
+    if (user == SYMBOL_NONE) {
+        return NULL;
+    }
+    MUTEX_LOCK(clients_mutex);
+    int i = client_index(user);
+    Client *result = i >= 0 ? &clients[i] : NULL;
+    MUTEX_UNLOCK(clients_mutex);
+    return result;
+}
+
+int find_client_socket_caps(const char *username, int *sock, int *caps) {
+    SymbolId user = symbol_lookup(username);
+    if (user == SYMBOL_NONE) {
+        return -1;
+    }
+    // Chép trong clients_mutex: remove_client có thể dời mảng ngay sau khi nhả khóa
+    MUTEX_LOCK(clients_mutex);
+    int i = client_index(user);
+    if (i >= 0) {
+        *sock = clients[i].socket;
+        if (caps) {
+            *caps = clients[i].caps;
+        }
+    }
+    MUTEX_UNLOCK(clients_mutex);
+    return i >= 0 ? 0 : -1;
+}
+
+int get_client_caps(int sock) {
+    int caps = 0;
+    MUTEX_LOCK(clients_mutex);
     for (int i = 0; i < clientCount; i++) {
-        if (strcmp(clients[i].username, username) == 0) {
-            result = &clients[i];
+        if (clients[i].socket == sock) {
+            caps = clients[i].caps;
             break;
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
-    return result;
+    MUTEX_UNLOCK(clients_mutex);
+    return caps;
 }
 
 void remove_client(int socket) {
-    pthread_mutex_lock(&clients_mutex);
+    char username[32] = "";
+    // Dừng writer trước khi đóng socket để fd không bị dùng lại khi writer còn gửi
+    outbox_destroy(socket);
+    MUTEX_LOCK(clients_mutex);
     for (int i = 0; i < clientCount; i++) {
         if (clients[i].socket == socket) {
             log_event("%s disconnected", clients[i].username);
+            strcpy(username, clients[i].username);
             shutdown(clients[i].socket, SHUT_RDWR);
             close(clients[i].socket);
-            for (int j = i; j < clientCount - 1; j++)
+            if (clients[i].user_id != SYMBOL_NONE) {
+                client_slots[clients[i].user_id] = 0;
+            }
+            for (int j = i; j < clientCount - 1; j++) {
                 clients[j] = clients[j + 1];
+                if (clients[j].user_id != SYMBOL_NONE) {
+                    client_slots[clients[j].user_id] = j + 1;
+                }
+            }
             clientCount--;
             break;
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
+    MUTEX_UNLOCK(clients_mutex);
+
+    if (username[0] != '\0') {
+        reply_cache_bump(REPLY_CACHE_USERS);
+        federation_publish_logout(username);
+    }
 }
 
 int check_login(const char *username, const char *password) {
-    for (int i = 0; i < userCount; i++) {
-        if (strcmp(users[i].username, username) == 0 &&
-            strcmp(users[i].password, password) == 0)
-            return 1;
+    SymbolId id = symbol_lookup(username);
+    if (id == SYMBOL_NONE || !user_slots[id]) {
+        return 0;
     }
-    return 0;
+    return strcmp(users[user_slots[id] - 1].password, password) == 0;
 }
 
 // ========================= MESSAGE SENDING FUNCTIONS =========================
 
-void broadcast(const char *sender, const char *msg) {
+/**
+ * Gửi một dòng realtime cho danh sách hàng đợi (fanout_send nhận các tham chiếu). Các hàng đợi
+ * từ vị trí acked_from trở đi là của client có CAP_ACK: chúng nhận bản có tag "~<slot>.<gen>:<seq> "
+ * (chỉ cấp tag khi có người như vậy).
+ * @param key: Khóa hội thoại để theo dõi ack
+ */
+static void fanout_tagged(const char *key, Outbox **boxes, int count, int acked_from,
+                          const char *line, int len) {
+    if (acked_from > 0) {
+        fanout_send(boxes, acked_from, LANE_REALTIME, line, len);
+    }
+    if (acked_from < count) {
+        char tagged[BUFFER_SIZE + 48];
+        int tag_len = delivery_tag(key, tagged, sizeof(tagged) - BUFFER_SIZE);
+        memcpy(tagged + tag_len, line, len);
+        fanout_send(boxes + acked_from, count - acked_from, LANE_REALTIME, tagged, tag_len + len);
+    }
+}
+
+/**
+ * Lấy tham chiếu tới hàng đợi của client c (gọi khi đang giữ clients_mutex) và xếp vào
+ * đầu hoặc cuối mảng tùy CAP_ACK. Client chưa có hàng đợi đang đăng nhập dở: bỏ qua.
+ */
+static void take_recipient(int c, Outbox **boxes, int *front, int *back) {
+    Outbox *box = outbox_acquire(clients[c].socket);
+    if (!box) {
+        return;
+    }
+    if (clients[c].caps & CAP_ACK) {
+        boxes[--*back] = box;
+    } else {
+        boxes[(*front)++] = box;
+    }
+}
+
+/**
+ * Chụp hàng đợi của mọi client để gửi sau khi nhả clients_mutex
+ * @param stack_buf: Buffer FANOUT_STACK_RECIPIENTS phần tử, dùng khi đủ chỗ
+ * @param count: Nhận số hàng đợi
+ * @param acked_from: Nhận vị trí đầu tiên của các hàng đợi có CAP_ACK (nằm liền sau phần còn lại)
+ * @return: Mảng hàng đợi (stack_buf hoặc mảng cấp phát mới), NULL nếu lỗi cấp phát
+ */
+static Outbox **snapshot_recipients(Outbox **stack_buf, int *count, int *acked_from) {
+    MUTEX_LOCK(clients_mutex);
+    int total = clientCount;
+    Outbox **boxes = total <= FANOUT_STACK_RECIPIENTS ? stack_buf : malloc(sizeof(Outbox *) * total);
+    int front = 0, back = total;
+    if (boxes) {
+        for (int i = 0; i < total; i++) {
+            take_recipient(i, boxes, &front, &back);
+        }
+    }
+    MUTEX_UNLOCK(clients_mutex);
+    if (!boxes) {
+        log_event("[ERROR] Failed to allocate recipient list (%d clients)", total);
+        return NULL;
+    }
+    // Phần CAP_ACK nằm ở [back, total); dời lại ngay sau phần không ack
+    memmove(boxes + front, boxes + back, (total - back) * sizeof(Outbox *));
+    *count = front + (total - back);
+    *acked_from = front;
+    return boxes;
+}
+
+void deliver_broadcast_local(const char *sender, const char *msg) {
     char buffer[BUFFER_SIZE];
-    snprintf(buffer, sizeof(buffer), "[%s -> ALL]: %s\n", sender, msg);
-    pthread_mutex_lock(&clients_mutex);
-    int count = clientCount;
-    Client local_clients[MAX_CLIENTS];
-    for (int i = 0; i < count; i++) {
-        local_clients[i] = clients[i];
-    }
-    pthread_mutex_unlock(&clients_mutex);
-    
-    for (int i = 0; i < count; i++) {
-        send_message_safe(local_clients[i].socket, buffer, "send broadcast");
+    int len = snprintf(buffer, sizeof(buffer), "[%s -> ALL]: %s\n", sender, msg);
+    if (len >= (int)sizeof(buffer)) {
+        len = sizeof(buffer) - 1;
+    }
+    TRACE_BEGIN(copy_start);
+    Outbox *stack_boxes[FANOUT_STACK_RECIPIENTS];
+    int count, acked_from;
+    Outbox **boxes = snapshot_recipients(stack_boxes, &count, &acked_from);
+    if (!boxes) {
+        return;
     }
+    TRACE_END("clients_copy", copy_start, -1);
+
+    fanout_tagged("*", boxes, count, acked_from, buffer, len);
+    if (boxes != stack_boxes) {
+        free(boxes);
+    }
+}
+
+void broadcast(const char *sender, const char *msg) {
+    deliver_broadcast_local(sender, msg);
+    federation_forward_broadcast(sender, msg);
     log_event("%s broadcast: %s", sender, msg);
 }
 
+/**
+ * Lấy tham chiếu tới hàng đợi của user đang online trên node này, trong clients_mutex
+ * (giống take_recipient): fd có thể bị đóng và cấp lại ngay sau khi nhả khóa
+ * @param box: Nhận hàng đợi (NULL nếu user đang đăng nhập dở hoặc đang thoát)
+ * @param caps: Nhận khả năng của client
+ * @return: 0 nếu user online, -1 nếu không
+ */
+static int acquire_client_outbox(const char *username, Outbox **box, int *caps) {
+    SymbolId user = symbol_lookup(username);
+    if (user == SYMBOL_NONE) {
+        return -1;
+    }
+    MUTEX_LOCK(clients_mutex);
+    int i = client_index(user);
+    if (i >= 0) {
+        *box = outbox_acquire(clients[i].socket);
+        *caps = clients[i].caps;
+    }
+    MUTEX_UNLOCK(clients_mutex);
+    return i >= 0 ? 0 : -1;
+}
+
+int deliver_private_local(const char *sender, const char *target, const char *msg) {
+    Outbox *box = NULL;
+    int receiver_caps = 0;
+    TRACE_BEGIN(lookup_start);
+    int found = acquire_client_outbox(target, &box, &receiver_caps);
+    TRACE_END("clients_lookup", lookup_start, -1);
+    if (found < 0) {
+        return -1;
+    }
+    if (!box) {
+        // Không gửi thẳng qua fd: tin realtime chỉ đi qua hàng đợi của đúng client đó
+        metrics_add(METRIC_PRIVATE_DROPPED, 1);
+        return 0;
+    }
+    // Client có CAP_ACK nhận thêm tag của hội thoại riêng (khóa giống tên file hội thoại)
+    char buffer[BUFFER_SIZE + 48];
+    size_t tag_len = 0;
+    if (receiver_caps & CAP_ACK) {
+        char key[80];
+        const char *user1 = strcmp(sender, target) < 0 ? sender : target;
+        const char *user2 = strcmp(sender, target) < 0 ? target : sender;
+        snprintf(key, sizeof(key), "%s_%s", user1, user2);
+        tag_len = delivery_tag(key, buffer, sizeof(buffer) - BUFFER_SIZE);
+    }
+    snprintf(buffer + tag_len, BUFFER_SIZE, "[PM %s → %s]: %s\n", sender, target, msg);
+    TRACE_BEGIN(send_start);
+    if (outbox_push_wait(box, LANE_REALTIME, buffer, strlen(buffer)) < 0) {
+        metrics_add(METRIC_PRIVATE_DROPPED, 1);
+    }
+    TRACE_END("send", send_start, outbox_socket(box));
+    outbox_release(box);
+    return 0;
+}
+
 void send_private(const char *sender, const char *target, const char *msg) {
-    Client *receiver = find_client_by_name(target);
-    char buffer[BUFFER_SIZE];
-    if (receiver) {
-        snprintf(buffer, sizeof(buffer), "[PM %s → %s]: %s\n", sender, target, msg);
-        send_message_safe(receiver->socket, buffer, "send private message");
+    // Ưu tiên phiên local, sau đó tới node đang giữ phiên của target
+    if (deliver_private_local(sender, target, msg) == 0 ||
+        federation_forward_private(sender, target, msg) == 0) {
         save_conversation(sender, target, msg, 0);
         log_event("%s → %s: %s", sender, target, msg);
     } else {
+        char buffer[BUFFER_SIZE];
         snprintf(buffer, sizeof(buffer), "[Server] User %s not found.\n", target);
-        Client *senderClient = find_client_by_name(sender);
-        if (senderClient) {
-            send_message_safe(senderClient->socket, buffer, "send error message");
+        int sender_sock;
+        if (find_client_socket_caps(sender, &sender_sock, NULL) == 0) {
+            send_message_safe(sender_sock, buffer, "send error message");
         }
     }
 }
 
-void send_group_message(const char *sender, const char *groupId, const char *msg) {
+void deliver_group_local(const char *sender, const char *groupId, const char *msg) {
+    int group = find_group_index(groupId);
+    if (group < 0) {
+        return;
+    }
     char buffer[BUFFER_SIZE];
-    snprintf(buffer, sizeof(buffer), "[%s@%s]: %s\n", sender, groupId, msg);
-    pthread_mutex_lock(&clients_mutex);
-    int count = clientCount;
-    Client local_clients[MAX_CLIENTS];
-    for (int i = 0; i < count; i++) {
-        local_clients[i] = clients[i];
-    }
-    pthread_mutex_unlock(&clients_mutex);
-    
-    for (int i = 0; i < count; i++) {
-        if (is_user_in_group(groupId, local_clients[i].username)) {
-            send_message_safe(local_clients[i].socket, buffer, "send group message");
+    int len = snprintf(buffer, sizeof(buffer), "[%s@%s]: %s\n", sender, groupId, msg);
+    if (len >= (int)sizeof(buffer)) {
+        len = sizeof(buffer) - 1;
+    }
+    // Đi theo danh sách thành viên đã intern, mỗi thành viên tra client bằng chỉ số mảng
+    TRACE_BEGIN(copy_start);
+    const Group *g = &groups[group];
+    Outbox *boxes[MAX_GROUP_MEMBERS];
+    int front = 0, back = g->member_count;
+    MUTEX_LOCK(clients_mutex);
+    for (int i = 0; i < g->member_count; i++) {
+        int c = client_index(g->member_ids[i]);
+        if (c >= 0) {
+            take_recipient(c, boxes, &front, &back);
         }
     }
+    MUTEX_UNLOCK(clients_mutex);
+    TRACE_END("clients_copy", copy_start, -1);
+
+    // Hàng đợi có CAP_ACK nằm ở [back, member_count); dời lại ngay sau phần không ack
+    int acked = g->member_count - back;
+    memmove(boxes + front, boxes + back, acked * sizeof(Outbox *));
+    fanout_tagged(groupId, boxes, front + acked, front, buffer, len);
+}
+
+void send_group_message(const char *sender, const char *groupId, const char *msg) {
+    deliver_group_local(sender, groupId, msg);
+    federation_forward_group(sender, groupId, msg);
     save_conversation(sender, groupId, msg, 1);
     log_event("%s → GROUP %s: %s", sender, groupId, msg);
 }
 
 void show_menu(int sock) {
-    const char *menu =
+    // Hằng số đã định dạng sẵn, độ dài tính lúc biên dịch
+    static const char menu[] =
         "\n=== COMMAND MENU ===\n"
         "/menu              : Show this menu\n"
-        "/users             : List online users\n"
-        "/groups            : List all groups\n"
+        "/users [page]      : List online users\n"
+        "/groups [page]     : List your groups\n"
         "|<username>        : View chat history with user\n"
         "|<groupId>         : View group chat history\n"
         "/<username> <msg>  : Send private message\n"
         "/<groupId> <msg>   : Send message to group\n"
+        "|<target> <page>   : View one page of chat history (1 = newest)\n"
+        "|<target> @<seq>   : Fetch only messages after <seq>\n"
+        "/search <target> <text> : Search chat history\n"
+        "/upload <target> <file> : Send a file or long text\n"
+        "/download <id>     : Download a file\n"
+        "/stats             : Show server metrics\n"
         "/esc               : Exit chat mode\n"
         "/exit              : Logout\n";
-    send_message_safe(sock, menu, "send menu");
+    outbox_send(sock, LANE_CONTROL, menu, sizeof(menu) - 1, "send menu");
 }
 
-void show_users(int sock) {
-    char buffer[BUFFER_SIZE] = "=== Online Users ===\n";
-    size_t pos = strlen(buffer);
-    
-    pthread_mutex_lock(&clients_mutex);
-    int count = clientCount;
-    for (int i = 0; i < count && pos < sizeof(buffer) - 32; i++) {
-        int written = snprintf(buffer + pos, sizeof(buffer) - pos, "%s\n", clients[i].username);
-        if (written > 0 && (size_t)written < sizeof(buffer) - pos) {
-            pos += written;
-        } else {
-            break;  // Buffer đầy
-        }
-    }
-    pthread_mutex_unlock(&clients_mutex);
-    
-    send_message_safe(sock, buffer, "send user list");
+void show_users(int sock, int page) {
+    reply_cache_send_users(sock, page);
+}
+
+void show_groups_for_user(int sock, const char *username, int page) {
+    reply_cache_send_groups(sock, username, page);
 }
 
-void show_groups_for_user(int sock, const char *username) {
-    char buffer[BUFFER_SIZE] = "=== Your Groups ===\n";
+void show_stats(int sock) {
+    char buffer[BUFFER_SIZE * 8] = "=== Server Stats ===\n";
     size_t pos = strlen(buffer);
-    int found = 0;
-    
-    for (int i = 0; i < groupCount; i++) {
-        if (is_user_in_group(groups[i].groupId, username)) {
-            int written = snprintf(buffer + pos, sizeof(buffer) - pos, "%s - %s\n", 
-                                   groups[i].groupId, groups[i].groupName);
-            if (written > 0 && (size_t)written < sizeof(buffer) - pos) {
-                pos += written;
-                found = 1;
-            } else {
-                break;  // Buffer đầy
-            }
-        }
+    pos += metrics_format(buffer + pos, sizeof(buffer) - pos);
+    long wire = metrics_get(METRIC_COMPRESS_WIRE_BYTES);
+    if (wire > 0 && pos < sizeof(buffer)) {
+        pos += snprintf(buffer + pos, sizeof(buffer) - pos, "compress_ratio %.2f\n",
+                        (double)metrics_get(METRIC_COMPRESS_RAW_BYTES) / wire);
     }
-    if (!found && pos < sizeof(buffer) - 30) {
-        snprintf(buffer + pos, sizeof(buffer) - pos, "(You are not in any groups)\n");
+    if (pos < sizeof(buffer)) {
+        pos += session_format_memory(buffer + pos, sizeof(buffer) - pos);
     }
-    send_message_safe(sock, buffer, "send group list");
-}
\ No newline at end of file
+    if (pos < sizeof(buffer)) {
+        pos += lock_stats_format(buffer + pos, sizeof(buffer) - pos);
+    }
+    if (pos < sizeof(buffer)) {
+        pos += delivery_ack_format(buffer + pos, sizeof(buffer) - pos);
+    }
+    send_message_safe(sock, buffer, "send stats");
+}
@@ -0,0 +1,258 @@
+#include "../include/session.h"
+#include "../include/metrics.h"
+#include "../include/outbound.h"
+#include "../include/command_parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+// Buffer lớn rảnh được nối thành danh sách qua chính vùng nhớ của nó
+typedef struct LargeBuffer {
+    struct LargeBuffer *next;
+} LargeBuffer;
+
+static Session *free_sessions = NULL;
+static long slab_count = 0;
+static long live_sessions = 0;
+static pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static LargeBuffer *free_buffers = NULL;
+static long pooled_buffers = 0;     // Buffer lớn đang nằm trong pool
+static long lent_buffers = 0;       // Buffer lớn đang được phiên mượn
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t login_timeout_ms = LOGIN_TIMEOUT_SEC * 1000ull;
+static uint64_t idle_timeout_ms = IDLE_TIMEOUT_SEC * 1000ull;
+static uint64_t ping_interval_ms = HEARTBEAT_INTERVAL_SEC * 1000ull;
+
+void session_set_timeouts(int login_sec, int idle_sec, int ping_sec) {
+    login_timeout_ms = login_sec * 1000ull;
+    idle_timeout_ms = idle_sec * 1000ull;
+    ping_interval_ms = ping_sec * 1000ull;
+}
+
+// ========================= HẠN CHỜ =========================
+
+/**
+ * Đặt timer tới hạn gần nhất trong hai hạn: im lặng quá lâu, hoặc tới lượt ping
+ * @param ping_base: Mốc tính lượt ping kế tiếp (lần nhận hoặc lần ping gần nhất)
+ */
+static void session_rearm(Session *s, uint64_t now, uint64_t last_rx, uint64_t ping_base) {
+    uint64_t next = UINT64_MAX;
+    if (idle_timeout_ms > 0) {
+        next = last_rx + idle_timeout_ms;
+    }
+    if (ping_interval_ms > 0 && ping_base + ping_interval_ms < next) {
+        next = ping_base + ping_interval_ms;
+    }
+    if (next != UINT64_MAX) {
+        timer_schedule(&s->timer, next > now ? next - now : 1);
+    }
+}
+
+// Chạy trên thread của timer wheel: chỉ shutdown socket (thread phiên tự dọn) hoặc xếp ping
+static void session_timer_fired(void *arg) {
+    Session *s = (Session *)arg;
+    if (!__atomic_load_n(&s->logged_in, __ATOMIC_ACQUIRE)) {
+        metrics_add(METRIC_LOGIN_TIMEOUTS, 1);
+        log_event("Login timeout on socket %d, closing connection", s->sock);
+        shutdown(s->sock, SHUT_RDWR);
+        return;
+    }
+    uint64_t now = timer_now_ms();
+    uint64_t last_rx = __atomic_load_n(&s->last_rx_ms, __ATOMIC_RELAXED);
+    if (idle_timeout_ms > 0 && now - last_rx >= idle_timeout_ms) {
+        metrics_add(METRIC_IDLE_REAPED, 1);
+        log_event("%s idle for %llu ms, closing connection", s->username, (unsigned long long)(now - last_rx));
+        shutdown(s->sock, SHUT_RDWR);
+        return;
+    }
+    uint64_t ping_base = last_rx > s->pinged_ms ? last_rx : s->pinged_ms;
+    if (ping_interval_ms > 0 && now - ping_base >= ping_interval_ms) {
+        // Không chờ nếu làn đầy: client đang không đọc thì ping cũng vô ích
+        if (outbox_post(s->sock, LANE_CONTROL, HEARTBEAT_PING "\n", sizeof(HEARTBEAT_PING)) == 0) {
+            metrics_add(METRIC_HEARTBEAT_PINGS, 1);
+        }
+        s->pinged_ms = now;
+        ping_base = now;
+    }
+    session_rearm(s, now, last_rx, ping_base);
+}
+
+void session_login_done(Session *s) {
+    uint64_t now = timer_now_ms();
+    __atomic_store_n(&s->last_rx_ms, now, __ATOMIC_RELAXED);
+    s->pinged_ms = 0;
+    __atomic_store_n(&s->logged_in, 1, __ATOMIC_RELEASE);
+    if (idle_timeout_ms > 0 || ping_interval_ms > 0) {
+        session_rearm(s, now, now, now);
+    } else {
+        timer_cancel(&s->timer);
+    }
+}
+
+// ========================= SLAB =========================
+
+// Cấp thêm một slab và đưa mọi Session của nó vào free list; gọi khi đang giữ slab_mutex
+static int grow_slab(void) {
+    Session *slab = malloc(sizeof(Session) * SESSION_SLAB_OBJECTS);
+    if (!slab) {
+        return -1;
+    }
+    for (int i = 0; i < SESSION_SLAB_OBJECTS; i++) {
+        slab[i].next_free = free_sessions;
+        free_sessions = &slab[i];
+    }
+    slab_count++;
+    return 0;
+}
+
+Session *session_alloc(int sock) {
+    pthread_mutex_lock(&slab_mutex);
+    if (!free_sessions && grow_slab() < 0) {
+        pthread_mutex_unlock(&slab_mutex);
+        log_event("[ERROR] Failed to allocate session slab for socket %d", sock);
+        return NULL;
+    }
+    Session *s = free_sessions;
+    free_sessions = s->next_free;
+    live_sessions++;
+    metrics_set(METRIC_SESSIONS, live_sessions);
+    pthread_mutex_unlock(&slab_mutex);
+
+    s->next_free = NULL;
+    s->sock = sock;
+    s->username[0] = '\0';
+    s->buf = s->inline_buf;
+    s->buf_cap = sizeof(s->inline_buf);
+    s->carry = 0;
+    s->skipping_long_line = 0;
+    s->logged_in = 0;
+    s->last_rx_ms = 0;
+    s->pinged_ms = 0;
+    timer_init(&s->timer, session_timer_fired, s);
+    if (login_timeout_ms > 0) {
+        timer_schedule(&s->timer, login_timeout_ms);
+    }
+    return s;
+}
+
+static void release_large(char *buf) {
+    pthread_mutex_lock(&pool_mutex);
+    lent_buffers--;
+    if (pooled_buffers < SESSION_POOL_MAX_FREE) {
+        LargeBuffer *lb = (LargeBuffer *)buf;
+        lb->next = free_buffers;
+        free_buffers = lb;
+        pooled_buffers++;
+        buf = NULL;
+    }
+    metrics_set(METRIC_SESSION_LARGE_BUFFERS, lent_buffers);
+    pthread_mutex_unlock(&pool_mutex);
+    free(buf);
+}
+
+void session_free(Session *s) {
+    if (!s) {
+        return;
+    }
+    // Sau khi hủy, callback của timer không còn chạy và không thể chạm vào socket/Session
+    timer_cancel(&s->timer);
+    if (s->buf != s->inline_buf) {
+        release_large(s->buf);
+    }
+    // Slab không được trả về hệ thống: Session chỉ quay lại free list để dùng lại
+    pthread_mutex_lock(&slab_mutex);
+    s->next_free = free_sessions;
+    free_sessions = s;
+    live_sessions--;
+    metrics_set(METRIC_SESSIONS, live_sessions);
+    pthread_mutex_unlock(&slab_mutex);
+}
+
+int session_grow(Session *s) {
+    if (s->buf != s->inline_buf) {
+        return -1;
+    }
+    pthread_mutex_lock(&pool_mutex);
+    char *buf = (char *)free_buffers;
+    if (buf) {
+        free_buffers = free_buffers->next;
+        pooled_buffers--;
+    }
+    lent_buffers++;
+    metrics_set(METRIC_SESSION_LARGE_BUFFERS, lent_buffers);
+    pthread_mutex_unlock(&pool_mutex);
+    if (!buf && !(buf = malloc(SESSION_LARGE_BUF))) {
+        pthread_mutex_lock(&pool_mutex);
+        lent_buffers--;
+        pthread_mutex_unlock(&pool_mutex);
+        log_event("[ERROR] Failed to allocate receive buffer for socket %d", s->sock);
+        return -1;
+    }
+    memcpy(buf, s->inline_buf, s->carry);
+    s->buf = buf;
+    s->buf_cap = SESSION_LARGE_BUF;
+    return 0;
+}
+
+void session_shrink(Session *s) {
+    if (s->buf == s->inline_buf || s->carry >= (int)sizeof(s->inline_buf)) {
+        return;
+    }
+    memcpy(s->inline_buf, s->buf, s->carry);
+    release_large(s->buf);
+    s->buf = s->inline_buf;
+    s->buf_cap = sizeof(s->inline_buf);
+}
+
+// RSS của tiến trình theo /proc/self/statm (0 nếu không đọc được)
+static long process_rss_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) {
+        return 0;
+    }
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+size_t session_format_memory(char *buffer, size_t size) {
+    pthread_mutex_lock(&slab_mutex);
+    long slabs = slab_count;
+    long live = live_sessions;
+    pthread_mutex_unlock(&slab_mutex);
+    pthread_mutex_lock(&pool_mutex);
+    long lent = lent_buffers;
+    long pooled = pooled_buffers;
+    pthread_mutex_unlock(&pool_mutex);
+
+    // Theo kết nối chỉ tính thứ thực sự thuộc về phiên đang sống: Session của nó và buffer lớn
+    // đang mượn. Dung lượng slab chưa dùng và buffer rảnh trong pool được báo riêng.
+    long session_size = (long)sizeof(Session);
+    long lent_bytes = lent * SESSION_LARGE_BUF;
+    long live_bytes = live * session_size + lent_bytes;
+    long rss = process_rss_bytes();
+    int written = snprintf(buffer, size,
+                           "session_struct_bytes %ld\n"
+                           "session_live_bytes %ld\n"
+                           "session_live_bytes_per_conn %ld\n"
+                           "session_lent_buffer_bytes %ld\n"
+                           "session_slab_capacity_bytes %ld\n"
+                           "session_pool_free_bytes %ld\n"
+                           "rss_bytes %ld\n"
+                           "rss_bytes_per_conn %ld\n",
+                           session_size, live_bytes, live > 0 ? session_size + lent_bytes / live : 0, lent_bytes,
+                           slabs * SESSION_SLAB_OBJECTS * session_size, pooled * SESSION_LARGE_BUF,
+                           rss, live > 0 ? rss / live : 0);
+    if (written < 0) {
+        return 0;
+    }
+    return (size_t)written < size ? (size_t)written : size - 1;
+}
@@ -1,4 +1,6 @@
 #include "../include/client_utils.h"
+#include "../include/compression.h"
+#include "../include/delivery_ack.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,12 +36,13 @@ int main() {
     }
 
     // Login
-    char username[32], password[32], creds[64];
+    char username[32], password[32], creds[80];
     printf("Username: "); scanf("%31s", username);
     printf("Password: "); scanf("%31s", password);
     getchar(); // bỏ newline
 
-    snprintf(creds, sizeof(creds), "%s:%s", username, password);
+    // Đề nghị nén lịch sử và ack giao tin; server cũ bỏ qua phần sau mật khẩu
+    snprintf(creds, sizeof(creds), "%s:%s " CAP_ZLIB_TOKEN " " CAP_ACK_TOKEN, username, password);
     if (send(sock, creds, strlen(creds), 0) < 0) {
         printf("Failed to send login credentials: %s\n", strerror(errno));
         close(sock);
@@ -61,6 +64,12 @@ int main() {
         return 0;
     }
 
+    if (strstr(response, CAP_ZLIB_ACK)) {
+        compression_enabled = 1;
+    }
+    if (strstr(response, CAP_ACK_ACK)) {
+        ack_enabled = 1;
+    }
     printf("%s\n", response);
 
     handle_server_message(sock);
@@ -1,4 +1,21 @@
+#define _GNU_SOURCE  // accept4()
 #include "../include/server_utils.h"
+#include "../include/command_parser.h"
+#include "../include/federation.h"
+#include "../include/replication.h"
+#include "../include/conversation_store.h"
+#include "../include/compression.h"
+#include "../include/traffic_capture.h"
+#include "../include/msg_trace.h"
+#include "../include/outbound.h"
+#include "../include/attachment.h"
+#include "../include/reply_cache.h"
+#include "../include/fanout.h"
+#include "../include/session.h"
+#include "../include/metrics.h"
+#include "../include/timer_wheel.h"
+#include "../include/busy_poll.h"
+#include "../include/delivery_ack.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,39 +25,58 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <stddef.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #define PORT 8080
+#define DEFAULT_LISTEN_BACKLOG 4096          // Kernel còn giới hạn bởi net.core.somaxconn
+#define SESSION_STACK_SIZE (256 * 1024)      // Stack của mỗi thread phiên (mặc định 8MB)
+#define ACCEPT_RETRY_DELAY_US 10000          // Chờ khi hết fd rồi mới accept tiếp
 
 // ========================= COMMAND HANDLERS =========================
 
+// Độ dài tối đa của username/groupId (khớp với char[32] trong Client/Group)
+#define MAX_NAME_LEN 31
+
+// Chế độ read replica: chỉ phục vụ lịch sử, phân trang và tìm kiếm
+static int read_only_mode = 0;
+
+static int reject_read_only(int sock) {
+    send_message_safe(sock, "[Server] This server is a read-only replica. Only history, search and stats are available.\n",
+                      "send read-only message");
+    return 0;
+}
+
 /**
  * Xử lý lệnh gửi tin nhắn (/target message)
+ * Target và body là lát cắt trỏ vào buffer nhận, được chuyển thẳng
+ * xuống fan-out và save_conversation() mà không copy.
  * @param sock: Socket của client
  * @param username: Tên người gửi
- * @param buffer: Buffer chứa command
+ * @param cmd: Lệnh đã phân tích
+ * @return: 0 để tiếp tục vòng lặp
  */
-static void handle_send_command(int sock, const char *username, const char *buffer) {
-    char target[32] = {0}, msg[BUFFER_SIZE] = {0};
-    char *space = strchr(buffer + 1, ' ');
-    if (space) {
-        strncpy(target, buffer + 1, space - (buffer + 1));
-        target[space - (buffer + 1)] = '\0';
-        strcpy(msg, space + 1);
-    } else {
-        strcpy(target, buffer + 1);
-    }
+static int handle_send_command(int sock, const char *username, const ParsedCommand *cmd) {
+    const char *target = cmd->target.ptr;
+    const char *msg = cmd->body.ptr;
     log_event("Parsed command from %s: target=%s, msg='%s'", username, target, msg);
 
-    // Kiểm tra target có phải là reserved command không
-    if (strcmp(target, "menu") == 0 || strcmp(target, "users") == 0 ||
-        strcmp(target, "groups") == 0 || strcmp(target, "exit") == 0) {
-        send_message_safe(sock, "[Server] Invalid command format.\n", "send invalid command message");
-        return;
+    if (read_only_mode) {
+        return reject_read_only(sock);
     }
 
     // Kiểm tra có message không
-    if (strlen(msg) == 0) {
-        return;
+    if (cmd->body.len == 0) {
+        return 0;
+    }
+
+    if (cmd->target.len == 0 || cmd->target.len > MAX_NAME_LEN) {
+        log_event("Invalid target: %s", target);
+        send_message_safe(sock, "[Server] Invalid target.\n", "send invalid target message");
+        return 0;
     }
 
     // Kiểm tra xem target có phải là groupId không
@@ -54,100 +90,389 @@ static void handle_send_command(int sock, const char *username, const char *buff
             log_event("User %s not in group %s", username, target);
             send_message_safe(sock, "[Server] You are not a member of this group.\n", "send not in group message");
         }
-    } else if (find_client_by_name(target)) {
+    } else if (find_client_by_name(target) || federation_find_user(target) >= 0) {
         log_event("Sending private message to %s: %s", target, msg);
         send_private(username, target, msg);
     } else {
         log_event("Invalid target: %s", target);
         send_message_safe(sock, "[Server] Invalid target.\n", "send invalid target message");
     }
+    return 0;
 }
 
 /**
- * Xử lý lệnh xem lịch sử chat (|target)
+ * Xử lý lệnh xem lịch sử chat (|target, |target page hoặc |target @seq)
  * @param sock: Socket của client
  * @param username: Tên người yêu cầu
- * @param buffer: Buffer chứa command
+ * @param cmd: Lệnh đã phân tích
+ * @return: 0 để tiếp tục vòng lặp
  */
-static void handle_history_command(int sock, const char *username, const char *buffer) {
-    char target[32] = {0};
-    strncpy(target, buffer + 1, sizeof(target) - 1);
-    target[sizeof(target) - 1] = '\0';
+static int handle_history_command(int sock, const char *username, const ParsedCommand *cmd) {
+    const char *target = cmd->target.ptr;
+    if (cmd->target.len == 0 || cmd->target.len > MAX_NAME_LEN) {
+        send_message_safe(sock, "[Server] Invalid target.\n", "send invalid target message");
+        return 0;
+    }
     log_event("Fetching conversation history for %s", target);
     int isGroup = is_group_id(target);
-    send_conversation_history(sock, username, target, isGroup);
+    if (cmd->body.len > 0 && cmd->body.ptr[0] == '@') {
+        // Đồng bộ delta: chỉ gửi các tin nhắn sau seq mà client đã có
+        send_conversation_delta(sock, username, target, isGroup, strtoull(cmd->body.ptr + 1, NULL, 10));
+        return 0;
+    }
+    int page = cmd->body.len > 0 ? atoi(cmd->body.ptr) : 0;
+    if (page > 0) {
+        send_conversation_page(sock, username, target, isGroup, page);
+    } else {
+        send_conversation_history(sock, username, target, isGroup);
+    }
+    return 0;
+}
+
+/**
+ * Xử lý lệnh tìm kiếm trong lịch sử chat (?target text)
+ * @param sock: Socket của client
+ * @param username: Tên người yêu cầu
+ * @param cmd: Lệnh đã phân tích
+ * @return: 0 để tiếp tục vòng lặp
+ */
+static int handle_search_command(int sock, const char *username, const ParsedCommand *cmd) {
+    const char *target = cmd->target.ptr;
+    if (cmd->target.len == 0 || cmd->target.len > MAX_NAME_LEN || cmd->body.len == 0) {
+        send_message_safe(sock, "[Server] Usage: /search <target> <text>\n", "send search usage message");
+        return 0;
+    }
+    log_event("Searching conversation %s for '%s'", target, cmd->body.ptr);
+    search_conversation(sock, username, target, is_group_id(target), cmd->body.ptr);
+    return 0;
+}
+
+/**
+ * Xử lý upload file/tin nhắn lớn (^target size name). Payload thô nằm ngay sau dòng lệnh
+ * nên lệnh này không đi qua bảng dispatch: phần payload đã có trong buffer nhận được
+ * dùng trước, phần còn lại được splice thẳng từ socket vào attachment store.
+ * @param payload: Các byte ngay sau dòng lệnh trong buffer nhận
+ * @param available: Số byte đó
+ * @return: Số byte trong buffer thuộc về payload, -1 nếu kết nối hỏng giữa chừng hoặc
+ *          kích thước khai báo vượt ATTACH_MAX_BYTES (kết nối bị đóng)
+ */
+static long handle_upload_command(int sock, const char *username, const ParsedCommand *cmd,
+                                  const char *payload, size_t available) {
+    const char *target = cmd->target.ptr;
+    char *name_start;
+    unsigned long long size = strtoull(cmd->body.ptr, &name_start, 10);
+    while (*name_start == ' ') name_start++;
+    if (cmd->body.len == 0 || name_start == cmd->body.ptr || *name_start == '\0') {
+        // Không biết kích thước payload: coi như không có payload
+        send_message_safe(sock, "[Server] Usage: /upload <target> <size> <name> followed by <size> bytes\n",
+                          "send upload usage message");
+        return 0;
+    }
+    if (size > ATTACH_MAX_BYTES) {
+        // Không đọc bỏ payload theo kích thước khai báo (có thể tới ULLONG_MAX): báo lỗi rồi đóng kết nối
+        char error[160];
+        snprintf(error, sizeof(error), "[Server] File too large (max %ld bytes).\n", (long)ATTACH_MAX_BYTES);
+        send_message_safe(sock, error, "send upload too large message");
+        outbox_flush(sock, OUTBOX_FLUSH_ON_CLOSE_MS);
+        log_event("[WARNING] Closing connection of %s: upload of %llu bytes exceeds %ld", username, size,
+                  (long)ATTACH_MAX_BYTES);
+        return -1;
+    }
+    size_t used = size < available ? (size_t)size : available;
+
+    char name[ATTACH_NAME_MAX + 1];
+    attachment_sanitize_name(name_start, name, sizeof(name));
+    int isGroup = is_group_id(target);
+    char error[160] = "";
+    if (read_only_mode) {
+        snprintf(error, sizeof(error), "[Server] This server is a read-only replica.\n");
+    } else if (cmd->target.len == 0 || cmd->target.len > MAX_NAME_LEN ||
+               (!isGroup && !find_client_by_name(target) && federation_find_user(target) < 0)) {
+        snprintf(error, sizeof(error), "[Server] Invalid target.\n");
+    } else if (isGroup && !is_user_in_group(target, username)) {
+        snprintf(error, sizeof(error), "[Server] You are not a member of this group.\n");
+    }
+    if (error[0]) {
+        // Vẫn phải đọc hết payload (tối đa ATTACH_MAX_BYTES) để lệnh tiếp theo không bị lẫn vào dữ liệu file
+        send_message_safe(sock, error, "send upload error message");
+        return attachment_discard(sock, size - used) < 0 ? -1 : (long)used;
+    }
+
+    log_event("Receiving %llu byte upload '%s' from %s to %s", size, name, username, target);
+    long id = attachment_receive(sock, payload, used, size, username, target, isGroup, name);
+    if (id < 0) {
+        return -1;
+    }
+    char reply[160];
+    if (id == 0) {
+        snprintf(reply, sizeof(reply), "[Server] Failed to store %s.\n", name);
+        send_message_safe(sock, reply, "send upload failed message");
+        return (long)used;
+    }
+
+    // Người nhận được báo bằng tin nhắn thường (đi qua fan-out, lịch sử và federation như mọi tin khác)
+    char notice[160];
+    snprintf(notice, sizeof(notice), "sent file %s (%llu bytes), download with /download %ld", name, size, id);
+    if (isGroup) {
+        send_group_message(username, target, notice);
+    } else {
+        send_private(username, target, notice);
+    }
+    snprintf(reply, sizeof(reply), "[Server] Stored %s (%llu bytes), download with /download %ld\n", name, size, id);
+    send_message_safe(sock, reply, "send upload stored message");
+    return (long)used;
+}
+
+/**
+ * Xử lý lệnh tải attachment (%id); dữ liệu đi qua làn bulk của client
+ */
+static int handle_download_command(int sock, const char *username, const ParsedCommand *cmd) {
+    char *end;
+    long id = strtol(cmd->target.ptr, &end, 10);
+    if (cmd->target.len == 0 || *end != '\0' || id <= 0 || attachment_send(sock, username, id) < 0) {
+        send_message_safe(sock, "[Server] No such file.\n", "send no such file message");
+    }
+    return 0;
+}
+
+/**
+ * Điều khiển tracing: "/stats trace <N>" đổi tỉ lệ lấy mẫu, "/stats trace dump" ghi file
+ */
+static void handle_trace_control(int sock, const char *arg) {
+    char reply[PATH_MAX + 64];
+    if (!msg_trace_enabled()) {
+        snprintf(reply, sizeof(reply), "[Server] Tracing is not enabled (start the server with -T).\n");
+    } else if (strcmp(arg, "dump") == 0) {
+        long events = msg_trace_dump();
+        if (events < 0) {
+            snprintf(reply, sizeof(reply), "[Server] Failed to write trace file.\n");
+        } else {
+            snprintf(reply, sizeof(reply), "[Server] Wrote %ld trace events.\n", events);
+        }
+    } else if (*arg >= '0' && *arg <= '9') {
+        msg_trace_set_rate((unsigned)strtoul(arg, NULL, 10));
+        snprintf(reply, sizeof(reply), "[Server] Trace sampling: 1 in %u commands.\n", msg_trace_get_rate());
+    } else {
+        snprintf(reply, sizeof(reply), "[Server] Usage: /stats trace <every_n> | /stats trace dump\n");
+    }
+    send_message_safe(sock, reply, "send trace control reply");
+}
+
+/**
+ * "/stats locks reset": xóa số liệu tranh chấp mutex để đo lại từ đầu
+ */
+static void handle_lock_stats_control(int sock, const char *arg) {
+    const char *reply;
+    if (strcmp(arg, "reset") != 0) {
+        reply = "[Server] Usage: /stats locks reset\n";
+    } else if (lock_stats_reset() < 0) {
+        reply = "[Server] Lock stats are not enabled (build with make LOCK_STATS=1).\n";
+    } else {
+        reply = "[Server] Lock stats reset.\n";
+    }
+    send_message_safe(sock, reply, "send lock stats reply");
+}
+
+static int handle_stats_command(int sock, const char *username, const ParsedCommand *cmd) {
+    (void)username;
+    if (cmd->body.len >= 5 && strncmp(cmd->body.ptr, "trace", 5) == 0) {
+        const char *arg = cmd->body.ptr + 5;
+        while (*arg == ' ') arg++;
+        handle_trace_control(sock, arg);
+        return 0;
+    }
+    if (cmd->body.len >= 5 && strncmp(cmd->body.ptr, "locks", 5) == 0) {
+        const char *arg = cmd->body.ptr + 5;
+        while (*arg == ' ') arg++;
+        handle_lock_stats_control(sock, arg);
+        return 0;
+    }
+    show_stats(sock);
+    return 0;
+}
+
+static int handle_exit_command(int sock, const char *username, const ParsedCommand *cmd) {
+    (void)sock; (void)username; (void)cmd;
+    return -1;
+}
+
+static int handle_menu_command(int sock, const char *username, const ParsedCommand *cmd) {
+    (void)username; (void)cmd;
+    show_menu(sock);
+    return 0;
+}
+
+static int handle_users_command(int sock, const char *username, const ParsedCommand *cmd) {
+    (void)username;
+    show_users(sock, cmd->body.len > 0 ? atoi(cmd->body.ptr) : 1);
+    return 0;
+}
+
+static int handle_groups_command(int sock, const char *username, const ParsedCommand *cmd) {
+    show_groups_for_user(sock, username, cmd->body.len > 0 ? atoi(cmd->body.ptr) : 1);
+    return 0;
+}
+
+static int handle_broadcast_command(int sock, const char *username, const ParsedCommand *cmd) {
+    if (read_only_mode) {
+        return reject_read_only(sock);
+    }
+    log_event("Broadcasting message from %s: %s", username, cmd->body.ptr);
+    broadcast(username, cmd->body.ptr);
+    return 0;
+}
+
+static int handle_ack_command(int sock, const char *username, const ParsedCommand *cmd) {
+    (void)sock; (void)username;
+    // Mục đầu tiên nằm trong target (ngay sau "/ack "), các mục còn lại trong body
+    delivery_ack_entries(cmd->target.ptr);
+    if (cmd->body.len > 0) {
+        delivery_ack_entries(cmd->body.ptr);
+    }
+    metrics_add(METRIC_DELIVERY_ACK_BATCHES, 1);
+    return 0;
 }
 
+/**
+ * Bảng dispatch theo loại lệnh
+ * Handler trả về 0 để tiếp tục, < 0 để kết thúc phiên
+ */
+typedef int (*CommandHandler)(int sock, const char *username, const ParsedCommand *cmd);
+
+static const CommandHandler command_handlers[CMD_COUNT] = {
+    [CMD_NONE]      = NULL,
+    [CMD_EXIT]      = handle_exit_command,
+    [CMD_MENU]      = handle_menu_command,
+    [CMD_USERS]     = handle_users_command,
+    [CMD_GROUPS]    = handle_groups_command,
+    [CMD_STATS]     = handle_stats_command,
+    [CMD_SEND]      = handle_send_command,
+    [CMD_HISTORY]   = handle_history_command,
+    [CMD_SEARCH]    = handle_search_command,
+    [CMD_UPLOAD]    = NULL,  // Cần payload sau dòng lệnh, xử lý trực tiếp trong client_handler
+    [CMD_DOWNLOAD]  = handle_download_command,
+    [CMD_BROADCAST] = handle_broadcast_command,
+    [CMD_PONG]      = NULL,  // Chỉ cần có dữ liệu tới là hạn im lặng đã được làm mới
+    [CMD_ACK]       = handle_ack_command,
+};
+
+// Tên giai đoạn handler trong trace
+static const char *command_span_names[CMD_COUNT] = {
+    [CMD_NONE]      = "handle_none",
+    [CMD_EXIT]      = "handle_exit_command",
+    [CMD_MENU]      = "handle_menu_command",
+    [CMD_USERS]     = "handle_users_command",
+    [CMD_GROUPS]    = "handle_groups_command",
+    [CMD_STATS]     = "handle_stats_command",
+    [CMD_SEND]      = "handle_send_command",
+    [CMD_HISTORY]   = "handle_history_command",
+    [CMD_SEARCH]    = "handle_search_command",
+    [CMD_UPLOAD]    = "handle_upload_command",
+    [CMD_DOWNLOAD]  = "handle_download_command",
+    [CMD_BROADCAST] = "handle_broadcast_command",
+    [CMD_PONG]      = "handle_pong",
+    [CMD_ACK]       = "handle_ack_command",
+};
+
 // ========================= XỬ LÝ CLIENT =========================
 void *client_handler(void *arg) {
-    int *sock_ptr = (int *)arg;
-    int sock = *sock_ptr;
-    char buffer[BUFFER_SIZE], username[32], password[32];
-    
-    // Giải phóng bộ nhớ đã cấp phát cho socket pointer ngay sau khi sử dụng
-    // Để tránh memory leak nếu có lỗi xảy ra
-    free(sock_ptr);
-    sock_ptr = NULL;
+    // Socket được truyền thẳng trong con trỏ tham số, không cần malloc mỗi kết nối
+    int sock = (int)(intptr_t)arg;
+    // Trạng thái phiên nằm trong slab, không chiếm stack của thread
+    Session *s = session_alloc(sock);
+    if (!s) {
+        close(sock);
+        pthread_exit(NULL);
+    }
+    char *buffer = s->buf;
+    char *username = s->username;
+    char password[32];
+    uint32_t session = capture_open_session();
+    busy_poll_pin_thread();
+    busy_poll_setup_socket(sock);
 
     // Receive login information
-    int len = recv(sock, buffer, sizeof(buffer) - 1, 0);
+    // Hạn đăng nhập (timer của phiên) đóng kết nối nếu client không gửi gì
+    int len = recv(sock, buffer, s->buf_cap - 1, 0);
     if (len <= 0) {
         log_event("[ERROR] Failed to receive login data for socket %d: %s", sock, len == 0 ? "Connection closed" : strerror(errno));
         fprintf(stderr, "[ERROR] Failed to receive login data for socket %d: %s\n", sock, len == 0 ? "Connection closed" : strerror(errno));
+        session_free(s);
         close(sock);
         pthread_exit(NULL);
     }
     buffer[len] = '\0';
+    capture_login(session, buffer, len);
     if (sscanf(buffer, "%31[^:]:%31s", username, password) != 2) {
         log_event("[ERROR] Invalid login format from socket %d", sock);
         fprintf(stderr, "[ERROR] Invalid login format from socket %d\n", sock);
         send_message_safe(sock, "Login failed: Invalid format\n", "send invalid format message");
+        session_free(s);
         close(sock);
         pthread_exit(NULL);
     }
     log_event("Login attempt: username=%s", username);
 
+    // Khả năng tùy chọn sau mật khẩu, ví dụ "user:pass +zlib +ack" (client cũ không gửi gì)
+    int caps = 0;
+    if (strstr(buffer, " " CAP_ZLIB_TOKEN)) {
+        caps |= CAP_ZLIB;
+    }
+    if (strstr(buffer, " " CAP_ACK_TOKEN)) {
+        caps |= CAP_ACK;
+    }
+
     if (!check_login(username, password)) {
         send_message_safe(sock, "Login failed\n", "send login failed message");
+        session_free(s);
         close(sock);
         pthread_exit(NULL);
     }
 
-    // Check if username is already in use
-    if (find_client_by_name(username)) {
+    // Check if username is already in use on another node; add_client kiểm tra node này
+    // trong clients_mutex nên hai lần đăng nhập đồng thời không thể cùng thành công
+    int added = federation_find_user(username) >= 0 ? -2 : add_client(sock, username, caps);
+    if (added == -2) {
+        log_event("Login rejected for %s: username already in use", username);
         send_message_safe(sock, "Login failed: Username already in use\n", "send duplicate username message");
+        session_free(s);
         close(sock);
         pthread_exit(NULL);
     }
-
-    // Kiểm tra giới hạn số lượng client
-    pthread_mutex_lock(&clients_mutex);
-    if (clientCount >= MAX_CLIENTS) {
-        pthread_mutex_unlock(&clients_mutex);
+    if (added < 0) {
         log_event("[ERROR] Maximum clients limit reached (%d)", MAX_CLIENTS);
         send_message_safe(sock, "Login failed: Server is full\n", "send server full message");
+        session_free(s);
         close(sock);
         pthread_exit(NULL);
     }
     
-    strncpy(clients[clientCount].username, username, sizeof(clients[clientCount].username) - 1);
-    clients[clientCount].username[sizeof(clients[clientCount].username) - 1] = '\0';
-    clients[clientCount].socket = sock;
-    clientCount++;
-    pthread_mutex_unlock(&clients_mutex);
-
-    send_message_safe(sock, "Login successful\n", "send login success message");
+    reply_cache_bump(REPLY_CACHE_USERS);
+    // Từ đây mọi dữ liệu gửi cho client đi qua hàng đợi nhiều làn của nó
+    outbox_create(sock);
+    federation_publish_login(username);
+
+    char reply[64];
+    snprintf(reply, sizeof(reply), "Login successful%s%s\n",
+             (caps & CAP_ZLIB) ? " " CAP_ZLIB_ACK : "", (caps & CAP_ACK) ? " " CAP_ACK_ACK : "");
+    send_message_safe(sock, reply, "send login success message");
     log_event("%s logged in", username);
+    session_login_done(s);
     show_menu(sock);
 
     // Message processing loop
+    // s->carry: phần lệnh chưa trọn vẹn (chưa có '\n') từ lần recv trước, nằm ở đầu s->buf
+    // s->skipping_long_line: đang bỏ phần còn lại của một dòng dài hơn buffer lớn
     while (1) {
         if (sock < 0) {
             log_event("[ERROR] Invalid socket %d for %s", sock, username);
             fprintf(stderr, "[ERROR] Invalid socket %d for %s\n", sock, username);
             break;
         }
-        len = recv(sock, buffer, sizeof(buffer) - 1, 0);
+        uint64_t recv_start = msg_trace_enabled() ? msg_trace_now() : 0;
+        buffer = s->buf;
+        len = busy_poll_recv(sock, buffer + s->carry, s->buf_cap - 1 - s->carry);
+        uint64_t recv_end = recv_start ? msg_trace_now() : 0;
         if (len < 0) {
             log_event("[ERROR] Receive failed for %s: %s", username, strerror(errno));
             fprintf(stderr, "[ERROR] Receive failed for %s: %s\n", username, strerror(errno));
@@ -157,36 +482,110 @@ void *client_handler(void *arg) {
             fprintf(stderr, "%s disconnected: Connection closed\n", username);
             break;
         }
+        session_touch(s);
+        len += s->carry;
+        s->carry = 0;
         buffer[len] = '\0';
-        log_event("Received from %s: %s", username, buffer);
 
-        if (strncmp(buffer, "/exit", 5) == 0) {
-            break;
-        }
-        else if (strncmp(buffer, "/menu", 5) == 0) {
-            show_menu(sock);
+        // Dòng dài hơn buffer: báo lỗi và bỏ tới hết dòng, thay vì cắt thành nhiều lệnh
+        // (phần đuôi trước đây bị coi là một tin nhắn broadcast)
+        if (s->skipping_long_line) {
+            char *nl = memchr(buffer, '\n', len);
+            if (!nl) {
+                continue;
+            }
+            s->skipping_long_line = 0;
+            len -= (nl + 1) - buffer;
+            memmove(buffer, nl + 1, len + 1);
+            if (len == 0) {
+                continue;
+            }
+        } else if (len == (int)s->buf_cap - 1 && !memchr(buffer, '\n', len)) {
+            // Dòng chưa trọn đầy buffer inline: mượn buffer lớn rồi nhận tiếp
+            s->carry = len;
+            if (session_grow(s) == 0) {
+                continue;
+            }
+            s->carry = 0;
+            log_event("Line too long from %s, discarding", username);
+            send_message_safe(sock, "[Server] Line too long. Send long text as a file: /upload <target> <size> <name>\n",
+                              "send line too long message");
+            s->skipping_long_line = 1;
             continue;
         }
-        else if (strncmp(buffer, "/users", 6) == 0) {
-            show_users(sock);
-            continue;
+        log_event("Received from %s: %s", username, buffer);
+
+        // Một lần recv có thể chứa nhiều lệnh, mỗi lệnh kết thúc bằng '\n'.
+        // Phần cuối chưa có '\n' (kể cả khi cả lần nhận không có '\n' nào) được giữ lại cho lần
+        // recv sau: một dòng bị TCP cắt làm hai không được xử lý thành hai lệnh.
+        char *data_end = buffer;
+        for (char *p = buffer + len - 1; p >= buffer; p--) {
+            if (*p == '\n') {
+                data_end = p + 1;
+                break;
+            }
         }
-        else if (strncmp(buffer, "/groups", 7) == 0) {
-            show_groups_for_user(sock, username);
-            continue;
+
+        // Ghi từng lệnh trước khi parser cắt buffer tại chỗ
+        if (capture_enabled()) {
+            for (char *line = buffer; line < data_end; ) {
+                char *nl = memchr(line, '\n', data_end - line);
+                char *next = nl ? nl + 1 : data_end;
+                capture_record(session, CAPTURE_COMMAND, line, next - line);
+                line = next;
+            }
         }
-        else if (buffer[0] == '/') {
-            handle_send_command(sock, username, buffer);
+
+        ParsedCommand cmd;
+        char *cursor = buffer;
+        int running = 1;
+        while (running && cursor < data_end) {
+            // Lệnh được lấy mẫu: ghi thời gian chờ recv của lần nhận chứa nó, parse và handler
+            if (recv_start && msg_trace_begin()) {
+                msg_trace_span("recv_wait", recv_start, recv_end, sock);
+            }
+            TRACE_BEGIN(parse_start);
+            cursor = parse_next_command(cursor, data_end, &cmd);
+            TRACE_END("parse", parse_start, -1);
+            if (!cursor) {
+                break;
+            }
+            CommandHandler handler = command_handlers[cmd.type];
+            TRACE_BEGIN(handler_start);
+            if (cmd.type == CMD_UPLOAD) {
+                long used = handle_upload_command(sock, username, &cmd, cursor, (buffer + len) - cursor);
+                if (used < 0) {
+                    running = 0;
+                } else {
+                    // Sau payload, lệnh tiếp theo (nếu có) kết thúc ở '\n' cuối cùng của buffer
+                    cursor += used;
+                    data_end = cursor;
+                    for (char *p = buffer + len - 1; p >= cursor; p--) {
+                        if (*p == '\n') {
+                            data_end = p + 1;
+                            break;
+                        }
+                    }
+                }
+            } else if (handler && handler(sock, username, &cmd) < 0) {
+                running = 0;
+            }
+            TRACE_END(command_span_names[cmd.type], handler_start, -1);
+            msg_trace_end();
         }
-        else if (buffer[0] == '|') {
-            handle_history_command(sock, username, buffer);
+        if (!running) {
+            break;
         }
-        else {
-            log_event("Broadcasting message from %s: %s", username, buffer);
-            broadcast(username, buffer);
+        if (data_end < buffer + len) {
+            s->carry = (buffer + len) - data_end;
+            memmove(buffer, data_end, s->carry);
         }
+        // Không còn dòng dài đang nhận dở: trả buffer lớn về pool
+        session_shrink(s);
     }
 
+    capture_record(session, CAPTURE_CLOSE, NULL, 0);
+    session_free(s);
     remove_client(sock);
     pthread_exit(NULL);
 }
@@ -208,7 +607,7 @@ static int init_server() {
     return 0;
 }
 
-static int setup_server_socket(int port) {
+static int setup_server_socket(int port, int backlog) {
     int server_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (server_sock < 0) {
         log_event("[ERROR] Socket creation failed: %s", strerror(errno));
@@ -238,62 +637,320 @@ static int setup_server_socket(int port) {
         return -1;
     }
 
-    if (listen(server_sock, 5) < 0) {
+    // Hàng đợi sâu để một loạt client kết nối lại cùng lúc (sau khi restart)
+    // không bị drop SYN rồi phải chờ retransmit vài giây
+    if (listen(server_sock, backlog) < 0) {
         log_event("[ERROR] Listen failed: %s", strerror(errno));
         fprintf(stderr, "[ERROR] Listen failed: %s\n", strerror(errno));
         close(server_sock);
         return -1;
     }
 
+    // Non-blocking để vòng accept biết khi nào đã nhận hết các kết nối đang chờ
+    int flags = fcntl(server_sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(server_sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        log_event("[ERROR] Failed to make listening socket non-blocking: %s", strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to make listening socket non-blocking: %s\n", strerror(errno));
+        close(server_sock);
+        return -1;
+    }
+
     printf("Server started on port %d\n", port);
-    log_event("Server listening on port %d", port);
+    log_event("Server listening on port %d (backlog %d)", port, backlog);
     return server_sock;
 }
 
+/**
+ * Tạo thread phiên cho socket vừa accept
+ * @return: 0 nếu thành công
+ */
+static int spawn_session(int client_sock, const pthread_attr_t *attr) {
+    pthread_t tid;
+    int rc = pthread_create(&tid, attr, client_handler, (void *)(intptr_t)client_sock);
+    if (rc != 0) {
+        log_event("[ERROR] Failed to create client thread: %s", strerror(rc));
+        fprintf(stderr, "[ERROR] Failed to create client thread: %s\n", strerror(rc));
+        close(client_sock);
+        return -1;
+    }
+    return 0;
+}
+
 static void run_server(int server_sock) {
+    // Thuộc tính thread dùng chung: detached và stack nhỏ để tạo thread nhanh khi có bão kết nối
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, SESSION_STACK_SIZE);
+
+    // Vòng lặp chờ cả socket lắng nghe lẫn timer wheel: poll ngủ tới tick có timer kế tiếp,
+    // eventfd của wheel đánh thức sớm khi thread khác đặt một timer gần hơn
+    struct pollfd pfds[2] = {
+        {.fd = server_sock, .events = POLLIN},
+        {.fd = timer_wheel_fd(), .events = POLLIN},
+    };
     while (1) {
-        int client_sock = accept(server_sock, NULL, NULL);
-        if (client_sock < 0) {
-            log_event("[ERROR] Accept failed: %s", strerror(errno));
-            fprintf(stderr, "[ERROR] Accept failed: %s\n", strerror(errno));
+        int ready = poll(pfds, 2, timer_wheel_timeout_ms());
+        if (ready < 0) {
+            if (errno != EINTR) {
+                log_event("[ERROR] Poll on listening socket failed: %s", strerror(errno));
+            }
             continue;
         }
-        log_event("New client connected: socket %d", client_sock);
-
-        // Tạo thread để xử lý client
-        pthread_t tid;
-        int *client_sock_ptr = malloc(sizeof(int));
-        if (!client_sock_ptr) {
-            log_event("[ERROR] Failed to allocate memory for client socket");
-            fprintf(stderr, "[ERROR] Failed to allocate memory for client socket\n");
-            close(client_sock);
+        timer_wheel_run();
+        if (!(pfds[0].revents & POLLIN)) {
             continue;
         }
-        *client_sock_ptr = client_sock;
 
-        if (pthread_create(&tid, NULL, client_handler, client_sock_ptr) != 0) {
-            log_event("[ERROR] Failed to create client thread: %s", strerror(errno));
-            fprintf(stderr, "[ERROR] Failed to create client thread: %s\n", strerror(errno));
-            free(client_sock_ptr);
-            close(client_sock);
-            continue;
+        // Nhận hết các kết nối đang chờ trong một lần thức dậy. Socket phiên vẫn ở chế độ
+        // blocking (accept4 không kế thừa O_NONBLOCK) vì mỗi thread phiên dùng I/O blocking.
+        long batch = 0;
+        while (1) {
+            int client_sock = accept4(server_sock, NULL, NULL, SOCK_CLOEXEC);
+            if (client_sock < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    log_event("[ERROR] Accept failed: %s", strerror(errno));
+                    fprintf(stderr, "[ERROR] Accept failed: %s\n", strerror(errno));
+                    if (errno == EMFILE || errno == ENFILE) {
+                        usleep(ACCEPT_RETRY_DELAY_US);
+                    }
+                }
+                break;
+            }
+            log_event("New client connected: socket %d", client_sock);
+            if (spawn_session(client_sock, &attr) == 0) {
+                batch++;
+            }
+        }
+        if (batch > 0) {
+            metrics_add(METRIC_ACCEPTS, batch);
+            if (batch > metrics_get(METRIC_ACCEPT_BATCH_MAX)) {
+                metrics_set(METRIC_ACCEPT_BATCH_MAX, batch);
+            }
         }
-        pthread_detach(tid);
     }
 }
 
 // ========================= MAIN =========================
-int main() {
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-p port] [-n node_id] [-P peer1:port,peer2:port,...] [-k secret_file] [-B addr]\n"
+                    "          [-d dir1[,dir2,...]] [-r repl_socket | -F primary_repl_socket]\n"
+                    "          [-C trace_file] [-T trace.json] [-b backlog] [-W coalesce_us]\n"
+                    "          [-j fanout_workers] [-J fanout_threshold]\n"
+                    "          [-L login_sec] [-I idle_sec] [-H ping_sec] [-E evict_sec]\n"
+                    "          [-S spin_us] [-A cpu_list]\n", prog);
+    fprintf(stderr, "  -p port     : Client port (default %d)\n", PORT);
+    fprintf(stderr, "  -n node_id  : Node id in the cluster (default: port)\n");
+    fprintf(stderr, "  -P peers    : Other cluster nodes as [id@]host:port (their client ports)\n");
+    fprintf(stderr, "  -k path     : File whose first line is the cluster shared secret (required with -P);\n"
+                    "                the link is not encrypted, keep it on a private network\n");
+    fprintf(stderr, "  -B addr     : IPv4 address for the inter-node link port (default " FEDERATION_DEFAULT_BIND ")\n");
+    fprintf(stderr, "  -d dirs     : Conversation directory (default: auto-detect); a comma list spreads\n"
+                    "                conversations over several roots, one per disk (up to %d)\n", STORE_MAX_ROOTS);
+    fprintf(stderr, "  -r path     : Serve a replication stream on this Unix socket (primary)\n");
+    fprintf(stderr, "  -F path     : Run as a read replica following the primary at this Unix socket\n");
+    fprintf(stderr, "  -C path     : Capture inbound traffic to a binary trace (replay with build/replay).\n"
+                    "                The trace (mode 0600) holds usernames and all message text;\n"
+                    "                login passwords are redacted\n");
+    fprintf(stderr, "  -T path     : Enable sampled latency tracing, dumped as Chrome trace JSON\n"
+                    "                (/stats trace <N> sets 1-in-N sampling, /stats trace dump writes the file)\n");
+    fprintf(stderr, "  -b backlog  : Listen backlog (default %d, capped by net.core.somaxconn)\n",
+            DEFAULT_LISTEN_BACKLOG);
+    fprintf(stderr, "  -W us       : Max per-recipient coalescing window in microseconds (default 0 = off);\n"
+                    "                shrinks automatically to 0 when traffic is light\n");
+    fprintf(stderr, "  -j workers  : Fan-out worker threads, recipients sharded by connection (default %d, 0 = off)\n",
+            FANOUT_DEFAULT_WORKERS);
+    fprintf(stderr, "  -J count    : Recipient count at which fan-out is split across workers (default %d)\n",
+            FANOUT_DEFAULT_THRESHOLD);
+    fprintf(stderr, "  -L sec      : Close connections that do not log in within this time (default %d, 0 = off)\n",
+            LOGIN_TIMEOUT_SEC);
+    fprintf(stderr, "  -I sec      : Close logged-in connections silent for this long (default %d = off)\n",
+            IDLE_TIMEOUT_SEC);
+    fprintf(stderr, "  -H sec      : Send a heartbeat ping after this much silence, repeated (default %d = off);\n"
+                    "                clients answer with " HEARTBEAT_PONG ", so with -I dead peers are reaped\n",
+            HEARTBEAT_INTERVAL_SEC);
+    fprintf(stderr, "  -E sec      : Close a connection whose send queue makes no progress for this long\n"
+                    "                while senders wait on it (default %d, 0 = off)\n", OUTBOX_EVICT_SEC);
+    fprintf(stderr, "  -S us       : Low-latency mode: session and writer threads spin up to this long for\n"
+                    "                new data before sleeping, and sockets get SO_BUSY_POLL (default 0 = off,\n"
+                    "                max %d); each spinning thread occupies a core\n", BUSY_POLL_MAX_US);
+    fprintf(stderr, "  -A cpus     : Pin session and writer threads round-robin to these cores, e.g. 2-5,8\n");
+}
+
+int main(int argc, char *argv[]) {
+    int port = PORT;
+    int node_id = -1;
+    const char *peer_list = NULL;
+    const char *secret_path = NULL;
+    const char *link_bind = NULL;
+    const char *conversation_dir = NULL;
+    const char *repl_socket = NULL;
+    const char *follow_socket = NULL;
+    const char *capture_path = NULL;
+    const char *trace_path = NULL;
+    int backlog = DEFAULT_LISTEN_BACKLOG;
+    int coalesce_us = 0;
+    int fanout_workers = FANOUT_DEFAULT_WORKERS;
+    int fanout_threshold = FANOUT_DEFAULT_THRESHOLD;
+    int login_sec = LOGIN_TIMEOUT_SEC;
+    int idle_sec = IDLE_TIMEOUT_SEC;
+    int ping_sec = HEARTBEAT_INTERVAL_SEC;
+    int evict_sec = OUTBOX_EVICT_SEC;
+    int spin_us = 0;
+    const char *pin_cpus = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:n:P:k:B:d:r:F:C:T:b:W:j:J:L:I:H:E:S:A:h")) != -1) {
+        switch (opt) {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'n':
+            node_id = atoi(optarg);
+            break;
+        case 'P':
+            peer_list = optarg;
+            break;
+        case 'k':
+            secret_path = optarg;
+            break;
+        case 'B':
+            link_bind = optarg;
+            break;
+        case 'd':
+            conversation_dir = optarg;
+            break;
+        case 'r':
+            repl_socket = optarg;
+            break;
+        case 'F':
+            follow_socket = optarg;
+            break;
+        case 'C':
+            capture_path = optarg;
+            break;
+        case 'T':
+            trace_path = optarg;
+            break;
+        case 'b':
+            backlog = atoi(optarg);
+            break;
+        case 'W':
+            coalesce_us = atoi(optarg);
+            break;
+        case 'j':
+            fanout_workers = atoi(optarg);
+            break;
+        case 'J':
+            fanout_threshold = atoi(optarg);
+            break;
+        case 'L':
+            login_sec = atoi(optarg);
+            break;
+        case 'I':
+            idle_sec = atoi(optarg);
+            break;
+        case 'H':
+            ping_sec = atoi(optarg);
+            break;
+        case 'E':
+            evict_sec = atoi(optarg);
+            break;
+        case 'S':
+            spin_us = atoi(optarg);
+            break;
+        case 'A':
+            pin_cpus = optarg;
+            break;
+        default:
+            print_usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (port <= 0 || port > 65535) {
+        fprintf(stderr, "[ERROR] Invalid port: %d\n", port);
+        return 1;
+    }
+    if (node_id < 0) {
+        node_id = port;
+    }
+    if (backlog <= 0) {
+        fprintf(stderr, "[ERROR] Invalid backlog: %d\n", backlog);
+        return 1;
+    }
+    if (coalesce_us < 0 || coalesce_us > 1000000) {
+        fprintf(stderr, "[ERROR] Invalid coalescing window: %d\n", coalesce_us);
+        return 1;
+    }
+    outbox_set_coalesce_window(coalesce_us);
+    if (fanout_workers < 0 || fanout_workers > FANOUT_MAX_WORKERS || fanout_threshold < 0) {
+        fprintf(stderr, "[ERROR] Invalid fan-out settings: %d workers, threshold %d (max %d workers)\n",
+                fanout_workers, fanout_threshold, FANOUT_MAX_WORKERS);
+        return 1;
+    }
+    if (login_sec < 0 || idle_sec < 0 || ping_sec < 0 || evict_sec < 0) {
+        fprintf(stderr, "[ERROR] Invalid timeouts: login %d, idle %d, ping %d, evict %d\n",
+                login_sec, idle_sec, ping_sec, evict_sec);
+        return 1;
+    }
+    session_set_timeouts(login_sec, idle_sec, ping_sec);
+    outbox_set_evict_timeout(evict_sec);
+    if (spin_us < 0 || busy_poll_configure(spin_us, pin_cpus) < 0) {
+        fprintf(stderr, "[ERROR] Invalid low-latency settings: spin %d us (max %d), cpus %s\n",
+                spin_us, BUSY_POLL_MAX_US, pin_cpus ? pin_cpus : "-");
+        return 1;
+    }
+    if (follow_socket && (repl_socket || peer_list)) {
+        fprintf(stderr, "[ERROR] -F cannot be combined with -r or -P\n");
+        return 1;
+    }
+
     printf("=== IPC CHAT SERVER (SOCKET MODE) ===\n");
 
+    // Client ngắt kết nối khi server đang gửi không được làm chết cả server
+    signal(SIGPIPE, SIG_IGN);
+
     // initialize server
-    if (init_server() < 0) {
+    if (init_server() < 0 || timer_wheel_init() < 0) {
         fprintf(stderr, "[ERROR] Server initialization failed\n");
         return 1;
     }
+    if (conversation_dir && conversation_store_set_roots(conversation_dir) < 0) {
+        fprintf(stderr, "[ERROR] Invalid conversation directory list: %s\n", conversation_dir);
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
+
+    // Nạp danh sách segment/archive và chạy compactor nền
+    if (conversation_store_init() < 0 || compactor_start() < 0) {
+        fprintf(stderr, "[ERROR] Conversation store initialization failed\n");
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
+    if (attachment_store_init() < 0) {
+        fprintf(stderr, "[ERROR] Attachment store initialization failed\n");
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
+    if (fanout_start(fanout_workers, fanout_threshold) < 0) {
+        fprintf(stderr, "[ERROR] Fan-out workers could not be started\n");
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
 
     // Create & configure server socket
-    int server_sock = setup_server_socket(PORT);
+    int server_sock = setup_server_socket(port, backlog);
     if (server_sock < 0) {
         fprintf(stderr, "[ERROR] Server socket setup failed\n");
         if (logFile) {
@@ -302,10 +959,57 @@ int main() {
         return 1;
     }
 
+    // Kết nối với các node khác trong cụm (nếu có)
+    if (federation_init(node_id, port, peer_list, link_bind, secret_path) < 0) {
+        fprintf(stderr, "[ERROR] Federation setup failed\n");
+        close(server_sock);
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
+
+    // Replication: primary phát stream, follower chỉ phục vụ đọc
+    int repl_rc = 0;
+    if (repl_socket) {
+        repl_rc = replication_primary_init(repl_socket);
+    } else if (follow_socket) {
+        read_only_mode = 1;
+        repl_rc = replication_follower_init(follow_socket);
+    }
+    if (repl_rc < 0) {
+        fprintf(stderr, "[ERROR] Replication setup failed\n");
+        close(server_sock);
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
+
+    if (trace_path && msg_trace_init(trace_path) < 0) {
+        fprintf(stderr, "[ERROR] Message tracing setup failed\n");
+        close(server_sock);
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
+
+    if (capture_path && capture_start(capture_path) < 0) {
+        fprintf(stderr, "[ERROR] Traffic capture setup failed\n");
+        close(server_sock);
+        if (logFile) {
+            fclose(logFile);
+        }
+        return 1;
+    }
+
     // Run server (infinite loop)
     run_server(server_sock);
 
     // Cleanup 
+    conversation_store_flush();
+    conversation_store_checkpoint();
     log_event("Server shutting down");
     if (logFile) {
         fclose(logFile);
@@ -0,0 +1,96 @@
+#include "../include/server_utils.h"
+#include "../include/symbol.h"
+#include "../include/metrics.h"
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Bảng băm địa chỉ mở, kích thước lũy thừa của 2 và ít nhất gấp đôi MAX_SYMBOLS.
+// Ô lưu id + 1 (0 = trống) để mảng tĩnh không cần khởi tạo.
+#define SYMBOL_TABLE_BITS (32 - __builtin_clz((unsigned)MAX_SYMBOLS * 2 - 1))
+#define SYMBOL_TABLE_SIZE (1u << SYMBOL_TABLE_BITS)
+#define SYMBOL_NAME_LEN 32
+
+static char symbol_names[MAX_SYMBOLS][SYMBOL_NAME_LEN];
+static int symbol_slots[SYMBOL_TABLE_SIZE];
+static int symbols_used = 0;
+static pthread_mutex_t symbol_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a
+static uint32_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * Tìm ô của name trong bảng
+ * @param id: Nhận id nếu tìm thấy
+ * @return: Chỉ số ô chứa name, hoặc ô trống đầu tiên trên đường dò
+ */
+static uint32_t probe(const char *name, SymbolId *id) {
+    uint32_t mask = SYMBOL_TABLE_SIZE - 1;
+    uint32_t slot = hash_name(name) & mask;
+    while (1) {
+        int stored = __atomic_load_n(&symbol_slots[slot], __ATOMIC_ACQUIRE);
+        if (stored == 0) {
+            *id = SYMBOL_NONE;
+            return slot;
+        }
+        if (strcmp(symbol_names[stored - 1], name) == 0) {
+            *id = stored - 1;
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+SymbolId symbol_lookup(const char *name) {
+    if (!name || !*name) {
+        return SYMBOL_NONE;
+    }
+    SymbolId id;
+    probe(name, &id);
+    return id;
+}
+
+SymbolId symbol_intern(const char *name) {
+    if (!name || !*name || strlen(name) >= SYMBOL_NAME_LEN) {
+        return SYMBOL_NONE;
+    }
+    SymbolId id = symbol_lookup(name);
+    if (id != SYMBOL_NONE) {
+        return id;
+    }
+    pthread_mutex_lock(&symbol_mutex);
+    uint32_t slot = probe(name, &id);
+    if (id == SYMBOL_NONE) {
+        if (symbols_used >= MAX_SYMBOLS) {
+            pthread_mutex_unlock(&symbol_mutex);
+            log_event("[WARNING] Symbol table full (%d), cannot intern %s", MAX_SYMBOLS, name);
+            return SYMBOL_NONE;
+        }
+        id = symbols_used;
+        strcpy(symbol_names[id], name);
+        // Tên phải nằm sẵn trước khi ô được công bố cho các thread tra cứu không khóa
+        __atomic_store_n(&symbol_slots[slot], id + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&symbols_used, id + 1, __ATOMIC_RELEASE);
+        metrics_set(METRIC_SYMBOLS, id + 1);
+    }
+    pthread_mutex_unlock(&symbol_mutex);
+    return id;
+}
+
+const char *symbol_name(SymbolId id) {
+    if (id < 0 || id >= __atomic_load_n(&symbols_used, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return symbol_names[id];
+}
+
+int symbol_count(void) {
+    return __atomic_load_n(&symbols_used, __ATOMIC_ACQUIRE);
+}
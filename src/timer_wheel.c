@@ -0,0 +1,247 @@
+#include "../include/timer_wheel.h"
+#include "../include/server_utils.h"
+#include "../include/metrics.h"
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#define WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_MAX_TICKS ((1ull << (TIMER_WHEEL_BITS * TIMER_LEVELS)) - 1)
+
+static Timer *slots[TIMER_LEVELS][TIMER_WHEEL_SLOTS];
+static uint64_t occupied[TIMER_LEVELS];        // Bit i = ô i của tầng khác rỗng
+static uint64_t wheel_tick = 0;                // Tick kế tiếp cần xử lý
+static uint64_t base_ms = 0;                   // Gốc thời gian của tick 0
+static long pending_count = 0;
+static uint64_t wake_tick = UINT64_MAX;        // Tick mà vòng lặp I/O định thức dậy
+static int wake_fd = -1;
+static Timer *running = NULL;                  // Timer có callback đang chạy
+static pthread_t running_thread;
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t running_done = PTHREAD_COND_INITIALIZER;
+
+uint64_t timer_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Tick hiện tại theo đồng hồ; gọi khi đang giữ wheel_mutex
+static uint64_t current_tick(void) {
+    uint64_t now = timer_now_ms();
+    if (base_ms == 0) {
+        base_ms = now;
+    }
+    return (now - base_ms) / TIMER_TICK_MS;
+}
+
+int timer_wheel_init(void) {
+    if (wake_fd >= 0) {
+        return 0;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        log_event("[ERROR] Failed to create timer wheel eventfd: %s", strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to create timer wheel eventfd: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int timer_wheel_fd(void) {
+    return wake_fd;
+}
+
+void timer_init(Timer *t, TimerCallback fn, void *arg) {
+    memset(t, 0, sizeof(*t));
+    t->fn = fn;
+    t->arg = arg;
+    t->slot = -1;
+}
+
+// ===== DANH SÁCH TRONG Ô (giữ wheel_mutex) =====
+
+static void link_timer(Timer *t, int level, int idx) {
+    Timer **head = &slots[level][idx];
+    t->next = *head;
+    if (t->next) {
+        t->next->pprev = &t->next;
+    }
+    t->pprev = head;
+    *head = t;
+    occupied[level] |= 1ull << idx;
+    __atomic_store_n(&t->slot, level * TIMER_WHEEL_SLOTS + idx, __ATOMIC_RELAXED);
+}
+
+static void unlink_timer(Timer *t) {
+    int level = t->slot / TIMER_WHEEL_SLOTS, idx = t->slot % TIMER_WHEEL_SLOTS;
+    *t->pprev = t->next;
+    if (t->next) {
+        t->next->pprev = t->pprev;
+    }
+    if (!slots[level][idx]) {
+        occupied[level] &= ~(1ull << idx);
+    }
+    t->next = NULL;
+    t->pprev = NULL;
+    __atomic_store_n(&t->slot, -1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Đặt timer vào ô ứng với khoảng cách tới hạn: tầng l chứa các hạn cách
+ * wheel_tick dưới 64^(l+1) tick, chỉ số ô lấy theo các bit tương ứng của tick hết hạn
+ */
+static void place_timer(Timer *t) {
+    if (t->expires < wheel_tick) {
+        t->expires = wheel_tick;
+    }
+    uint64_t delta = t->expires - wheel_tick;
+    if (delta > WHEEL_MAX_TICKS) {
+        t->expires = wheel_tick + WHEEL_MAX_TICKS;
+        delta = WHEEL_MAX_TICKS;
+    }
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= 1ull << (TIMER_WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    link_timer(t, level, (t->expires >> (TIMER_WHEEL_BITS * level)) & WHEEL_MASK);
+}
+
+// Hạ các timer của một ô tầng cao xuống tầng thấp hơn
+static void cascade(int level, int idx) {
+    Timer *t = slots[level][idx];
+    slots[level][idx] = NULL;
+    occupied[level] &= ~(1ull << idx);
+    while (t) {
+        Timer *next = t->next;
+        place_timer(t);
+        t = next;
+    }
+}
+
+// ===== API =====
+
+void timer_schedule(Timer *t, uint64_t delay_ms) {
+    uint64_t ticks = (delay_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+    pthread_mutex_lock(&wheel_mutex);
+    uint64_t now = current_tick();
+    if (pending_count == 0 && !running) {
+        // Wheel rỗng: nhảy thẳng tới hiện tại thay vì quay từng tick đã trôi qua
+        wheel_tick = now + 1;
+    }
+    if (t->slot >= 0) {
+        unlink_timer(t);
+    } else {
+        pending_count++;
+    }
+    t->expires = now + (ticks > 0 ? ticks : 1);
+    place_timer(t);
+    metrics_set(METRIC_TIMERS, pending_count);
+    int wake = t->expires < wake_tick;
+    if (wake) {
+        wake_tick = t->expires;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+    if (wake && wake_fd >= 0) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            log_event("[ERROR] Failed to wake timer loop: %s", strerror(errno));
+        }
+    }
+}
+
+void timer_cancel(Timer *t) {
+    pthread_mutex_lock(&wheel_mutex);
+    while (1) {
+        if (t->slot >= 0) {
+            unlink_timer(t);
+            pending_count--;
+            metrics_set(METRIC_TIMERS, pending_count);
+        }
+        // Callback đang chạy có thể đặt lại chính timer này: chờ xong rồi gỡ lần nữa
+        if (running != t || pthread_equal(running_thread, pthread_self())) {
+            break;
+        }
+        pthread_cond_wait(&running_done, &wheel_mutex);
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+long timer_wheel_count(void) {
+    pthread_mutex_lock(&wheel_mutex);
+    long count = pending_count;
+    pthread_mutex_unlock(&wheel_mutex);
+    return count;
+}
+
+int timer_wheel_timeout_ms(void) {
+    pthread_mutex_lock(&wheel_mutex);
+    if (pending_count == 0) {
+        wake_tick = UINT64_MAX;
+        pthread_mutex_unlock(&wheel_mutex);
+        return -1;
+    }
+    // Ô khác rỗng gần nhất của tầng 0; nếu không có thì tới lần hạ tầng kế tiếp
+    int idx = wheel_tick & WHEEL_MASK;
+    uint64_t ahead = occupied[0] >> idx;
+    uint64_t target = wheel_tick + (ahead ? (uint64_t)__builtin_ctzll(ahead) : (uint64_t)(TIMER_WHEEL_SLOTS - idx));
+    wake_tick = target;
+    uint64_t now = timer_now_ms();
+    uint64_t due = base_ms + target * TIMER_TICK_MS;
+    pthread_mutex_unlock(&wheel_mutex);
+    if (due <= now) {
+        return 0;
+    }
+    return due - now > INT_MAX ? INT_MAX : (int)(due - now);
+}
+
+int timer_wheel_run(void) {
+    if (wake_fd >= 0) {
+        uint64_t drained;
+        if (read(wake_fd, &drained, sizeof(drained)) < 0 && errno != EAGAIN) {
+            log_event("[ERROR] Failed to drain timer wakeup: %s", strerror(errno));
+        }
+    }
+    int fired = 0;
+    pthread_mutex_lock(&wheel_mutex);
+    uint64_t now = current_tick();
+    while (wheel_tick <= now) {
+        if (pending_count == 0) {
+            wheel_tick = now + 1;
+            break;
+        }
+        int idx = wheel_tick & WHEEL_MASK;
+        // Kim tầng 0 quay hết vòng: hạ ô kế tiếp của tầng trên (và lan lên nếu tầng đó cũng hết vòng)
+        if (idx == 0) {
+            for (int level = 1; level < TIMER_LEVELS; level++) {
+                int up = (wheel_tick >> (TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+                cascade(level, up);
+                if (up != 0) {
+                    break;
+                }
+            }
+        }
+        Timer *t;
+        while ((t = slots[0][idx]) != NULL) {
+            unlink_timer(t);
+            pending_count--;
+            metrics_set(METRIC_TIMERS, pending_count);
+            running = t;
+            running_thread = pthread_self();
+            pthread_mutex_unlock(&wheel_mutex);
+            t->fn(t->arg);
+            fired++;
+            pthread_mutex_lock(&wheel_mutex);
+            running = NULL;
+            pthread_cond_broadcast(&running_done);
+        }
+        wheel_tick++;
+    }
+    wake_tick = UINT64_MAX;
+    pthread_mutex_unlock(&wheel_mutex);
+    return fired;
+}
@@ -0,0 +1,131 @@
+#include "../include/traffic_capture.h"
+#include "../include/server_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+static FILE *capture_file = NULL;
+static int capture_on = 0;
+static uint32_t next_session = 0;
+static struct timespec capture_epoch;
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t elapsed_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)(ts.tv_sec - capture_epoch.tv_sec) * 1000000000ULL + ts.tv_nsec - capture_epoch.tv_nsec;
+}
+
+static void put_be(unsigned char *out, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+        out[i] = (unsigned char)(v & 0xff);
+        v >>= 8;
+    }
+}
+
+// Đẩy buffer của stdio xuống đĩa định kỳ để trace dùng được kể cả khi server bị kill
+static void *capture_flush_thread(void *arg) {
+    (void)arg;
+    while (1) {
+        usleep(CAPTURE_FLUSH_INTERVAL_MS * 1000);
+        pthread_mutex_lock(&capture_mutex);
+        fflush(capture_file);
+        pthread_mutex_unlock(&capture_mutex);
+    }
+    return NULL;
+}
+
+int capture_start(const char *path) {
+    // Trace chứa tên user và nội dung tin nhắn: chỉ chủ sở hữu được đọc, kể cả khi ghi đè file cũ
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd >= 0 && fchmod(fd, 0600) == -1) {
+        close(fd);
+        fd = -1;
+    }
+    capture_file = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    if (!capture_file) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        log_event("[ERROR] Failed to open capture file %s: %s", path, strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to open capture file %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    setvbuf(capture_file, NULL, _IOFBF, 1 << 20);
+    fwrite(CAPTURE_MAGIC, 1, CAPTURE_MAGIC_LEN, capture_file);
+    clock_gettime(CLOCK_MONOTONIC, &capture_epoch);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, capture_flush_thread, NULL) != 0) {
+        log_event("[ERROR] Failed to create capture flush thread: %s", strerror(errno));
+        fprintf(stderr, "[ERROR] Failed to create capture flush thread: %s\n", strerror(errno));
+        fclose(capture_file);
+        capture_file = NULL;
+        return -1;
+    }
+    pthread_detach(tid);
+    capture_on = 1;
+    log_event("Capturing inbound traffic to %s", path);
+    return 0;
+}
+
+int capture_enabled(void) {
+    return capture_on;
+}
+
+uint32_t capture_open_session(void) {
+    if (!capture_on) {
+        return 0;
+    }
+    uint32_t session = __atomic_add_fetch(&next_session, 1, __ATOMIC_RELAXED);
+    capture_record(session, CAPTURE_OPEN, NULL, 0);
+    return session;
+}
+
+void capture_record(uint32_t session, int type, const char *data, size_t len) {
+    if (!capture_on) {
+        return;
+    }
+    unsigned char header[CAPTURE_RECORD_HEADER];
+    pthread_mutex_lock(&capture_mutex);
+    // Lấy thời gian trong lock để thứ tự bản ghi trong file khớp thứ tự thời gian
+    header[0] = (unsigned char)type;
+    put_be(header + 1, session, 4);
+    put_be(header + 5, elapsed_ns(), 8);
+    put_be(header + 13, len, 4);
+    fwrite(header, 1, sizeof(header), capture_file);
+    if (len > 0) {
+        fwrite(data, 1, len, capture_file);
+    }
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+void capture_login(uint32_t session, const char *login, size_t len) {
+    if (!capture_on) {
+        return;
+    }
+    // Giữ "user:" và phần sau mật khẩu (khả năng tùy chọn), bỏ chính mật khẩu
+    const char *colon = memchr(login, ':', len);
+    if (!colon) {
+        capture_record(session, CAPTURE_LOGIN, login, len);
+        return;
+    }
+    size_t user_len = (size_t)(colon - login) + 1;
+    size_t rest = user_len;
+    while (rest < len && login[rest] != ' ' && login[rest] != '\t' && login[rest] != '\r' && login[rest] != '\n') {
+        rest++;
+    }
+    char redacted[512];
+    int n = snprintf(redacted, sizeof(redacted), "%.*s%s%.*s", (int)user_len, login, CAPTURE_REDACTED,
+                     (int)(len - rest), login + rest);
+    if (n < 0 || (size_t)n >= sizeof(redacted)) {
+        n = snprintf(redacted, sizeof(redacted), "%.*s%s", (int)(user_len < 64 ? user_len : 64), login, CAPTURE_REDACTED);
+    }
+    capture_record(session, CAPTURE_LOGIN, redacted, (size_t)n);
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Chạy server trong thư mục tạm rồi chạy các kiểm thử giao thức với nó.
+# Usage: tests/run_tests.sh [build_dir]
+BINDIR=$(cd "${1:-build}" && pwd)
+RUNDIR=$(mktemp -d)
+PORT=18290
+
+mkdir -p "$RUNDIR/data" "$RUNDIR/conversation" "$RUNDIR/node"
+printf 'alice:1234\nbob:1234\n' > "$RUNDIR/data/user.txt"
+: > "$RUNDIR/data/group.txt"
+
+(cd "$RUNDIR/node" && exec "$BINDIR/socket_server" -p "$PORT" -d "$RUNDIR/conversation" > /dev/null) &
+PID=$!
+sleep 1
+
+"$BINDIR/test_protocol" -p "$PORT"
+STATUS=$?
+
+kill $PID 2>/dev/null
+wait $PID 2>/dev/null
+rm -rf "$RUNDIR"
+exit $STATUS
@@ -0,0 +1,123 @@
+// Kiểm thử giao thức dòng lệnh với một server đang chạy (xem tests/run_tests.sh).
+// Mỗi ca đăng nhập hai user, gửi lệnh qua socket thô và kiểm tra những gì người nhận thấy.
+// Usage: test_protocol -p port
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+
+#define REPLY_WAIT_MS 500
+
+static int port = 8080;
+static int failures = 0;
+
+static int connect_user(const char *user) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(2);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char creds[64];
+    int len = snprintf(creds, sizeof(creds), "%s:1234", user);
+    send(sock, creds, len, 0);
+    return sock;
+}
+
+/**
+ * Đọc mọi thứ server gửi cho tới khi im lặng REPLY_WAIT_MS
+ * @return: Số byte trong out (đã kết thúc bằng '\0')
+ */
+static size_t drain(int sock, char *out, size_t size) {
+    size_t pos = 0;
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    while (pos < size - 1 && poll(&pfd, 1, REPLY_WAIT_MS) > 0) {
+        ssize_t n = recv(sock, out + pos, size - 1 - pos, 0);
+        if (n <= 0) {
+            break;
+        }
+        pos += n;
+    }
+    out[pos] = '\0';
+    return pos;
+}
+
+static void expect(const char *name, int ok, const char *got) {
+    printf("%-32s %s\n", name, ok ? "ok" : "FAIL");
+    if (!ok) {
+        printf("  got: %s\n", got);
+        failures++;
+    }
+}
+
+// Một dòng bị cắt làm hai lần gửi (lần đầu không có '\n') phải là một lệnh
+static void test_split_command(void) {
+    char out[8192];
+    int alice = connect_user("alice");
+    int bob = connect_user("bob");
+    drain(alice, out, sizeof(out));
+    drain(bob, out, sizeof(out));
+
+    send(alice, "/bob part", 9, 0);
+    usleep(200 * 1000);
+    send(alice, "ial line\n", 9, 0);
+    drain(bob, out, sizeof(out));
+    expect("split command delivered whole", strstr(out, "[PM alice → bob]: partial line\n") != NULL, out);
+    expect("split command not broken up", !strstr(out, "]: part\n") && !strstr(out, "-> ALL]: ial line"), out);
+
+    // Nhiều lệnh trong một lần gửi, lệnh cuối bị cắt
+    send(alice, "/bob one\n/bob tw", 16, 0);
+    usleep(200 * 1000);
+    send(alice, "o\n", 2, 0);
+    drain(bob, out, sizeof(out));
+    expect("batched commands with split tail", strstr(out, "]: one\n") && strstr(out, "]: two\n") && !strstr(out, "]: tw\n"), out);
+
+    close(alice);
+    close(bob);
+    usleep(200 * 1000);  // Để server gỡ phiên cũ trước ca sau (đăng nhập trùng bị từ chối)
+}
+
+// Upload khai báo lớn hơn ATTACH_MAX_BYTES bị từ chối và kết nối bị đóng, không đọc bỏ payload
+static void test_oversized_upload(void) {
+    char out[8192];
+    int alice = connect_user("alice");
+    int bob = connect_user("bob");
+    drain(alice, out, sizeof(out));
+    drain(bob, out, sizeof(out));
+
+    const char *cmd = "/upload bob 18446744073709551615 huge.bin\n";
+    send(alice, cmd, strlen(cmd), 0);
+    drain(alice, out, sizeof(out));
+    expect("oversized upload rejected", strstr(out, "[Server] File too large") != NULL, out);
+    char byte;
+    expect("oversized upload closes connection", recv(alice, &byte, 1, MSG_DONTWAIT) == 0, out);
+
+    close(alice);
+    close(bob);
+    usleep(200 * 1000);  // Để server gỡ phiên cũ trước ca sau (đăng nhập trùng bị từ chối)
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "p:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port]\n", argv[0]);
+            return 2;
+        }
+    }
+    test_split_command();
+    test_oversized_upload();
+    printf("%s\n", failures ? "FAILED" : "PASSED");
+    return failures ? 1 : 0;
+}